@@ -147,6 +147,9 @@ typedef struct _CLIENT_ID {
 #define DSLOS_PAGE_SIZE 4096
 #define DSLOS_PAGE_MASK (DSLOS_PAGE_SIZE - 1)
 
+// Processor limits
+#define DSLOS_MAX_PROCESSORS 64
+
 // Array size macro
 #define DSLOS_ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -43,8 +43,17 @@ typedef struct _CPU_TOPOLOGY {
     ULONG* CpuLoad;
     ULONG* CpuTemperature;
     BOOLEAN* CpuOnline;
+    PKE_PROCESSOR_TOPOLOGY Processors; // Core, last-level cache and package ids
 } CPU_TOPOLOGY, *PCPU_TOPOLOGY;
 
+// Fair-share bandwidth on a scratch run queue, see KeMeasureGroupBandwidth
+typedef struct _KE_GROUP_BANDWIDTH_STATISTICS {
+    ULONG64 Picks;                 // Ticks a thread was picked
+    ULONG64 GroupPicks;            // Picks of the limited group's thread
+    ULONG64 ThrottledPicks;        // Of those, picks while the group was throttled
+    ULONG64 ThrottleCount;         // Times the group ran out of quota
+} KE_GROUP_BANDWIDTH_STATISTICS, *PKE_GROUP_BANDWIDTH_STATISTICS;
+
 // Power modes
 typedef enum _POWER_MODE {
     POWER_MODE_PERFORMANCE,
@@ -68,6 +77,12 @@ NTAPI
 KeStopScheduler(VOID);
 
 // Thread management
+NTSTATUS
+NTAPI
+KeInitializeSchedulerThread(
+    _In_ PTHREAD Thread
+);
+
 NTSTATUS
 NTAPI
 KeAddThreadToScheduler(
@@ -96,6 +111,13 @@ KeGetSchedulerStatistics(
     _Out_ PSCHEDULER_STATS Stats
 );
 
+NTSTATUS
+NTAPI
+KeGetMigrationStatistics(
+    _In_ ULONG CpuId,
+    _Out_ PKE_MIGRATION_STATISTICS Stats
+);
+
 NTSTATUS
 NTAPI
 KeSetSchedulerAlgorithm(
@@ -103,6 +125,14 @@ KeSetSchedulerAlgorithm(
 );
 
 // Fair share scheduling
+NTSTATUS
+NTAPI
+KeMeasureFairPick(
+    _In_ ULONG ThreadCount,
+    _In_ ULONG Picks,
+    _Out_ PKE_RUN_QUEUE_TIMING Timing
+);
+
 NTSTATUS
 NTAPI
 KeCreateFairShareGroup(
@@ -111,6 +141,42 @@ KeCreateFairShareGroup(
     _Out_ PGROUP_ID GroupId
 );
 
+NTSTATUS
+NTAPI
+KeCreateNestedFairShareGroup(
+    _In_ GROUP_ID ParentGroupId,
+    _In_ PCWSTR GroupName,
+    _In_ ULONG Weight,
+    _Out_ PGROUP_ID GroupId
+);
+
+NTSTATUS
+NTAPI
+KeSetFairShareBandwidth(
+    _In_ GROUP_ID GroupId,
+    _In_ ULONG64 Quota,
+    _In_ ULONG64 Period
+);
+
+NTSTATUS
+NTAPI
+KeMeasureGroupBandwidth(
+    _In_ ULONG64 Quota,
+    _In_ ULONG64 Period,
+    _In_ ULONG Ticks,
+    _Out_ PKE_GROUP_BANDWIDTH_STATISTICS Statistics
+);
+
+// Deadline scheduling
+NTSTATUS
+NTAPI
+KeSetThreadDeadline(
+    _In_ PTHREAD Thread,
+    _In_ ULONG64 Runtime,
+    _In_ ULONG64 Deadline,
+    _In_ ULONG64 Period
+);
+
 // Thread affinity
 NTSTATUS
 NTAPI
@@ -126,6 +192,10 @@ KeGetCpuTopology(
     _Out_ PCPU_TOPOLOGY Topology
 );
 
+NTSTATUS
+NTAPI
+KeRefreshCpuTopology(VOID);
+
 VOID
 NTAPI
 KeUpdateCpuLoad(
@@ -474,6 +474,13 @@ NTSTATUS
 NTAPI
 UiRunEventLoop(VOID);
 
+NTSTATUS
+NTAPI
+UiPostMessage(
+    _In_ WINDOW_ID WindowId,
+    _In_ MESSAGE_TYPE MessageType
+);
+
 // Statistics
 NTSTATUS
 NTAPI
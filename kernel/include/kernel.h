@@ -146,7 +146,9 @@ typedef struct _THREAD_CONTROL_BLOCK {
     // Scheduling
     volatile LONG Priority;         // Thread priority
     volatile LONG BasePriority;     // Base priority
-    ULONG CpuAffinity;             // CPU affinity
+    ULONG64 CpuAffinity;           // CPU affinity, 0 for any processor
+    ULONG LastProcessor;           // Run queue holding the thread, where it last ran, or MAXULONG
+    ULONG64 LastRunTime;           // System time the thread last left a processor
     volatile THREAD_STATE State;    // Thread state
     WAIT_REASON WaitReason;        // Wait reason
     PVOID WaitObject;              // Wait object
@@ -162,12 +164,21 @@ typedef struct _THREAD_CONTROL_BLOCK {
     PVOID TlsArray;                // TLS array
     ULONG TlsSize;                 // TLS size
 
+    // NUMA page placement
+    ULONG MemoryPolicy;            // MM_POLICY_*, local by default
+    ULONG MemoryPolicyNode;        // Preferred node, or interleave cursor
+
     // List management
     LIST_ENTRY ThreadListEntry;    // Thread list entry
     LIST_ENTRY ReadyListEntry;     // Ready list entry
     LIST_ENTRY WaitListEntry;     // Wait list entry
 } THREAD_CONTROL_BLOCK, *PTHREAD_CONTROL_BLOCK;
 
+// NUMA page placement policies
+#define MM_POLICY_LOCAL          0    // Node of the processor the thread runs on
+#define MM_POLICY_PREFERRED      1    // One node, falling back to the others
+#define MM_POLICY_INTERLEAVE     2    // Round-robin across all nodes
+
 // System call numbers
 #define SYSCALL_PROCESS_CREATE   1
 #define SYSCALL_PROCESS_TERMINATE 2
@@ -189,10 +200,12 @@ typedef NTSTATUS (*SYSCALL_ENTRY)(PVOID Parameters, ULONG ParameterLength);
 NTSTATUS KiInitializeKernel(VOID);
 VOID KiInitializeHardware(VOID);
 VOID KiInitializeSystemServices(VOID);
+VOID KiKernelPanic(PCSTR Message);
 VOID KiStartScheduler(VOID);
 
 // Process management
 NTSTATUS PsCreateProcess(PPROCESS_CONTROL_BLOCK* Process, PCSTR ImageName, PPROCESS_CONTROL_BLOCK Parent);
+NTSTATUS PsForkProcess(PPROCESS_CONTROL_BLOCK* Process, PPROCESS_CONTROL_BLOCK Parent);
 NTSTATUS PsTerminateProcess(PPROCESS_CONTROL_BLOCK Process, NTSTATUS ExitStatus);
 NTSTATUS PsCreateThread(PPROCESS_CONTROL_BLOCK Process, PTHREAD_CONTROL_BLOCK* Thread, PVOID StartRoutine, PVOID Parameter);
 NTSTATUS PsTerminateThread(PTHREAD_CONTROL_BLOCK Thread, NTSTATUS ExitStatus);
@@ -200,11 +213,176 @@ NTSTATUS PsTerminateThread(PTHREAD_CONTROL_BLOCK Thread, NTSTATUS ExitStatus);
 // Memory management
 NTSTATUS MmInitializeMemoryManager(VOID);
 PVOID MmAllocatePhysicalMemory(SIZE_T Size);
+PVOID MmAllocateZeroedPhysicalMemory(SIZE_T Size);
 VOID MmFreePhysicalMemory(PVOID Address, SIZE_T Size);
+PVOID MmPhysicalToVirtual(ULONG_PTR PhysicalAddress);
+ULONG_PTR MmVirtualToPhysical(PVOID VirtualAddress);
 NTSTATUS MmCreateAddressSpace(PPROCESS_CONTROL_BLOCK Process);
 NTSTATUS MmDestroyAddressSpace(PPROCESS_CONTROL_BLOCK Process);
+VOID MmSwitchAddressSpace(PPROCESS_CONTROL_BLOCK Process);
+VOID MmProcessTlbShootdown(VOID);
+NTSTATUS MmCloneAddressSpace(PPROCESS_CONTROL_BLOCK Parent, PPROCESS_CONTROL_BLOCK Process);
 PVOID MmAllocateVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size, ULONG Protect);
 VOID MmFreeVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID Address, SIZE_T Size);
+PVOID MmAllocateVirtualMemoryEx(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size,
+                                ULONG AllocationType, ULONG Protect);
+NTSTATUS MmFreeVirtualMemoryEx(PPROCESS_CONTROL_BLOCK Process, PVOID Address, SIZE_T Size, ULONG FreeType);
+NTSTATUS MmProtectVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID Address, SIZE_T Size,
+                                ULONG NewProtect, PULONG OldProtect);
+NTSTATUS MmAccessFault(PPROCESS_CONTROL_BLOCK Process, PVOID FaultAddress, ULONG FaultCode);
+NTSTATUS MmSetProcessorNode(ULONG Processor, ULONG Node);
+ULONG MmZeroFreePages(ULONG MaxPages);
+NTSTATUS MmSetThreadMemoryPolicy(PTHREAD_CONTROL_BLOCK Thread, ULONG Policy, ULONG Node);
+NTSTATUS MmCompactMemory(ULONG Node, ULONG Order);
+
+// Buddy allocator orders (order N is a block of 2^N contiguous pages)
+#define MM_MAX_ORDER             10
+
+// Per-node allocation statistics, counted per MmAllocatePhysicalMemory call
+typedef struct _MM_NODE_STATISTICS {
+    ULONG TotalPages;
+    ULONG FreePages;              // Free pages in the zone, per-CPU caches excluded
+    ULONG ZeroedPages;            // Free pages already zeroed
+    ULONG NumaHit;                // Served here as the policy asked
+    ULONG NumaMiss;               // Served here because the policy's node had no memory
+    ULONG NumaForeign;            // Meant for this node but served by another
+} MM_NODE_STATISTICS, *PMM_NODE_STATISTICS;
+
+NTSTATUS MmGetNodeStatistics(ULONG Node, PMM_NODE_STATISTICS Statistics);
+
+// Per-order free block report of one node
+typedef struct _MM_FRAGMENTATION_REPORT {
+    ULONG FreePages;
+    ULONG FreeBlocks[MM_MAX_ORDER + 1];
+    LONG FragmentationIndex[MM_MAX_ORDER + 1];  // Per mille: near 0 for lack of memory, near 1000 for
+                                                // fragmentation, -1000 if a block of the order is free
+} MM_FRAGMENTATION_REPORT, *PMM_FRAGMENTATION_REPORT;
+
+NTSTATUS MmGetFragmentationReport(ULONG Node, PMM_FRAGMENTATION_REPORT Report);
+
+// Page fault error code bits, as the processor pushes them
+#define MM_FAULT_PROTECTION      0x01    // Set for a protection violation, clear for a not-present page
+#define MM_FAULT_WRITE           0x02    // The access was a write
+#define MM_FAULT_USER            0x04    // The access came from user mode
+#define MM_FAULT_INSTRUCTION     0x10    // The access was an instruction fetch
+
+// Per-CPU page cache statistics
+typedef struct _MM_PER_CPU_PAGE_STATISTICS {
+    ULONG HotPages;
+    ULONG ColdPages;
+    ULONG64 AllocationHits;
+    ULONG64 FreeHits;
+    ULONG64 RefillCount;
+    ULONG64 RefillPages;
+    ULONG64 DrainCount;
+    ULONG64 DrainPages;
+} MM_PER_CPU_PAGE_STATISTICS, *PMM_PER_CPU_PAGE_STATISTICS;
+
+NTSTATUS MmGetPerCpuPageStatistics(ULONG Processor, PMM_PER_CPU_PAGE_STATISTICS Statistics);
+NTSTATUS MmSetPerCpuPageWatermarks(ULONG HighWatermark, ULONG LowWatermark, ULONG Batch);
+
+// Page frame database scan timing, for comparing the ways of scanning it
+typedef struct _MM_FRAME_SCAN_TIMING {
+    ULONG PageCount;               // Frames in the database
+    ULONG RecordPages;             // Frames without an owning address space, by walking the frame records
+    ULONG FlagFreePages;           // Free frames, by walking the dense flag array
+    ULONG BitmapFreePages;         // Free frames, by counting the free page bitmap
+    ULONG64 RecordTicks;           // Performance counter ticks each scan took
+    ULONG64 FlagTicks;
+    ULONG64 BitmapTicks;
+} MM_FRAME_SCAN_TIMING, *PMM_FRAME_SCAN_TIMING;
+
+NTSTATUS MmMeasureFrameScan(PMM_FRAME_SCAN_TIMING Timing);
+
+// Page reclamation. Paging file routines move one page to or from a slot
+typedef NTSTATUS (*PMM_PAGING_FILE_ROUTINE)(PVOID Context, ULONG Slot, PVOID Page);
+
+NTSTATUS MmRegisterPagingFile(ULONG SlotCount, PMM_PAGING_FILE_ROUTINE WritePage,
+                              PMM_PAGING_FILE_ROUTINE ReadPage, PVOID Context);
+NTSTATUS MmSetReclaimWatermarks(ULONG LowWatermark, ULONG HighWatermark);
+NTSTATUS MmSetWorkingSetLimit(PPROCESS_CONTROL_BLOCK Process, ULONG MaximumPages);
+ULONG MmTrimWorkingSet(PPROCESS_CONTROL_BLOCK Process, ULONG PageCount);
+VOID MmWorkingSetManager(PVOID Context);
+
+// Thread stacks
+#define MM_KERNEL_STACK_SIZE (16 * 1024)
+
+NTSTATUS MmAllocateKernelStack(PVOID* Stack, SIZE_T Size);
+VOID MmFreeKernelStack(PVOID Stack);
+NTSTATUS MmAllocateUserStack(PPROCESS_CONTROL_BLOCK Process, SIZE_T Size, PVOID* Stack);
+VOID MmFreeUserStack(PPROCESS_CONTROL_BLOCK Process, PVOID Stack, SIZE_T Size);
+
+// Page merging
+NTSTATUS MmSetPageMerging(PPROCESS_CONTROL_BLOCK Process, BOOLEAN Enable);
+NTSTATUS MmSetPageMergingRate(ULONG PagesPerInterval);
+ULONG MmScanMergeablePages(ULONG PageCount);
+
+// Executive pool allocation (segregated-fit kernel heap)
+PVOID ExAllocatePool(POOL_TYPE PoolType, SIZE_T NumberOfBytes);
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag);
+VOID ExFreePool(PVOID P);
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag);
+
+// Pool tag tracking
+#define MM_POOL_TRACE_DEPTH      8       // Return addresses kept per trace
+
+// Usage of one pool tag, as reported by MmQueryPoolTags
+typedef struct _MM_POOL_TAG_INFORMATION {
+    ULONG Tag;
+    POOL_TYPE PoolType;
+    ULONG Allocations;
+    ULONG Frees;
+    SIZE_T Bytes;                  // Live bytes, block headers included
+    SIZE_T PeakBytes;              // High-water mark, exact to 64 KB per processor
+} MM_POOL_TAG_INFORMATION, *PMM_POOL_TAG_INFORMATION;
+
+// Sampled allocation still outstanding, with the call chain that made it
+typedef struct _MM_POOL_TRACE {
+    PVOID Address;                 // NULL for an unused record
+    ULONG Tag;
+    SIZE_T Size;
+    ULONG FrameCount;
+    PVOID Frames[MM_POOL_TRACE_DEPTH];
+} MM_POOL_TRACE, *PMM_POOL_TRACE;
+
+NTSTATUS MmQueryPoolTags(PMM_POOL_TAG_INFORMATION Buffer, ULONG Count, PULONG ReturnedCount);
+NTSTATUS MmSetPoolTraceTag(ULONG Tag, ULONG SampleRate);
+NTSTATUS MmQueryPoolTraces(PMM_POOL_TRACE Buffer, ULONG Count, PULONG ReturnedCount);
+
+// Object caches (slab allocator for fixed-size kernel objects)
+typedef struct _MM_OBJECT_CACHE MM_OBJECT_CACHE, *PMM_OBJECT_CACHE;
+typedef VOID (*MM_OBJECT_CONSTRUCTOR)(PVOID Object, SIZE_T ObjectSize);
+typedef VOID (*MM_OBJECT_DESTRUCTOR)(PVOID Object, SIZE_T ObjectSize);
+
+typedef struct _MM_OBJECT_CACHE_STATISTICS {
+    CHAR Name[32];                 // Cache name
+    SIZE_T ObjectSize;             // Requested object size
+    SIZE_T BufferSize;             // Object size including alignment and free link
+    ULONG ObjectsPerSlab;          // Objects carved from each slab
+    ULONG SlabCount;               // Slabs currently owned by the cache
+    ULONG ActiveObjects;           // Objects handed out to callers
+    ULONG CachedObjects;           // Objects sitting in per-CPU and depot magazines
+    ULONG64 AllocationCount;       // Total allocations
+    ULONG64 FreeCount;             // Total frees
+    ULONG64 MagazineHits;          // Allocations served by a per-CPU magazine
+    ULONG64 MagazineMisses;        // Allocations that fell through to the slab layer
+    ULONG64 SlabsCreated;          // Slabs grown from the page allocator
+    ULONG64 SlabsDestroyed;        // Slabs returned to the page allocator
+} MM_OBJECT_CACHE_STATISTICS, *PMM_OBJECT_CACHE_STATISTICS;
+
+NTSTATUS MmInitializeObjectCaches(VOID);
+NTSTATUS MmCreateObjectCache(PCSTR Name, SIZE_T ObjectSize, SIZE_T Alignment,
+                             MM_OBJECT_CONSTRUCTOR Constructor, MM_OBJECT_DESTRUCTOR Destructor,
+                             PMM_OBJECT_CACHE* Cache);
+VOID MmDestroyObjectCache(PMM_OBJECT_CACHE Cache);
+PVOID MmAllocateObject(PMM_OBJECT_CACHE Cache);
+VOID MmFreeObject(PMM_OBJECT_CACHE Cache, PVOID Object);
+VOID MmReapObjectCaches(VOID);
+NTSTATUS MmGetObjectCacheStatistics(PMM_OBJECT_CACHE Cache, PMM_OBJECT_CACHE_STATISTICS Statistics);
+PMM_OBJECT_CACHE MmLookupObjectCache(PCSTR Name);
+
+// Object cache backing every THREAD_CONTROL_BLOCK
+extern PMM_OBJECT_CACHE PsThreadObjectCache;
 
 // Thread scheduling
 VOID KeInitializeScheduler(VOID);
@@ -212,7 +390,152 @@ VOID KeSchedule(VOID);
 NTSTATUS KeAddThreadToReadyQueue(PTHREAD_CONTROL_BLOCK Thread);
 VOID KeRemoveThreadFromReadyQueue(PTHREAD_CONTROL_BLOCK Thread);
 VOID KeSwitchContext(PTHREAD_CONTROL_BLOCK NewThread);
+PTHREAD_CONTROL_BLOCK KeGetCurrentThread(VOID);
 VOID KeUpdateThreadTimes(VOID);
+VOID KeDelayExecutionThread(ULONG Microseconds);
+VOID KeHandleRescheduleInterrupt(VOID);
+
+// Run queue operation timing for a modelled processor count
+typedef struct _KE_RUN_QUEUE_TIMING {
+    ULONG ProcessorCount;
+    ULONG64 Operations;            // Enqueues plus dispatches
+    ULONG64 Dispatches;
+    ULONG64 Ticks;
+    ULONG TreeHeight;              // Fair tree height after the run, 0 where no tree is used
+} KE_RUN_QUEUE_TIMING, *PKE_RUN_QUEUE_TIMING;
+
+NTSTATUS KeMeasureRunQueueCost(ULONG ProcessorCount, ULONG ThreadsPerProcessor, ULONG Rounds,
+                               PKE_RUN_QUEUE_TIMING Timing);
+NTSTATUS KeMeasureThreadPick(LONG Priority, ULONG Iterations, PKE_RUN_QUEUE_TIMING Timing);
+
+// Work stealing counters. Every steal attempt ends in exactly one of
+// StealsWithoutCandidate, StealFailures or Migrations
+typedef struct _KE_MIGRATION_STATISTICS {
+    ULONG64 StealAttempts;         // Searches of sibling queues for work
+    ULONG64 StealsWithoutCandidate; // Gave up without taking a victim lock
+    ULONG64 StealFailures;         // Locked a victim but nothing could move
+    ULONG64 Migrations;            // Threads pulled onto this processor
+    ULONG64 AffinitySkips;         // Candidates whose affinity excludes this processor
+    ULONG64 CacheHotSkips;         // Candidates left on their warm cache
+    ULONG64 MigrationTicks;        // Performance counter ticks spent stealing
+} KE_MIGRATION_STATISTICS, *PKE_MIGRATION_STATISTICS;
+
+#define KE_ALL_PROCESSORS        0xFFFFFFFF
+
+NTSTATUS KeQueryMigrationStatistics(ULONG Processor, PKE_MIGRATION_STATISTICS Statistics);
+
+// Scheduler topology. Processors nest into scheduling domains: SMT threads
+// of one core, cores sharing a last-level cache, and caches in one package.
+// Ids are unique system-wide, so processors with equal ids share that level
+typedef enum _KE_SCHED_DOMAIN {
+    KE_DOMAIN_SMT = 0,
+    KE_DOMAIN_LLC,
+    KE_DOMAIN_PACKAGE,
+    KE_DOMAIN_COUNT
+} KE_SCHED_DOMAIN;
+
+typedef struct _KE_PROCESSOR_TOPOLOGY {
+    ULONG CoreId;
+    ULONG LlcId;
+    ULONG PackageId;
+} KE_PROCESSOR_TOPOLOGY, *PKE_PROCESSOR_TOPOLOGY;
+
+NTSTATUS KeBuildSchedulerDomains(VOID);
+ULONG64 KeQuerySchedulerDomain(ULONG Processor, KE_SCHED_DOMAIN Domain);
+
+// Scheduling classes. A fair-class entity is a node of a per-processor
+// red-black tree ordered by weighted virtual runtime; the leftmost runs next.
+// A group entity owns a tree of its runnable members on that processor
+typedef struct _KE_SCHED_ENTITY {
+    struct _KE_SCHED_ENTITY* Left;
+    struct _KE_SCHED_ENTITY* Right;
+    struct _KE_SCHED_ENTITY* Parent;
+    struct _KE_SCHED_TREE* Tree;   // Tree the entity joins when runnable
+    struct _KE_SCHED_TREE* Children; // Members of a group entity, NULL for a thread
+    BOOLEAN Red;
+    BOOLEAN OnTree;
+    ULONG Weight;                  // Share of the processor; KE_SCHED_NOMINAL_WEIGHT is one
+    ULONG64 VirtualRuntime;        // Runtime in 1/KE_SCHED_NOMINAL_WEIGHT ticks, scaled by KE_SCHED_NOMINAL_WEIGHT / Weight
+    ULONG64 ExecStart;             // When the entity last started running
+    ULONG64 SumExecRuntime;        // Unscaled runtime charged so far
+} KE_SCHED_ENTITY, *PKE_SCHED_ENTITY;
+
+typedef struct _KE_SCHED_TREE {
+    PKE_SCHED_ENTITY Owner;        // Group entity these are the members of, NULL at the top
+    PKE_SCHED_ENTITY Root;
+    PKE_SCHED_ENTITY Leftmost;     // Cached minimum
+    ULONG Count;
+    ULONG64 TotalWeight;
+    ULONG64 MinVirtualRuntime;     // Monotonic floor for entities joining the tree
+} KE_SCHED_TREE, *PKE_SCHED_TREE;
+
+#define KE_SCHED_NOMINAL_WEIGHT  1024
+
+// A deadline-class thread reserves Runtime ticks of every Period, due
+// RelativeDeadline ticks after the period starts. The earliest absolute
+// deadline runs first; a thread that overruns its budget waits for the next
+typedef struct _KE_DEADLINE_ENTITY {
+    ULONG64 Runtime;               // Budget per period; 0 outside the class
+    ULONG64 RelativeDeadline;
+    ULONG64 Period;
+    ULONG64 Deadline;              // Absolute deadline of the current budget
+    LONG64 RemainingRuntime;
+    ULONG64 ExecStart;             // When the entity last started running
+    ULONG Processor;               // Processor whose bandwidth admitted it
+    BOOLEAN Throttled;             // Out of budget until Deadline
+    ULONG64 ThrottleCount;         // Times it was held for using up its budget
+} KE_DEADLINE_ENTITY, *PKE_DEADLINE_ENTITY;
+
+// Tickless idle. A processor with nothing to run stops its periodic tick
+// and wakes only for the next timer in the queue; one running a single
+// thread ticks at KE_TICK_REDUCED_INTERVAL. New work restores the tick
+typedef enum _KE_TICK_MODE {
+    KE_TICK_PERIODIC = 0,
+    KE_TICK_REDUCED,
+    KE_TICK_STOPPED
+} KE_TICK_MODE;
+
+#define KE_TICK_INTERVAL         1       // Milliseconds between periodic ticks
+#define KE_TICK_REDUCED_INTERVAL 100     // Milliseconds between ticks for a lone thread
+
+typedef struct _KE_TICK_STATISTICS {
+    ULONG64 Ticks;                 // Tick interrupts taken
+    ULONG64 StoppedEntries;        // Times the tick stopped for idle
+    ULONG64 ReducedEntries;        // Times it slowed for a lone thread
+    ULONG64 TimerWakeups;          // One-shot ticks armed for a queued timer
+} KE_TICK_STATISTICS, *PKE_TICK_STATISTICS;
+
+VOID KeSetProcessorTickMode(ULONG Processor, KE_TICK_MODE Mode);
+VOID KeHandleProcessorTick(VOID);
+BOOLEAN KeQueryNextTimerExpiry(PLARGE_INTEGER DueTime);
+NTSTATUS KeQueryTickStatistics(ULONG Processor, PKE_TICK_STATISTICS Statistics);
+
+// Run queue helpers shared by both schedulers, in scheduler_common.c. Each
+// scheduler describes its per-processor run queues with these operations;
+// state read through them without the queue lock is only a hint
+typedef struct _KI_RUN_QUEUE_OPERATIONS {
+    ULONG64 (*ActiveProcessors)(VOID);       // Processors dispatching from a run queue
+    ULONG64 (*DomainMask)(ULONG Processor, ULONG Level); // KE_DOMAIN_COUNT for the steal domain
+    ULONG (*ReadyCount)(ULONG Processor);
+    ULONG (*MigratableCount)(ULONG Processor);
+    PKSPIN_LOCK (*Lock)(ULONG Processor);
+    KE_TICK_MODE* (*TickMode)(ULONG Processor);
+    PKE_MIGRATION_STATISTICS (*Migration)(ULONG Processor);
+    PVOID (*TakeThread)(ULONG Victim, ULONG Thief, BOOLEAN Enqueue); // Both queues locked
+    BOOLEAN (*ClaimIdleProcessor)(ULONG Processor); // Mark a reschedule pending on it
+    ULONG (*ThreadQueue)(PVOID Thread);      // Processor queuing the thread, MAXULONG if none
+} KI_RUN_QUEUE_OPERATIONS, *PKI_RUN_QUEUE_OPERATIONS;
+
+ULONG KiFindLowestSetBit(ULONG Value);
+ULONG KiFindHighestSetBit(ULONG Value);
+ULONG KiFindFirstSet64(ULONG64 Value);
+BOOLEAN KiIsProcessorIdle(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG Processor);
+ULONG KiFindIdleProcessor(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG64 Candidates);
+ULONG KiLockThreadQueue(PKI_RUN_QUEUE_OPERATIONS Queues, PVOID Thread, PKIRQL OldIrql);
+PVOID KiStealThread(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG Thief, ULONG MinimumReady, BOOLEAN Enqueue);
+VOID KiKickIdleProcessor(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG Processor);
+VOID KiRestorePeriodicTick(KE_TICK_MODE* TickMode, ULONG Processor);
+VOID KiUpdateTickMode(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG Processor, KE_TICK_MODE Mode);
 
 // IPC management
 NTSTATUS IpcInitializeIpc(VOID);
@@ -228,6 +551,7 @@ NTSTATUS ObCreateObject(KERNEL_OBJECT_TYPE Type, SIZE_T ObjectSize, PKERNEL_OBJE
 VOID ObReferenceObject(PKERNEL_OBJECT Object);
 VOID ObDereferenceObject(PKERNEL_OBJECT Object);
 NTSTATUS ObGetObjectByName(PUNICODE_STRING Name, PKERNEL_OBJECT* Object);
+NTSTATUS ObSetObjectTypeCache(KERNEL_OBJECT_TYPE Type, PMM_OBJECT_CACHE Cache);
 
 // Security management
 NTSTATUS SeInitializeSecurity(VOID);
@@ -242,5 +566,20 @@ VOID HalInitializeTimers(VOID);
 VOID HalDisableInterrupts(VOID);
 VOID HalEnableInterrupts(VOID);
 VOID HalHaltSystem(VOID);
+VOID HalInvalidateTlbEntry(PVOID VirtualAddress);
+VOID HalFlushTlb(VOID);
+UINT_PTR HalGetCr3(VOID);
+VOID HalSetCr3(UINT_PTR Cr3Value);
+PVOID HalGetPageFaultAddress(VOID);
+VOID HalSendInterProcessorInterrupt(ULONG Processor, ULONG Vector);
+VOID HalSetPeriodicTick(ULONG Processor, ULONG Milliseconds);
+VOID HalSetOneShotTick(ULONG Processor, ULONG Milliseconds);
+VOID HalStopTick(ULONG Processor);
+VOID HalQueryProcessorTopology(ULONG Processor, PKE_PROCESSOR_TOPOLOGY Topology);
+NTSTATUS HalSetProcessorTopology(PKE_PROCESSOR_TOPOLOGY Topology, ULONG ProcessorCount);
+
+// Interrupt vectors
+#define HAL_TLB_SHOOTDOWN_VECTOR 0xFC    // Invalidate translations another processor changed
+#define HAL_RESCHEDULE_VECTOR    0xFD    // Dispatch a thread another processor readied
 
 #endif // DSLOS_KERNEL_H
\ No newline at end of file
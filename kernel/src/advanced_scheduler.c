@@ -11,8 +11,7 @@
 
 // Scheduler state
 static BOOLEAN g_AdvancedSchedulerInitialized = FALSE;
-static KSPIN_LOCK g_SchedulerLock;
-static volatile ULONG64 g_SchedulerTicks = 0;
+static KSPIN_LOCK g_SchedulerLock;             // Configuration and fair-share groups
 static volatile BOOLEAN g_SchedulerRunning = FALSE;
 
 // Scheduler statistics
@@ -25,8 +24,6 @@ typedef struct _SCHEDULER_STATS {
     ULONG64 LoadBalanceOperations;
 } SCHEDULER_STATS;
 
-static SCHEDULER_STATS g_SchedulerStats = {0};
-
 // Multi-level feedback queue
 #define SCHEDULER_PRIORITY_LEVELS 8
 #define SCHEDULER_TIME_SLICE_BASE 10  // Base time slice in milliseconds
@@ -38,14 +35,71 @@ typedef struct _PRIORITY_QUEUE {
     ULONG AgingFactor;
 } PRIORITY_QUEUE;
 
-static PRIORITY_QUEUE g_PriorityQueues[SCHEDULER_PRIORITY_LEVELS];
+// Per-processor run queue. Each processor selects only from its own queues
+// under its own lock; other processors lock it briefly to place a thread
+typedef struct _RUN_QUEUE {
+    KSPIN_LOCK Lock;
+    ULONG Processor;
+    PTHREAD IdleThread;            // Runs when nothing else is ready here; never queued
+    PRIORITY_QUEUE PriorityQueues[SCHEDULER_PRIORITY_LEVELS];
+    ULONG ReadySummary;            // Bit n set while PriorityQueues[n] is non-empty
+
+    // Deadline class: ready threads by absolute deadline, earliest first,
+    // and threads out of budget until their deadline
+    LIST_ENTRY DeadlineQueueHead;
+    LIST_ENTRY DeadlineThrottled;
+    volatile ULONG64 NextReplenishTime; // Earliest deadline among the throttled, 0 if none
+    ULONG64 DeadlineBandwidth;     // Admitted density; guarded by g_SchedulerLock
+
+    // Real-time queue
+    LIST_ENTRY RealTimeQueueHead;
+    ULONG RealTimeQueueLength;
+
+    // Fair class: every feedback-queue thread is also keyed by virtual
+    // runtime, here or in its group's tree below a group entity here
+    KE_SCHED_TREE FairTree;
+    LIST_ENTRY ThrottledGroups;    // FAIR_GROUP_QUEUEs out of quota on this processor
+    volatile ULONG64 NextUnthrottleTime; // Earliest refill among them, 0 if none
+
+    ULONG64 ReadyTimeSum;          // Sum of ReadyTime over feedback-queue threads
+    volatile ULONG ReadyCount;     // Read without the lock as a placement hint
+    volatile ULONG MigratableCount; // Feedback-queue threads allowed elsewhere; steal hint
+    volatile BOOLEAN ReschedulePending;
+    ULONG64 LastBalanceTime;
+    ULONG64 StealDomainMask;       // Processors this one may pull work from
+    ULONG64 DomainMasks[KE_DOMAIN_COUNT]; // Processors sharing each topology level, itself included
+    KE_TICK_MODE TickMode;         // How this processor's tick fires
+    ULONG64 RemoteEnqueues;
+    SCHEDULER_STATS Stats;
+    KE_MIGRATION_STATISTICS Migration; // Updated by the owning processor only
+} RUN_QUEUE, *PRUN_QUEUE;
+
+static RUN_QUEUE g_RunQueues[DSLOS_MAX_PROCESSORS];
+
+// Levels passed to KiDequeueThread for the real-time and deadline queues
+#define SCHEDULER_REAL_TIME_LEVEL SCHEDULER_PRIORITY_LEVELS
+#define SCHEDULER_DEADLINE_LEVEL (SCHEDULER_PRIORITY_LEVELS + 1)
+
+// Deadline class. Bandwidth is Runtime / RelativeDeadline in fixed point;
+// each processor admits up to the limit and leaves the rest to other classes
+#define SCHEDULER_DEADLINE_BANDWIDTH_SHIFT 20
+#define SCHEDULER_DEADLINE_BANDWIDTH_LIMIT ((95ULL << SCHEDULER_DEADLINE_BANDWIDTH_SHIFT) / 100)
+
+// Fair class
+#define SCHEDULER_FAIR_WAKEUP_CREDIT (SCHEDULER_TIME_SLICE_BASE * 2 * KE_SCHED_NOMINAL_WEIGHT)  // Virtual runtime a waking thread may trail by
+
+// Load weight per feedback queue level; each level gets about 25% more
+// processor than the one below it
+static const ULONG g_FairLevelWeights[SCHEDULER_PRIORITY_LEVELS] = {
+    423, 526, 655, 820, 1024, 1277, 1586, 1991
+};
 
-// Real-time queue
-static LIST_ENTRY g_RealTimeQueueHead;
-static ULONG g_RealTimeQueueLength = 0;
+// Work stealing
+#define SCHEDULER_CACHE_HOT_TICKS 5    // Threads that ran this recently keep their cache
+#define SCHEDULER_STEAL_SCAN_LIMIT 16  // Ready threads examined per steal attempt
 
 // Idle thread
-static PTHREAD g_IdleThread = NULL;
+#define SCHEDULER_IDLE_ZERO_PAGES 8    // Free pages zeroed per idle loop pass
 
 // Scheduler algorithms
 typedef enum _SCHEDULER_ALGORITHM {
@@ -66,30 +120,63 @@ typedef struct _CPU_TOPOLOGY {
     ULONG* CpuLoad;
     ULONG* CpuTemperature;
     BOOLEAN* CpuOnline;
+    PKE_PROCESSOR_TOPOLOGY Processors; // Core, last-level cache and package ids
 } CPU_TOPOLOGY;
 
 static CPU_TOPOLOGY g_CpuTopology = {0};
 
-// Fair share scheduling
+// Fair share scheduling. Groups nest (container, service, ...) and each
+// has one FAIR_GROUP_QUEUE per processor: an entity in its parent's tree
+// there and a tree of its own runnable members. Per-processor state is
+// guarded by that processor's run queue lock
+#define SCHEDULER_MAX_FAIR_SHARE_GROUPS 256
+#define SCHEDULER_MAX_GROUP_DEPTH 4
+#define SCHEDULER_DEFAULT_BANDWIDTH_PERIOD 100   // Ticks
+#define SCHEDULER_BANDWIDTH_SLICE 5              // Runtime a processor takes from the pool at once
+
+struct _FAIR_SHARE_GROUP;
+
+typedef struct _FAIR_GROUP_QUEUE {
+    KE_SCHED_ENTITY Entity;        // The group in its parent's tree
+    KE_SCHED_TREE Tree;            // Runnable members on this processor
+    struct _FAIR_SHARE_GROUP* Group;
+    LONG64 RuntimeRemaining;       // Quota this processor holds for the group
+    ULONG64 PeriodEnd;             // When a throttled group may refill
+    BOOLEAN Throttled;
+    LIST_ENTRY ThrottledEntry;     // RUN_QUEUE.ThrottledGroups
+} FAIR_GROUP_QUEUE, *PFAIR_GROUP_QUEUE;
+
 typedef struct _FAIR_SHARE_GROUP {
     LIST_ENTRY GroupList;
     GROUP_ID GroupId;
     UNICODE_STRING GroupName;
     ULONG GroupWeight;
-    ULONG64 CpuTimeUsed;
+    struct _FAIR_SHARE_GROUP* ParentGroup;
+    ULONG Depth;                   // 1 for a top-level group
+    volatile ULONG64 CpuTimeUsed;
+
+    // Bandwidth: CpuTimeQuota ticks per CpuTimePeriod, 0 for unlimited
+    KSPIN_LOCK BandwidthLock;
     ULONG64 CpuTimeQuota;
+    ULONG64 CpuTimePeriod;
+    ULONG64 PeriodStart;
+    ULONG64 RuntimePool;           // Quota not yet handed to a processor
+    ULONG64 ThrottleCount;
+
     ULONG ProcessCount;
+    PFAIR_GROUP_QUEUE PerCpu;      // One per processor
 } FAIR_SHARE_GROUP;
 
 static LIST_ENTRY g_FairShareGroups;
 static ULONG g_FairShareGroupCount = 0;
+static FAIR_SHARE_GROUP* g_FairShareGroupTable[SCHEDULER_MAX_FAIR_SHARE_GROUPS];  // By GroupId
+static volatile ULONG g_BandwidthGroupCount = 0;
 
 // Load balancing
 typedef struct _LOAD_BALANCER {
     BOOLEAN Enabled;
     ULONG BalanceInterval;
     ULONG BalanceThreshold;
-    volatile ULONG64 LastBalanceTime;
 } LOAD_BALANCER;
 
 static LOAD_BALANCER g_LoadBalancer = {
@@ -114,15 +201,41 @@ static POWER_MANAGER g_PowerManager = {
 };
 
 // Forward declarations
-static VOID KiUpdateSchedulerStatistics(VOID);
-static VOID KiBalanceLoad(VOID);
+static VOID KiUpdateSchedulerStatistics(PRUN_QUEUE Queue);
+static VOID KiBalanceLoad(PRUN_QUEUE Queue);
+static VOID KiBuildSchedulingDomains(VOID);
+static PTHREAD KiDequeueThread(PRUN_QUEUE Queue, PLIST_ENTRY Entry, ULONG Level);
 static VOID KiManagePower(VOID);
-static VOID KiAgeThreads(VOID);
-static PTHREAD KiSelectNextThread(VOID);
+static VOID KiAgeThreads(PRUN_QUEUE Queue);
+static PTHREAD KiSelectNextThread(PRUN_QUEUE Queue);
 static VOID KiUpdateThreadPriority(PTHREAD Thread);
 static BOOLEAN KiShouldPreempt(PTHREAD CurrentThread, PTHREAD NewThread);
 static VOID KiHandleStarvation(VOID);
-static VOID KiCalculateFairShare(VOID);
+NTSTATUS NTAPI KeSetThreadDeadline(PTHREAD Thread, ULONG64 Runtime, ULONG64 Deadline, ULONG64 Period);
+static ULONG64 KiActiveProcessors(VOID);
+static ULONG64 KiDomainMask(ULONG Processor, ULONG Level);
+static ULONG KiReadyCount(ULONG Processor);
+static ULONG KiMigratableCount(ULONG Processor);
+static PKSPIN_LOCK KiQueueLock(ULONG Processor);
+static KE_TICK_MODE* KiTickMode(ULONG Processor);
+static PKE_MIGRATION_STATISTICS KiMigration(ULONG Processor);
+static PVOID KiTakeReadyThread(ULONG Victim, ULONG Thief, BOOLEAN Enqueue);
+static BOOLEAN KiClaimIdleProcessor(ULONG Processor);
+static ULONG KiThreadQueue(PVOID Thread);
+
+// Run queue operations for the helpers shared with the base scheduler
+static KI_RUN_QUEUE_OPERATIONS g_KiRunQueueOperations = {
+    KiActiveProcessors,
+    KiDomainMask,
+    KiReadyCount,
+    KiMigratableCount,
+    KiQueueLock,
+    KiTickMode,
+    KiMigration,
+    KiTakeReadyThread,
+    KiClaimIdleProcessor,
+    KiThreadQueue
+};
 
 /**
  * @brief Initialize advanced scheduler
@@ -138,17 +251,27 @@ KeInitializeAdvancedScheduler(VOID)
 
     KeInitializeSpinLock(&g_SchedulerLock);
 
-    // Initialize priority queues
-    for (ULONG i = 0; i < SCHEDULER_PRIORITY_LEVELS; i++) {
-        InitializeListHead(&g_PriorityQueues[i].QueueHead);
-        g_PriorityQueues[i].QueueLength = 0;
-        g_PriorityQueues[i].TimeSlice = SCHEDULER_TIME_SLICE_BASE * (i + 1);
-        g_PriorityQueues[i].AgingFactor = 100 / (i + 1);
-    }
+    // Initialize one set of priority and real-time queues per processor
+    for (ULONG cpu = 0; cpu < DSLOS_MAX_PROCESSORS; cpu++) {
+        PRUN_QUEUE queue = &g_RunQueues[cpu];
 
-    // Initialize real-time queue
-    InitializeListHead(&g_RealTimeQueueHead);
-    g_RealTimeQueueLength = 0;
+        RtlZeroMemory(queue, sizeof(RUN_QUEUE));
+        KeInitializeSpinLock(&queue->Lock);
+        queue->Processor = cpu;
+
+        for (ULONG i = 0; i < SCHEDULER_PRIORITY_LEVELS; i++) {
+            InitializeListHead(&queue->PriorityQueues[i].QueueHead);
+            queue->PriorityQueues[i].QueueLength = 0;
+            queue->PriorityQueues[i].TimeSlice = SCHEDULER_TIME_SLICE_BASE * (i + 1);
+            queue->PriorityQueues[i].AgingFactor = 100 / (i + 1);
+        }
+
+        InitializeListHead(&queue->DeadlineQueueHead);
+        InitializeListHead(&queue->DeadlineThrottled);
+        InitializeListHead(&queue->RealTimeQueueHead);
+        queue->RealTimeQueueLength = 0;
+        InitializeListHead(&queue->ThrottledGroups);
+    }
 
     // Initialize fair share groups
     InitializeListHead(&g_FairShareGroups);
@@ -167,8 +290,11 @@ KeInitializeAdvancedScheduler(VOID)
         g_CpuTopology.CpuCount * sizeof(ULONG), 'TldC');
     g_CpuTopology.CpuOnline = ExAllocatePoolWithTag(NonPagedPool,
         g_CpuTopology.CpuCount * sizeof(BOOLEAN), 'OldC');
+    g_CpuTopology.Processors = ExAllocatePoolWithTag(NonPagedPool,
+        g_CpuTopology.CpuCount * sizeof(KE_PROCESSOR_TOPOLOGY), 'PldC');
 
-    if (!g_CpuTopology.CpuLoad || !g_CpuTopology.CpuTemperature || !g_CpuTopology.CpuOnline) {
+    if (!g_CpuTopology.CpuLoad || !g_CpuTopology.CpuTemperature || !g_CpuTopology.CpuOnline ||
+        !g_CpuTopology.Processors) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
@@ -179,12 +305,22 @@ KeInitializeAdvancedScheduler(VOID)
         g_CpuTopology.CpuOnline[i] = TRUE;
     }
 
-    // Create idle thread
-    NTSTATUS status = PsCreateSystemThread(&g_IdleThread,
-        KeGetCurrentProcessorNumber(), THREAD_PRIORITY_IDLE, KiIdleThread);
+    // Every processor may steal from every other; the topology domains
+    // decide which it looks at first
+    ULONG64 all_cpus = (g_CpuTopology.CpuCount >= 64) ? ~0ULL : ((1ULL << g_CpuTopology.CpuCount) - 1);
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        g_RunQueues[i].StealDomainMask = all_cpus;
+    }
+    KiBuildSchedulingDomains();
 
-    if (!NT_SUCCESS(status)) {
-        return status;
+    // Create one idle thread per processor, bound to it
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        NTSTATUS status = PsCreateSystemThread(&g_RunQueues[i].IdleThread,
+            i, THREAD_PRIORITY_IDLE, KiIdleThread);
+
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
     }
 
     g_AdvancedSchedulerInitialized = TRUE;
@@ -238,384 +374,1768 @@ KeStopScheduler(VOID)
 }
 
 /**
- * @brief Add thread to scheduler
- * @param Thread Thread to add
- * @return NTSTATUS Status code
+ * @brief Get the feedback queue level of a regular thread
+ * @param Thread Thread
+ * @return Level, clamped to the highest queue
  */
-NTSTATUS
+static ULONG
 NTAPI
-KeAddThreadToScheduler(
+KiPriorityLevel(
     _In_ PTHREAD Thread
 )
 {
-    if (!g_AdvancedSchedulerInitialized || !Thread) {
-        return STATUS_INVALID_PARAMETER;
+    ULONG priority_level = Thread->Priority / THREAD_PRIORITY_INCREMENT;
+    if (priority_level >= SCHEDULER_PRIORITY_LEVELS) {
+        priority_level = SCHEDULER_PRIORITY_LEVELS - 1;
     }
+    return priority_level;
+}
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_SchedulerLock, &old_irql);
-
-    // Set thread state to ready
-    Thread->State = THREAD_STATE_READY;
-
-    // Add to appropriate queue based on priority and type
+/**
+ * @brief Find the queue a thread waits on
+ * @param Thread Thread
+ * @return SCHEDULER_DEADLINE_LEVEL, SCHEDULER_REAL_TIME_LEVEL or a feedback level
+ */
+static ULONG
+NTAPI
+KiThreadQueueLevel(
+    _In_ PTHREAD Thread
+)
+{
+    if (Thread->DeadlineEntity.Runtime != 0) {
+        return SCHEDULER_DEADLINE_LEVEL;
+    }
     if (Thread->Priority >= THREAD_PRIORITY_REAL_TIME) {
-        // Real-time thread
-        InsertTailList(&g_RealTimeQueueHead, &Thread->SchedulerListEntry);
-        g_RealTimeQueueLength++;
-    } else {
-        // Regular thread - add to priority queue
-        ULONG priority_level = Thread->Priority / THREAD_PRIORITY_INCREMENT;
-        if (priority_level >= SCHEDULER_PRIORITY_LEVELS) {
-            priority_level = SCHEDULER_PRIORITY_LEVELS - 1;
-        }
-
-        InsertTailList(&g_PriorityQueues[priority_level].QueueHead,
-                      &Thread->SchedulerListEntry);
-        g_PriorityQueues[priority_level].QueueLength++;
+        return SCHEDULER_REAL_TIME_LEVEL;
     }
-
-    Thread->InSchedulerQueue = TRUE;
-    Thread->ReadyTime = KeQueryTimeTicks();
-
-    KeReleaseSpinLock(&g_SchedulerLock, old_irql);
-
-    return STATUS_SUCCESS;
+    return KiPriorityLevel(Thread);
 }
 
 /**
- * @brief Remove thread from scheduler
- * @param Thread Thread to remove
- * @return NTSTATUS Status code
+ * @brief Check whether a thread's affinity allows more than one processor
+ * @param Thread Thread
+ * @return TRUE if another processor could run it
  */
-NTSTATUS
+static BOOLEAN
 NTAPI
-KeRemoveThreadFromScheduler(
+KiIsThreadMigratable(
     _In_ PTHREAD Thread
 )
 {
-    if (!g_AdvancedSchedulerInitialized || !Thread) {
-        return STATUS_INVALID_PARAMETER;
-    }
-
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_SchedulerLock, &old_irql);
-
-    if (Thread->InSchedulerQueue) {
-        RemoveEntryList(&Thread->SchedulerListEntry);
-        Thread->InSchedulerQueue = FALSE;
+    return Thread->Affinity == 0 || (Thread->Affinity & (Thread->Affinity - 1)) != 0;
+}
 
-        // Update queue length
-        if (Thread->Priority >= THREAD_PRIORITY_REAL_TIME) {
-            g_RealTimeQueueLength--;
-        } else {
-            ULONG priority_level = Thread->Priority / THREAD_PRIORITY_INCREMENT;
-            if (priority_level < SCHEDULER_PRIORITY_LEVELS) {
-                g_PriorityQueues[priority_level].QueueLength--;
-            }
-        }
+/**
+ * @brief Append a thread to one feedback queue level
+ * @param Queue Run queue, locked by the caller
+ * @param Thread Thread to append
+ * @param Level Feedback queue level
+ */
+static VOID
+NTAPI
+KiEnqueuePriorityThread(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PTHREAD Thread,
+    _In_ ULONG Level
+)
+{
+    InsertTailList(&Queue->PriorityQueues[Level].QueueHead, &Thread->SchedulerListEntry);
+    Queue->PriorityQueues[Level].QueueLength++;
+    Queue->ReadySummary |= 1UL << Level;
+    Queue->ReadyTimeSum += Thread->ReadyTime;
+    if (KiIsThreadMigratable(Thread)) {
+        Queue->MigratableCount++;
     }
+}
 
-    KeReleaseSpinLock(&g_SchedulerLock, old_irql);
+/**
+ * @brief Unlink a thread from one feedback queue level
+ * @param Queue Run queue, locked by the caller
+ * @param Entry Scheduler list entry of the thread
+ * @param Level Feedback queue level
+ */
+static VOID
+NTAPI
+KiUnlinkPriorityThread(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PLIST_ENTRY Entry,
+    _In_ ULONG Level
+)
+{
+    PTHREAD thread = CONTAINING_RECORD(Entry, THREAD, SchedulerListEntry);
 
-    return STATUS_SUCCESS;
+    RemoveEntryList(Entry);
+    if (--Queue->PriorityQueues[Level].QueueLength == 0) {
+        Queue->ReadySummary &= ~(1UL << Level);
+    }
+    Queue->ReadyTimeSum -= thread->ReadyTime;
+    if (KiIsThreadMigratable(thread)) {
+        Queue->MigratableCount--;
+    }
 }
 
 /**
- * @brief Schedule next thread
- * @return PTHREAD Next thread to run
+ * @brief Choose the tick for what a processor is about to run
+ * @param Queue Current processor's run queue, not locked by the caller
+ * @param NextThread Thread it is switching to
+ * @return Tick mode
+ * @note Idle stops the tick and a thread with nothing waiting behind it
+ *       slows it. Deadline budgets, group quotas and held threads are
+ *       enforced from the tick, so any of them keeps it periodic
  */
-PTHREAD
+static KE_TICK_MODE
 NTAPI
-KeScheduleNextThread(VOID)
+KiSelectTickMode(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PTHREAD NextThread
+)
 {
-    if (!g_AdvancedSchedulerInitialized || !g_SchedulerRunning) {
-        return NULL;
+    if (Queue->ReadyCount != 0 || Queue->NextReplenishTime != 0 || Queue->NextUnthrottleTime != 0) {
+        return KE_TICK_PERIODIC;
+    }
+    if (NextThread == Queue->IdleThread) {
+        return KE_TICK_STOPPED;
+    }
+    if (KiThreadQueueLevel(NextThread) != SCHEDULER_DEADLINE_LEVEL && g_BandwidthGroupCount == 0) {
+        return KE_TICK_REDUCED;
     }
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_SchedulerLock, &old_irql);
-
-    // Update scheduler statistics
-    KiUpdateSchedulerStatistics();
-
-    // Perform load balancing if needed
-    KiBalanceLoad();
+    return KE_TICK_PERIODIC;
+}
 
-    // Handle aging to prevent starvation
-    KiAgeThreads();
+/**
+ * @brief Rotate a fair tree node left
+ * @param Tree Tree holding the node
+ * @param Node Node whose right child takes its place
+ */
+static VOID
+NTAPI
+KiFairRotateLeft(
+    _In_ PKE_SCHED_TREE Tree,
+    _In_ PKE_SCHED_ENTITY Node
+)
+{
+    PKE_SCHED_ENTITY pivot = Node->Right;
 
-    // Calculate fair share if using fair share algorithm
-    if (g_CurrentAlgorithm == SCHED_ALGORITHM_FAIR_SHARE) {
-        KiCalculateFairShare();
+    Node->Right = pivot->Left;
+    if (pivot->Left) {
+        pivot->Left->Parent = Node;
     }
-
-    // Select next thread
-    PTHREAD next_thread = KiSelectNextThread();
-
-    // Update statistics
-    g_SchedulerTicks++;
-    g_SchedulerStats.TotalSchedules++;
-    if (next_thread && next_thread != KeGetCurrentThread()) {
-        g_SchedulerStats.ContextSwitches++;
+    pivot->Parent = Node->Parent;
+    if (!Node->Parent) {
+        Tree->Root = pivot;
+    } else if (Node == Node->Parent->Left) {
+        Node->Parent->Left = pivot;
+    } else {
+        Node->Parent->Right = pivot;
     }
-
-    KeReleaseSpinLock(&g_SchedulerLock, old_irql);
-
-    return next_thread;
+    pivot->Left = Node;
+    Node->Parent = pivot;
 }
 
 /**
- * @brief Select next thread to run
- * @return PTHREAD Selected thread
+ * @brief Rotate a fair tree node right
+ * @param Tree Tree holding the node
+ * @param Node Node whose left child takes its place
  */
-static PTHREAD
+static VOID
 NTAPI
-KiSelectNextThread(VOID)
+KiFairRotateRight(
+    _In_ PKE_SCHED_TREE Tree,
+    _In_ PKE_SCHED_ENTITY Node
+)
 {
-    PTHREAD current_thread = KeGetCurrentThread();
-    PTHREAD next_thread = NULL;
+    PKE_SCHED_ENTITY pivot = Node->Left;
 
-    // Check real-time queue first
-    if (!IsListEmpty(&g_RealTimeQueueHead)) {
-        PLIST_ENTRY entry = RemoveHeadList(&g_RealTimeQueueHead);
-        next_thread = CONTAINING_RECORD(entry, THREAD, SchedulerListEntry);
-        g_RealTimeQueueLength--;
-        next_thread->InSchedulerQueue = FALSE;
-        return next_thread;
+    Node->Left = pivot->Right;
+    if (pivot->Right) {
+        pivot->Right->Parent = Node;
     }
+    pivot->Parent = Node->Parent;
+    if (!Node->Parent) {
+        Tree->Root = pivot;
+    } else if (Node == Node->Parent->Right) {
+        Node->Parent->Right = pivot;
+    } else {
+        Node->Parent->Left = pivot;
+    }
+    pivot->Right = Node;
+    Node->Parent = pivot;
+}
 
-    // Select based on current algorithm
-    switch (g_CurrentAlgorithm) {
-        case SCHED_ALGORITHM_ROUND_ROBIN:
-            next_thread = KiSelectNextThreadRoundRobin();
-            break;
+/**
+ * @brief Insert an entity into a fair tree
+ * @param Tree Tree, locked by the caller
+ * @param Entity Entity with its VirtualRuntime and Weight set
+ * @note Equal keys go to the right, so entities with the same virtual
+ *       runtime run in insertion order
+ */
+static VOID
+NTAPI
+KiFairInsert(
+    _In_ PKE_SCHED_TREE Tree,
+    _In_ PKE_SCHED_ENTITY Entity
+)
+{
+    PKE_SCHED_ENTITY parent = NULL;
+    PKE_SCHED_ENTITY* link = &Tree->Root;
+    BOOLEAN leftmost = TRUE;
+
+    while (*link) {
+        parent = *link;
+        if (Entity->VirtualRuntime < parent->VirtualRuntime) {
+            link = &parent->Left;
+        } else {
+            link = &parent->Right;
+            leftmost = FALSE;
+        }
+    }
 
-        case SCHED_ALGORITHM_PRIORITY:
-            next_thread = KiSelectNextThreadPriority();
-            break;
+    Entity->Parent = parent;
+    Entity->Left = NULL;
+    Entity->Right = NULL;
+    Entity->Red = TRUE;
+    Entity->OnTree = TRUE;
+    *link = Entity;
 
-        case SCHED_ALGORITHM_FAIR_SHARE:
-            next_thread = KiSelectNextThreadFairShare();
-            break;
+    if (leftmost) {
+        Tree->Leftmost = Entity;
+    }
+    Tree->Count++;
+    Tree->TotalWeight += Entity->Weight;
 
-        case SCHED_ALGORITHM_LOAD_BALANCING:
-            next_thread = KiSelectNextThreadLoadBalanced();
-            break;
+    // Restore the red-black properties up from the new node
+    PKE_SCHED_ENTITY node = Entity;
 
-        case SCHED_ALGORITHM_ADAPTIVE:
-        default:
-            next_thread = KiSelectNextThreadAdaptive();
-            break;
-    }
+    while (node->Parent && node->Parent->Red) {
+        PKE_SCHED_ENTITY father = node->Parent;
+        PKE_SCHED_ENTITY grandfather = father->Parent;
 
-    // If no thread found, use idle thread
-    if (!next_thread) {
-        next_thread = g_IdleThread;
-    }
+        if (father == grandfather->Left) {
+            PKE_SCHED_ENTITY uncle = grandfather->Right;
 
-    // Check if we should preempt current thread
-    if (current_thread && next_thread && current_thread != next_thread) {
-        if (KiShouldPreempt(current_thread, next_thread)) {
-            return next_thread;
+            if (uncle && uncle->Red) {
+                father->Red = FALSE;
+                uncle->Red = FALSE;
+                grandfather->Red = TRUE;
+                node = grandfather;
+                continue;
+            }
+            if (node == father->Right) {
+                KiFairRotateLeft(Tree, father);
+                node = father;
+                father = node->Parent;
+            }
+            father->Red = FALSE;
+            grandfather->Red = TRUE;
+            KiFairRotateRight(Tree, grandfather);
+        } else {
+            PKE_SCHED_ENTITY uncle = grandfather->Left;
+
+            if (uncle && uncle->Red) {
+                father->Red = FALSE;
+                uncle->Red = FALSE;
+                grandfather->Red = TRUE;
+                node = grandfather;
+                continue;
+            }
+            if (node == father->Left) {
+                KiFairRotateRight(Tree, father);
+                node = father;
+                father = node->Parent;
+            }
+            father->Red = FALSE;
+            grandfather->Red = TRUE;
+            KiFairRotateLeft(Tree, grandfather);
         }
     }
 
-    return next_thread;
+    Tree->Root->Red = FALSE;
 }
 
 /**
- * @brief Select next thread using round-robin algorithm
- * @return PTHREAD Selected thread
+ * @brief Find the next entity in virtual runtime order
+ * @param Entity Entity on a fair tree
+ * @return Successor, or NULL for the rightmost entity
  */
-static PTHREAD
+static PKE_SCHED_ENTITY
 NTAPI
-KiSelectNextThreadRoundRobin(VOID)
+KiFairNext(
+    _In_ PKE_SCHED_ENTITY Entity
+)
 {
-    // Simple round-robin through priority queues
-    for (ULONG i = 0; i < SCHEDULER_PRIORITY_LEVELS; i++) {
-        if (!IsListEmpty(&g_PriorityQueues[i].QueueHead)) {
-            PLIST_ENTRY entry = RemoveHeadList(&g_PriorityQueues[i].QueueHead);
-            PTHREAD thread = CONTAINING_RECORD(entry, THREAD, SchedulerListEntry);
-            g_PriorityQueues[i].QueueLength--;
-            thread->InSchedulerQueue = FALSE;
-            return thread;
+    if (Entity->Right) {
+        PKE_SCHED_ENTITY node = Entity->Right;
+        while (node->Left) {
+            node = node->Left;
         }
+        return node;
+    }
+
+    while (Entity->Parent && Entity == Entity->Parent->Right) {
+        Entity = Entity->Parent;
     }
-    return NULL;
+    return Entity->Parent;
 }
 
 /**
- * @brief Select next thread using priority algorithm
- * @return PTHREAD Selected thread
+ * @brief Measure the height of a fair subtree
+ * @param Entity Subtree root, or NULL
+ * @return Nodes on the longest path down from Entity
+ * @note Red-black balancing bounds the height by 2 * log2(Count + 1)
  */
-static PTHREAD
+static ULONG
 NTAPI
-KiSelectNextThreadPriority(VOID)
+KiFairTreeHeight(
+    _In_opt_ PKE_SCHED_ENTITY Entity
+)
 {
-    // Always pick highest priority thread
-    for (LONG i = SCHEDULER_PRIORITY_LEVELS - 1; i >= 0; i--) {
-        if (!IsListEmpty(&g_PriorityQueues[i].QueueHead)) {
-            PLIST_ENTRY entry = RemoveHeadList(&g_PriorityQueues[i].QueueHead);
-            PTHREAD thread = CONTAINING_RECORD(entry, THREAD, SchedulerListEntry);
-            g_PriorityQueues[i].QueueLength--;
-            thread->InSchedulerQueue = FALSE;
-            return thread;
-        }
+    if (!Entity) {
+        return 0;
     }
-    return NULL;
+
+    ULONG left = KiFairTreeHeight(Entity->Left);
+    ULONG right = KiFairTreeHeight(Entity->Right);
+    return 1 + max(left, right);
 }
 
 /**
- * @brief Select next thread using fair share algorithm
- * @return PTHREAD Selected thread
+ * @brief Remove an entity from a fair tree
+ * @param Tree Tree, locked by the caller
+ * @param Entity Entity on the tree
  */
-static PTHREAD
+static VOID
 NTAPI
-KiSelectNextThreadFairShare(VOID)
+KiFairRemove(
+    _In_ PKE_SCHED_TREE Tree,
+    _In_ PKE_SCHED_ENTITY Entity
+)
 {
-    // Find group with most CPU time remaining
-    PLIST_ENTRY group_entry = g_FairShareGroups.Flink;
-    FAIR_SHARE_GROUP* best_group = NULL;
-    ULONG64 best_remaining = 0;
+    if (Tree->Leftmost == Entity) {
+        Tree->Leftmost = KiFairNext(Entity);
+    }
+    Tree->Count--;
+    Tree->TotalWeight -= Entity->Weight;
+    Entity->OnTree = FALSE;
+
+    // Unlink the entity, or swap its successor into its place when it has
+    // two children. child may be NULL, so child_parent tracks its position
+    PKE_SCHED_ENTITY child;
+    PKE_SCHED_ENTITY child_parent;
+    BOOLEAN removed_red;
+
+    if (!Entity->Left || !Entity->Right) {
+        child = Entity->Left ? Entity->Left : Entity->Right;
+        child_parent = Entity->Parent;
+        removed_red = Entity->Red;
+
+        if (child) {
+            child->Parent = child_parent;
+        }
+        if (!child_parent) {
+            Tree->Root = child;
+        } else if (child_parent->Left == Entity) {
+            child_parent->Left = child;
+        } else {
+            child_parent->Right = child;
+        }
+    } else {
+        PKE_SCHED_ENTITY successor = Entity->Right;
+        while (successor->Left) {
+            successor = successor->Left;
+        }
 
-    while (group_entry != &g_FairShareGroups) {
-        FAIR_SHARE_GROUP* group = CONTAINING_RECORD(group_entry, FAIR_SHARE_GROUP, GroupList);
-        ULONG64 remaining = group->CpuTimeQuota - group->CpuTimeUsed;
+        child = successor->Right;
+        removed_red = successor->Red;
 
-        if (remaining > best_remaining) {
-            best_remaining = remaining;
-            best_group = group;
+        if (successor->Parent == Entity) {
+            child_parent = successor;
+        } else {
+            child_parent = successor->Parent;
+            child_parent->Left = child;
+            if (child) {
+                child->Parent = child_parent;
+            }
+            successor->Right = Entity->Right;
+            Entity->Right->Parent = successor;
         }
 
-        group_entry = group_entry->Flink;
+        successor->Left = Entity->Left;
+        Entity->Left->Parent = successor;
+        successor->Parent = Entity->Parent;
+        successor->Red = Entity->Red;
+        if (!Entity->Parent) {
+            Tree->Root = successor;
+        } else if (Entity->Parent->Left == Entity) {
+            Entity->Parent->Left = successor;
+        } else {
+            Entity->Parent->Right = successor;
+        }
     }
 
-    if (!best_group) {
-        return KiSelectNextThreadPriority();
+    if (removed_red) {
+        return;
     }
 
-    // Find thread from best group
-    for (LONG i = SCHEDULER_PRIORITY_LEVELS - 1; i >= 0; i--) {
-        PLIST_ENTRY thread_entry = g_PriorityQueues[i].QueueHead.Flink;
-
-        while (thread_entry != &g_PriorityQueues[i].QueueHead) {
-            PTHREAD thread = CONTAINING_RECORD(thread_entry, THREAD, SchedulerListEntry);
+    // A black node left; push the missing black up or rebalance
+    while (child != Tree->Root && (!child || !child->Red)) {
+        if (child == child_parent->Left) {
+            PKE_SCHED_ENTITY sibling = child_parent->Right;
 
-            if (thread->Process && thread->Process->GroupId == best_group->GroupId) {
-                RemoveEntryList(thread_entry);
-                g_PriorityQueues[i].QueueLength--;
-                thread->InSchedulerQueue = FALSE;
-                return thread;
+            if (sibling->Red) {
+                sibling->Red = FALSE;
+                child_parent->Red = TRUE;
+                KiFairRotateLeft(Tree, child_parent);
+                sibling = child_parent->Right;
             }
+            if ((!sibling->Left || !sibling->Left->Red) && (!sibling->Right || !sibling->Right->Red)) {
+                sibling->Red = TRUE;
+                child = child_parent;
+                child_parent = child->Parent;
+                continue;
+            }
+            if (!sibling->Right || !sibling->Right->Red) {
+                sibling->Left->Red = FALSE;
+                sibling->Red = TRUE;
+                KiFairRotateRight(Tree, sibling);
+                sibling = child_parent->Right;
+            }
+            sibling->Red = child_parent->Red;
+            child_parent->Red = FALSE;
+            sibling->Right->Red = FALSE;
+            KiFairRotateLeft(Tree, child_parent);
+        } else {
+            PKE_SCHED_ENTITY sibling = child_parent->Left;
 
-            thread_entry = thread_entry->Flink;
+            if (sibling->Red) {
+                sibling->Red = FALSE;
+                child_parent->Red = TRUE;
+                KiFairRotateRight(Tree, child_parent);
+                sibling = child_parent->Left;
+            }
+            if ((!sibling->Left || !sibling->Left->Red) && (!sibling->Right || !sibling->Right->Red)) {
+                sibling->Red = TRUE;
+                child = child_parent;
+                child_parent = child->Parent;
+                continue;
+            }
+            if (!sibling->Left || !sibling->Left->Red) {
+                sibling->Right->Red = FALSE;
+                sibling->Red = TRUE;
+                KiFairRotateLeft(Tree, sibling);
+                sibling = child_parent->Left;
+            }
+            sibling->Red = child_parent->Red;
+            child_parent->Red = FALSE;
+            sibling->Left->Red = FALSE;
+            KiFairRotateRight(Tree, child_parent);
         }
+        child = Tree->Root;
     }
 
-    return KiSelectNextThreadPriority();
+    if (child) {
+        child->Red = FALSE;
+    }
 }
 
 /**
- * @brief Select next thread using load balancing algorithm
- * @return PTHREAD Selected thread
+ * @brief Find the fair tree a thread joins on a processor
+ * @param Thread Feedback-queue thread
+ * @param Queue Run queue of the processor
+ * @return Its group's tree there, or the queue's top-level tree
  */
-static PTHREAD
+static PKE_SCHED_TREE
 NTAPI
-KiSelectNextThreadLoadBalanced(VOID)
+KiThreadFairTree(
+    _In_ PTHREAD Thread,
+    _In_ PRUN_QUEUE Queue
+)
 {
-    ULONG current_cpu = KeGetCurrentProcessorNumber();
-    ULONG best_cpu = current_cpu;
-    ULONG min_load = g_CpuTopology.CpuLoad[current_cpu];
-
-    // Find least loaded CPU
-    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
-        if (g_CpuTopology.CpuOnline[i] && g_CpuTopology.CpuLoad[i] < min_load) {
-            min_load = g_CpuTopology.CpuLoad[i];
-            best_cpu = i;
+    if (Thread->Process && Thread->Process->GroupId != 0 &&
+        Thread->Process->GroupId < SCHEDULER_MAX_FAIR_SHARE_GROUPS) {
+        FAIR_SHARE_GROUP* group = g_FairShareGroupTable[Thread->Process->GroupId];
+        if (group) {
+            return &group->PerCpu[Queue->Processor].Tree;
         }
     }
 
-    // Prefer thread with affinity to best CPU
-    for (LONG i = SCHEDULER_PRIORITY_LEVELS - 1; i >= 0; i--) {
-        PLIST_ENTRY thread_entry = g_PriorityQueues[i].QueueHead.Flink;
+    return &Queue->FairTree;
+}
 
-        while (thread_entry != &g_PriorityQueues[i].QueueHead) {
-            PTHREAD thread = CONTAINING_RECORD(thread_entry, THREAD, SchedulerListEntry);
+/**
+ * @brief Move a thread's virtual runtime to the clock of the tree it joins next
+ * @param Thread Thread being readied or migrated, on no tree
+ * @param To Queue it will be measured against
+ * @note Virtual runtimes only compare within one tree, so the thread keeps
+ *       its lag behind the old tree's floor. The old floor may belong to
+ *       another processor and is read without its lock; it only ever
+ *       grows, so a stale value is harmless
+ */
+static VOID
+NTAPI
+KiFairRenormalize(
+    _In_ PTHREAD Thread,
+    _In_ PRUN_QUEUE To
+)
+{
+    PKE_SCHED_ENTITY entity = &Thread->FairEntity;
+    PKE_SCHED_TREE to_tree = KiThreadFairTree(Thread, To);
 
-            if (thread->Affinity == 0 || (thread->Affinity & (1ULL << best_cpu))) {
-                RemoveEntryList(thread_entry);
-                g_PriorityQueues[i].QueueLength--;
-                thread->InSchedulerQueue = FALSE;
-                return thread;
-            }
+    if (entity->Tree && entity->Tree != to_tree) {
+        ULONG64 from_floor = entity->Tree->MinVirtualRuntime;
 
-            thread_entry = thread_entry->Flink;
-        }
+        entity->VirtualRuntime = (entity->VirtualRuntime > from_floor) ?
+            to_tree->MinVirtualRuntime + (entity->VirtualRuntime - from_floor) :
+            to_tree->MinVirtualRuntime;
     }
 
-    return KiSelectNextThreadPriority();
+    entity->Tree = to_tree;
 }
 
 /**
- * @brief Select next thread using adaptive algorithm
- * @return PTHREAD Selected thread
+ * @brief Insert an entity into its tree, first limiting how far it trails
+ * @param Entity Entity with Tree and Weight set
+ * @note An entity that slept keeps at most SCHEDULER_FAIR_WAKEUP_CREDIT of
+ *       its lag, so it runs soon without monopolising the processor
  */
-static PTHREAD
+static VOID
 NTAPI
-KiSelectNextThreadAdaptive(VOID)
+KiFairPlace(
+    _In_ PKE_SCHED_ENTITY Entity
+)
 {
-    ULONG64 current_time = KeQueryTimeTicks();
-    ULONG total_load = 0;
+    ULONG64 floor = Entity->Tree->MinVirtualRuntime;
 
-    // Calculate total system load
-    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
-        if (g_CpuTopology.CpuOnline[i]) {
-            total_load += g_CpuTopology.CpuLoad[i];
-        }
+    if (floor > SCHEDULER_FAIR_WAKEUP_CREDIT && Entity->VirtualRuntime < floor - SCHEDULER_FAIR_WAKEUP_CREDIT) {
+        Entity->VirtualRuntime = floor - SCHEDULER_FAIR_WAKEUP_CREDIT;
     }
 
-    // Adapt algorithm based on system load
-    if (total_load > 80) {
-        // High load - use load balancing
-        g_CurrentAlgorithm = SCHED_ALGORITHM_LOAD_BALANCING;
-        return KiSelectNextThreadLoadBalanced();
-    } else if (total_load < 20) {
-        // Low load - use priority for responsiveness
-        g_CurrentAlgorithm = SCHED_ALGORITHM_PRIORITY;
-        return KiSelectNextThreadPriority();
-    } else {
-        // Medium load - use fair share
-        g_CurrentAlgorithm = SCHED_ALGORITHM_FAIR_SHARE;
-        return KiSelectNextThreadFairShare();
-    }
+    KiFairInsert(Entity->Tree, Entity);
 }
 
 /**
- * @brief Check if should preempt current thread
- * @param CurrentThread Current running thread
- * @param NewThread New thread to run
- * @return BOOLEAN TRUE if should preempt
+ * @brief Take group entities whose trees emptied off their parents' trees
+ * @param Tree Tree an entity just left
  */
-static BOOLEAN
+static VOID
 NTAPI
-KiShouldPreempt(
-    _In_ PTHREAD CurrentThread,
-    _In_ PTHREAD NewThread
+KiFairPruneGroups(
+    _In_ PKE_SCHED_TREE Tree
 )
 {
-    if (!CurrentThread || !NewThread) {
-        return TRUE;
-    }
+    while (Tree->Count == 0 && Tree->Owner && Tree->Owner->OnTree) {
+        PKE_SCHED_ENTITY group = Tree->Owner;
 
-    // Real-time threads always preempt
-    if (NewThread->Priority >= THREAD_PRIORITY_REAL_TIME &&
-        CurrentThread->Priority < THREAD_PRIORITY_REAL_TIME) {
-        return TRUE;
+        KiFairRemove(group->Tree, group);
+        Tree = group->Tree;
     }
+}
 
-    // Higher priority threads preempt
-    if (NewThread->Priority > CurrentThread->Priority + 2) {
+/**
+ * @brief Put group entities that gained a runnable member on their parents' trees
+ * @param Tree Tree an entity just joined
+ * @note Stops at a group throttled on this processor; unthrottling it
+ *       carries on from there
+ */
+static VOID
+NTAPI
+KiFairActivateGroups(
+    _In_ PKE_SCHED_TREE Tree
+)
+{
+    while (Tree->Owner && !Tree->Owner->OnTree) {
+        PKE_SCHED_ENTITY group = Tree->Owner;
+
+        if (CONTAINING_RECORD(group, FAIR_GROUP_QUEUE, Entity)->Throttled) {
+            break;
+        }
+
+        KiFairPlace(group);
+        Tree = group->Tree;
+    }
+}
+
+/**
+ * @brief Key a readied thread into its group's fair tree on a processor
+ * @param Queue Run queue, locked by the caller
+ * @param Thread Feedback-queue thread
+ */
+static VOID
+NTAPI
+KiFairEnqueue(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PTHREAD Thread
+)
+{
+    PKE_SCHED_ENTITY entity = &Thread->FairEntity;
+
+    entity->Tree = KiThreadFairTree(Thread, Queue);
+    entity->Weight = g_FairLevelWeights[KiPriorityLevel(Thread)];
+    KiFairPlace(entity);
+    KiFairActivateGroups(entity->Tree);
+}
+
+/**
+ * @brief Take a thread off its fair tree
+ * @param Thread Queued feedback-queue thread; its run queue is locked
+ */
+static VOID
+NTAPI
+KiFairDequeue(
+    _In_ PTHREAD Thread
+)
+{
+    PKE_SCHED_ENTITY entity = &Thread->FairEntity;
+
+    KiFairRemove(entity->Tree, entity);
+    KiFairPruneGroups(entity->Tree);
+}
+
+/**
+ * @brief Advance a tree's virtual runtime floor
+ * @param Tree Fair tree, its run queue locked by the caller
+ * @param Running Entity of the tree that is running, or NULL
+ */
+static VOID
+NTAPI
+KiFairUpdateFloor(
+    _In_ PKE_SCHED_TREE Tree,
+    _In_opt_ PKE_SCHED_ENTITY Running
+)
+{
+    ULONG64 floor;
+
+    if (Tree->Leftmost && Running) {
+        floor = min(Tree->Leftmost->VirtualRuntime, Running->VirtualRuntime);
+    } else if (Tree->Leftmost) {
+        floor = Tree->Leftmost->VirtualRuntime;
+    } else if (Running) {
+        floor = Running->VirtualRuntime;
+    } else {
+        return;
+    }
+
+    if (floor > Tree->MinVirtualRuntime) {
+        Tree->MinVirtualRuntime = floor;
+    }
+}
+
+/**
+ * @brief Add runtime to an entity, rekeying it if it is on its tree
+ * @param Entity Thread or group entity
+ * @param Delta Runtime in ticks
+ * @param Weight Weight to scale the runtime by
+ */
+static VOID
+NTAPI
+KiFairAdvance(
+    _In_ PKE_SCHED_ENTITY Entity,
+    _In_ ULONG64 Delta,
+    _In_ ULONG Weight
+)
+{
+    BOOLEAN queued = Entity->OnTree;
+
+    if (queued) {
+        KiFairRemove(Entity->Tree, Entity);
+    }
+
+    Entity->SumExecRuntime += Delta;
+    // Kept in fractions of a tick, or heavy entities would not advance at all
+    // on one-tick charges
+    Entity->VirtualRuntime += (Delta * KE_SCHED_NOMINAL_WEIGHT * KE_SCHED_NOMINAL_WEIGHT) / Weight;
+
+    if (queued) {
+        KiFairInsert(Entity->Tree, Entity);
+    }
+
+    KiFairUpdateFloor(Entity->Tree, Entity);
+}
+
+/**
+ * @brief Take runtime for a group on one processor from its period quota
+ * @param Group Bandwidth-limited group
+ * @param GroupQueue The group's state on the current processor
+ * @param Now Current time in ticks
+ * @return TRUE if the processor holds runtime for the group
+ * @note Runtime moves from the group-wide pool in SCHEDULER_BANDWIDTH_SLICE
+ *       pieces, so the group lock is taken about once per slice, not per
+ *       charge. The pool refills to the quota at each period boundary
+ */
+static BOOLEAN
+NTAPI
+KiAcquireGroupRuntime(
+    _In_ FAIR_SHARE_GROUP* Group,
+    _In_ PFAIR_GROUP_QUEUE GroupQueue,
+    _In_ ULONG64 Now
+)
+{
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Group->BandwidthLock, &old_irql);
+
+    if (Now - Group->PeriodStart >= Group->CpuTimePeriod) {
+        Group->PeriodStart = Now - (Now - Group->PeriodStart) % Group->CpuTimePeriod;
+        Group->RuntimePool = Group->CpuTimeQuota;
+    }
+
+    if (GroupQueue->RuntimeRemaining <= 0 && Group->RuntimePool > 0) {
+        ULONG64 amount = min(Group->RuntimePool, (ULONG64)SCHEDULER_BANDWIDTH_SLICE);
+
+        Group->RuntimePool -= amount;
+        GroupQueue->RuntimeRemaining += (LONG64)amount;
+    }
+
+    GroupQueue->PeriodEnd = Group->PeriodStart + Group->CpuTimePeriod;
+
+    KeReleaseSpinLock(&Group->BandwidthLock, old_irql);
+
+    return GroupQueue->RuntimeRemaining > 0;
+}
+
+/**
+ * @brief Stop a group running on one processor until its next period
+ * @param Queue Run queue, locked by the caller
+ * @param GroupQueue The group's state on that processor
+ */
+static VOID
+NTAPI
+KiThrottleGroup(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PFAIR_GROUP_QUEUE GroupQueue
+)
+{
+    GroupQueue->Throttled = TRUE;
+    GroupQueue->Group->ThrottleCount++;
+    InsertTailList(&Queue->ThrottledGroups, &GroupQueue->ThrottledEntry);
+    if (Queue->NextUnthrottleTime == 0 || GroupQueue->PeriodEnd < Queue->NextUnthrottleTime) {
+        Queue->NextUnthrottleTime = GroupQueue->PeriodEnd;
+    }
+
+    if (GroupQueue->Entity.OnTree) {
+        KiFairRemove(GroupQueue->Entity.Tree, &GroupQueue->Entity);
+        KiFairPruneGroups(GroupQueue->Entity.Tree);
+    }
+}
+
+/**
+ * @brief Let throttled groups run again once their period has refilled
+ * @param Queue Run queue, locked by the caller
+ * @param Now Current time in ticks
+ */
+static VOID
+NTAPI
+KiUnthrottleGroups(
+    _In_ PRUN_QUEUE Queue,
+    _In_ ULONG64 Now
+)
+{
+    PLIST_ENTRY entry = Queue->ThrottledGroups.Flink;
+    ULONG64 next_unthrottle = 0;
+
+    while (entry != &Queue->ThrottledGroups) {
+        PFAIR_GROUP_QUEUE group_queue = CONTAINING_RECORD(entry, FAIR_GROUP_QUEUE, ThrottledEntry);
+        entry = entry->Flink;
+
+        // A group whose limit was lifted leaves at once
+        if (group_queue->Group->CpuTimeQuota != 0 &&
+            (Now < group_queue->PeriodEnd || !KiAcquireGroupRuntime(group_queue->Group, group_queue, Now))) {
+            if (next_unthrottle == 0 || group_queue->PeriodEnd < next_unthrottle) {
+                next_unthrottle = group_queue->PeriodEnd;
+            }
+            continue;
+        }
+
+        RemoveEntryList(&group_queue->ThrottledEntry);
+        group_queue->Throttled = FALSE;
+
+        if (group_queue->Tree.Count != 0) {
+            KiFairPlace(&group_queue->Entity);
+            KiFairActivateGroups(group_queue->Entity.Tree);
+        }
+    }
+
+    Queue->NextUnthrottleTime = next_unthrottle;
+}
+
+/**
+ * @brief Charge a running thread, and every group above it, for the time
+ *        since it was last charged
+ * @param Queue Run queue of the processor running it, locked by the caller
+ * @param Thread Running feedback-queue thread
+ * @param Now Current time in ticks
+ * @note Groups whose quota runs out on this processor are throttled here
+ */
+static VOID
+NTAPI
+KiFairCharge(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PTHREAD Thread,
+    _In_ ULONG64 Now
+)
+{
+    PKE_SCHED_ENTITY entity = &Thread->FairEntity;
+    ULONG64 delta = Now - entity->ExecStart;
+
+    if (Now <= entity->ExecStart) {
+        return;
+    }
+
+    entity->ExecStart = Now;
+    if (!entity->Tree) {
+        entity->Tree = KiThreadFairTree(Thread, Queue);
+    }
+    KiFairAdvance(entity, delta, g_FairLevelWeights[KiPriorityLevel(Thread)]);
+
+    for (PKE_SCHED_ENTITY group = entity->Tree->Owner; group; group = group->Tree->Owner) {
+        PFAIR_GROUP_QUEUE group_queue = CONTAINING_RECORD(group, FAIR_GROUP_QUEUE, Entity);
+        FAIR_SHARE_GROUP* share_group = group_queue->Group;
+
+        KiFairAdvance(group, delta, group->Weight);
+        InterlockedExchangeAdd64((volatile LONG64*)&share_group->CpuTimeUsed, (LONG64)delta);
+
+        if (share_group->CpuTimeQuota == 0 || group_queue->Throttled) {
+            continue;
+        }
+
+        group_queue->RuntimeRemaining -= (LONG64)delta;
+        if (group_queue->RuntimeRemaining <= 0 && !KiAcquireGroupRuntime(share_group, group_queue, Now)) {
+            KiThrottleGroup(Queue, group_queue);
+        }
+    }
+}
+
+/**
+ * @brief Queue a deadline thread that has budget in deadline order
+ * @param Queue Run queue, locked by the caller
+ * @param Thread Deadline thread
+ * @note Searched from the tail, where the deadline of a new period usually
+ *       lands; equal deadlines keep arrival order
+ */
+static VOID
+NTAPI
+KiDeadlineInsert(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PTHREAD Thread
+)
+{
+    PLIST_ENTRY entry = Queue->DeadlineQueueHead.Blink;
+
+    while (entry != &Queue->DeadlineQueueHead &&
+           CONTAINING_RECORD(entry, THREAD, SchedulerListEntry)->DeadlineEntity.Deadline >
+           Thread->DeadlineEntity.Deadline) {
+        entry = entry->Blink;
+    }
+
+    InsertHeadList(entry, &Thread->SchedulerListEntry);
+    Queue->ReadyCount++;
+}
+
+/**
+ * @brief Start the next budget of a deadline thread
+ * @param Entity Deadline entity whose budget is used up or expired
+ * @param Now Current time in ticks
+ * @note An overrun is repaid from the following budgets. A thread that is
+ *       still behind afterwards starts afresh from now
+ */
+static VOID
+NTAPI
+KiDeadlineReplenish(
+    _In_ PKE_DEADLINE_ENTITY Entity,
+    _In_ ULONG64 Now
+)
+{
+    while (Entity->RemainingRuntime <= 0) {
+        Entity->Deadline += Entity->Period;
+        Entity->RemainingRuntime += (LONG64)Entity->Runtime;
+    }
+
+    if (Entity->Deadline <= Now) {
+        Entity->Deadline = Now + Entity->RelativeDeadline;
+        Entity->RemainingRuntime = (LONG64)Entity->Runtime;
+    }
+}
+
+/**
+ * @brief Hold a deadline thread that used up its budget until its deadline
+ * @param Queue Run queue, locked by the caller
+ * @param Thread Deadline thread, on no list
+ */
+static VOID
+NTAPI
+KiDeadlineThrottle(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PTHREAD Thread
+)
+{
+    PKE_DEADLINE_ENTITY entity = &Thread->DeadlineEntity;
+
+    entity->Throttled = TRUE;
+    entity->ThrottleCount++;
+    InsertTailList(&Queue->DeadlineThrottled, &Thread->SchedulerListEntry);
+    if (Queue->NextReplenishTime == 0 || entity->Deadline < Queue->NextReplenishTime) {
+        Queue->NextReplenishTime = entity->Deadline;
+    }
+}
+
+/**
+ * @brief Queue a readied deadline thread
+ * @param Queue Run queue, locked by the caller
+ * @param Thread Deadline thread
+ * @param Now Current time in ticks
+ * @param Woken TRUE if it was waiting, FALSE if it was preempted
+ * @note Constant bandwidth rule: a woken thread whose remaining budget,
+ *       spent by its old deadline, would exceed its reserved density gets a
+ *       fresh budget and deadline instead, so sleeping cannot bank time for
+ *       a burst that would crowd out the other reservations
+ */
+static VOID
+NTAPI
+KiDeadlineEnqueue(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PTHREAD Thread,
+    _In_ ULONG64 Now,
+    _In_ BOOLEAN Woken
+)
+{
+    PKE_DEADLINE_ENTITY entity = &Thread->DeadlineEntity;
+
+    if (entity->Deadline <= Now ||
+        (Woken && entity->RemainingRuntime > 0 &&
+         (ULONG64)entity->RemainingRuntime * entity->RelativeDeadline > (entity->Deadline - Now) * entity->Runtime)) {
+        entity->Deadline = Now + entity->RelativeDeadline;
+        entity->RemainingRuntime = (LONG64)entity->Runtime;
+    }
+
+    if (entity->RemainingRuntime <= 0) {
+        KiDeadlineThrottle(Queue, Thread);
+    } else {
+        KiDeadlineInsert(Queue, Thread);
+    }
+}
+
+/**
+ * @brief Charge a running deadline thread against its budget
+ * @param Queue Run queue of the processor running it, locked by the caller
+ * @param Thread Running deadline thread
+ * @param Now Current time in ticks
+ * @note A thread already requeued here that has used up its budget leaves
+ *       the deadline order: it is held until its deadline, or moves to its
+ *       next budget at once if the deadline has passed. One that is not
+ *       queued is dealt with when it is readied
+ */
+static VOID
+NTAPI
+KiDeadlineCharge(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PTHREAD Thread,
+    _In_ ULONG64 Now
+)
+{
+    PKE_DEADLINE_ENTITY entity = &Thread->DeadlineEntity;
+
+    if (Now <= entity->ExecStart) {
+        return;
+    }
+
+    entity->RemainingRuntime -= (LONG64)(Now - entity->ExecStart);
+    entity->ExecStart = Now;
+
+    if (entity->RemainingRuntime > 0 || !Thread->InSchedulerQueue) {
+        return;
+    }
+
+    RemoveEntryList(&Thread->SchedulerListEntry);
+    Queue->ReadyCount--;
+
+    if (Now < entity->Deadline) {
+        KiDeadlineThrottle(Queue, Thread);
+    } else {
+        KiDeadlineReplenish(entity, Now);
+        KiDeadlineInsert(Queue, Thread);
+    }
+}
+
+/**
+ * @brief Return held deadline threads whose deadline has come to the deadline order
+ * @param Queue Run queue, locked by the caller
+ * @param Now Current time in ticks
+ */
+static VOID
+NTAPI
+KiDeadlineUnthrottle(
+    _In_ PRUN_QUEUE Queue,
+    _In_ ULONG64 Now
+)
+{
+    if (Queue->NextReplenishTime == 0 || Now < Queue->NextReplenishTime) {
+        return;
+    }
+
+    PLIST_ENTRY entry = Queue->DeadlineThrottled.Flink;
+    ULONG64 next_replenish = 0;
+
+    while (entry != &Queue->DeadlineThrottled) {
+        PTHREAD thread = CONTAINING_RECORD(entry, THREAD, SchedulerListEntry);
+        PKE_DEADLINE_ENTITY entity = &thread->DeadlineEntity;
+        entry = entry->Flink;
+
+        if (Now < entity->Deadline) {
+            if (next_replenish == 0 || entity->Deadline < next_replenish) {
+                next_replenish = entity->Deadline;
+            }
+            continue;
+        }
+
+        RemoveEntryList(&thread->SchedulerListEntry);
+        entity->Throttled = FALSE;
+        KiDeadlineReplenish(entity, Now);
+        KiDeadlineInsert(Queue, thread);
+    }
+
+    Queue->NextReplenishTime = next_replenish;
+}
+
+/**
+ * @brief Get the processors dispatching from a run queue
+ * @return Processor mask of the online processors
+ */
+static ULONG64
+KiActiveProcessors(VOID)
+{
+    ULONG64 active = 0;
+
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        if (g_CpuTopology.CpuOnline[i]) {
+            active |= 1ULL << i;
+        }
+    }
+
+    return active;
+}
+
+/**
+ * @brief Get the processors sharing a topology level with a processor
+ * @param Processor Processor number
+ * @param Level Topology level, or KE_DOMAIN_COUNT for its steal domain
+ * @return Processor mask
+ */
+static ULONG64
+KiDomainMask(
+    _In_ ULONG Processor,
+    _In_ ULONG Level
+)
+{
+    PRUN_QUEUE queue = &g_RunQueues[Processor];
+    return (Level < KE_DOMAIN_COUNT) ? queue->DomainMasks[Level] : queue->StealDomainMask;
+}
+
+/**
+ * @brief Get the number of ready threads on a processor's queue
+ * @param Processor Processor number
+ * @return Ready thread count
+ */
+static ULONG
+KiReadyCount(
+    _In_ ULONG Processor
+)
+{
+    return g_RunQueues[Processor].ReadyCount;
+}
+
+/**
+ * @brief Get the number of ready threads another processor could take
+ * @param Processor Processor number
+ * @return Migratable feedback-queue thread count
+ */
+static ULONG
+KiMigratableCount(
+    _In_ ULONG Processor
+)
+{
+    return g_RunQueues[Processor].MigratableCount;
+}
+
+/**
+ * @brief Get a processor's run queue lock
+ * @param Processor Processor number
+ * @return Queue lock
+ */
+static PKSPIN_LOCK
+KiQueueLock(
+    _In_ ULONG Processor
+)
+{
+    return &g_RunQueues[Processor].Lock;
+}
+
+/**
+ * @brief Get a processor's tick mode
+ * @param Processor Processor number
+ * @return Tick mode, guarded by the queue lock
+ */
+static KE_TICK_MODE*
+KiTickMode(
+    _In_ ULONG Processor
+)
+{
+    return &g_RunQueues[Processor].TickMode;
+}
+
+/**
+ * @brief Get a processor's work stealing counters
+ * @param Processor Processor number
+ * @return Migration statistics
+ */
+static PKE_MIGRATION_STATISTICS
+KiMigration(
+    _In_ ULONG Processor
+)
+{
+    return &g_RunQueues[Processor].Migration;
+}
+
+/**
+ * @brief Get the processor whose queue holds a ready thread
+ * @param Thread Thread
+ * @return Processor number, or MAXULONG if the thread is not queued
+ */
+static ULONG
+KiThreadQueue(
+    _In_ PVOID Thread
+)
+{
+    PTHREAD thread = (PTHREAD)Thread;
+    return thread->InSchedulerQueue ? thread->LastProcessor : MAXULONG;
+}
+
+/**
+ * @brief Pick the run queue a readied thread joins
+ * @param Thread Thread being readied
+ * @return Processor whose queue receives the thread
+ * @note Prefers the thread's last processor while the affinity mask allows
+ *       it. If that processor is busy, an idle core sharing its last-level
+ *       cache runs the thread sooner with the cache still warm. Otherwise
+ *       takes the least loaded allowed processor. Queue state is read
+ *       without locks as a hint
+ */
+static ULONG
+NTAPI
+KiSelectRunQueue(
+    _In_ PTHREAD Thread
+)
+{
+    ULONG64 allowed = Thread->Affinity;
+
+    // A deadline thread runs where its bandwidth was admitted
+    if (Thread->DeadlineEntity.Runtime != 0) {
+        return Thread->DeadlineEntity.Processor;
+    }
+
+    if (Thread->LastProcessor < g_CpuTopology.CpuCount &&
+        g_CpuTopology.CpuOnline[Thread->LastProcessor] &&
+        (allowed == 0 || (allowed & (1ULL << Thread->LastProcessor)))) {
+        ULONG last = Thread->LastProcessor;
+
+        if (!KiIsProcessorIdle(&g_KiRunQueueOperations, last)) {
+            ULONG64 cache = g_RunQueues[last].DomainMasks[KE_DOMAIN_LLC];
+            ULONG idle = KiFindIdleProcessor(&g_KiRunQueueOperations, allowed == 0 ? cache : (cache & allowed));
+            if (idle != MAXULONG) {
+                return idle;
+            }
+        }
+        return last;
+    }
+
+    ULONG best_cpu = KeGetCurrentProcessorNumber();
+    ULONG best_count = MAXULONG;
+
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        if (!g_CpuTopology.CpuOnline[i] || (allowed != 0 && !(allowed & (1ULL << i)))) {
+            continue;
+        }
+        if (g_RunQueues[i].ReadyCount < best_count) {
+            best_count = g_RunQueues[i].ReadyCount;
+            best_cpu = i;
+        }
+    }
+
+    return best_cpu;
+}
+
+/**
+ * @brief Lock the run queue a queued thread sits on
+ * @param Thread Thread to look up
+ * @param OldIrql Receives the IRQL to restore
+ * @return Locked queue, or NULL if the thread is not queued
+ */
+static PRUN_QUEUE
+NTAPI
+KiLockThreadRunQueue(
+    _In_ PTHREAD Thread,
+    _Out_ PKIRQL OldIrql
+)
+{
+    ULONG processor = KiLockThreadQueue(&g_KiRunQueueOperations, Thread, OldIrql);
+    return (processor != MAXULONG) ? &g_RunQueues[processor] : NULL;
+}
+
+/**
+ * @brief Prepare a new thread for the scheduler
+ * @param Thread Thread being created
+ * @return NTSTATUS Status code
+ * @note Called once when the thread is created, before its first
+ *       KeAddThreadToScheduler. A zeroed thread would claim processor 0 as
+ *       its last processor and pile new threads there, so it is marked as
+ *       never having run and its first placement goes to the least loaded
+ *       processor
+ */
+NTSTATUS
+NTAPI
+KeInitializeSchedulerThread(
+    _In_ PTHREAD Thread
+)
+{
+    if (!Thread) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Thread->LastProcessor = MAXULONG;
+    Thread->InSchedulerQueue = FALSE;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Add thread to scheduler
+ * @param Thread Thread to add
+ * @return NTSTATUS Status code
+ * @note Only the target processor's queue is locked. A thread placed on
+ *       another processor that should preempt its current thread raises a
+ *       reschedule interrupt there
+ */
+NTSTATUS
+NTAPI
+KeAddThreadToScheduler(
+    _In_ PTHREAD Thread
+)
+{
+    if (!g_AdvancedSchedulerInitialized || !Thread) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ULONG current_cpu = KeGetCurrentProcessorNumber();
+    ULONG target_cpu = KiSelectRunQueue(Thread);
+    ULONG level = KiThreadQueueLevel(Thread);
+    PRUN_QUEUE queue = &g_RunQueues[target_cpu];
+    BOOLEAN send_ipi = FALSE;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&queue->Lock, &old_irql);
+
+    // Set thread state to ready; a running thread is being preempted
+    BOOLEAN woken = (Thread->State != THREAD_STATE_RUNNING);
+    Thread->State = THREAD_STATE_READY;
+    Thread->ReadyTime = KeQueryTimeTicks();
+
+    // Add to appropriate queue based on priority and type
+    if (level == SCHEDULER_DEADLINE_LEVEL) {
+        // Deadline thread - in deadline order, or held if out of budget
+        KiDeadlineEnqueue(queue, Thread, Thread->ReadyTime, woken);
+    } else if (level == SCHEDULER_REAL_TIME_LEVEL) {
+        // Real-time thread
+        InsertTailList(&queue->RealTimeQueueHead, &Thread->SchedulerListEntry);
+        queue->RealTimeQueueLength++;
+        queue->ReadyCount++;
+    } else {
+        // Regular thread - add to priority queue and the fair tree
+        KiEnqueuePriorityThread(queue, Thread, level);
+        KiFairRenormalize(Thread, queue);
+        KiFairEnqueue(queue, Thread);
+        queue->ReadyCount++;
+    }
+
+    Thread->LastProcessor = target_cpu;
+    Thread->InSchedulerQueue = TRUE;
+    KiRestorePeriodicTick(&queue->TickMode, queue->Processor);
+
+    if (target_cpu != current_cpu) {
+        queue->RemoteEnqueues++;
+
+        // Deadline and real-time threads, and anything landing on an idle
+        // processor, should not wait for the target's next tick
+        if (!queue->ReschedulePending &&
+            (level >= SCHEDULER_REAL_TIME_LEVEL || g_CpuTopology.CpuLoad[target_cpu] == 0)) {
+            queue->ReschedulePending = TRUE;
+            send_ipi = TRUE;
+        }
+    }
+
+    KeReleaseSpinLock(&queue->Lock, old_irql);
+
+    if (send_ipi) {
+        HalSendInterProcessorInterrupt(target_cpu, HAL_RESCHEDULE_VECTOR);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Remove thread from scheduler
+ * @param Thread Thread to remove
+ * @return NTSTATUS Status code
+ * @note A deadline thread leaves the deadline class and its admitted
+ *       bandwidth is released; it must set its deadline again if it is
+ *       added back
+ */
+NTSTATUS
+NTAPI
+KeRemoveThreadFromScheduler(
+    _In_ PTHREAD Thread
+)
+{
+    if (!g_AdvancedSchedulerInitialized || !Thread) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KIRQL old_irql;
+    PRUN_QUEUE queue = KiLockThreadRunQueue(Thread, &old_irql);
+    if (queue != NULL) {
+        KiDequeueThread(queue, &Thread->SchedulerListEntry, KiThreadQueueLevel(Thread));
+        KeReleaseSpinLock(&queue->Lock, old_irql);
+    }
+
+    // Give back the processor time admitted for a deadline thread
+    if (Thread->DeadlineEntity.Runtime != 0) {
+        return KeSetThreadDeadline(Thread, 0, 0, 0);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Schedule next thread
+ * @return PTHREAD Next thread to run
+ * @note Takes the current processor's run queue lock, and a sibling's only
+ *       when balancing or an otherwise idle pick finds a thread to steal
+ */
+PTHREAD
+NTAPI
+KeScheduleNextThread(VOID)
+{
+    if (!g_AdvancedSchedulerInitialized || !g_SchedulerRunning) {
+        return NULL;
+    }
+
+    PRUN_QUEUE queue = &g_RunQueues[KeGetCurrentProcessorNumber()];
+    PTHREAD current_thread = KeGetCurrentThread();
+
+    // Perform load balancing if needed; it takes its own locks
+    KiBalanceLoad(queue);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&queue->Lock, &old_irql);
+
+    queue->ReschedulePending = FALSE;
+
+    // Charge the outgoing thread's virtual runtime or deadline budget
+    // before any pick. If it was already requeued here it is rekeyed; on
+    // another queue it is left
+    ULONG64 now = KeQueryTimeTicks();
+    if (current_thread && current_thread != queue->IdleThread) {
+        ULONG level = KiThreadQueueLevel(current_thread);
+        BOOLEAN queued_here = current_thread->InSchedulerQueue &&
+                              current_thread->LastProcessor == queue->Processor;
+
+        if (level == SCHEDULER_DEADLINE_LEVEL) {
+            if (!current_thread->InSchedulerQueue || queued_here) {
+                KiDeadlineCharge(queue, current_thread, now);
+            }
+        } else if (level < SCHEDULER_PRIORITY_LEVELS) {
+            if (!current_thread->FairEntity.OnTree || queued_here) {
+                KiFairCharge(queue, current_thread, now);
+            }
+        }
+    }
+
+    // Deadline threads and groups held here may have refilled
+    KiDeadlineUnthrottle(queue, now);
+    KiUnthrottleGroups(queue, now);
+
+    // Update scheduler statistics
+    KiUpdateSchedulerStatistics(queue);
+
+    // Handle aging to prevent starvation
+    KiAgeThreads(queue);
+
+    // Select next thread
+    PTHREAD next_thread = KiSelectNextThread(queue);
+
+    KeReleaseSpinLock(&queue->Lock, old_irql);
+
+    // About to idle: take work from the busiest sibling instead
+    if (next_thread == queue->IdleThread && g_LoadBalancer.Enabled) {
+        PTHREAD stolen = KiStealThread(&g_KiRunQueueOperations, queue->Processor, 1, FALSE);
+        if (stolen) {
+            next_thread = stolen;
+        }
+    }
+
+    if (next_thread) {
+        KiUpdateTickMode(&g_KiRunQueueOperations, queue->Processor, KiSelectTickMode(queue, next_thread));
+    }
+
+    // Update statistics
+    queue->Stats.TotalSchedules++;
+    if (next_thread) {
+        next_thread->State = THREAD_STATE_RUNNING;
+    }
+    if (next_thread && next_thread != current_thread) {
+        queue->Stats.ContextSwitches++;
+        next_thread->FairEntity.ExecStart = now;
+        next_thread->DeadlineEntity.ExecStart = now;
+
+        // Remember when it left, for the cache-hot check of work stealing
+        if (current_thread) {
+            current_thread->LastRunTime = now;
+        }
+    }
+
+    return next_thread;
+}
+
+/**
+ * @brief Take a thread off a run queue
+ * @param Queue Run queue, locked by the caller
+ * @param Entry Scheduler list entry of the thread
+ * @param Level Feedback queue level, SCHEDULER_REAL_TIME_LEVEL or SCHEDULER_DEADLINE_LEVEL
+ * @return PTHREAD The thread
+ * @note A held deadline thread is taken off the throttled list instead
+ */
+static PTHREAD
+NTAPI
+KiDequeueThread(
+    _In_ PRUN_QUEUE Queue,
+    _In_ PLIST_ENTRY Entry,
+    _In_ ULONG Level
+)
+{
+    PTHREAD thread = CONTAINING_RECORD(Entry, THREAD, SchedulerListEntry);
+
+    if (Level == SCHEDULER_DEADLINE_LEVEL) {
+        RemoveEntryList(Entry);
+        if (thread->DeadlineEntity.Throttled) {
+            thread->DeadlineEntity.Throttled = FALSE;
+        } else {
+            Queue->ReadyCount--;
+        }
+    } else if (Level == SCHEDULER_REAL_TIME_LEVEL) {
+        RemoveEntryList(Entry);
+        Queue->RealTimeQueueLength--;
+        Queue->ReadyCount--;
+    } else {
+        KiUnlinkPriorityThread(Queue, Entry, Level);
+        KiFairDequeue(thread);
+        Queue->ReadyCount--;
+    }
+    thread->InSchedulerQueue = FALSE;
+
+    return thread;
+}
+
+/**
+ * @brief Take the best ready thread off a sibling's queue for a thief
+ * @param Victim Processor to take from
+ * @param Thief Processor taking it
+ * @param Enqueue TRUE to queue the thread on the thief, FALSE to hand it back to run now
+ * @return PTHREAD Thread taken, or NULL
+ * @note Called by KiStealThread with both queues locked. Highest level
+ *       first, longest waiter first within a level; threads not allowed on
+ *       the thief, or that ran in the last SCHEDULER_CACHE_HOT_TICKS, are
+ *       skipped. Real-time threads are never stolen; they are placed with
+ *       an IPI instead
+ */
+static PVOID
+KiTakeReadyThread(
+    _In_ ULONG Victim,
+    _In_ ULONG Thief,
+    _In_ BOOLEAN Enqueue
+)
+{
+    PRUN_QUEUE victim = &g_RunQueues[Victim];
+    PRUN_QUEUE thief = &g_RunQueues[Thief];
+    PKE_MIGRATION_STATISTICS counters = &thief->Migration;
+    ULONG64 thief_bit = 1ULL << Thief;
+    ULONG64 now = KeQueryTimeTicks();
+    PTHREAD stolen = NULL;
+    ULONG stolen_level = 0;
+    ULONG summary = victim->ReadySummary;
+    ULONG scanned = 0;
+
+    while (summary != 0 && !stolen && scanned < SCHEDULER_STEAL_SCAN_LIMIT) {
+        ULONG level = KiFindHighestSetBit(summary);
+        PLIST_ENTRY head = &victim->PriorityQueues[level].QueueHead;
+
+        summary &= ~(1UL << level);
+
+        for (PLIST_ENTRY entry = head->Flink; entry != head && scanned < SCHEDULER_STEAL_SCAN_LIMIT;
+             entry = entry->Flink) {
+            PTHREAD thread = CONTAINING_RECORD(entry, THREAD, SchedulerListEntry);
+            scanned++;
+
+            if (thread->Affinity != 0 && !(thread->Affinity & thief_bit)) {
+                counters->AffinitySkips++;
+                continue;
+            }
+            if (now - thread->LastRunTime < SCHEDULER_CACHE_HOT_TICKS) {
+                counters->CacheHotSkips++;
+                continue;
+            }
+
+            stolen = thread;
+            stolen_level = level;
+            break;
+        }
+    }
+
+    if (stolen) {
+        KiDequeueThread(victim, &stolen->SchedulerListEntry, stolen_level);
+        KiFairRenormalize(stolen, thief);
+        if (Enqueue) {
+            KiEnqueuePriorityThread(thief, stolen, stolen_level);
+            KiFairEnqueue(thief, stolen);
+            thief->ReadyCount++;
+            stolen->InSchedulerQueue = TRUE;
+            stolen->State = THREAD_STATE_READY;
+            KiRestorePeriodicTick(&thief->TickMode, Thief);
+        } else {
+            stolen->State = THREAD_STATE_RUNNING;
+        }
+        stolen->LastProcessor = Thief;
+    }
+
+    return stolen;
+}
+
+/**
+ * @brief Select next thread to run
+ * @param Queue Current processor's run queue, locked by the caller
+ * @return PTHREAD Selected thread
+ */
+static PTHREAD
+NTAPI
+KiSelectNextThread(
+    _In_ PRUN_QUEUE Queue
+)
+{
+    PTHREAD current_thread = KeGetCurrentThread();
+    PTHREAD next_thread = NULL;
+
+    // Earliest deadline first, ahead of every other class
+    if (!IsListEmpty(&Queue->DeadlineQueueHead)) {
+        return KiDequeueThread(Queue, Queue->DeadlineQueueHead.Flink, SCHEDULER_DEADLINE_LEVEL);
+    }
+
+    // Then the real-time queue
+    if (!IsListEmpty(&Queue->RealTimeQueueHead)) {
+        return KiDequeueThread(Queue, Queue->RealTimeQueueHead.Flink, SCHEDULER_REAL_TIME_LEVEL);
+    }
+
+    // Group quotas only hold while picks go through the fair class: the
+    // priority lists still hold the threads of throttled groups. So while
+    // any group is limited, it overrides the configured algorithm
+    if (g_BandwidthGroupCount != 0) {
+        next_thread = KiSelectNextThreadFairShare(Queue);
+    } else {
+        // Select based on current algorithm
+        switch (g_CurrentAlgorithm) {
+            case SCHED_ALGORITHM_ROUND_ROBIN:
+                next_thread = KiSelectNextThreadRoundRobin(Queue);
+                break;
+
+            case SCHED_ALGORITHM_PRIORITY:
+                next_thread = KiSelectNextThreadPriority(Queue);
+                break;
+
+            case SCHED_ALGORITHM_FAIR_SHARE:
+                next_thread = KiSelectNextThreadFairShare(Queue);
+                break;
+
+            case SCHED_ALGORITHM_LOAD_BALANCING:
+                next_thread = KiSelectNextThreadLoadBalanced(Queue);
+                break;
+
+            case SCHED_ALGORITHM_ADAPTIVE:
+            default:
+                next_thread = KiSelectNextThreadAdaptive(Queue);
+                break;
+        }
+    }
+
+    // If no thread found, use idle thread
+    if (!next_thread) {
+        next_thread = Queue->IdleThread;
+    }
+
+    // Check if we should preempt current thread
+    if (current_thread && next_thread && current_thread != next_thread) {
+        if (KiShouldPreempt(current_thread, next_thread)) {
+            return next_thread;
+        }
+    }
+
+    return next_thread;
+}
+
+/**
+ * @brief Select next thread using round-robin algorithm
+ * @param Queue Run queue, locked by the caller
+ * @return PTHREAD Selected thread
+ */
+static PTHREAD
+NTAPI
+KiSelectNextThreadRoundRobin(
+    _In_ PRUN_QUEUE Queue
+)
+{
+    // Simple round-robin through priority queues, lowest non-empty level first
+    if (Queue->ReadySummary == 0) {
+        return NULL;
+    }
+
+    ULONG level = KiFindLowestSetBit(Queue->ReadySummary);
+    return KiDequeueThread(Queue, Queue->PriorityQueues[level].QueueHead.Flink, level);
+}
+
+/**
+ * @brief Select next thread using priority algorithm
+ * @param Queue Run queue, locked by the caller
+ * @return PTHREAD Selected thread
+ */
+static PTHREAD
+NTAPI
+KiSelectNextThreadPriority(
+    _In_ PRUN_QUEUE Queue
+)
+{
+    // Always pick highest priority thread; one bit scan finds its level
+    if (Queue->ReadySummary == 0) {
+        return NULL;
+    }
+
+    ULONG level = KiFindHighestSetBit(Queue->ReadySummary);
+    return KiDequeueThread(Queue, Queue->PriorityQueues[level].QueueHead.Flink, level);
+}
+
+/**
+ * @brief Select next thread using fair share algorithm
+ * @param Queue Run queue, locked by the caller
+ * @return PTHREAD Selected thread
+ * @note Takes the leftmost entity at each level: the group that has had
+ *       the least weighted processor time, then its member that has had the
+ *       least, down to a thread. Throttled groups are not on any tree
+ */
+static PTHREAD
+NTAPI
+KiSelectNextThreadFairShare(
+    _In_ PRUN_QUEUE Queue
+)
+{
+    PKE_SCHED_ENTITY entity = Queue->FairTree.Leftmost;
+
+    while (entity && entity->Children) {
+        entity = entity->Children->Leftmost;
+    }
+
+    if (!entity) {
+        return NULL;
+    }
+
+    PTHREAD thread = CONTAINING_RECORD(entity, THREAD, FairEntity);
+    return KiDequeueThread(Queue, &thread->SchedulerListEntry, KiPriorityLevel(thread));
+}
+
+/**
+ * @brief Select next thread using load balancing algorithm
+ * @param Queue Run queue, locked by the caller
+ * @return PTHREAD Selected thread
+ * @note Every thread on a processor's queue may already run there, so the
+ *       pick is by priority; spreading work is left to KiBalanceLoad
+ */
+static PTHREAD
+NTAPI
+KiSelectNextThreadLoadBalanced(
+    _In_ PRUN_QUEUE Queue
+)
+{
+    return KiSelectNextThreadPriority(Queue);
+}
+
+/**
+ * @brief Select next thread using adaptive algorithm
+ * @param Queue Run queue, locked by the caller
+ * @return PTHREAD Selected thread
+ */
+static PTHREAD
+NTAPI
+KiSelectNextThreadAdaptive(
+    _In_ PRUN_QUEUE Queue
+)
+{
+    ULONG total_load = 0;
+
+    // Calculate total system load
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        if (g_CpuTopology.CpuOnline[i]) {
+            total_load += g_CpuTopology.CpuLoad[i];
+        }
+    }
+
+    // Adapt algorithm based on system load
+    if (total_load > 80) {
+        // High load - use load balancing
+        g_CurrentAlgorithm = SCHED_ALGORITHM_LOAD_BALANCING;
+        return KiSelectNextThreadLoadBalanced(Queue);
+    } else if (total_load < 20) {
+        // Low load - use priority for responsiveness
+        g_CurrentAlgorithm = SCHED_ALGORITHM_PRIORITY;
+        return KiSelectNextThreadPriority(Queue);
+    } else {
+        // Medium load - use fair share
+        g_CurrentAlgorithm = SCHED_ALGORITHM_FAIR_SHARE;
+        return KiSelectNextThreadFairShare(Queue);
+    }
+}
+
+/**
+ * @brief Check if should preempt current thread
+ * @param CurrentThread Current running thread
+ * @param NewThread New thread to run
+ * @return BOOLEAN TRUE if should preempt
+ */
+static BOOLEAN
+NTAPI
+KiShouldPreempt(
+    _In_ PTHREAD CurrentThread,
+    _In_ PTHREAD NewThread
+)
+{
+    if (!CurrentThread || !NewThread) {
+        return TRUE;
+    }
+
+    // Deadline threads preempt every other class
+    if (NewThread->DeadlineEntity.Runtime != 0 && CurrentThread->DeadlineEntity.Runtime == 0) {
+        return TRUE;
+    }
+
+    // Real-time threads always preempt
+    if (NewThread->Priority >= THREAD_PRIORITY_REAL_TIME &&
+        CurrentThread->Priority < THREAD_PRIORITY_REAL_TIME) {
+        return TRUE;
+    }
+
+    // Higher priority threads preempt
+    if (NewThread->Priority > CurrentThread->Priority + 2) {
         return TRUE;
     }
 
@@ -656,40 +2176,39 @@ KiUpdateThreadPriority(
 
 /**
  * @brief Age threads to prevent starvation
+ * @param Queue Run queue, locked by the caller
  */
 static VOID
 NTAPI
-KiAgeThreads(VOID)
+KiAgeThreads(
+    _In_ PRUN_QUEUE Queue
+)
 {
     ULONG64 current_time = KeQueryTimeTicks();
 
-    for (ULONG i = 1; i < SCHEDULER_PRIORITY_LEVELS; i++) {  // Skip highest priority
-        PLIST_ENTRY entry = g_PriorityQueues[i].QueueHead.Flink;
+    for (ULONG i = 0; i < SCHEDULER_PRIORITY_LEVELS - 1; i++) {  // Skip highest priority
+        PLIST_ENTRY entry = Queue->PriorityQueues[i].QueueHead.Flink;
 
-        while (entry != &g_PriorityQueues[i].QueueHead) {
+        while (entry != &Queue->PriorityQueues[i].QueueHead) {
             PTHREAD thread = CONTAINING_RECORD(entry, THREAD, SchedulerListEntry);
             PLIST_ENTRY next_entry = entry->Flink;
 
-            // Check if thread has been waiting too long
-            if (current_time - thread->ReadyTime > 10000) {  // 10 seconds
-                // Boost priority
-                RemoveEntryList(entry);
-                g_PriorityQueues[i].QueueLength--;
+            // Levels are filled at the tail, so the first thread that has
+            // not waited too long ends the scan of its level
+            if (current_time - thread->ReadyTime <= 10000) {
+                break;
+            }
 
-                thread->Priority = min(thread->Priority + THREAD_PRIORITY_INCREMENT,
-                                      THREAD_PRIORITY_HIGHEST);
+            // Thread has been waiting too long: boost priority
+            KiUnlinkPriorityThread(Queue, entry, i);
 
-                // Add to higher priority queue
-                ULONG new_level = thread->Priority / THREAD_PRIORITY_INCREMENT;
-                if (new_level >= SCHEDULER_PRIORITY_LEVELS) {
-                    new_level = SCHEDULER_PRIORITY_LEVELS - 1;
-                }
+            thread->Priority = min(thread->Priority + THREAD_PRIORITY_INCREMENT,
+                                  THREAD_PRIORITY_HIGHEST);
 
-                InsertTailList(&g_PriorityQueues[new_level].QueueHead, entry);
-                g_PriorityQueues[new_level].QueueLength++;
+            // Add to higher priority queue
+            KiEnqueuePriorityThread(Queue, thread, KiPriorityLevel(thread));
 
-                g_SchedulerStats.StarvationCount++;
-            }
+            Queue->Stats.StarvationCount++;
 
             entry = next_entry;
         }
@@ -698,48 +2217,67 @@ KiAgeThreads(VOID)
 
 /**
  * @brief Update scheduler statistics
+ * @param Queue Run queue, locked by the caller
  */
 static VOID
 NTAPI
-KiUpdateSchedulerStatistics(VOID)
+KiUpdateSchedulerStatistics(
+    _In_ PRUN_QUEUE Queue
+)
 {
-    ULONG total_ready = 0;
-    ULONG64 total_wait_time = 0;
-    ULONG waiting_count = 0;
-
-    // Count ready threads
-    for (ULONG i = 0; i < SCHEDULER_PRIORITY_LEVELS; i++) {
-        total_ready += g_PriorityQueues[i].QueueLength;
-    }
-    total_ready += g_RealTimeQueueLength;
-
-    g_SchedulerStats.ReadyQueueLength = total_ready;
+    // Runs on every pick, so both figures come from running totals rather
+    // than a walk of the queues
+    Queue->Stats.ReadyQueueLength = Queue->ReadyCount;
 
     // Calculate average wait time
     ULONG64 current_time = KeQueryTimeTicks();
+    ULONG waiting_count = Queue->FairTree.Count;
 
-    for (ULONG i = 0; i < SCHEDULER_PRIORITY_LEVELS; i++) {
-        PLIST_ENTRY entry = g_PriorityQueues[i].QueueHead.Flink;
+    if (waiting_count > 0) {
+        Queue->Stats.AverageWaitTime = current_time - Queue->ReadyTimeSum / waiting_count;
+    }
+}
 
-        while (entry != &g_PriorityQueues[i].QueueHead) {
-            PTHREAD thread = CONTAINING_RECORD(entry, THREAD, SchedulerListEntry);
-            total_wait_time += (current_time - thread->ReadyTime);
-            waiting_count++;
-            entry = entry->Flink;
-        }
+/**
+ * @brief Mark a reschedule pending on an idle processor
+ * @param Processor Processor to wake
+ * @return TRUE if it was idle and the caller should send the interrupt
+ */
+static BOOLEAN
+KiClaimIdleProcessor(
+    _In_ ULONG Processor
+)
+{
+    PRUN_QUEUE idle = &g_RunQueues[Processor];
+    BOOLEAN claimed = FALSE;
+
+    if (idle->TickMode != KE_TICK_STOPPED || idle->ReschedulePending) {
+        return FALSE;
     }
 
-    if (waiting_count > 0) {
-        g_SchedulerStats.AverageWaitTime = total_wait_time / waiting_count;
+    KIRQL old_irql;
+    KeAcquireSpinLock(&idle->Lock, &old_irql);
+    if (idle->TickMode == KE_TICK_STOPPED && !idle->ReschedulePending) {
+        idle->ReschedulePending = TRUE;
+        claimed = TRUE;
     }
+    KeReleaseSpinLock(&idle->Lock, old_irql);
+
+    return claimed;
 }
 
 /**
  * @brief Balance load across CPUs
+ * @param Queue Current processor's run queue, not locked by the caller
+ * @note Pulls one thread here when the busiest sibling's queue is longer by
+ *       at least two. Idle processors steal from KeScheduleNextThread, and
+ *       are woken to do so when threads wait here
  */
 static VOID
 NTAPI
-KiBalanceLoad(VOID)
+KiBalanceLoad(
+    _In_ PRUN_QUEUE Queue
+)
 {
     if (!g_LoadBalancer.Enabled) {
         return;
@@ -748,94 +2286,100 @@ KiBalanceLoad(VOID)
     ULONG64 current_time = KeQueryTimeTicks();
 
     // Check if it's time to balance
-    if (current_time - g_LoadBalancer.LastBalanceTime < g_LoadBalancer.BalanceInterval) {
+    if (current_time - Queue->LastBalanceTime < g_LoadBalancer.BalanceInterval) {
         return;
     }
 
-    // Find most and least loaded CPUs
-    ULONG max_load = 0;
-    ULONG min_load = 100;
-    ULONG max_cpu = 0;
-    ULONG min_cpu = 0;
+    Queue->LastBalanceTime = current_time;
 
-    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
-        if (g_CpuTopology.CpuOnline[i]) {
-            if (g_CpuTopology.CpuLoad[i] > max_load) {
-                max_load = g_CpuTopology.CpuLoad[i];
-                max_cpu = i;
-            }
-            if (g_CpuTopology.CpuLoad[i] < min_load) {
-                min_load = g_CpuTopology.CpuLoad[i];
-                min_cpu = i;
-            }
-        }
+    if (KiStealThread(&g_KiRunQueueOperations, Queue->Processor, Queue->ReadyCount + 2, TRUE)) {
+        Queue->Stats.LoadBalanceOperations++;
     }
 
-    // Balance if difference is significant
-    if (max_load - min_load > g_LoadBalancer.BalanceThreshold) {
-        // Move threads from max_cpu to min_cpu
-        // This is a simplified implementation
-        // In a real system, we would migrate actual threads
-
-        g_SchedulerStats.LoadBalanceOperations++;
+    if (Queue->ReadyCount >= 2 && Queue->MigratableCount != 0) {
+        KiKickIdleProcessor(&g_KiRunQueueOperations, Queue->Processor);
     }
-
-    g_LoadBalancer.LastBalanceTime = current_time;
 }
 
 /**
- * @brief Calculate fair share for groups
+ * @brief Get scheduler statistics
+ * @param Stats Pointer to receive statistics
+ * @return NTSTATUS Status code
+ * @note Sums the per-processor counters without stopping dispatch, so the
+ *       figures are a snapshot
  */
-static VOID
+NTSTATUS
 NTAPI
-KiCalculateFairShare(VOID)
+KeGetSchedulerStatistics(
+    _Out_ PSCHEDULER_STATS Stats
+)
 {
-    if (IsListEmpty(&g_FairShareGroups)) {
-        return;
+    if (!g_AdvancedSchedulerInitialized || !Stats) {
+        return STATUS_INVALID_PARAMETER;
     }
 
-    // Calculate total weight
-    ULONG total_weight = 0;
-    PLIST_ENTRY entry = g_FairShareGroups.Flink;
+    RtlZeroMemory(Stats, sizeof(SCHEDULER_STATS));
 
-    while (entry != &g_FairShareGroups) {
-        FAIR_SHARE_GROUP* group = CONTAINING_RECORD(entry, FAIR_SHARE_GROUP, GroupList);
-        total_weight += group->GroupWeight;
-        entry = entry->Flink;
-    }
+    ULONG64 wait_time_sum = 0;
+    ULONG busy_queues = 0;
 
-    // Set quotas based on weights
-    ULONG64 total_cpu_time = 100;  // 100% CPU
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        PSCHEDULER_STATS counters = &g_RunQueues[i].Stats;
 
-    entry = g_FairShareGroups.Flink;
-    while (entry != &g_FairShareGroups) {
-        FAIR_SHARE_GROUP* group = CONTAINING_RECORD(entry, FAIR_SHARE_GROUP, GroupList);
-        group->CpuTimeQuota = (total_cpu_time * group->GroupWeight) / total_weight;
-        entry = entry->Flink;
+        Stats->TotalSchedules += counters->TotalSchedules;
+        Stats->ContextSwitches += counters->ContextSwitches;
+        Stats->ReadyQueueLength += counters->ReadyQueueLength;
+        Stats->StarvationCount += counters->StarvationCount;
+        Stats->LoadBalanceOperations += counters->LoadBalanceOperations;
+
+        if (counters->AverageWaitTime != 0) {
+            wait_time_sum += counters->AverageWaitTime;
+            busy_queues++;
+        }
+    }
+
+    if (busy_queues > 0) {
+        Stats->AverageWaitTime = wait_time_sum / busy_queues;
     }
+
+    return STATUS_SUCCESS;
 }
 
 /**
- * @brief Get scheduler statistics
- * @param Stats Pointer to receive statistics
+ * @brief Get work stealing counters
+ * @param CpuId Processor to report, or KE_ALL_PROCESSORS for the sum
+ * @param Stats Pointer to receive the counters
  * @return NTSTATUS Status code
  */
 NTSTATUS
 NTAPI
-KeGetSchedulerStatistics(
-    _Out_ PSCHEDULER_STATS Stats
+KeGetMigrationStatistics(
+    _In_ ULONG CpuId,
+    _Out_ PKE_MIGRATION_STATISTICS Stats
 )
 {
-    if (!g_AdvancedSchedulerInitialized || !Stats) {
+    if (!g_AdvancedSchedulerInitialized || !Stats ||
+        (CpuId != KE_ALL_PROCESSORS && CpuId >= g_CpuTopology.CpuCount)) {
         return STATUS_INVALID_PARAMETER;
     }
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_SchedulerLock, &old_irql);
+    RtlZeroMemory(Stats, sizeof(KE_MIGRATION_STATISTICS));
+
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        if (CpuId != KE_ALL_PROCESSORS && CpuId != i) {
+            continue;
+        }
 
-    RtlCopyMemory(Stats, &g_SchedulerStats, sizeof(SCHEDULER_STATS));
+        PKE_MIGRATION_STATISTICS counters = &g_RunQueues[i].Migration;
 
-    KeReleaseSpinLock(&g_SchedulerLock, old_irql);
+        Stats->StealAttempts += counters->StealAttempts;
+        Stats->StealsWithoutCandidate += counters->StealsWithoutCandidate;
+        Stats->StealFailures += counters->StealFailures;
+        Stats->Migrations += counters->Migrations;
+        Stats->AffinitySkips += counters->AffinitySkips;
+        Stats->CacheHotSkips += counters->CacheHotSkips;
+        Stats->MigrationTicks += counters->MigrationTicks;
+    }
 
     return STATUS_SUCCESS;
 }
@@ -866,48 +2410,101 @@ KeSetSchedulerAlgorithm(
 }
 
 /**
- * @brief Create fair share group
+ * @brief Create fair share group inside another
+ * @param ParentGroupId Enclosing group, or 0 for a top-level group
  * @param GroupName Name of the group
- * @param Weight Group weight
+ * @param Weight Share relative to its siblings; KE_SCHED_NOMINAL_WEIGHT is one
  * @param GroupId Pointer to receive group ID
  * @return NTSTATUS Status code
+ * @note A group competes only with its siblings for what its parent is
+ *       given, so a container's services split the container's share and
+ *       their threads split each service's
  */
 NTSTATUS
 NTAPI
-KeCreateFairShareGroup(
+KeCreateNestedFairShareGroup(
+    _In_ GROUP_ID ParentGroupId,
     _In_ PCWSTR GroupName,
     _In_ ULONG Weight,
     _Out_ PGROUP_ID GroupId
 )
 {
-    if (!g_AdvancedSchedulerInitialized || !GroupName || !GroupId) {
+    if (!g_AdvancedSchedulerInitialized || !GroupName || !GroupId || Weight == 0 ||
+        ParentGroupId >= SCHEDULER_MAX_FAIR_SHARE_GROUPS) {
         return STATUS_INVALID_PARAMETER;
     }
 
     FAIR_SHARE_GROUP* group = ExAllocatePoolWithTag(NonPagedPool,
         sizeof(FAIR_SHARE_GROUP), 'GldS');
+    PFAIR_GROUP_QUEUE per_cpu = ExAllocatePoolWithTag(NonPagedPool,
+        g_CpuTopology.CpuCount * sizeof(FAIR_GROUP_QUEUE), 'GldS');
 
-    if (!group) {
+    if (!group || !per_cpu) {
+        if (group) {
+            ExFreePoolWithTag(group, 'GldS');
+        }
+        if (per_cpu) {
+            ExFreePoolWithTag(per_cpu, 'GldS');
+        }
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
     // Initialize group
-    group->GroupId = InterlockedIncrement((PLONG)&g_FairShareGroupCount);
+    RtlZeroMemory(group, sizeof(FAIR_SHARE_GROUP));
+    RtlZeroMemory(per_cpu, g_CpuTopology.CpuCount * sizeof(FAIR_GROUP_QUEUE));
     group->GroupWeight = Weight;
-    group->CpuTimeUsed = 0;
-    group->CpuTimeQuota = 0;
-    group->ProcessCount = 0;
+    group->CpuTimePeriod = SCHEDULER_DEFAULT_BANDWIDTH_PERIOD;
+    group->PerCpu = per_cpu;
+    KeInitializeSpinLock(&group->BandwidthLock);
 
     // Set group name
     UNICODE_STRING group_name;
     RtlInitUnicodeString(&group_name, GroupName);
     group->GroupName = group_name;
 
-    // Add to groups list
     KIRQL old_irql;
     KeAcquireSpinLock(&g_SchedulerLock, &old_irql);
 
+    FAIR_SHARE_GROUP* parent = NULL;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (ParentGroupId != 0) {
+        parent = g_FairShareGroupTable[ParentGroupId];
+        if (!parent || parent->Depth >= SCHEDULER_MAX_GROUP_DEPTH) {
+            status = STATUS_INVALID_PARAMETER;
+        }
+    }
+    if (NT_SUCCESS(status) && g_FairShareGroupCount + 1 >= SCHEDULER_MAX_FAIR_SHARE_GROUPS) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (!NT_SUCCESS(status)) {
+        KeReleaseSpinLock(&g_SchedulerLock, old_irql);
+        ExFreePoolWithTag(per_cpu, 'GldS');
+        ExFreePoolWithTag(group, 'GldS');
+        return status;
+    }
+
+    group->GroupId = ++g_FairShareGroupCount;
+    group->ParentGroup = parent;
+    group->Depth = parent ? parent->Depth + 1 : 1;
+
+    // Link the per-processor entities under the parent's, or the run queues
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        PFAIR_GROUP_QUEUE group_queue = &per_cpu[i];
+
+        group_queue->Group = group;
+        group_queue->Entity.Weight = Weight;
+        group_queue->Entity.Tree = parent ? &parent->PerCpu[i].Tree : &g_RunQueues[i].FairTree;
+        group_queue->Entity.Children = &group_queue->Tree;
+        group_queue->Tree.Owner = &group_queue->Entity;
+        InitializeListHead(&group_queue->ThrottledEntry);
+    }
+
+    // Add to groups list. Enqueue looks groups up in the table without
+    // the lock, so the group is complete before it is published there
     InsertTailList(&g_FairShareGroups, &group->GroupList);
+    g_FairShareGroupTable[group->GroupId] = group;
 
     KeReleaseSpinLock(&g_SchedulerLock, old_irql);
 
@@ -916,6 +2513,184 @@ KeCreateFairShareGroup(
     return STATUS_SUCCESS;
 }
 
+/**
+ * @brief Create fair share group
+ * @param GroupName Name of the group
+ * @param Weight Group weight
+ * @param GroupId Pointer to receive group ID
+ * @return NTSTATUS Status code
+ */
+NTSTATUS
+NTAPI
+KeCreateFairShareGroup(
+    _In_ PCWSTR GroupName,
+    _In_ ULONG Weight,
+    _Out_ PGROUP_ID GroupId
+)
+{
+    return KeCreateNestedFairShareGroup(0, GroupName, Weight, GroupId);
+}
+
+/**
+ * @brief Limit a fair share group to a quota of processor time per period
+ * @param GroupId Group to limit
+ * @param Quota Ticks of runtime per period across all processors, 0 for no limit
+ * @param Period Period length in ticks, or 0 for the default
+ * @return NTSTATUS Status code
+ * @note A group that uses its quota is throttled on each processor that
+ *       runs out, until the pool refills at the next period. Members of
+ *       nested groups are bound by every quota above them
+ */
+NTSTATUS
+NTAPI
+KeSetFairShareBandwidth(
+    _In_ GROUP_ID GroupId,
+    _In_ ULONG64 Quota,
+    _In_ ULONG64 Period
+)
+{
+    if (!g_AdvancedSchedulerInitialized || GroupId == 0 || GroupId >= SCHEDULER_MAX_FAIR_SHARE_GROUPS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    FAIR_SHARE_GROUP* group = g_FairShareGroupTable[GroupId];
+    if (!group) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Period == 0) {
+        Period = SCHEDULER_DEFAULT_BANDWIDTH_PERIOD;
+    }
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&group->BandwidthLock, &old_irql);
+
+    BOOLEAN was_limited = group->CpuTimeQuota != 0;
+
+    group->CpuTimeQuota = Quota;
+    group->CpuTimePeriod = Period;
+    group->PeriodStart = KeQueryTimeTicks();
+    group->RuntimePool = Quota;
+
+    if (!was_limited && Quota != 0) {
+        InterlockedIncrement((PLONG)&g_BandwidthGroupCount);
+    } else if (was_limited && Quota == 0) {
+        InterlockedDecrement((PLONG)&g_BandwidthGroupCount);
+    }
+
+    KeReleaseSpinLock(&group->BandwidthLock, old_irql);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Move a thread into or out of the deadline class
+ * @param Thread Thread to configure
+ * @param Runtime Ticks of processor time it needs in every period, 0 to leave the class
+ * @param Deadline Ticks into each period by which it needs them, 0 for the whole period
+ * @param Period Period length in ticks
+ * @return NTSTATUS Status code; STATUS_INSUFFICIENT_RESOURCES if no allowed
+ *         processor has the bandwidth left
+ * @note Admission is per processor. The thread is bound to the first one
+ *       its affinity allows, starting from its own, whose deadline threads'
+ *       summed Runtime / Deadline stays within
+ *       SCHEDULER_DEADLINE_BANDWIDTH_LIMIT, so EDF there meets every deadline
+ */
+NTSTATUS
+NTAPI
+KeSetThreadDeadline(
+    _In_ PTHREAD Thread,
+    _In_ ULONG64 Runtime,
+    _In_ ULONG64 Deadline,
+    _In_ ULONG64 Period
+)
+{
+    if (!g_AdvancedSchedulerInitialized || !Thread) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Deadline == 0) {
+        Deadline = Period;
+    }
+
+    if (Runtime != 0 && (Period == 0 || Runtime > Deadline || Deadline > Period)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PKE_DEADLINE_ENTITY entity = &Thread->DeadlineEntity;
+    ULONG64 bandwidth = (Runtime != 0) ? (Runtime << SCHEDULER_DEADLINE_BANDWIDTH_SHIFT) / Deadline : 0;
+    ULONG64 old_bandwidth = (entity->Runtime != 0) ?
+        (entity->Runtime << SCHEDULER_DEADLINE_BANDWIDTH_SHIFT) / entity->RelativeDeadline : 0;
+    ULONG target_cpu = entity->Processor;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_SchedulerLock, &old_irql);
+
+    // Give back the old reservation before looking for room
+    if (entity->Runtime != 0) {
+        g_RunQueues[entity->Processor].DeadlineBandwidth -= old_bandwidth;
+    }
+
+    if (Runtime != 0) {
+        ULONG first_cpu = (Thread->LastProcessor < g_CpuTopology.CpuCount) ? Thread->LastProcessor : 0;
+
+        target_cpu = MAXULONG;
+        for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+            ULONG cpu = (first_cpu + i) % g_CpuTopology.CpuCount;
+
+            if (!g_CpuTopology.CpuOnline[cpu] || (Thread->Affinity != 0 && !(Thread->Affinity & (1ULL << cpu)))) {
+                continue;
+            }
+            if (g_RunQueues[cpu].DeadlineBandwidth + bandwidth <= SCHEDULER_DEADLINE_BANDWIDTH_LIMIT) {
+                target_cpu = cpu;
+                break;
+            }
+        }
+
+        if (target_cpu == MAXULONG) {
+            if (entity->Runtime != 0) {
+                g_RunQueues[entity->Processor].DeadlineBandwidth += old_bandwidth;
+            }
+            KeReleaseSpinLock(&g_SchedulerLock, old_irql);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        g_RunQueues[target_cpu].DeadlineBandwidth += bandwidth;
+    }
+
+    KeReleaseSpinLock(&g_SchedulerLock, old_irql);
+
+    // Change the parameters under the lock of the queue holding the thread,
+    // or of the processor it last ran on, so no charge sees half of them
+    KIRQL queue_irql;
+    PRUN_QUEUE queue = KiLockThreadRunQueue(Thread, &queue_irql);
+    BOOLEAN queued = (queue != NULL);
+
+    if (queued) {
+        KiDequeueThread(queue, &Thread->SchedulerListEntry, KiThreadQueueLevel(Thread));
+    } else {
+        ULONG last_cpu = (Thread->LastProcessor < g_CpuTopology.CpuCount) ? Thread->LastProcessor : 0;
+        queue = &g_RunQueues[last_cpu];
+        KeAcquireSpinLock(&queue->Lock, &queue_irql);
+    }
+
+    // A zero deadline starts a fresh budget when the thread is next queued
+    entity->Runtime = Runtime;
+    entity->RelativeDeadline = Deadline;
+    entity->Period = Period;
+    entity->Deadline = 0;
+    entity->RemainingRuntime = 0;
+    entity->Processor = target_cpu;
+
+    KeReleaseSpinLock(&queue->Lock, queue_irql);
+
+    if (queued) {
+        return KeAddThreadToScheduler(Thread);
+    }
+
+    return STATUS_SUCCESS;
+}
+
 /**
  * @brief Set thread affinity
  * @param Thread Thread to set affinity for
@@ -933,12 +2708,25 @@ KeSetThreadAffinity(
         return STATUS_INVALID_PARAMETER;
     }
 
+    // A queued thread is requeued so the queue's migratable count follows
+    // the new mask. It stays where it is even if the mask now excludes that
+    // processor; the next wakeup places it correctly. A deadline thread
+    // keeps the processor that admitted it until its parameters are set again
     KIRQL old_irql;
-    KeAcquireSpinLock(&g_SchedulerLock, &old_irql);
+    PRUN_QUEUE queue = KiLockThreadRunQueue(Thread, &old_irql);
+    ULONG level = KiThreadQueueLevel(Thread);
 
-    Thread->Affinity = Affinity;
+    if (queue && level < SCHEDULER_PRIORITY_LEVELS) {
+        KiUnlinkPriorityThread(queue, &Thread->SchedulerListEntry, level);
+        Thread->Affinity = Affinity;
+        KiEnqueuePriorityThread(queue, Thread, level);
+    } else {
+        Thread->Affinity = Affinity;
+    }
 
-    KeReleaseSpinLock(&g_SchedulerLock, old_irql);
+    if (queue) {
+        KeReleaseSpinLock(&queue->Lock, old_irql);
+    }
 
     return STATUS_SUCCESS;
 }
@@ -964,8 +2752,10 @@ KiIdleThread(
         ULONG current_cpu = KeGetCurrentProcessorNumber();
         g_CpuTopology.CpuLoad[current_cpu] = 0;
 
-        // Yield CPU
-        KeYieldProcessor();
+        // Zero free pages ahead of demand-zero faults; yield once there is nothing left to do
+        if (MmZeroFreePages(SCHEDULER_IDLE_ZERO_PAGES) == 0) {
+            KeYieldProcessor();
+        }
     }
 
     return STATUS_SUCCESS;
@@ -1020,6 +2810,66 @@ KeUpdateCpuLoad(
     g_CpuTopology.CpuLoad[CpuId] = Load;
 }
 
+/**
+ * @brief Read processor ids from the HAL and group processors into domains
+ * @note Each level's mask includes the levels below it. Placement and
+ *       stealing read the masks without locks, as hints
+ */
+static VOID
+NTAPI
+KiBuildSchedulingDomains(VOID)
+{
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        HalQueryProcessorTopology(i, &g_CpuTopology.Processors[i]);
+    }
+
+    for (ULONG i = 0; i < g_CpuTopology.CpuCount; i++) {
+        PKE_PROCESSOR_TOPOLOGY self = &g_CpuTopology.Processors[i];
+        ULONG64 masks[KE_DOMAIN_COUNT] = {0};
+
+        for (ULONG j = 0; j < g_CpuTopology.CpuCount; j++) {
+            PKE_PROCESSOR_TOPOLOGY other = &g_CpuTopology.Processors[j];
+
+            if (other->PackageId != self->PackageId) {
+                continue;
+            }
+            masks[KE_DOMAIN_PACKAGE] |= 1ULL << j;
+            if (other->LlcId == self->LlcId) {
+                masks[KE_DOMAIN_LLC] |= 1ULL << j;
+            }
+            if (other->CoreId == self->CoreId) {
+                masks[KE_DOMAIN_SMT] |= 1ULL << j;
+            }
+        }
+
+        masks[KE_DOMAIN_LLC] |= masks[KE_DOMAIN_SMT];
+        masks[KE_DOMAIN_PACKAGE] |= masks[KE_DOMAIN_LLC];
+        RtlCopyMemory(g_RunQueues[i].DomainMasks, masks, sizeof(masks));
+    }
+}
+
+/**
+ * @brief Rebuild the scheduling domains from the topology the HAL reports
+ * @return NTSTATUS Status code
+ */
+NTSTATUS
+NTAPI
+KeRefreshCpuTopology(VOID)
+{
+    if (!g_AdvancedSchedulerInitialized) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_SchedulerLock, &old_irql);
+
+    KiBuildSchedulingDomains();
+
+    KeReleaseSpinLock(&g_SchedulerLock, old_irql);
+
+    return STATUS_SUCCESS;
+}
+
 /**
  * @brief Get CPU topology
  * @param Topology Pointer to receive topology
@@ -1045,6 +2895,213 @@ KeGetCpuTopology(
     return STATUS_SUCCESS;
 }
 
+/**
+ * @brief Time fair-class picks on a scratch run queue
+ * @param ThreadCount Runnable threads on the queue
+ * @param Picks Pick, charge and requeue rounds to run
+ * @param Timing Receives the operation count, elapsed ticks and final tree height
+ * @return NTSTATUS Status code
+ * @note Threads are spread over every feedback level, so weights differ.
+ *       Each pick is charged one base time slice of a synthetic clock
+ */
+NTSTATUS
+NTAPI
+KeMeasureFairPick(
+    _In_ ULONG ThreadCount,
+    _In_ ULONG Picks,
+    _Out_ PKE_RUN_QUEUE_TIMING Timing
+)
+{
+    if (ThreadCount == 0 || Picks == 0 || !Timing) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PRUN_QUEUE queue = ExAllocatePoolWithTag(NonPagedPool, sizeof(RUN_QUEUE), 'BldS');
+    PTHREAD threads = ExAllocatePoolWithTag(NonPagedPool, (SIZE_T)ThreadCount * sizeof(THREAD), 'BldS');
+
+    if (!queue || !threads) {
+        if (queue) {
+            ExFreePoolWithTag(queue, 'BldS');
+        }
+        if (threads) {
+            ExFreePoolWithTag(threads, 'BldS');
+        }
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(queue, sizeof(RUN_QUEUE));
+    RtlZeroMemory(threads, (SIZE_T)ThreadCount * sizeof(THREAD));
+    KeInitializeSpinLock(&queue->Lock);
+    for (ULONG i = 0; i < SCHEDULER_PRIORITY_LEVELS; i++) {
+        InitializeListHead(&queue->PriorityQueues[i].QueueHead);
+    }
+    InitializeListHead(&queue->DeadlineQueueHead);
+    InitializeListHead(&queue->DeadlineThrottled);
+    InitializeListHead(&queue->RealTimeQueueHead);
+    InitializeListHead(&queue->ThrottledGroups);
+
+    for (ULONG i = 0; i < ThreadCount; i++) {
+        threads[i].Priority = (i % SCHEDULER_PRIORITY_LEVELS) * THREAD_PRIORITY_INCREMENT;
+        KiEnqueuePriorityThread(queue, &threads[i], KiPriorityLevel(&threads[i]));
+        KiFairEnqueue(queue, &threads[i]);
+        threads[i].InSchedulerQueue = TRUE;
+        queue->ReadyCount++;
+    }
+
+    ULONG64 clock = 0;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    KeQueryPerformanceCounter(&start);
+
+    for (ULONG i = 0; i < Picks; i++) {
+        PTHREAD thread = KiSelectNextThreadFairShare(queue);
+
+        thread->FairEntity.ExecStart = clock;
+        clock += SCHEDULER_TIME_SLICE_BASE;
+        KiFairCharge(queue, thread, clock);
+
+        KiEnqueuePriorityThread(queue, thread, KiPriorityLevel(thread));
+        KiFairEnqueue(queue, thread);
+        thread->InSchedulerQueue = TRUE;
+        queue->ReadyCount++;
+    }
+
+    KeQueryPerformanceCounter(&end);
+
+    Timing->ProcessorCount = 1;
+    Timing->Operations = (ULONG64)Picks * 2;
+    Timing->Dispatches = Picks;
+    Timing->Ticks = (ULONG64)(end.QuadPart - start.QuadPart);
+    Timing->TreeHeight = KiFairTreeHeight(queue->FairTree.Root);
+
+    ExFreePoolWithTag(threads, 'BldS');
+    ExFreePoolWithTag(queue, 'BldS');
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Run a bandwidth-limited group against an unlimited thread on a scratch run queue
+ * @param Quota Ticks the group may run per period
+ * @param Period Bandwidth period in ticks
+ * @param Ticks Ticks of a synthetic clock to run, one pick each
+ * @param Statistics Receives what was picked and how often the group was throttled
+ * @return NTSTATUS Status code
+ * @note Picks go through KiSelectNextThread under the configured algorithm,
+ *       so a throttled group's thread must never be picked whatever it is
+ */
+NTSTATUS
+NTAPI
+KeMeasureGroupBandwidth(
+    _In_ ULONG64 Quota,
+    _In_ ULONG64 Period,
+    _In_ ULONG Ticks,
+    _Out_ PKE_GROUP_BANDWIDTH_STATISTICS Statistics
+)
+{
+    if (Quota == 0 || Period == 0 || Quota > Period || !Statistics) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PRUN_QUEUE queue = ExAllocatePoolWithTag(NonPagedPool, sizeof(RUN_QUEUE), 'BldS');
+    PTHREAD threads = ExAllocatePoolWithTag(NonPagedPool, 2 * sizeof(THREAD), 'BldS');
+
+    if (!queue || !threads) {
+        if (queue) {
+            ExFreePoolWithTag(queue, 'BldS');
+        }
+        if (threads) {
+            ExFreePoolWithTag(threads, 'BldS');
+        }
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(queue, sizeof(RUN_QUEUE));
+    RtlZeroMemory(threads, 2 * sizeof(THREAD));
+    KeInitializeSpinLock(&queue->Lock);
+    for (ULONG i = 0; i < SCHEDULER_PRIORITY_LEVELS; i++) {
+        InitializeListHead(&queue->PriorityQueues[i].QueueHead);
+    }
+    InitializeListHead(&queue->DeadlineQueueHead);
+    InitializeListHead(&queue->DeadlineThrottled);
+    InitializeListHead(&queue->RealTimeQueueHead);
+    InitializeListHead(&queue->ThrottledGroups);
+
+    // A top-level group on the scratch queue only, outside the group table
+    FAIR_SHARE_GROUP group;
+    FAIR_GROUP_QUEUE group_queue;
+    RtlZeroMemory(&group, sizeof(FAIR_SHARE_GROUP));
+    RtlZeroMemory(&group_queue, sizeof(FAIR_GROUP_QUEUE));
+    KeInitializeSpinLock(&group.BandwidthLock);
+    group.GroupWeight = KE_SCHED_NOMINAL_WEIGHT;
+    group.Depth = 1;
+    group.CpuTimeQuota = Quota;
+    group.CpuTimePeriod = Period;
+    group.RuntimePool = Quota;
+    group.PerCpu = &group_queue;
+    group_queue.Group = &group;
+    group_queue.Entity.Weight = KE_SCHED_NOMINAL_WEIGHT;
+    group_queue.Entity.Tree = &queue->FairTree;
+    group_queue.Entity.Children = &group_queue.Tree;
+    group_queue.Tree.Owner = &group_queue.Entity;
+    InitializeListHead(&group_queue.ThrottledEntry);
+
+    // Thread 0 belongs to the group, thread 1 to none; both at one level
+    PKE_SCHED_TREE trees[2] = { &group_queue.Tree, &queue->FairTree };
+
+    RtlZeroMemory(Statistics, sizeof(KE_GROUP_BANDWIDTH_STATISTICS));
+    InterlockedIncrement((PLONG)&g_BandwidthGroupCount);
+
+    for (ULONG i = 0; i < 2; i++) {
+        threads[i].Priority = THREAD_PRIORITY_INCREMENT;
+        KiEnqueuePriorityThread(queue, &threads[i], KiPriorityLevel(&threads[i]));
+        threads[i].FairEntity.Tree = trees[i];
+        threads[i].FairEntity.Weight = g_FairLevelWeights[KiPriorityLevel(&threads[i])];
+        KiFairPlace(&threads[i].FairEntity);
+        KiFairActivateGroups(trees[i]);
+        threads[i].InSchedulerQueue = TRUE;
+        queue->ReadyCount++;
+    }
+
+    for (ULONG64 now = 0; now < Ticks; now++) {
+        if (queue->NextUnthrottleTime != 0 && now >= queue->NextUnthrottleTime) {
+            KiUnthrottleGroups(queue, now);
+        }
+
+        PTHREAD thread = KiSelectNextThread(queue);
+        if (thread != &threads[0] && thread != &threads[1]) {
+            continue;
+        }
+
+        Statistics->Picks++;
+        if (thread == &threads[0]) {
+            Statistics->GroupPicks++;
+            if (group_queue.Throttled) {
+                Statistics->ThrottledPicks++;
+            }
+        }
+
+        thread->FairEntity.ExecStart = now;
+        KiFairCharge(queue, thread, now + 1);
+
+        KiEnqueuePriorityThread(queue, thread, KiPriorityLevel(thread));
+        thread->FairEntity.Tree = trees[thread - threads];
+        KiFairPlace(&thread->FairEntity);
+        KiFairActivateGroups(thread->FairEntity.Tree);
+        thread->InSchedulerQueue = TRUE;
+        queue->ReadyCount++;
+    }
+
+    InterlockedDecrement((PLONG)&g_BandwidthGroupCount);
+    Statistics->ThrottleCount = group.ThrottleCount;
+
+    ExFreePoolWithTag(threads, 'BldS');
+    ExFreePoolWithTag(queue, 'BldS');
+
+    return STATUS_SUCCESS;
+}
+
 /**
  * @brief Check if scheduler is initialized
  * @return BOOLEAN TRUE if initialized
@@ -1066,6 +3123,9 @@ KeTimerInterruptHandler(VOID)
     // This is called by the timer interrupt handler
     // Update scheduler state and potentially reschedule
 
+    // Expire timers and rearm a one-shot tick
+    KeHandleProcessorTick();
+
     if (g_AdvancedSchedulerInitialized && g_SchedulerRunning) {
         PTHREAD current_thread = KeGetCurrentThread();
 
@@ -1073,16 +3133,33 @@ KeTimerInterruptHandler(VOID)
             // Update quantum
             current_thread->Quantum--;
 
+            // A thread another processor queued here may have missed its IPI
+            if (g_RunQueues[KeGetCurrentProcessorNumber()].ReschedulePending) {
+                KeRequestReschedule();
+            }
+
+            // A group or deadline thread held here may have refilled
+            ULONG64 now = KeQueryTimeTicks();
+            ULONG64 next_unthrottle = g_RunQueues[KeGetCurrentProcessorNumber()].NextUnthrottleTime;
+            ULONG64 next_replenish = g_RunQueues[KeGetCurrentProcessorNumber()].NextReplenishTime;
+            if ((next_unthrottle != 0 && now >= next_unthrottle) ||
+                (next_replenish != 0 && now >= next_replenish)) {
+                KeRequestReschedule();
+            }
+
+            // A deadline thread that has used its budget gives way
+            PKE_DEADLINE_ENTITY deadline = &current_thread->DeadlineEntity;
+            if (deadline->Runtime != 0 && (LONG64)(now - deadline->ExecStart) >= deadline->RemainingRuntime) {
+                KeRequestReschedule();
+            }
+
             if (current_thread->Quantum <= 0) {
                 // Time slice expired, request reschedule
                 KeRequestReschedule();
 
                 // Reset quantum
-                ULONG priority_level = current_thread->Priority / THREAD_PRIORITY_INCREMENT;
-                if (priority_level >= SCHEDULER_PRIORITY_LEVELS) {
-                    priority_level = SCHEDULER_PRIORITY_LEVELS - 1;
-                }
-                current_thread->Quantum = g_PriorityQueues[priority_level].TimeSlice;
+                ULONG priority_level = KiPriorityLevel(current_thread);
+                current_thread->Quantum = g_RunQueues[KeGetCurrentProcessorNumber()].PriorityQueues[priority_level].TimeSlice;
             }
         }
     }
@@ -521,6 +521,7 @@ static KSPIN_LOCK g_DisplayListLock;
 static KSPIN_LOCK g_WindowListLock;
 static KSPIN_LOCK g_InputDeviceListLock;
 static KSPIN_LOCK g_ThemeListLock;
+static PMM_OBJECT_CACHE g_UiMessageCache;
 
 // UI mode
 static UI_MODE g_CurrentUiMode = UI_MODE_HYBRID;
@@ -971,6 +972,13 @@ KiInitializeEventLoop(VOID)
     InitializeListHead(&g_UiManager->MessageQueue.MessageList);
     g_UiManager->MessageQueue.MessageCount = 0;
 
+    // Create message cache
+    NTSTATUS status = MmCreateObjectCache("UiMessage", sizeof(UI_MESSAGE), 0, NULL, NULL,
+                                          &g_UiMessageCache);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     // Set event loop state
     g_UiManager->Running = TRUE;
 
@@ -1516,6 +1524,47 @@ UiFindWindowById(
     return NULL;
 }
 
+/**
+ * @brief Post message to a window's message queue
+ * @param WindowId Target window ID
+ * @param MessageType Message type
+ * @return NTSTATUS Status code
+ */
+NTSTATUS
+NTAPI
+UiPostMessage(
+    _In_ WINDOW_ID WindowId,
+    _In_ MESSAGE_TYPE MessageType
+)
+{
+    if (!g_CompositeUiInitialized) {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    PUI_WINDOW window = UiFindWindowById(WindowId);
+    if (!window) {
+        return STATUS_NOT_FOUND;
+    }
+
+    PUI_MESSAGE message = MmAllocateObject(g_UiMessageCache);
+    if (!message) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(message, sizeof(UI_MESSAGE));
+    message->Type = MessageType;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&window->WindowLock, &old_irql);
+
+    InsertTailList(&window->MessageQueue.MessageList, &message->MessageListEntry);
+    window->MessageQueue.MessageCount++;
+
+    KeReleaseSpinLock(&window->WindowLock, old_irql);
+
+    return STATUS_SUCCESS;
+}
+
 /**
  * @brief Find control by ID
  * @param ControlId Control ID to find
@@ -1760,7 +1809,7 @@ KiProcessWindowEvents(
         }
 
         // Free message
-        ExFreePoolWithTag(message, 'MldU');
+        MmFreeObject(g_UiMessageCache, message);
     }
 
     return STATUS_SUCCESS;
@@ -1855,7 +1904,7 @@ KiProcessMessageQueue(
         }
 
         // Free message
-        ExFreePoolWithTag(message, 'MldU');
+        MmFreeObject(g_UiMessageCache, message);
     }
 
     // Process all window message queues
@@ -550,6 +550,9 @@ KiCreateContainerProcess(
     Container->InitProcess->IsContainerInit = TRUE;
     Container->InitProcess->ContainerId = Container->ContainerId;
 
+    // Containers run many copies of the same images; let their pages be merged
+    MmSetPageMerging(Container->InitProcess, TRUE);
+
     // Add to process list
     InsertTailList(&Container->ProcessList, &Container->InitProcess->ContainerProcessEntry);
     Container->ProcessCount = 1;
@@ -955,6 +958,8 @@ CsExecuteInContainer(
         return status;
     }
 
+    MmSetPageMerging(process, TRUE);
+
     // Add to container process list
     KeAcquireSpinLock(&container->ContainerLock, &old_irql);
     InsertTailList(&container->ProcessList, &process->ContainerProcessEntry);
@@ -31,6 +31,7 @@ typedef struct _DEVICE_MANAGER_STATE {
     LIST_ENTRY IoRequestQueueHead;
     KSPIN_LOCK IoRequestLock;
     ULONG IoRequestQueueDepth;
+    PMM_OBJECT_CACHE IoRequestCache;
 
     // PnP management
     LIST_ENTRY PnpDeviceListHead;
@@ -413,6 +414,13 @@ NTSTATUS IoInitializeDeviceManager(VOID)
     KeInitializeSpinLock(&g_DeviceManager.IoRequestLock);
     g_DeviceManager.IoRequestQueueDepth = 0;
 
+    // Create I/O request cache
+    NTSTATUS status = MmCreateObjectCache("IoRequest", sizeof(IO_REQUEST), 0, NULL, NULL,
+                                          &g_DeviceManager.IoRequestCache);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     // Initialize PnP management
     InitializeListHead(&g_DeviceManager.PnpDeviceListHead);
     g_DeviceManager.PnpDeviceEnumerationInProgress = 0;
@@ -430,7 +438,7 @@ NTSTATUS IoInitializeDeviceManager(VOID)
     g_DeviceManager.MaxIoRequests = 10000;
 
     // Initialize root bus device
-    NTSTATUS status = IoCreateRootBusDevice();
+    status = IoCreateRootBusDevice();
     if (!NT_SUCCESS(status)) {
         return status;
     }
@@ -716,7 +724,7 @@ NTSTATUS IoSendIoRequest(PDEVICE_OBJECT DeviceObject, IO_CODE IoCode,
     }
 
     // Allocate I/O request
-    PIO_REQUEST io_request = ExAllocatePool(NonPagedPool, sizeof(IO_REQUEST));
+    PIO_REQUEST io_request = MmAllocateObject(g_DeviceManager.IoRequestCache);
     if (io_request == NULL) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -776,7 +784,7 @@ NTSTATUS IoSendIoRequest(PDEVICE_OBJECT DeviceObject, IO_CODE IoCode,
     IoStatus->Information = 0; // Bytes transferred
 
     // Free request
-    ExFreePool(io_request);
+    MmFreeObject(g_DeviceManager.IoRequestCache, io_request);
 
     return STATUS_SUCCESS;
 }
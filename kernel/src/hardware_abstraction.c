@@ -31,9 +31,10 @@ typedef struct _INTERRUPT_CONTROLLER {
     VOID (*SendEndOfInterrupt)(ULONG Vector);
     VOID (*MaskInterrupt)(ULONG Vector);
     VOID (*UnmaskInterrupt)(ULONG Vector);
+    VOID (*SendInterProcessorInterrupt)(ULONG Processor, ULONG Vector);
 } INTERRUPT_CONTROLLER;
 
-// Timer interface
+// Timer interface. Tick timers are numbered by processor
 typedef struct _TIMER_CONTROLLER {
     VOID (*Initialize)(VOID);
     VOID (*StartTimer)(ULONG TimerId, ULONG Milliseconds);
@@ -98,6 +99,41 @@ VOID HalInitializeTimers(VOID)
     }
 }
 
+/**
+ * @brief Make a processor's tick timer fire periodically
+ * @param Processor Processor whose tick timer to program
+ * @param Milliseconds Interval between ticks
+ */
+VOID HalSetPeriodicTick(ULONG Processor, ULONG Milliseconds)
+{
+    if (g_TimerController.SetPeriodicTimer != NULL) {
+        g_TimerController.SetPeriodicTimer(Processor, Milliseconds);
+    }
+}
+
+/**
+ * @brief Make a processor's tick timer fire once
+ * @param Processor Processor whose tick timer to program
+ * @param Milliseconds Delay before the tick
+ */
+VOID HalSetOneShotTick(ULONG Processor, ULONG Milliseconds)
+{
+    if (g_TimerController.StartTimer != NULL) {
+        g_TimerController.StartTimer(Processor, Milliseconds);
+    }
+}
+
+/**
+ * @brief Stop a processor's tick timer
+ * @param Processor Processor whose tick timer to stop
+ */
+VOID HalStopTick(ULONG Processor)
+{
+    if (g_TimerController.StopTimer != NULL) {
+        g_TimerController.StopTimer(Processor);
+    }
+}
+
 /**
  * @brief Disable interrupts
  */
@@ -122,6 +158,20 @@ VOID HalEnableInterrupts(VOID)
 #endif
 }
 
+/**
+ * @brief Send an interrupt to another processor
+ * @param Processor Target processor number
+ * @param Vector Interrupt vector to raise there
+ * @note Does nothing until a controller that can deliver IPIs is registered;
+ *       callers must not depend on delivery for correctness
+ */
+VOID HalSendInterProcessorInterrupt(ULONG Processor, ULONG Vector)
+{
+    if (g_InterruptController.SendInterProcessorInterrupt != NULL) {
+        g_InterruptController.SendInterProcessorInterrupt(Processor, Vector);
+    }
+}
+
 /**
  * @brief Halt system
  */
@@ -310,7 +360,9 @@ VOID HalFlushCpuCache(VOID)
  */
 VOID HalInvalidateTlbEntry(PVOID VirtualAddress)
 {
-#ifdef DSLOS_ARCH_X64
+#if defined(DSLOS_HOSTED)
+    UNREFERENCED_PARAMETER(VirtualAddress); // No hardware TLB to maintain
+#elif defined(DSLOS_ARCH_X64)
     __asm__ __volatile__("invlpg (%0)" : : "r"(VirtualAddress));
 #elif defined(_WIN64)
     __invlpg(VirtualAddress);
@@ -363,7 +415,9 @@ UINT_PTR HalGetCr3(VOID)
 {
     UINT_PTR cr3;
 
-#ifdef DSLOS_ARCH_X64
+#if defined(DSLOS_HOSTED)
+    cr3 = 0; // No page tables are loaded
+#elif defined(DSLOS_ARCH_X64)
     __asm__ __volatile__("movq %%cr3, %0" : "=r"(cr3));
 #elif defined(_WIN64)
     cr3 = __readcr3();
@@ -378,7 +432,9 @@ UINT_PTR HalGetCr3(VOID)
  */
 VOID HalSetCr3(UINT_PTR Cr3Value)
 {
-#ifdef DSLOS_ARCH_X64
+#if defined(DSLOS_HOSTED)
+    UNREFERENCED_PARAMETER(Cr3Value); // The page tables are only walked in software
+#elif defined(DSLOS_ARCH_X64)
     __asm__ __volatile__("movq %0, %%cr3" : : "r"(Cr3Value));
 #elif defined(_WIN64)
     __writecr3(Cr3Value);
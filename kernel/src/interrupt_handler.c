@@ -50,6 +50,29 @@ typedef struct _KDPC {
     ULONG Priority;
 } KDPC, *PKDPC;
 
+// Frame the interrupt entry stubs pass to KeInterruptHandler. ErrorCode is
+// the one the processor pushes for exceptions that have one, 0 otherwise
+typedef struct _KINTERRUPT_FRAME {
+    ULONG_PTR ErrorCode;
+    ULONG_PTR InstructionPointer;
+    ULONG_PTR CodeSegment;
+    ULONG_PTR Flags;
+    ULONG_PTR StackPointer;
+    ULONG_PTR StackSegment;
+} KINTERRUPT_FRAME, *PKINTERRUPT_FRAME;
+
+// Termination of a thread whose fault could not be resolved, run as a DPC
+// once the fault handler has returned
+typedef struct _KFAULT_TERMINATION {
+    KDPC Dpc;
+    PTHREAD_CONTROL_BLOCK Thread;  // NULL while no termination is queued
+    NTSTATUS ExitStatus;
+} KFAULT_TERMINATION, *PKFAULT_TERMINATION;
+
+// Frame of the interrupt each processor is handling, and its fault terminations
+static PKINTERRUPT_FRAME g_InterruptFrames[DSLOS_MAX_PROCESSORS];
+static KFAULT_TERMINATION g_FaultTerminations[DSLOS_MAX_PROCESSORS];
+
 // Interrupt flags
 #define INTERRUPT_FLAG_SPURIOUS     0x00000001
 #define INTERRUPT_FLAG_MASKED       0x00000002
@@ -156,7 +179,10 @@ NTSTATUS KeUnregisterInterruptHandler(ULONG Vector)
  */
 VOID KeInterruptHandler(ULONG Vector, PVOID Context)
 {
-    UNREFERENCED_PARAMETER(Context);
+    // Keep the frame for handlers that need the error code; interrupts nest
+    ULONG processor = KeGetCurrentProcessorNumber();
+    PKINTERRUPT_FRAME previous_frame = g_InterruptFrames[processor];
+    g_InterruptFrames[processor] = (PKINTERRUPT_FRAME)Context;
 
     // Update statistics
     InterlockedIncrement(&g_InterruptHandler.Statistics.TotalInterrupts);
@@ -184,6 +210,8 @@ VOID KeInterruptHandler(ULONG Vector, PVOID Context)
         InterlockedIncrement(&g_InterruptHandler.Statistics.TotalSpuriousInterrupts);
     }
 
+    g_InterruptFrames[processor] = previous_frame;
+
     // Send end of interrupt
     HalSendEndOfInterrupt(Vector);
 
@@ -245,11 +273,80 @@ VOID KeSystemCallInterruptHandler(ULONG Vector)
     // - Return result to user mode
 }
 
+/**
+ * @brief TLB shootdown interrupt handler
+ * @param Vector Interrupt vector
+ */
+VOID KeTlbShootdownInterruptHandler(ULONG Vector)
+{
+    UNREFERENCED_PARAMETER(Vector);
+
+    MmProcessTlbShootdown();
+}
+
+/**
+ * @brief Terminate a thread whose fault could not be resolved
+ * @param Context Fault termination record
+ * @note Runs from the DPC queue, after the fault handler has returned, so the
+ *       thread is never torn down underneath its own fault handler
+ */
+static VOID KiTerminateFaultingThread(PVOID Context)
+{
+    PKFAULT_TERMINATION termination = (PKFAULT_TERMINATION)Context;
+    PTHREAD_CONTROL_BLOCK thread = termination->Thread;
+
+    termination->Thread = NULL;
+    PsTerminateThread(thread, termination->ExitStatus);
+
+    // The terminated thread must not return to the faulting instruction
+    if (KeGetCurrentThread() == thread) {
+        KeSchedule();
+    }
+}
+
+/**
+ * @brief Page fault handler
+ * @param Vector Interrupt vector
+ */
+VOID KePageFaultInterruptHandler(ULONG Vector)
+{
+    UNREFERENCED_PARAMETER(Vector);
+
+    ULONG processor = KeGetCurrentProcessorNumber();
+    PKINTERRUPT_FRAME frame = g_InterruptFrames[processor];
+    ULONG fault_code = (frame != NULL) ? (ULONG)frame->ErrorCode : 0;
+    PVOID fault_address = HalGetPageFaultAddress();
+    PTHREAD_CONTROL_BLOCK thread = KeGetCurrentThread();
+    PPROCESS_CONTROL_BLOCK process = (thread != NULL) ? thread->Process : NULL;
+
+    // Demand-zero, copy-on-write and other resolvable faults are handled by the memory manager
+    NTSTATUS status = MmAccessFault(process, fault_address, fault_code);
+    if (NT_SUCCESS(status)) {
+        return;
+    }
+
+    if (process == NULL) {
+        HalHaltSystem(); // Unresolvable kernel fault
+        return;
+    }
+
+    // Terminate the thread once this handler has returned
+    PKFAULT_TERMINATION termination = &g_FaultTerminations[processor];
+    if (termination->Thread == NULL) {
+        termination->Thread = thread;
+        termination->ExitStatus = status;
+        KeQueueDpc(&termination->Dpc, KiTerminateFaultingThread, termination, 0);
+    }
+}
+
 /**
  * @brief Register default interrupt handlers
  */
 static VOID KeRegisterDefaultHandlers(VOID)
 {
+    // Register page fault handler (exception 14)
+    KeRegisterInterruptHandler(14, KePageFaultInterruptHandler, 0);
+
     // Register timer interrupt handler (typically IRQ 0)
     KeRegisterInterruptHandler(32, KeTimerInterruptHandler, 0);
 
@@ -258,6 +355,9 @@ static VOID KeRegisterDefaultHandlers(VOID)
 
     // Register system call handler (typically INT 0x80)
     KeRegisterInterruptHandler(0x80, KeSystemCallInterruptHandler, 0);
+
+    // Register TLB shootdown handler
+    KeRegisterInterruptHandler(HAL_TLB_SHOOTDOWN_VECTOR, KeTlbShootdownInterruptHandler, 0);
 }
 
 /**
@@ -19,6 +19,7 @@ typedef struct _IPC_MANAGER_STATE {
     LIST_ENTRY PortListHead;
     ULONG PortCount;
     ULONG NextPortId;
+    PMM_OBJECT_CACHE PortCache;
 
     // Connection management
     LIST_ENTRY ConnectionListHead;
@@ -190,6 +191,14 @@ NTSTATUS IpcInitializeIpc(VOID)
     g_IpcManager.PortCount = 0;
     g_IpcManager.NextPortId = 1;
 
+    // Create port cache; ports are released through ObDeleteObject
+    NTSTATUS status = MmCreateObjectCache("IpcPort", sizeof(IPC_PORT), 0, NULL, NULL,
+                                          &g_IpcManager.PortCache);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    ObSetObjectTypeCache(KERNEL_OBJECT_TYPE_PORT, g_IpcManager.PortCache);
+
     // Initialize connection list
     InitializeListHead(&g_IpcManager.ConnectionListHead);
     g_IpcManager.ConnectionCount = 0;
@@ -210,7 +219,7 @@ NTSTATUS IpcInitializeIpc(VOID)
     g_IpcManager.MessagePoolSize = 4 * 1024 * 1024; // 4MB
 
     // Pre-allocate some messages
-    NTSTATUS status = IpcPreallocateMessages(100);
+    status = IpcPreallocateMessages(100);
     if (!NT_SUCCESS(status)) {
         return status;
     }
@@ -259,7 +268,7 @@ NTSTATUS IpcCreatePort(PHANDLE PortHandle, ULONG MaxConnections)
     }
 
     // Allocate port object
-    PIPC_PORT port = ExAllocatePool(NonPagedPool, sizeof(IPC_PORT));
+    PIPC_PORT port = MmAllocateObject(g_IpcManager.PortCache);
     if (port == NULL) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -310,7 +319,7 @@ NTSTATUS IpcCreatePort(PHANDLE PortHandle, ULONG MaxConnections)
         g_IpcManager.PortCount--;
         g_IpcManager.Statistics.TotalPortsCreated--;
         KeReleaseSpinLock(&g_IpcManager.IpcLock, old_irql);
-        ExFreePool(port);
+        MmFreeObject(g_IpcManager.PortCache, port);
         return status;
     }
 
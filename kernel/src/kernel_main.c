@@ -194,6 +194,13 @@ static NTSTATUS KiCreateSystemProcesses(VOID)
         return status;
     }
 
+    // Start the page reclaim thread in the system process
+    PTHREAD_CONTROL_BLOCK reclaim_thread;
+    status = PsCreateThread(system_process, &reclaim_thread, MmWorkingSetManager, NULL);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     // Create initial user processes
     PPROCESS_CONTROL_BLOCK user_process;
     status = PsCreateProcess(&user_process, "\\System\\Shell.exe", NULL);
@@ -10,6 +10,178 @@
 #include "../include/dslos.h"
 #include <string.h>
 
+// MmAllocatePhysicalPages flags
+#define MM_ALLOCATE_ZEROED         0x00000001  // Zero-fill the pages
+#define MM_ALLOCATE_NO_COMPACT     0x00000002  // Caller holds a page table lock; do not compact
+
+// Buddy free area, one per order
+typedef struct _MM_FREE_AREA {
+    LIST_ENTRY FreeListHead;
+    ULONG FreeBlockCount;
+} MM_FREE_AREA, *PMM_FREE_AREA;
+
+// Pre-zeroed pages kept per node by the idle-time zeroing worker
+#define MM_ZERO_PAGE_TARGET        256   // Zeroed pages a node keeps ready (1MB)
+
+// NUMA nodes. Until the ACPI SRAT is parsed, boot splits available memory
+// evenly across MM_BOOT_NODE_COUNT simulated nodes
+#define MM_MAX_NODES               4
+#define MM_BOOT_NODE_COUNT         2
+
+
+// Physical memory zone of one node, with its own buddy free areas
+typedef struct _MM_ZONE {
+    KSPIN_LOCK ZoneLock;
+    ULONG Node;
+    MM_FREE_AREA FreeAreas[MM_MAX_ORDER + 1];
+    ULONG FreePageCount;
+    ULONG TotalPages;
+    LIST_ENTRY ZeroedListHead;     // Single free pages zeroed ahead of time
+    ULONG ZeroedPageCount;
+    MM_NODE_STATISTICS Statistics;
+} MM_ZONE, *PMM_ZONE;
+
+// Page reclamation. The allocator wakes the reclaim thread when free pages
+// drop below the low watermark, and it trims working sets until they are back
+// above the high watermark. It also wakes every MM_RECLAIM_INTERVAL while page
+// merging is on, to scan
+#define MM_RECLAIM_INTERVAL        100000  // Merge scan period in microseconds
+#define MM_RECLAIM_BATCH           32      // Pages revoked per TLB flush while trimming
+#define MM_RECLAIM_MIN_SCAN        32      // Active pages aged per trim at the least
+
+// Compaction. The reclaim thread compacts a node when its fragmentation index
+// for MM_COMPACTION_ORDER (or the order of a failed allocation) exceeds
+// MM_COMPACTION_THRESHOLD per mille
+#define MM_COMPACTION_ORDER        9       // Huge pages
+#define MM_COMPACTION_THRESHOLD    500
+
+
+// Page merging. Each interval the reclaim thread hashes up to the merge scan
+// rate of working set pages in address spaces that opted in. A page whose hash
+// held since the previous pass is merged with an identical page into a shared
+// copy-on-write frame
+#define MM_MERGE_DEFAULT_SCAN_RATE 256     // Candidate pages hashed per reclaim interval
+#define MM_MERGE_TABLE_SIZE        4096    // Slots per merge table, a power of two
+#define MM_MERGE_TABLE_PROBES      4       // Slots a merged frame may occupy past its home slot
+#define MM_MERGE_HASH_LANES        4       // Independent hash lanes, so the loop vectorizes
+#define MM_MERGE_SLOT_EMPTY        0xFFFFFFFF
+
+// Paging file registered by a storage driver. Slots are page-sized; a slot is
+// referenced by every paged-out entry that names it, so clones share it
+typedef struct _MM_PAGING_FILE {
+    KSPIN_LOCK SlotLock;
+    PMM_PAGING_FILE_ROUTINE WritePage;
+    PMM_PAGING_FILE_ROUTINE ReadPage;
+    PVOID Context;
+    ULONG SlotCount;
+    ULONG FreeSlotCount;
+    ULONG NextSlot;               // Where the next free slot search starts
+    PUSHORT SlotReferences;
+} MM_PAGING_FILE, *PMM_PAGING_FILE;
+
+// A page read from the paging file with no lock held, mapped by the retried
+// fault if the entry still names the slot. The read holds a slot reference
+typedef struct _MM_PAGE_IN {
+    PVOID Page;
+    ULONG Slot;
+} MM_PAGE_IN, *PMM_PAGE_IN;
+
+// Thread stacks. Each stack has a guard page below it that is never
+// committed. Kernel stacks are resident and recycled through per-CPU caches;
+// user stacks commit their top and grow downward on fault
+#define MM_STACK_GUARD_SIZE        DSLOS_PAGE_SIZE
+#define MM_KERNEL_STACK_CACHE_DEPTH 8      // Recycled kernel stacks kept per processor
+#define MM_USER_STACK_INITIAL_COMMIT (16 * 1024)
+#define MM_USER_STACK_GROWTH       (64 * 1024)   // Commit granularity of a growing user stack
+#define MM_USER_STACK_CACHE_DEPTH  4       // Stacks of exited threads kept per address space
+
+// Per-CPU cache of recycled kernel stacks
+typedef struct _MM_KERNEL_STACK_CACHE {
+    PVOID Stacks[MM_KERNEL_STACK_CACHE_DEPTH];
+    ULONG Count;
+} MM_KERNEL_STACK_CACHE, *PMM_KERNEL_STACK_CACHE;
+
+// User stack kept for the next thread of the same process
+typedef struct _MM_CACHED_USER_STACK {
+    PVOID Stack;
+    SIZE_T Size;
+} MM_CACHED_USER_STACK, *PMM_CACHED_USER_STACK;
+
+// Per-CPU page cache defaults
+#define MM_MAX_PROCESSORS          DSLOS_MAX_PROCESSORS
+#define MM_PCP_DEFAULT_HIGH        96    // Drain when a CPU caches more pages than this
+#define MM_PCP_DEFAULT_LOW         0     // Refill when a CPU caches this many pages or fewer
+#define MM_PCP_DEFAULT_BATCH       16    // Pages moved per refill/drain
+
+// Per-CPU hot/cold page lists in front of the buddy allocator. They only
+// cache pages of the processor's own node. The lock is uncontended except
+// when another processor drains the lists; it is taken before a zone lock
+typedef struct _MM_PER_CPU_PAGES {
+    KSPIN_LOCK Lock;
+    LIST_ENTRY HotListHead;       // Recently freed, likely cache-warm pages
+    LIST_ENTRY ColdListHead;      // Pages pulled from the node's free areas
+    ULONG Node;
+    ULONG HotCount;
+    ULONG ColdCount;
+    MM_PER_CPU_PAGE_STATISTICS Statistics;
+} MM_PER_CPU_PAGES, *PMM_PER_CPU_PAGES;
+
+// Segregated-fit kernel heap size classes. Each power of two is split into
+// MM_HEAP_SL_COUNT linear sub-classes (1x, 1.25x, 1.5x, 1.75x)
+#define MM_HEAP_ALIGNMENT          16
+#define MM_HEAP_SL_SHIFT           2
+#define MM_HEAP_SL_COUNT           (1 << MM_HEAP_SL_SHIFT)
+#define MM_HEAP_FL_SHIFT           5     // First class starts at 32 bytes
+#define MM_HEAP_FL_COUNT           16    // Last class ends below 2MB
+#define MM_HEAP_SIZE_CLASS_COUNT   (MM_HEAP_FL_COUNT * MM_HEAP_SL_COUNT)
+#define MM_HEAP_SEGMENT_SIZE       (1024 * 1024)  // Heap grows in 1MB buddy blocks
+#define MM_HEAP_LARGE_THRESHOLD    (64 * 1024)    // Larger requests are page-backed
+
+// Per-size-class heap occupancy
+typedef struct _MM_POOL_SIZE_CLASS_STATISTICS {
+    ULONG AllocatedBlocks;
+    ULONG FreeBlocks;
+} MM_POOL_SIZE_CLASS_STATISTICS, *PMM_POOL_SIZE_CLASS_STATISTICS;
+
+// Kernel heap statistics, one per pool
+typedef struct _MM_POOL_STATISTICS {
+    ULONG SegmentCount;
+    SIZE_T CommittedBytes;         // Bytes held in heap segments
+    SIZE_T AllocatedBytes;         // Bytes in allocated blocks, headers included
+    SIZE_T FreeBytes;              // Bytes in free blocks
+    SIZE_T LargestFreeBlock;
+    ULONG FreeBlockCount;
+    ULONG FragmentationPercent;    // Share of free bytes outside the largest free block
+    ULONG LargeAllocationCount;
+    SIZE_T LargeAllocationBytes;
+    ULONG64 AllocationCount;
+    ULONG64 FreeCount;
+    ULONG64 FailedAllocationCount;
+    MM_POOL_SIZE_CLASS_STATISTICS SizeClasses[MM_HEAP_SIZE_CLASS_COUNT];
+} MM_POOL_STATISTICS, *PMM_POOL_STATISTICS;
+
+// Pool tag tracking. Usage is counted per tag and pool in per-CPU counters; a
+// CPU folds its byte count into the tag's shared total once it drifts by
+// MM_POOL_TAG_FOLD_BYTES, and the high-water mark is kept from the folded totals
+#define MM_POOL_TAG_COUNT          256     // Tracked (tag, pool) pairs, a power of two
+#define MM_POOL_TAG_FOLD_BYTES     (64 * 1024)
+#define MM_POOL_TRACE_COUNT        256     // Sampled allocations traced at once
+#define MM_POOL_TRACE_FRAME_LIMIT  (16 * 1024)  // Larger frame steps are taken to leave the kernel stack
+
+// Per-CPU usage counters of one pool tag
+typedef struct _MM_POOL_TAG_COUNTERS {
+    ULONG Allocations;
+    ULONG Frees;
+    LONG64 Bytes;                  // Net bytes not folded into the tag's total yet
+} MM_POOL_TAG_COUNTERS, *PMM_POOL_TAG_COUNTERS;
+
+// Registered pool tag
+typedef struct _MM_POOL_TAG_ENTRY {
+    ULONG64 Key;                   // (pool type + 1) << 32 | tag, 0 for a free slot
+    LONG64 Bytes;                  // Folded from the per-CPU counters
+    LONG64 PeakBytes;
+} MM_POOL_TAG_ENTRY, *PMM_POOL_TAG_ENTRY;
+
 // Memory manager state
 typedef struct _MEMORY_MANAGER_STATE {
     BOOLEAN Initialized;
@@ -19,13 +191,45 @@ typedef struct _MEMORY_MANAGER_STATE {
     PHYSICAL_MEMORY_RANGE* PhysicalMemoryRanges;
     ULONG PhysicalMemoryRangeCount;
     ULONG TotalPhysicalPages;
-    ULONG FreePhysicalPages;
 
     // Page frame management
+    // Page frame database. The fields frame scans read are kept in dense
+    // arrays indexed by page frame number; PageFrameArray holds the rest
     PHYSICAL_PAGE_FRAME* PageFrameArray;
+    PUCHAR PageFlags;              // PAGE_FLAG_* bits
+    PUCHAR PageOrders;             // Buddy order when PAGE_FLAG_BUDDY_HEAD is set
+    PUCHAR PageNodes;              // NUMA node the page belongs to
+    PULONG PageReferenceCounts;
+    PULONG64 FreePageBitmap;       // Bit set for every PAGE_FLAG_AVAILABLE page
     ULONG PageFrameArraySize;
-    LIST_ENTRY FreePageListHead;
-    ULONG FreePageCount;
+
+    // NUMA zones, one per node
+    MM_ZONE Zones[MM_MAX_NODES];
+    ULONG NodeCount;
+    ULONG ProcessorNode[MM_MAX_PROCESSORS];
+
+    // Per-CPU page caches
+    MM_PER_CPU_PAGES PerCpuPages[MM_MAX_PROCESSORS];
+    ULONG PerCpuHighWatermark;
+    ULONG PerCpuLowWatermark;
+    ULONG PerCpuBatch;
+
+    // Recycled kernel stacks
+    MM_KERNEL_STACK_CACHE KernelStackCaches[MM_MAX_PROCESSORS];
+
+    // Page reclamation
+    ULONG ReclaimLowWatermark;     // Free pages below which the reclaim thread trims working sets
+    ULONG ReclaimHighWatermark;    // Free pages at which it stops
+    MM_PAGING_FILE PagingFile;
+    ULONG CompactionOrder;         // Highest order a non-compacting allocation failed at, 0 for none
+    KEVENT ReclaimEvent;           // Wakes the reclaim thread
+    volatile LONG ReclaimPending;  // Set once ReclaimEvent is signaled, until the thread runs
+
+    // Page merging. MergeLock guards the merged frame flags and the stable table
+    KSPIN_LOCK MergeLock;
+    PULONG MergeStableTable;       // Merged frames by content hash
+    PULONG MergeUnstableTable;     // Candidate pages by content hash, used by the scanner only
+    ULONG MergeScanRate;           // Pages hashed per reclaim interval, 0 to stop scanning
 
     // Virtual memory management
     PVOID KernelBaseAddress;
@@ -40,37 +244,85 @@ typedef struct _MEMORY_MANAGER_STATE {
     // Memory pools
     typedef struct _MEMORY_POOL {
         POOL_TYPE PoolType;
-        PVOID PoolBase;
-        SIZE_T PoolSize;
-        SIZE_T PoolUsed;
-        LIST_ENTRY FreeBlockListHead;
+        PVOID PoolBase;                // First heap segment
+        SIZE_T PoolSize;               // Bytes held in heap segments
+        SIZE_T PoolUsed;               // Bytes handed out, large allocations included
+        ULONG FirstLevelBitmap;        // Bit per first-level class with a free block
+        ULONG SecondLevelBitmap[MM_HEAP_FL_COUNT];
+        LIST_ENTRY FreeLists[MM_HEAP_FL_COUNT][MM_HEAP_SL_COUNT];
+        LIST_ENTRY SegmentListHead;
+        MM_POOL_STATISTICS Statistics;
         KSPIN_LOCK PoolLock;
-    } MEMORY_POOL;
+    } MEMORY_POOL, *PMEMORY_POOL;
 
     MEMORY_POOL NonPagedPool;
     MEMORY_POOL PagedPool;
 
+    // Pool tag tracking. PoolTagLock guards tag registration, folding and the traces
+    KSPIN_LOCK PoolTagLock;
+    MM_POOL_TAG_ENTRY PoolTags[MM_POOL_TAG_COUNT];
+    MM_POOL_TAG_COUNTERS PoolTagCounters[MM_MAX_PROCESSORS][MM_POOL_TAG_COUNT];
+    ULONG PoolTagOverflows;        // Allocations left untracked because every slot was taken
+    ULONG PoolTraceTag;            // Tag whose allocations are sampled
+    ULONG PoolTraceRate;           // Every Nth allocation of it is traced, 0 for none
+    ULONG PoolTraceCounter;
+    ULONG PoolTracesDropped;       // Samples lost because every trace record was in use
+    MM_POOL_TRACE PoolTraces[MM_POOL_TRACE_COUNT];
+
     // Address space management
     LIST_ENTRY AddressSpaceListHead;
     ULONG AddressSpaceCount;
+    ADDRESS_SPACE_DESCRIPTOR SystemAddressSpace;   // Used when a caller has no process address space
+    PMM_OBJECT_CACHE RegionCache;                  // VIRTUAL_MEMORY_REGION objects
+
+    // Address space loaded on each processor, and the processors that have loaded one
+    PADDRESS_SPACE_DESCRIPTOR LoadedAddressSpaces[MM_MAX_PROCESSORS];
+    volatile LONG64 LoadedProcessors;
+
+    // TLB shootdown. One batch is in flight at a time; each target clears its
+    // bit in ShootdownPending once it has invalidated the batch locally
+    volatile LONG ShootdownBusy;
+    PMM_TLB_BATCH ShootdownBatch;
+    volatile LONG64 ShootdownPending;
 } MEMORY_MANAGER_STATE;
 
 static MEMORY_MANAGER_STATE g_MemoryManager = {0};
 
+// Boot memory map; the pools are not available while it is built
+static PHYSICAL_MEMORY_RANGE g_PhysicalMemoryRanges[MM_MAX_PHYSICAL_RANGES];
+
 // Physical page frame structure
 typedef struct _PHYSICAL_PAGE_FRAME {
     ULONG_PTR PhysicalAddress;
-    ULONG ReferenceCount;
-    ULONG Flags;
+    struct _ADDRESS_SPACE_DESCRIPTOR* AddressSpace;  // Owner of a working set page
+    ULONG MergeHash;              // Content hash of a merged page or merge candidate, 0 if not hashed
     PVOID VirtualMapping;
     LIST_ENTRY PageListEntry;
 } PHYSICAL_PAGE_FRAME, *PPHYSICAL_PAGE_FRAME;
 
+// Page frame database access by page frame number
+#define MM_PFN(Page)               ((ULONG)((Page) - g_MemoryManager.PageFrameArray))
+#define MM_PAGE_FLAGS(Pfn)         (g_MemoryManager.PageFlags[Pfn])
+#define MM_PAGE_ORDER(Pfn)         (g_MemoryManager.PageOrders[Pfn])
+#define MM_PAGE_NODE(Pfn)          (g_MemoryManager.PageNodes[Pfn])
+#define MM_PAGE_REFERENCES(Pfn)    (g_MemoryManager.PageReferenceCounts[Pfn])
+
+// Page frame flags
+#define PAGE_FLAG_AVAILABLE    0x00000001
+#define PAGE_FLAG_BUDDY_HEAD   0x00000002  // First page of a free buddy block
+#define PAGE_FLAG_PER_CPU      0x00000004  // Free page held in a per-CPU cache
+#define PAGE_FLAG_ZEROED       0x00000008  // Free page held on a zone's zeroed list
+#define PAGE_FLAG_ACTIVE       0x00000010  // On its address space's active working set list
+#define PAGE_FLAG_INACTIVE     0x00000020  // On its address space's inactive working set list
+#define PAGE_FLAG_MERGED       0x00000040  // Read-only frame shared by merged identical pages
+#define PAGE_FLAG_PAGE_OUT     0x00000080  // Being written to the paging file with no lock held
+
 // Physical memory range structure
 typedef struct _PHYSICAL_MEMORY_RANGE {
     ULONG_PTR BaseAddress;
     SIZE_T Size;
     ULONG Type;
+    ULONG Node;
 } PHYSICAL_MEMORY_RANGE, *PPHYSICAL_MEMORY_RANGE;
 
 // Memory statistics structure
@@ -84,33 +336,207 @@ typedef struct _MEMORY_STATISTICS {
     ULONG PageFaultCount;
     ULONG PageInCount;
     ULONG PageOutCount;
+    ULONG PageTablePages;
+    ULONG TlbBatchCount;           // Deferred invalidation batches flushed
+    ULONG TlbEntryFlushCount;      // Single-entry invalidations issued by batches
+    ULONG TlbFullFlushCount;       // Full TLB flushes issued by batches
+    ULONG TlbShootdownCount;       // Batches that also had to be flushed on other processors
+    ULONG BasePageMappings;        // 4KB pages mapped by page table entries
+    ULONG HugePageMappings;        // 2MB pages mapped by page directory entries
+    ULONG HugePageFallbacks;       // 2MB windows mapped with base pages for lack of an order-9 block
+    ULONG HugePageSplits;          // Huge mappings split by a partial free or protect
+    ULONG CopyOnWriteFaults;       // Writes to shared pages resolved by the fault handler
+    ULONG CopyOnWriteCopies;       // Of those, the ones that had to copy the page
+    ULONG ZeroedPageListHits;      // Zeroed allocations served from a zeroed list
+    ULONG ZeroedPageListMisses;    // Zeroed allocations that had to clear the memory
+    ULONG IdleZeroedPages;         // Pages zeroed by the idle-time worker
+    ULONG WorkingSetTrims;         // Working set trims by the reclaim thread, faults or callers
+    ULONG ReclaimedPages;          // Pages taken from working sets, PageOutCount included
+    ULONG ReclaimedZeroPages;      // Of those, all-zero pages dropped without a paging file write
+    ULONG CompactionRuns;          // Node compactions, on demand or in the background
+    ULONG CompactionSuccesses;     // Of those, the ones that freed a block of the wanted order
+    ULONG CompactionMigratedPages; // Working set pages moved to another frame
+    ULONG MergeScannedPages;       // Pages hashed by the merge scanner
+    ULONG MergedFrames;            // Frames currently shared by merged pages
+    ULONG MergedMappings;          // Mappings of those frames beyond the first, one saved page each
+    SIZE_T MergeSavedBytes;        // MergedMappings in bytes
+    ULONG KernelStackCacheHits;    // Kernel stacks served from a per-CPU cache
+    ULONG KernelStackCacheMisses;  // Kernel stacks that had to be mapped
+    ULONG UserStackCacheHits;      // User stacks reused from an exited thread
+    ULONG StackGrowthFaults;       // Faults that extended a user stack's committed part
+    MM_POOL_STATISTICS NonPagedPoolStatistics;
+    MM_POOL_STATISTICS PagedPoolStatistics;
 } MEMORY_STATISTICS, *PMEMORY_STATISTICS;
 
-// Memory pool block header
-typedef struct _MEMORY_POOL_BLOCK {
-    SIZE_T BlockSize;
-    ULONG Flags;
-    LIST_ENTRY ListEntry;
-} MEMORY_POOL_BLOCK, *PMEMORY_POOL_BLOCK;
+// Kernel heap block header. PrevSize is the boundary tag used to find the
+// physically preceding block when coalescing
+typedef struct _MM_HEAP_BLOCK {
+    SIZE_T PrevSize;               // Size of the preceding block, 0 for the first block in a segment
+    SIZE_T Size;                   // Block size including header; low bits hold MM_HEAP_BLOCK_* flags
+    ULONG Tag;                     // Pool tag of the allocation
+    ULONG PoolType;                // Pool the block belongs to
+    LIST_ENTRY FreeListEntry;      // Valid only while free, overlays the payload
+} MM_HEAP_BLOCK, *PMM_HEAP_BLOCK;
 
-// Address space descriptor
-typedef struct _ADDRESS_SPACE_DESCRIPTOR {
-    PPROCESS_CONTROL_BLOCK Process;
-    PVOID PageDirectory;
-    LIST_ENTRY AddressSpaceListEntry;
-    ULONG RegionCount;
-} ADDRESS_SPACE_DESCRIPTOR, *PADDRESS_SPACE_DESCRIPTOR;
+// Kernel heap segment header, followed by the segment's blocks
+typedef struct _MM_HEAP_SEGMENT {
+    LIST_ENTRY SegmentListEntry;
+    SIZE_T Size;
+} MM_HEAP_SEGMENT, *PMM_HEAP_SEGMENT;
+
+// Heap block flags
+#define MM_HEAP_BLOCK_FREE         0x1
+#define MM_HEAP_BLOCK_LAST         0x2   // Last block in its segment
+#define MM_HEAP_BLOCK_LARGE        0x4   // Page-backed allocation outside the size classes
+#define MM_HEAP_BLOCK_TRACED       0x8   // Sampled allocation with a record in PoolTraces
+#define MM_HEAP_BLOCK_FLAGS        (MM_HEAP_ALIGNMENT - 1)
+
+#define MM_HEAP_ALIGN_UP(x)        (((SIZE_T)(x) + MM_HEAP_ALIGNMENT - 1) & ~(SIZE_T)(MM_HEAP_ALIGNMENT - 1))
+#define MM_HEAP_HEADER_SIZE        MM_HEAP_ALIGN_UP(FIELD_OFFSET(MM_HEAP_BLOCK, FreeListEntry))
+#define MM_HEAP_MIN_BLOCK_SIZE     MM_HEAP_ALIGN_UP(sizeof(MM_HEAP_BLOCK))
+#define MM_HEAP_SEGMENT_HEADER     MM_HEAP_ALIGN_UP(sizeof(MM_HEAP_SEGMENT))
+#define MM_HEAP_BLOCK_SIZE(b)      ((b)->Size & ~(SIZE_T)MM_HEAP_BLOCK_FLAGS)
 
-// Virtual memory region
+// Default tag for untagged pool allocations
+#define MM_POOL_DEFAULT_TAG        'enoN'
+
+// Boot memory map limit
+#define MM_MAX_PHYSICAL_RANGES     16
+
+// Virtual memory region. Regions of an address space form an AVL tree keyed
+// by BaseAddress; each node also tracks the address bounds of its subtree and
+// the largest gap between regions inside it
 typedef struct _VIRTUAL_MEMORY_REGION {
     PVOID BaseAddress;
     SIZE_T RegionSize;
     ULONG Protect;
     ULONG State;
     ULONG Type;
+    BOOLEAN GrowsDown;             // Reserved part of a stack, committed downward by faults
     LIST_ENTRY RegionListEntry;
+
+    // VMA tree linkage
+    struct _VIRTUAL_MEMORY_REGION* Left;
+    struct _VIRTUAL_MEMORY_REGION* Right;
+    LONG Height;
+    ULONG_PTR SubtreeStart;        // Lowest address covered by the subtree
+    ULONG_PTR SubtreeEnd;          // End of the highest region in the subtree
+    SIZE_T SubtreeMaxGap;          // Largest gap between regions in the subtree
 } VIRTUAL_MEMORY_REGION, *PVIRTUAL_MEMORY_REGION;
 
+// Address space descriptor
+typedef struct _ADDRESS_SPACE_DESCRIPTOR {
+    PPROCESS_CONTROL_BLOCK Process;
+    PVOID PageDirectory;
+    LIST_ENTRY AddressSpaceListEntry;
+    ULONG RegionCount;
+
+    // Page tables (PageDirectory is the PML4). Mapped pages are owned by the
+    // entries that map them. Taken after RegionLock when both are held
+    KSPIN_LOCK PageTableLock;
+
+    // Virtual memory regions
+    KSPIN_LOCK RegionLock;
+    PVIRTUAL_MEMORY_REGION RegionRoot;
+    LIST_ENTRY RegionListHead;
+    ULONG_PTR LowestAddress;       // Range searched for free address space
+    ULONG_PTR HighestAddress;
+
+    // Working set: pageable base pages mapped by demand-zero, copy-on-write and
+    // page-in faults, aged through the accessed bit. Protected by PageTableLock
+    LIST_ENTRY ActiveListHead;
+    LIST_ENTRY InactiveListHead;
+    ULONG ActivePageCount;
+    ULONG InactivePageCount;
+    ULONG WorkingSetMaximum;       // Pages, 0 for no limit
+
+    // Page merging, opted into per address space. The scanner resumes at MergeCursor
+    BOOLEAN PageMerging;
+    ULONG_PTR MergeCursor;
+
+    // Stacks of exited threads. Protected by RegionLock
+    MM_CACHED_USER_STACK StackCache[MM_USER_STACK_CACHE_DEPTH];
+    ULONG StackCacheCount;
+
+    // Processors with these page tables loaded, which TLB shootdowns target
+    volatile LONG64 ActiveProcessors;
+
+    // Reclaim passes trimming this address space outside MemoryLock. Changed
+    // under MemoryLock; teardown waits for it to drop to zero
+    volatile LONG TrimReferences;
+} ADDRESS_SPACE_DESCRIPTOR, *PADDRESS_SPACE_DESCRIPTOR;
+
+// Address space layout. The system range occupies one PML4 slot in the upper
+// half whose page directory pointer table is shared by every address space
+#define MM_USER_RANGE_START        0x10000000ULL            // 256MB
+#define MM_USER_RANGE_END          0x80000000ULL            // 2GB
+#define MM_SYSTEM_RANGE_START      0xFFFF800000000000ULL
+#define MM_SYSTEM_RANGE_END        0xFFFF808000000000ULL    // 512GB, one PML4 entry
+
+// x86_64 4-level page table entries
+typedef ULONG64 MM_PTE, *PMM_PTE;
+
+#define MM_PTE_PRESENT             0x0000000000000001ULL
+#define MM_PTE_WRITABLE            0x0000000000000002ULL
+#define MM_PTE_USER                0x0000000000000004ULL
+#define MM_PTE_ACCESSED            0x0000000000000020ULL
+#define MM_PTE_DIRTY               0x0000000000000040ULL
+#define MM_PTE_LARGE               0x0000000000000080ULL
+#define MM_PTE_GLOBAL              0x0000000000000100ULL
+#define MM_PTE_COPY_ON_WRITE       0x0000000000000200ULL    // Software bit: frame shared by a clone
+#define MM_PTE_PAGED_OUT           0x0000000000000400ULL    // Software bit: not present, frame bits hold a paging file slot
+#define MM_PTE_TRANSITION          0x0000000000000800ULL    // Software bit: not present, frame kept while it is paged out
+#define MM_PTE_NO_EXECUTE          0x8000000000000000ULL
+#define MM_PTE_FRAME_MASK          0x000FFFFFFFFFF000ULL
+
+#define MM_PAGE_TABLE_ENTRIES      512
+#define MM_PML4_SHIFT              39
+#define MM_PDPT_SHIFT              30
+#define MM_PD_SHIFT                21
+#define MM_PT_SHIFT                12
+#define MM_PAGE_TABLE_INDEX(va, shift) ((ULONG)(((ULONG_PTR)(va) >> (shift)) & (MM_PAGE_TABLE_ENTRIES - 1)))
+#define MM_KERNEL_PML4_INDEX       MM_PAGE_TABLE_INDEX(MM_SYSTEM_RANGE_START, MM_PML4_SHIFT)
+
+// Direct map. The boot loader maps all physical memory at MM_DIRECT_MAP_BASE
+// through one PML4 slot, which every address space shares like the system
+// range. Page tables and page contents are reached through it, so the walker
+// works whichever address space is loaded
+#define MM_DIRECT_MAP_BASE         0xFFFF888000000000ULL
+#define MM_DIRECT_MAP_PML4_INDEX   MM_PAGE_TABLE_INDEX(MM_DIRECT_MAP_BASE, MM_PML4_SHIFT)
+
+#if defined(DSLOS_HOSTED)
+// Hosted build. No boot loader maps physical memory, so the memory the boot
+// map describes is an arena in the kernel image, and a physical address is an
+// offset into it. The page tables still hold frames; only the processor
+// never loads them
+#define MM_HOSTED_PHYSICAL_SIZE    0x40000000
+
+static ULONG64 g_HostedPhysicalMemory[(MM_HOSTED_PHYSICAL_SIZE + DSLOS_PAGE_SIZE) / sizeof(ULONG64)];
+static ULONG_PTR g_HostedDirectMapBase;   // First page boundary in the arena
+#endif
+
+// Page table an intermediate entry points to, and the frame bits for a table
+#define MM_PTE_TABLE(entry)        ((PMM_PTE)MmPhysicalToVirtual((ULONG_PTR)((entry) & MM_PTE_FRAME_MASK)))
+#define MM_TABLE_FRAME(table)      ((MM_PTE)MmVirtualToPhysical(table) & MM_PTE_FRAME_MASK)
+
+// Transparent huge pages. A huge page is an order-9 buddy block mapped by a
+// single page directory entry with MM_PTE_LARGE set
+#define MM_HUGE_PAGE_SIZE          ((SIZE_T)1 << MM_PD_SHIFT)
+#define MM_HUGE_PAGE_MASK          (MM_HUGE_PAGE_SIZE - 1)
+#define MM_PTE_LARGE_FRAME_MASK    (MM_PTE_FRAME_MASK & ~(MM_PTE)MM_HUGE_PAGE_MASK)
+
+// Deferred TLB invalidation batch, flushed once per map or unmap operation
+// on every processor that has the address space loaded
+#define MM_TLB_BATCH_SIZE          32    // Beyond this a full flush is cheaper
+
+typedef struct _MM_TLB_BATCH {
+    PADDRESS_SPACE_DESCRIPTOR AddressSpace;   // NULL when entries of several address spaces are queued
+    ULONG Count;
+    BOOLEAN FlushAll;
+    BOOLEAN Unload;                           // Processors with the address space loaded switch away from it
+    PVOID Addresses[MM_TLB_BATCH_SIZE];
+} MM_TLB_BATCH, *PMM_TLB_BATCH;
+
 // Memory protection flags
 #define PAGE_NOACCESS          0x01
 #define PAGE_READONLY          0x02
@@ -135,6 +561,12 @@ typedef struct _VIRTUAL_MEMORY_REGION {
 #define MEM_STATE_RESERVED     0x20000
 #define MEM_STATE_COMMITTED    0x40000
 
+// Defined with the buddy allocator, which boot-time setup frees ranges into
+static VOID MmBuddyFreeRange(PMM_ZONE Zone, ULONG Pfn, SIZE_T PageCount);
+
+// Defined with the page table code, which compaction needs to remap pages
+static BOOLEAN MmCompactZone(PMM_ZONE Zone, ULONG Order);
+
 /**
  * @brief Initialize memory manager
  * @return NTSTATUS Status code
@@ -171,10 +603,152 @@ NTSTATUS MmInitializeMemoryManager(VOID)
         return status;
     }
 
+    // Initialize object caches
+    status = MmInitializeObjectCaches();
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Create virtual memory region cache
+    status = MmCreateObjectCache("VirtualMemoryRegion", sizeof(VIRTUAL_MEMORY_REGION), 0, NULL, NULL,
+                                 &g_MemoryManager.RegionCache);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     g_MemoryManager.Initialized = TRUE;
     return STATUS_SUCCESS;
 }
 
+/**
+ * @brief Find the lowest set bit of a 64-bit value
+ * @param Value Non-zero value
+ * @return Bit index
+ */
+static ULONG MmFindFirstSet64(ULONG64 Value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, Value);
+    return (ULONG)index;
+#else
+    return (ULONG)__builtin_ctzll((unsigned long long)Value);
+#endif
+}
+
+/**
+ * @brief Count the set bits of a 64-bit value
+ * @param Value Value
+ * @return Number of set bits
+ */
+static ULONG MmCountSetBits64(ULONG64 Value)
+{
+#ifdef _MSC_VER
+    return (ULONG)__popcnt64(Value);
+#else
+    return (ULONG)__builtin_popcountll((unsigned long long)Value);
+#endif
+}
+
+/**
+ * @brief Mark a run of pages free or allocated
+ * @param Pfn First page frame number
+ * @param PageCount Number of pages
+ * @param Available TRUE to set PAGE_FLAG_AVAILABLE, FALSE to clear it
+ * @note Caller must own the pages, normally through their zone lock. Bitmap
+ *       words shared with pages outside the run, possibly of another zone,
+ *       are updated atomically
+ */
+static VOID MmSetPagesAvailable(ULONG Pfn, ULONG PageCount, BOOLEAN Available)
+{
+    ULONG end = Pfn + PageCount;
+
+    for (ULONG pfn = Pfn; pfn < end; pfn++) {
+        if (Available) {
+            MM_PAGE_FLAGS(pfn) |= PAGE_FLAG_AVAILABLE;
+        } else {
+            MM_PAGE_FLAGS(pfn) &= ~PAGE_FLAG_AVAILABLE;
+        }
+    }
+
+    for (ULONG pfn = Pfn; pfn < end; ) {
+        ULONG bit = pfn % 64;
+        ULONG count = (end - pfn < 64 - bit) ? end - pfn : 64 - bit;
+        volatile LONG64* word = (volatile LONG64*)&g_MemoryManager.FreePageBitmap[pfn / 64];
+
+        if (count == 64) {
+            *word = Available ? -1 : 0;
+        } else {
+            ULONG64 mask = ((1ULL << count) - 1) << bit;
+            if (Available) {
+                InterlockedOr64(word, (LONG64)mask);
+            } else {
+                InterlockedAnd64(word, (LONG64)~mask);
+            }
+        }
+
+        pfn += count;
+    }
+}
+
+/**
+ * @brief Find the next free or allocated page
+ * @param Start First page frame number to look at
+ * @param End Page frame number to stop at
+ * @param Available TRUE to look for a free page, FALSE for an allocated one
+ * @return Page frame number found, or End if there is none
+ * @note Reads the free page bitmap a word at a time without the zone locks,
+ *       so the answer is a hint unless the caller holds them
+ */
+static ULONG MmFindNextPage(ULONG Start, ULONG End, BOOLEAN Available)
+{
+    ULONG pfn = Start;
+
+    while (pfn < End) {
+        ULONG64 word = g_MemoryManager.FreePageBitmap[pfn / 64];
+        if (!Available) {
+            word = ~word;
+        }
+
+        word &= ~0ULL << (pfn % 64);
+        if (word != 0) {
+            pfn = (pfn & ~63UL) + MmFindFirstSet64(word);
+            return (pfn < End) ? pfn : End;
+        }
+
+        pfn = (pfn & ~63UL) + 64;
+    }
+
+    return End;
+}
+
+/**
+ * @brief Count the free pages of a range
+ * @param Pfn First page frame number
+ * @param PageCount Number of pages
+ * @return Pages with PAGE_FLAG_AVAILABLE set, read without the zone locks
+ */
+static ULONG MmCountFreePages(ULONG Pfn, ULONG PageCount)
+{
+    ULONG end = Pfn + PageCount;
+    ULONG free_pages = 0;
+
+    for (ULONG pfn = Pfn; pfn < end; ) {
+        ULONG bit = pfn % 64;
+        ULONG count = (end - pfn < 64 - bit) ? end - pfn : 64 - bit;
+        ULONG64 word = g_MemoryManager.FreePageBitmap[pfn / 64] >> bit;
+
+        if (count < 64) {
+            word &= (1ULL << count) - 1;
+        }
+
+        free_pages += MmCountSetBits64(word);
+        pfn += count;
+    }
+
+    return free_pages;
+}
+
 /**
  * @brief Initialize physical memory management
  * @return NTSTATUS Status code
@@ -187,26 +761,90 @@ static NTSTATUS MmInitializePhysicalMemory(VOID)
         return status;
     }
 
+    // Initialize the zones before the page frame array assigns pages to them
+    for (ULONG node = 0; node < MM_MAX_NODES; node++) {
+        PMM_ZONE zone = &g_MemoryManager.Zones[node];
+        KeInitializeSpinLock(&zone->ZoneLock);
+        zone->Node = node;
+        for (ULONG order = 0; order <= MM_MAX_ORDER; order++) {
+            InitializeListHead(&zone->FreeAreas[order].FreeListHead);
+            zone->FreeAreas[order].FreeBlockCount = 0;
+        }
+        zone->FreePageCount = 0;
+        zone->TotalPages = 0;
+        InitializeListHead(&zone->ZeroedListHead);
+        zone->ZeroedPageCount = 0;
+        RtlZeroMemory(&zone->Statistics, sizeof(MM_NODE_STATISTICS));
+    }
+
     // Initialize page frame array
     status = MmInitializePageFrameArray();
     if (!NT_SUCCESS(status)) {
         return status;
     }
 
-    // Initialize free page list
-    InitializeListHead(&g_MemoryManager.FreePageListHead);
-    g_MemoryManager.FreePageCount = 0;
-
-    // Add initial free pages
-    for (ULONG i = 0; i < g_MemoryManager.PageFrameArraySize; i++) {
-        PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[i];
-        if (page->Flags & PAGE_FLAG_AVAILABLE) {
-            InsertTailList(&g_MemoryManager.FreePageListHead, &page->PageListEntry);
-            g_MemoryManager.FreePageCount++;
+    // Seed each node's free areas with the largest aligned runs of its available pages
+    ULONG size = g_MemoryManager.PageFrameArraySize;
+    ULONG pfn = MmFindNextPage(0, size, TRUE);
+    while (pfn < size) {
+        ULONG node = MM_PAGE_NODE(pfn);
+        ULONG run_end = MmFindNextPage(pfn, size, FALSE);
+        for (ULONG i = pfn; i < run_end; i++) {
+            if (MM_PAGE_NODE(i) != node) {
+                run_end = i;
+                break;
+            }
         }
+
+        g_MemoryManager.Zones[node].TotalPages += run_end - pfn;
+        g_MemoryManager.Zones[node].Statistics.TotalPages += run_end - pfn;
+        MmBuddyFreeRange(&g_MemoryManager.Zones[node], pfn, run_end - pfn);
+        pfn = MmFindNextPage(run_end, size, TRUE);
+    }
+
+    // Processors are spread over the nodes in contiguous blocks, as on a
+    // multi-socket machine, until the topology code says otherwise. Slots
+    // past the processor count wrap around so every slot names a real node
+    SYSTEM_INFO sys_info;
+    KeGetSystemInfo(&sys_info);
+    ULONG processor_count = sys_info.dwNumberOfProcessors;
+    if (processor_count == 0 || processor_count > MM_MAX_PROCESSORS) {
+        processor_count = (processor_count == 0) ? 1 : MM_MAX_PROCESSORS;
     }
 
-    g_MemoryManager.FreePhysicalPages = g_MemoryManager.FreePageCount;
+    for (ULONG cpu = 0; cpu < MM_MAX_PROCESSORS; cpu++) {
+        g_MemoryManager.ProcessorNode[cpu] = (cpu % processor_count) * g_MemoryManager.NodeCount / processor_count;
+    }
+
+    // Initialize per-CPU page caches
+    g_MemoryManager.PerCpuHighWatermark = MM_PCP_DEFAULT_HIGH;
+    g_MemoryManager.PerCpuLowWatermark = MM_PCP_DEFAULT_LOW;
+    g_MemoryManager.PerCpuBatch = MM_PCP_DEFAULT_BATCH;
+
+    for (ULONG cpu = 0; cpu < MM_MAX_PROCESSORS; cpu++) {
+        PMM_PER_CPU_PAGES pcp = &g_MemoryManager.PerCpuPages[cpu];
+        KeInitializeSpinLock(&pcp->Lock);
+        InitializeListHead(&pcp->HotListHead);
+        InitializeListHead(&pcp->ColdListHead);
+        pcp->Node = g_MemoryManager.ProcessorNode[cpu];
+        pcp->HotCount = 0;
+        pcp->ColdCount = 0;
+        RtlZeroMemory(&pcp->Statistics, sizeof(MM_PER_CPU_PAGE_STATISTICS));
+    }
+
+    // Reclaim watermarks scale with memory: 1/128 low, 1/64 high (8MB and 16MB per GB)
+    ULONG total_pages = 0;
+    for (ULONG node = 0; node < g_MemoryManager.NodeCount; node++) {
+        total_pages += g_MemoryManager.Zones[node].TotalPages;
+    }
+    g_MemoryManager.ReclaimLowWatermark = total_pages / 128;
+    g_MemoryManager.ReclaimHighWatermark = total_pages / 64;
+    KeInitializeEvent(&g_MemoryManager.ReclaimEvent, SynchronizationEvent, FALSE);
+
+    KeInitializeSpinLock(&g_MemoryManager.PagingFile.SlotLock);
+
+    KeInitializeSpinLock(&g_MemoryManager.MergeLock);
+    g_MemoryManager.MergeScanRate = MM_MERGE_DEFAULT_SCAN_RATE;
 
     return STATUS_SUCCESS;
 }
@@ -223,24 +861,33 @@ static NTSTATUS MmDetectPhysicalMemoryRanges(VOID)
     // - Parse ACPI tables
     // - Detect available memory ranges
 
-    // For demonstration, we'll create a simple memory map
-    g_MemoryManager.PhysicalMemoryRangeCount = 2;
-    g_MemoryManager.PhysicalMemoryRanges = ExAllocatePool(NonPagedPool,
-        sizeof(PHYSICAL_MEMORY_RANGE) * g_MemoryManager.PhysicalMemoryRangeCount);
+#if defined(DSLOS_HOSTED)
+    g_HostedDirectMapBase = ((ULONG_PTR)g_HostedPhysicalMemory + DSLOS_PAGE_SIZE - 1) &
+                            ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+#endif
 
-    if (g_MemoryManager.PhysicalMemoryRanges == NULL) {
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
+    // For demonstration, we'll create a simple memory map
+    g_MemoryManager.PhysicalMemoryRangeCount = 1 + MM_BOOT_NODE_COUNT;
+    g_MemoryManager.PhysicalMemoryRanges = g_PhysicalMemoryRanges;
+    g_MemoryManager.NodeCount = MM_BOOT_NODE_COUNT;
 
     // First 1MB is typically reserved
     g_MemoryManager.PhysicalMemoryRanges[0].BaseAddress = 0x00000000;
     g_MemoryManager.PhysicalMemoryRanges[0].Size = 0x100000;
     g_MemoryManager.PhysicalMemoryRanges[0].Type = MEMORY_TYPE_RESERVED;
+    g_MemoryManager.PhysicalMemoryRanges[0].Node = 0;
 
-    // Available memory starting at 1MB
-    g_MemoryManager.PhysicalMemoryRanges[1].BaseAddress = 0x00100000;
-    g_MemoryManager.PhysicalMemoryRanges[1].Size = 0x3FF00000; // ~1GB total
-    g_MemoryManager.PhysicalMemoryRanges[1].Type = MEMORY_TYPE_AVAILABLE;
+    // Available memory starting at 1MB (~1GB total), split evenly across the nodes
+    ULONG_PTR base = 0x00100000;
+    SIZE_T node_size = (0x3FF00000 / MM_BOOT_NODE_COUNT) & ~(SIZE_T)(DSLOS_PAGE_SIZE - 1);
+    for (ULONG node = 0; node < MM_BOOT_NODE_COUNT; node++) {
+        PPHYSICAL_MEMORY_RANGE range = &g_MemoryManager.PhysicalMemoryRanges[1 + node];
+        range->BaseAddress = base;
+        range->Size = (node == MM_BOOT_NODE_COUNT - 1) ? 0x40000000 - base : node_size;
+        range->Type = MEMORY_TYPE_AVAILABLE;
+        range->Node = node;
+        base += range->Size;
+    }
 
     return STATUS_SUCCESS;
 }
@@ -248,6 +895,8 @@ static NTSTATUS MmDetectPhysicalMemoryRanges(VOID)
 /**
  * @brief Initialize page frame array
  * @return NTSTATUS Status code
+ * @note The frame records, the dense per-frame arrays and the free page
+ *       bitmap are carved from one block
  */
 static NTSTATUS MmInitializePageFrameArray(VOID)
 {
@@ -262,27 +911,53 @@ static NTSTATUS MmInitializePageFrameArray(VOID)
     g_MemoryManager.TotalPhysicalPages = (ULONG)(total_physical_memory / DSLOS_PAGE_SIZE);
     g_MemoryManager.PageFrameArraySize = g_MemoryManager.TotalPhysicalPages;
 
-    // Allocate page frame array
-    g_MemoryManager.PageFrameArray = ExAllocatePool(NonPagedPool,
-        sizeof(PHYSICAL_PAGE_FRAME) * g_MemoryManager.PageFrameArraySize);
+    // Carve the page frame database from the start of the first available range
+    // large enough to hold it; those pages then fall outside every range
+    SIZE_T frame_count = g_MemoryManager.PageFrameArraySize;
+    SIZE_T records_size = sizeof(PHYSICAL_PAGE_FRAME) * frame_count;
+    SIZE_T bitmap_size = (frame_count + 63) / 64 * sizeof(ULONG64);
+    SIZE_T database_size = records_size + bitmap_size + frame_count * (sizeof(ULONG) + 3 * sizeof(UCHAR));
+    SIZE_T array_size = (database_size + DSLOS_PAGE_SIZE - 1) & ~(SIZE_T)(DSLOS_PAGE_SIZE - 1);
+
+    g_MemoryManager.PageFrameArray = NULL;
+    for (ULONG i = 0; i < g_MemoryManager.PhysicalMemoryRangeCount; i++) {
+        PPHYSICAL_MEMORY_RANGE range = &g_MemoryManager.PhysicalMemoryRanges[i];
+        if (range->Type == MEMORY_TYPE_AVAILABLE && range->Size >= array_size) {
+            g_MemoryManager.PageFrameArray = MmPhysicalToVirtual(range->BaseAddress);
+            range->BaseAddress += array_size;
+            range->Size -= array_size;
+            break;
+        }
+    }
 
     if (g_MemoryManager.PageFrameArray == NULL) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    // Initialize page frame array
-    RtlZeroMemory(g_MemoryManager.PageFrameArray,
-        sizeof(PHYSICAL_PAGE_FRAME) * g_MemoryManager.PageFrameArraySize);
+    g_MemoryManager.Statistics.ReservedPages += (ULONG)(array_size / DSLOS_PAGE_SIZE);
+
+    // Initialize page frame database
+    RtlZeroMemory(g_MemoryManager.PageFrameArray, database_size);
+
+    PUCHAR cursor = (PUCHAR)g_MemoryManager.PageFrameArray + records_size;
+    g_MemoryManager.FreePageBitmap = (PULONG64)cursor;
+    cursor += bitmap_size;
+    g_MemoryManager.PageReferenceCounts = (PULONG)cursor;
+    cursor += frame_count * sizeof(ULONG);
+    g_MemoryManager.PageFlags = cursor;
+    cursor += frame_count;
+    g_MemoryManager.PageOrders = cursor;
+    cursor += frame_count;
+    g_MemoryManager.PageNodes = cursor;
 
     ULONG_PTR current_address = 0;
     for (ULONG i = 0; i < g_MemoryManager.PageFrameArraySize; i++) {
         g_MemoryManager.PageFrameArray[i].PhysicalAddress = current_address;
-        g_MemoryManager.PageFrameArray[i].ReferenceCount = 0;
-        g_MemoryManager.PageFrameArray[i].Flags = 0;
         g_MemoryManager.PageFrameArray[i].VirtualMapping = NULL;
+        g_MemoryManager.PageFrameArray[i].AddressSpace = NULL;
         InitializeListHead(&g_MemoryManager.PageFrameArray[i].PageListEntry);
 
-        // Determine if page is available
+        // Determine if page is available, and on which node
         BOOLEAN is_available = FALSE;
         for (ULONG j = 0; j < g_MemoryManager.PhysicalMemoryRangeCount; j++) {
             if (current_address >= g_MemoryManager.PhysicalMemoryRanges[j].BaseAddress &&
@@ -291,12 +966,13 @@ static NTSTATUS MmInitializePageFrameArray(VOID)
                 if (g_MemoryManager.PhysicalMemoryRanges[j].Type == MEMORY_TYPE_AVAILABLE) {
                     is_available = TRUE;
                 }
+                MM_PAGE_NODE(i) = (UCHAR)g_MemoryManager.PhysicalMemoryRanges[j].Node;
                 break;
             }
         }
 
         if (is_available) {
-            g_MemoryManager.PageFrameArray[i].Flags |= PAGE_FLAG_AVAILABLE;
+            MmSetPagesAvailable(i, 1, TRUE);
         }
 
         current_address += DSLOS_PAGE_SIZE;
@@ -315,38 +991,106 @@ static NTSTATUS MmInitializeVirtualMemory(VOID)
     InitializeListHead(&g_MemoryManager.AddressSpaceListHead);
     g_MemoryManager.AddressSpaceCount = 0;
 
+    // Initialize system address space
+    MmInitializeAddressSpaceDescriptor(&g_MemoryManager.SystemAddressSpace, NULL,
+                                       MM_SYSTEM_RANGE_START, MM_SYSTEM_RANGE_END);
+
+    // Build the system PML4 and the page directory pointer table every address space shares
+    PMM_PTE pml4 = MmAllocatePageTable();
+    PMM_PTE pdpt = MmAllocatePageTable();
+    if (pml4 == NULL || pdpt == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pml4[MM_KERNEL_PML4_INDEX] = MM_TABLE_FRAME(pdpt) | MM_PTE_PRESENT | MM_PTE_WRITABLE;
+
+#if !defined(DSLOS_HOSTED)
+    // Keep the boot loader's direct map, through which the tables above are written
+    PMM_PTE boot_pml4 = MM_PTE_TABLE(HalGetCr3());
+    pml4[MM_DIRECT_MAP_PML4_INDEX] = boot_pml4[MM_DIRECT_MAP_PML4_INDEX];
+#endif
+    g_MemoryManager.SystemAddressSpace.PageDirectory = pml4;
+
     return STATUS_SUCCESS;
 }
 
+/**
+ * @brief Initialize an address space descriptor with an empty region tree
+ * @param Descriptor Descriptor to initialize
+ * @param Process Owning process (NULL for the system address space)
+ * @param LowestAddress Start of the range searched for free address space
+ * @param HighestAddress End of the range searched for free address space
+ */
+static VOID MmInitializeAddressSpaceDescriptor(PADDRESS_SPACE_DESCRIPTOR Descriptor,
+                                               PPROCESS_CONTROL_BLOCK Process,
+                                               ULONG_PTR LowestAddress, ULONG_PTR HighestAddress)
+{
+    Descriptor->Process = Process;
+    Descriptor->PageDirectory = NULL;
+    Descriptor->RegionCount = 0;
+    InitializeListHead(&Descriptor->AddressSpaceListEntry);
+
+    KeInitializeSpinLock(&Descriptor->PageTableLock);
+    KeInitializeSpinLock(&Descriptor->RegionLock);
+    Descriptor->RegionRoot = NULL;
+    InitializeListHead(&Descriptor->RegionListHead);
+    Descriptor->LowestAddress = LowestAddress;
+    Descriptor->HighestAddress = HighestAddress;
+
+    InitializeListHead(&Descriptor->ActiveListHead);
+    InitializeListHead(&Descriptor->InactiveListHead);
+    Descriptor->ActivePageCount = 0;
+    Descriptor->InactivePageCount = 0;
+    Descriptor->WorkingSetMaximum = 0;
+
+    Descriptor->PageMerging = FALSE;
+    Descriptor->MergeCursor = LowestAddress;
+    Descriptor->StackCacheCount = 0;
+}
+
 /**
  * @brief Initialize memory pools
  * @return NTSTATUS Status code
  */
 static NTSTATUS MmInitializeMemoryPools(VOID)
 {
+    KeInitializeSpinLock(&g_MemoryManager.PoolTagLock);
+
     // Initialize non-paged pool
-    g_MemoryManager.NonPagedPool.PoolType = NonPagedPool;
-    g_MemoryManager.NonPagedPool.PoolBase = ExAllocatePool(NonPagedPool, 16 * 1024 * 1024); // 16MB
-    g_MemoryManager.NonPagedPool.PoolSize = 16 * 1024 * 1024;
-    g_MemoryManager.NonPagedPool.PoolUsed = 0;
-    InitializeListHead(&g_MemoryManager.NonPagedPool.FreeBlockListHead);
-    KeInitializeSpinLock(&g_MemoryManager.NonPagedPool.PoolLock);
-
-    // Initialize non-paged pool with one large free block
-    PMEMORY_POOL_BLOCK initial_block = (PMEMORY_POOL_BLOCK)g_MemoryManager.NonPagedPool.PoolBase;
-    initial_block->BlockSize = g_MemoryManager.NonPagedPool.PoolSize - sizeof(MEMORY_POOL_BLOCK);
-    initial_block->Flags = 0;
-    InitializeListHead(&initial_block->ListEntry);
-    InsertTailList(&g_MemoryManager.NonPagedPool.FreeBlockListHead, &initial_block->ListEntry);
-
-    // Initialize paged pool (simplified)
-    g_MemoryManager.PagedPool.PoolType = PagedPool;
-    g_MemoryManager.PagedPool.PoolBase = ExAllocatePool(PagedPool, 32 * 1024 * 1024); // 32MB
-    g_MemoryManager.PagedPool.PoolSize = 32 * 1024 * 1024;
-    g_MemoryManager.PagedPool.PoolUsed = 0;
-    InitializeListHead(&g_MemoryManager.PagedPool.FreeBlockListHead);
-    KeInitializeSpinLock(&g_MemoryManager.PagedPool.PoolLock);
+    NTSTATUS status = MmInitializeHeapPool(&g_MemoryManager.NonPagedPool, NonPagedPool);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Initialize paged pool (simplified, backed the same way as non-paged pool)
+    return MmInitializeHeapPool(&g_MemoryManager.PagedPool, PagedPool);
+}
+
+/**
+ * @brief Initialize a kernel heap pool and commit its first segment
+ * @param Pool Pool to initialize
+ * @param PoolType Pool type
+ * @return NTSTATUS Status code
+ */
+static NTSTATUS MmInitializeHeapPool(PMEMORY_POOL Pool, POOL_TYPE PoolType)
+{
+    RtlZeroMemory(Pool, sizeof(MEMORY_POOL));
+
+    Pool->PoolType = PoolType;
+    KeInitializeSpinLock(&Pool->PoolLock);
+    InitializeListHead(&Pool->SegmentListHead);
+
+    for (ULONG fl = 0; fl < MM_HEAP_FL_COUNT; fl++) {
+        for (ULONG sl = 0; sl < MM_HEAP_SL_COUNT; sl++) {
+            InitializeListHead(&Pool->FreeLists[fl][sl]);
+        }
+    }
+
+    if (!MmHeapGrowPool(Pool, 0)) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
+    Pool->PoolBase = CONTAINING_RECORD(Pool->SegmentListHead.Flink, MM_HEAP_SEGMENT, SegmentListEntry);
     return STATUS_SUCCESS;
 }
 
@@ -365,262 +1109,4827 @@ static NTSTATUS MmInitializeKernelHeap(VOID)
 }
 
 /**
- * @brief Allocate physical memory
- * @param Size Size to allocate
- * @return Pointer to allocated physical memory
+ * @brief Get the smallest buddy order that covers a page count
+ * @param PageCount Number of pages
+ * @return Buddy order
  */
-PVOID MmAllocatePhysicalMemory(SIZE_T Size)
+static ULONG MmBuddyOrderForPages(SIZE_T PageCount)
 {
-    if (Size == 0) {
-        return NULL;
+    ULONG order = 0;
+    while (((SIZE_T)1 << order) < PageCount) {
+        order++;
     }
+    return order;
+}
 
-    SIZE_T page_count = (Size + DSLOS_PAGE_SIZE - 1) / DSLOS_PAGE_SIZE;
-    PVOID physical_memory = NULL;
+/**
+ * @brief Insert a free block into its buddy free area
+ * @param Zone Zone owning the block
+ * @param Pfn Page frame number of the block head
+ * @param Order Block order
+ * @note Caller must hold the zone lock
+ */
+static VOID MmBuddyInsertBlock(PMM_ZONE Zone, ULONG Pfn, ULONG Order)
+{
+    MM_PAGE_FLAGS(Pfn) |= PAGE_FLAG_BUDDY_HEAD;
+    MM_PAGE_ORDER(Pfn) = (UCHAR)Order;
+    InsertTailList(&Zone->FreeAreas[Order].FreeListHead, &g_MemoryManager.PageFrameArray[Pfn].PageListEntry);
+    Zone->FreeAreas[Order].FreeBlockCount++;
+}
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+/**
+ * @brief Remove a free block from its buddy free area
+ * @param Zone Zone owning the block
+ * @param Pfn Page frame number of the block head
+ * @note Caller must hold the zone lock
+ */
+static VOID MmBuddyRemoveBlock(PMM_ZONE Zone, ULONG Pfn)
+{
+    PPHYSICAL_PAGE_FRAME head = &g_MemoryManager.PageFrameArray[Pfn];
 
-    if (g_MemoryManager.FreePageCount < page_count) {
-        KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
-        return NULL; // Out of memory
+    RemoveEntryList(&head->PageListEntry);
+    InitializeListHead(&head->PageListEntry);
+    Zone->FreeAreas[MM_PAGE_ORDER(Pfn)].FreeBlockCount--;
+    MM_PAGE_FLAGS(Pfn) &= ~PAGE_FLAG_BUDDY_HEAD;
+}
+
+/**
+ * @brief Free a block and merge it with its buddies
+ * @param Zone Zone owning the block
+ * @param Pfn Page frame number of the block head
+ * @param Order Block order
+ * @note Caller must hold the zone lock. Buddies on another node are never merged
+ */
+static VOID MmBuddyFreeBlock(PMM_ZONE Zone, ULONG Pfn, ULONG Order)
+{
+    for (ULONG i = 0; i < (1UL << Order); i++) {
+        MM_PAGE_REFERENCES(Pfn + i) = 0;
+        g_MemoryManager.PageFrameArray[Pfn + i].VirtualMapping = NULL;
     }
+    MmSetPagesAvailable(Pfn, 1UL << Order, TRUE);
 
-    // Allocate contiguous pages (simplified)
-    ULONG pages_allocated = 0;
-    for (ULONG i = 0; i < g_MemoryManager.PageFrameArraySize && pages_allocated < page_count; i++) {
-        PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[i];
-        if (page->Flags & PAGE_FLAG_AVAILABLE) {
-            page->Flags &= ~PAGE_FLAG_AVAILABLE;
-            page->ReferenceCount = 1;
-            RemoveEntryList(&page->PageListEntry);
-            g_MemoryManager.FreePageCount--;
-            g_MemoryManager.FreePhysicalPages--;
+    Zone->FreePageCount += 1UL << Order;
 
-            if (physical_memory == NULL) {
-                physical_memory = (PVOID)page->PhysicalAddress;
-            }
+    // Merge with free buddies of the same order
+    while (Order < MM_MAX_ORDER) {
+        ULONG buddy_pfn = Pfn ^ (1UL << Order);
+        if (buddy_pfn + (1UL << Order) > g_MemoryManager.PageFrameArraySize) {
+            break;
+        }
 
-            pages_allocated++;
+        if (!(MM_PAGE_FLAGS(buddy_pfn) & PAGE_FLAG_BUDDY_HEAD) || MM_PAGE_ORDER(buddy_pfn) != Order ||
+            MM_PAGE_NODE(buddy_pfn) != Zone->Node) {
+            break;
         }
+
+        MmBuddyRemoveBlock(Zone, buddy_pfn);
+        Pfn &= buddy_pfn;
+        Order++;
     }
 
-    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+    MmBuddyInsertBlock(Zone, Pfn, Order);
+}
+
+/**
+ * @brief Free an arbitrary page range as naturally aligned buddy blocks
+ * @param Zone Zone owning the range
+ * @param Pfn First page frame number
+ * @param PageCount Number of pages
+ * @note Caller must hold the zone lock (or be single-threaded during init)
+ */
+static VOID MmBuddyFreeRange(PMM_ZONE Zone, ULONG Pfn, SIZE_T PageCount)
+{
+    while (PageCount > 0) {
+        ULONG order = 0;
+        while (order < MM_MAX_ORDER &&
+               (Pfn & ((1UL << (order + 1)) - 1)) == 0 &&
+               ((SIZE_T)1 << (order + 1)) <= PageCount) {
+            order++;
+        }
 
-    return physical_memory;
+        MmBuddyFreeBlock(Zone, Pfn, order);
+        Pfn += 1UL << order;
+        PageCount -= (SIZE_T)1 << order;
+    }
 }
 
 /**
- * @brief Free physical memory
- * @param Address Address to free
- * @param Size Size to free
+ * @brief Allocate a block of the given order
+ * @param Zone Zone to allocate from
+ * @param Order Block order
+ * @param Pfn Pointer to receive the page frame number of the block
+ * @return TRUE on success, FALSE if no block is available
+ * @note Caller must hold the zone lock
  */
-VOID MmFreePhysicalMemory(PVOID Address, SIZE_T Size)
+static BOOLEAN MmBuddyAllocateBlock(PMM_ZONE Zone, ULONG Order, PULONG Pfn)
 {
-    if (Address == NULL || Size == 0) {
-        return;
+    ULONG current_order = Order;
+    while (current_order <= MM_MAX_ORDER &&
+           IsListEmpty(&Zone->FreeAreas[current_order].FreeListHead)) {
+        current_order++;
     }
 
-    SIZE_T page_count = (Size + DSLOS_PAGE_SIZE - 1) / DSLOS_PAGE_SIZE;
-    ULONG_PTR base_address = (ULONG_PTR)Address;
+    if (current_order > MM_MAX_ORDER) {
+        return FALSE;
+    }
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+    PLIST_ENTRY entry = Zone->FreeAreas[current_order].FreeListHead.Flink;
+    ULONG pfn = MM_PFN(CONTAINING_RECORD(entry, PHYSICAL_PAGE_FRAME, PageListEntry));
 
-    for (SIZE_T i = 0; i < page_count; i++) {
-        ULONG_PTR page_address = base_address + (i * DSLOS_PAGE_SIZE);
-        ULONG page_index = (ULONG)(page_address / DSLOS_PAGE_SIZE);
-
-        if (page_index < g_MemoryManager.PageFrameArraySize) {
-            PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[page_index];
-            if (page->ReferenceCount > 0) {
-                page->ReferenceCount--;
-                if (page->ReferenceCount == 0) {
-                    page->Flags |= PAGE_FLAG_AVAILABLE;
-                    page->VirtualMapping = NULL;
-                    InsertTailList(&g_MemoryManager.FreePageListHead, &page->PageListEntry);
-                    g_MemoryManager.FreePageCount++;
-                    g_MemoryManager.FreePhysicalPages++;
-                }
-            }
-        }
+    MmBuddyRemoveBlock(Zone, pfn);
+
+    // Split down to the requested order, returning upper halves
+    while (current_order > Order) {
+        current_order--;
+        MmBuddyInsertBlock(Zone, pfn + (1UL << current_order), current_order);
     }
 
-    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+    MmSetPagesAvailable(pfn, 1UL << Order, FALSE);
+    for (ULONG i = 0; i < (1UL << Order); i++) {
+        MM_PAGE_REFERENCES(pfn + i) = 1;
+    }
+
+    Zone->FreePageCount -= 1UL << Order;
+
+    *Pfn = pfn;
+    return TRUE;
 }
 
 /**
- * @brief Allocate virtual memory
- * @param Process Process to allocate for
- * @param BaseAddress Base address (can be NULL)
+ * @brief Allocate pages from a node, falling back to the other nodes
+ * @param Node Node asked for
+ * @param PageCount Number of contiguous pages
+ * @param Pfn Pointer to receive the first page frame number
+ * @return TRUE on success, FALSE if no node has a large enough block
+ * @note Nodes are tried in increasing number, wrapping around, from the one asked for
+ */
+static BOOLEAN MmAllocateZonePages(ULONG Node, SIZE_T PageCount, PULONG Pfn)
+{
+    ULONG order = MmBuddyOrderForPages(PageCount);
+
+    for (ULONG i = 0; i < g_MemoryManager.NodeCount; i++) {
+        PMM_ZONE zone = &g_MemoryManager.Zones[(Node + i) % g_MemoryManager.NodeCount];
+
+        KIRQL old_irql;
+        KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+
+        if (MmBuddyAllocateBlock(zone, order, Pfn)) {
+            // Give back the unused tail of the block
+            SIZE_T block_pages = (SIZE_T)1 << order;
+            if (block_pages > PageCount) {
+                MmBuddyFreeRange(zone, *Pfn + (ULONG)PageCount, block_pages - PageCount);
+            }
+
+            KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+            return TRUE;
+        }
+
+        KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief Return a run of unreferenced pages to their node's free areas
+ * @param Pfn First page frame number
+ * @param PageCount Number of pages, all on the same node
+ */
+static VOID MmFreeZonePages(ULONG Pfn, SIZE_T PageCount)
+{
+    PMM_ZONE zone = &g_MemoryManager.Zones[MM_PAGE_NODE(Pfn)];
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+    MmBuddyFreeRange(zone, Pfn, PageCount);
+    KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+}
+
+/**
+ * @brief Get the page cache of the current processor
+ * @return Per-CPU page cache
+ * @note The caller locks it; if the thread has moved processor meanwhile the
+ *       lock still makes the access safe, the page merely goes to a sibling
+ */
+static PMM_PER_CPU_PAGES MmGetCurrentPerCpuPages(VOID)
+{
+    ULONG cpu = KeGetCurrentProcessorNumber();
+    if (cpu >= MM_MAX_PROCESSORS) {
+        cpu = 0;
+    }
+    return &g_MemoryManager.PerCpuPages[cpu];
+}
+
+/**
+ * @brief Get the node of the current processor
+ * @return Node whose memory is local to the current processor
+ */
+static ULONG MmGetCurrentNode(VOID)
+{
+    ULONG cpu = KeGetCurrentProcessorNumber();
+    if (cpu >= MM_MAX_PROCESSORS) {
+        cpu = 0;
+    }
+    return g_MemoryManager.ProcessorNode[cpu];
+}
+
+/**
+ * @brief Pick the node a page allocation should come from
+ * @return Node chosen by the current thread's memory policy; the node of the
+ *         current processor when there is no thread or no policy
+ */
+static ULONG MmSelectAllocationNode(VOID)
+{
+    PTHREAD_CONTROL_BLOCK thread = KeGetCurrentThread();
+
+    if (thread != NULL) {
+        switch (thread->MemoryPolicy) {
+        case MM_POLICY_PREFERRED:
+            if (thread->MemoryPolicyNode < g_MemoryManager.NodeCount) {
+                return thread->MemoryPolicyNode;
+            }
+            break;
+
+        case MM_POLICY_INTERLEAVE:
+            // MemoryPolicyNode is the thread's rotating interleave cursor
+            return thread->MemoryPolicyNode++ % g_MemoryManager.NodeCount;
+
+        default:
+            break;
+        }
+    }
+
+    return MmGetCurrentNode();
+}
+
+/**
+ * @brief Refill a per-CPU page cache from its node's free areas
+ * @param Pcp Per-CPU page cache, locked by the caller
+ * @note Takes the zone lock once for the whole batch
+ */
+static VOID MmRefillPerCpuPages(PMM_PER_CPU_PAGES Pcp)
+{
+    PMM_ZONE zone = &g_MemoryManager.Zones[Pcp->Node];
+    ULONG refilled = 0;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+
+    while (refilled < g_MemoryManager.PerCpuBatch) {
+        ULONG pfn;
+        if (!MmBuddyAllocateBlock(zone, 0, &pfn)) {
+            break;
+        }
+
+        MM_PAGE_REFERENCES(pfn) = 0;
+        MM_PAGE_FLAGS(pfn) |= PAGE_FLAG_PER_CPU;
+        InsertTailList(&Pcp->ColdListHead, &g_MemoryManager.PageFrameArray[pfn].PageListEntry);
+        refilled++;
+    }
+
+    KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+
+    Pcp->ColdCount += refilled;
+    Pcp->Statistics.RefillCount++;
+    Pcp->Statistics.RefillPages += refilled;
+}
+
+/**
+ * @brief Drain pages from a per-CPU page cache to its node's free areas
+ * @param Pcp Per-CPU page cache, locked by the caller
+ * @param PageCount Number of pages to drain
+ * @note Cold pages are drained before hot ones; takes the zone lock once
+ */
+static VOID MmDrainPerCpuPages(PMM_PER_CPU_PAGES Pcp, ULONG PageCount)
+{
+    PMM_ZONE zone = &g_MemoryManager.Zones[Pcp->Node];
+    ULONG drained = 0;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+
+    while (drained < PageCount && (Pcp->ColdCount > 0 || Pcp->HotCount > 0)) {
+        PLIST_ENTRY entry;
+        if (Pcp->ColdCount > 0) {
+            entry = RemoveTailList(&Pcp->ColdListHead);
+            Pcp->ColdCount--;
+        } else {
+            entry = RemoveTailList(&Pcp->HotListHead);
+            Pcp->HotCount--;
+        }
+
+        PPHYSICAL_PAGE_FRAME page = CONTAINING_RECORD(entry, PHYSICAL_PAGE_FRAME, PageListEntry);
+        InitializeListHead(&page->PageListEntry);
+        MM_PAGE_FLAGS(MM_PFN(page)) &= ~PAGE_FLAG_PER_CPU;
+        MmBuddyFreeBlock(zone, MM_PFN(page), 0);
+        drained++;
+    }
+
+    KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+
+    Pcp->Statistics.DrainCount++;
+    Pcp->Statistics.DrainPages += drained;
+}
+
+/**
+ * @brief Drain every per-CPU page cache back to the node free areas
+ * @note Used when a multi-page allocation cannot be satisfied. Each cache is
+ *       locked while it is drained, since its owner may be using it
+ */
+static VOID MmDrainAllPerCpuPages(VOID)
+{
+    for (ULONG cpu = 0; cpu < MM_MAX_PROCESSORS; cpu++) {
+        PMM_PER_CPU_PAGES pcp = &g_MemoryManager.PerCpuPages[cpu];
+        if (pcp->HotCount + pcp->ColdCount == 0) {
+            continue;
+        }
+
+        KIRQL old_irql;
+        KeAcquireSpinLock(&pcp->Lock, &old_irql);
+        MmDrainPerCpuPages(pcp, pcp->HotCount + pcp->ColdCount);
+        KeReleaseSpinLock(&pcp->Lock, old_irql);
+    }
+}
+
+/**
+ * @brief Allocate a single page from the current processor's cache
+ * @param Node Node the page must come from
+ * @return Page frame, or NULL if none is available or the processor is on another node
+ */
+static PPHYSICAL_PAGE_FRAME MmAllocatePerCpuPage(ULONG Node)
+{
+    PMM_PER_CPU_PAGES pcp = MmGetCurrentPerCpuPages();
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&pcp->Lock, &old_irql);
+
+    if (pcp->Node != Node) {
+        KeReleaseSpinLock(&pcp->Lock, old_irql);
+        return NULL;
+    }
+
+    if (pcp->HotCount + pcp->ColdCount <= g_MemoryManager.PerCpuLowWatermark) {
+        MmRefillPerCpuPages(pcp);
+    }
+
+    PPHYSICAL_PAGE_FRAME page = NULL;
+    if (pcp->HotCount > 0) {
+        page = CONTAINING_RECORD(RemoveHeadList(&pcp->HotListHead), PHYSICAL_PAGE_FRAME, PageListEntry);
+        pcp->HotCount--;
+    } else if (pcp->ColdCount > 0) {
+        page = CONTAINING_RECORD(RemoveHeadList(&pcp->ColdListHead), PHYSICAL_PAGE_FRAME, PageListEntry);
+        pcp->ColdCount--;
+    }
+
+    if (page != NULL) {
+        InitializeListHead(&page->PageListEntry);
+        MM_PAGE_FLAGS(MM_PFN(page)) &= ~PAGE_FLAG_PER_CPU;
+        MM_PAGE_REFERENCES(MM_PFN(page)) = 1;
+        pcp->Statistics.AllocationHits++;
+    }
+
+    KeReleaseSpinLock(&pcp->Lock, old_irql);
+    return page;
+}
+
+/**
+ * @brief Release a reference on a single page, caching it per-CPU when freed
+ * @param Page Page frame
+ * @note Pages of another node go straight back to their own zone
+ */
+static VOID MmFreePerCpuPage(PPHYSICAL_PAGE_FRAME Page)
+{
+    ULONG pfn = MM_PFN(Page);
+    if (MM_PAGE_REFERENCES(pfn) == 0 ||
+        InterlockedDecrement((PLONG)&MM_PAGE_REFERENCES(pfn)) != 0) {
+        return;
+    }
+
+    PMM_PER_CPU_PAGES pcp = MmGetCurrentPerCpuPages();
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&pcp->Lock, &old_irql);
+
+    if (pcp->Node != MM_PAGE_NODE(pfn)) {
+        KeReleaseSpinLock(&pcp->Lock, old_irql);
+        MmFreeZonePages(pfn, 1);
+        return;
+    }
+
+    MM_PAGE_FLAGS(pfn) |= PAGE_FLAG_PER_CPU;
+    Page->VirtualMapping = NULL;
+    InsertHeadList(&pcp->HotListHead, &Page->PageListEntry);
+    pcp->HotCount++;
+    pcp->Statistics.FreeHits++;
+
+    if (pcp->HotCount + pcp->ColdCount > g_MemoryManager.PerCpuHighWatermark) {
+        MmDrainPerCpuPages(pcp, g_MemoryManager.PerCpuBatch);
+    }
+
+    KeReleaseSpinLock(&pcp->Lock, old_irql);
+}
+
+/**
+ * @brief Take a page from a node's zeroed list
+ * @param Node Node the page must come from
+ * @return Page frame, or NULL if the list is empty
+ */
+static PPHYSICAL_PAGE_FRAME MmAllocateZeroedPage(ULONG Node)
+{
+    PMM_ZONE zone = &g_MemoryManager.Zones[Node];
+    PPHYSICAL_PAGE_FRAME page = NULL;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+
+    if (zone->ZeroedPageCount > 0) {
+        page = CONTAINING_RECORD(RemoveHeadList(&zone->ZeroedListHead), PHYSICAL_PAGE_FRAME, PageListEntry);
+        zone->ZeroedPageCount--;
+        InitializeListHead(&page->PageListEntry);
+        MM_PAGE_FLAGS(MM_PFN(page)) &= ~PAGE_FLAG_ZEROED;
+        MM_PAGE_REFERENCES(MM_PFN(page)) = 1;
+    }
+
+    KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+    return page;
+}
+
+/**
+ * @brief Return every zeroed page to the buddy free areas
+ * @note Used when an allocation cannot be satisfied otherwise
+ */
+static VOID MmReleaseZeroedPages(VOID)
+{
+    for (ULONG node = 0; node < g_MemoryManager.NodeCount; node++) {
+        PMM_ZONE zone = &g_MemoryManager.Zones[node];
+
+        KIRQL old_irql;
+        KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+
+        while (zone->ZeroedPageCount > 0) {
+            PPHYSICAL_PAGE_FRAME page = CONTAINING_RECORD(RemoveHeadList(&zone->ZeroedListHead),
+                                                          PHYSICAL_PAGE_FRAME, PageListEntry);
+            zone->ZeroedPageCount--;
+            InitializeListHead(&page->PageListEntry);
+            MM_PAGE_FLAGS(MM_PFN(page)) &= ~PAGE_FLAG_ZEROED;
+            MmBuddyFreeBlock(zone, MM_PFN(page), 0);
+        }
+
+        KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+    }
+}
+
+/**
+ * @brief Count free physical pages
+ * @return Pages in the free areas, zeroed lists and per-CPU caches
+ * @note Read without the zone locks, so the count is a snapshot
+ */
+static ULONG MmGetFreePageCount(VOID)
+{
+    ULONG free_pages = 0;
+
+    for (ULONG node = 0; node < g_MemoryManager.NodeCount; node++) {
+        free_pages += g_MemoryManager.Zones[node].FreePageCount + g_MemoryManager.Zones[node].ZeroedPageCount;
+    }
+
+    // Pages parked in per-CPU caches are still free
+    for (ULONG cpu = 0; cpu < MM_MAX_PROCESSORS; cpu++) {
+        free_pages += g_MemoryManager.PerCpuPages[cpu].HotCount + g_MemoryManager.PerCpuPages[cpu].ColdCount;
+    }
+
+    return free_pages;
+}
+
+/**
+ * @brief Wake the reclaim thread unless it is already on its way
+ */
+static VOID MmWakeReclaimThread(VOID)
+{
+    if (InterlockedExchange(&g_MemoryManager.ReclaimPending, 1) == 0) {
+        KeSetEvent(&g_MemoryManager.ReclaimEvent, IO_NO_INCREMENT, FALSE);
+    }
+}
+
+/**
+ * @brief Wake the reclaim thread if free pages fell below the low watermark
+ * @note Only the zones are counted, which is cheap enough for every allocation.
+ *       Pages parked in per-CPU caches are left out, so this may wake the
+ *       thread a little early; it recounts them before trimming anything
+ */
+static VOID MmCheckReclaimWatermark(VOID)
+{
+    ULONG free_pages = 0;
+
+    if (g_MemoryManager.ReclaimPending) {
+        return;
+    }
+
+    for (ULONG node = 0; node < g_MemoryManager.NodeCount; node++) {
+        free_pages += g_MemoryManager.Zones[node].FreePageCount + g_MemoryManager.Zones[node].ZeroedPageCount;
+    }
+
+    if (free_pages < g_MemoryManager.ReclaimLowWatermark) {
+        MmWakeReclaimThread();
+    }
+}
+
+/**
+ * @brief Allocate physical pages
  * @param Size Size to allocate
- * @param Protect Memory protection flags
- * @return Pointer to allocated virtual memory
+ * @param Flags MM_ALLOCATE_* flags
+ * @return Pointer to allocated physical memory
+ * @note Pages come from the node picked by the current thread's memory policy,
+ *       or from the nearest other node when that one is exhausted. A failed
+ *       multi-page allocation compacts the node, unless MM_ALLOCATE_NO_COMPACT
+ *       says the caller holds a page table lock, and then asks the reclaim
+ *       thread to compact in the background. Falling below the low watermark
+ *       wakes the reclaim thread too
  */
-PVOID MmAllocateVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size, ULONG Protect)
+static PVOID MmAllocatePhysicalPages(SIZE_T Size, ULONG Flags)
 {
+    
     if (Size == 0) {
         return NULL;
     }
 
-    // Align size to page boundary
-    SIZE_T aligned_size = (Size + DSLOS_PAGE_SIZE - 1) & ~(DSLOS_PAGE_SIZE - 1);
-
-    // Find free virtual address space (simplified)
-    PVOID virtual_address = BaseAddress;
-    if (virtual_address == NULL) {
-        virtual_address = MmFindFreeVirtualAddress(Process, aligned_size);
-        if (virtual_address == NULL) {
-            return NULL; // Out of virtual address space
-        }
-    }
+    SIZE_T page_count = (Size + DSLOS_PAGE_SIZE - 1) / DSLOS_PAGE_SIZE;
+    ULONG order = MmBuddyOrderForPages(page_count);
+    if (order > MM_MAX_ORDER) {
+        return NULL; // Larger than the biggest contiguous block
+    }
+
+    ULONG node = MmSelectAllocationNode();
+    PPHYSICAL_PAGE_FRAME page = NULL;
+
+    // Single zeroed pages come from the list the idle-time worker fills
+    BOOLEAN zeroed = (Flags & MM_ALLOCATE_ZEROED) != 0;
+    if (zeroed) {
+        page = (page_count == 1) ? MmAllocateZeroedPage(node) : NULL;
+        InterlockedIncrement((PLONG)((page != NULL) ? &g_MemoryManager.Statistics.ZeroedPageListHits :
+                                                      &g_MemoryManager.Statistics.ZeroedPageListMisses));
+    }
+    BOOLEAN needs_zeroing = zeroed && page == NULL;
+
+    // Single pages come from the per-CPU cache without a zone lock
+    if (page == NULL && page_count == 1) {
+        page = MmAllocatePerCpuPage(node);
+    }
+
+    if (page == NULL) {
+        ULONG pfn;
+        if (!MmAllocateZonePages(node, page_count, &pfn)) {
+            // Pages parked in per-CPU caches or zeroed lists may complete a larger block
+            MmDrainAllPerCpuPages();
+            MmReleaseZeroedPages();
+
+            BOOLEAN allocated = MmAllocateZonePages(node, page_count, &pfn);
+            if (!allocated && order > 0 && !(Flags & MM_ALLOCATE_NO_COMPACT)) {
+                allocated = MmCompactZone(&g_MemoryManager.Zones[node], order) &&
+                            MmAllocateZonePages(node, page_count, &pfn);
+            }
+
+            if (!allocated) {
+                if (order > 0 && order > g_MemoryManager.CompactionOrder) {
+                    g_MemoryManager.CompactionOrder = order;
+                }
+                MmWakeReclaimThread();
+                return NULL; // Out of memory
+            }
+        }
+        page = &g_MemoryManager.PageFrameArray[pfn];
+    }
+
+    MmCheckReclaimWatermark();
+
+    ULONG page_node = MM_PAGE_NODE(MM_PFN(page));
+    if (page_node == node) {
+        InterlockedIncrement((PLONG)&g_MemoryManager.Zones[node].Statistics.NumaHit);
+    } else {
+        InterlockedIncrement((PLONG)&g_MemoryManager.Zones[page_node].Statistics.NumaMiss);
+        InterlockedIncrement((PLONG)&g_MemoryManager.Zones[node].Statistics.NumaForeign);
+    }
+
+    if (needs_zeroing) {
+        RtlZeroMemory(MmPhysicalToVirtual(page->PhysicalAddress), page_count * DSLOS_PAGE_SIZE);
+    }
+
+    return (PVOID)page->PhysicalAddress;
+}
+
+/**
+ * @brief Get the direct map address of physical memory
+ * @param PhysicalAddress Physical address
+ * @return Kernel virtual address the memory can be accessed through
+ */
+PVOID MmPhysicalToVirtual(ULONG_PTR PhysicalAddress)
+{
+#if defined(DSLOS_HOSTED)
+    return (PVOID)(PhysicalAddress + g_HostedDirectMapBase);
+#else
+    return (PVOID)(PhysicalAddress + MM_DIRECT_MAP_BASE);
+#endif
+}
+
+/**
+ * @brief Get the physical address behind a direct map address
+ * @param VirtualAddress Address returned by MmPhysicalToVirtual
+ * @return Physical address
+ */
+ULONG_PTR MmVirtualToPhysical(PVOID VirtualAddress)
+{
+#if defined(DSLOS_HOSTED)
+    return (ULONG_PTR)VirtualAddress - g_HostedDirectMapBase;
+#else
+    return (ULONG_PTR)VirtualAddress - MM_DIRECT_MAP_BASE;
+#endif
+}
+
+/**
+ * @brief Allocate physical memory
+ * @param Size Size to allocate
+ * @return Pointer to allocated physical memory
+ * @note The contents of the memory are undefined
+ */
+PVOID MmAllocatePhysicalMemory(SIZE_T Size)
+{
+    return MmAllocatePhysicalPages(Size, 0);
+}
+
+/**
+ * @brief Allocate zero-filled physical memory
+ * @param Size Size to allocate
+ * @return Pointer to allocated physical memory
+ * @note Single pages are taken from the pre-zeroed list when it has one, so
+ *       the caller does not pay for clearing them
+ */
+PVOID MmAllocateZeroedPhysicalMemory(SIZE_T Size)
+{
+    return MmAllocatePhysicalPages(Size, MM_ALLOCATE_ZEROED);
+}
+
+/**
+ * @brief Zero free pages ahead of demand
+ * @param MaxPages Maximum number of pages to zero
+ * @return Number of pages zeroed
+ * @note Called from the idle thread. Pages of the current processor's node
+ *       are zeroed outside the zone lock until the node holds
+ *       MM_ZERO_PAGE_TARGET zeroed pages
+ */
+ULONG MmZeroFreePages(ULONG MaxPages)
+{
+    PMM_ZONE zone = &g_MemoryManager.Zones[MmGetCurrentNode()];
+    ULONG zeroed = 0;
+
+    while (zeroed < MaxPages) {
+        ULONG pfn;
+
+        KIRQL old_irql;
+        KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+
+        if (zone->ZeroedPageCount >= MM_ZERO_PAGE_TARGET || !MmBuddyAllocateBlock(zone, 0, &pfn)) {
+            KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+            break;
+        }
+
+        KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+
+        PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[pfn];
+        RtlZeroMemory(MmPhysicalToVirtual(page->PhysicalAddress), DSLOS_PAGE_SIZE);
+
+        KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+        MM_PAGE_REFERENCES(pfn) = 0;
+        MM_PAGE_FLAGS(pfn) |= PAGE_FLAG_ZEROED;
+        InsertTailList(&zone->ZeroedListHead, &page->PageListEntry);
+        zone->ZeroedPageCount++;
+        KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+
+        zeroed++;
+    }
+
+    if (zeroed > 0) {
+        InterlockedExchangeAdd((PLONG)&g_MemoryManager.Statistics.IdleZeroedPages, (LONG)zeroed);
+    }
+
+    return zeroed;
+}
+
+/**
+ * @brief Enter a frame in the stable merge table
+ * @param Page Frame that just became merged (MergeLock held)
+ * @note When every probed slot is taken the home slot is reused; the frame it
+ *       held stays merged but is no longer offered to new pages
+ */
+static VOID MmInsertMergedPage(PPHYSICAL_PAGE_FRAME Page)
+{
+    ULONG pfn = MM_PFN(Page);
+    ULONG home = Page->MergeHash & (MM_MERGE_TABLE_SIZE - 1);
+    ULONG slot = home;
+
+    for (ULONG probe = 0; probe < MM_MERGE_TABLE_PROBES; probe++) {
+        ULONG index = (home + probe) & (MM_MERGE_TABLE_SIZE - 1);
+        if (g_MemoryManager.MergeStableTable[index] == MM_MERGE_SLOT_EMPTY) {
+            slot = index;
+            break;
+        }
+    }
+
+    g_MemoryManager.MergeStableTable[slot] = pfn;
+    MM_PAGE_FLAGS(pfn) |= PAGE_FLAG_MERGED;
+    g_MemoryManager.Statistics.MergedFrames++;
+}
+
+/**
+ * @brief Turn a merged frame back into an ordinary page
+ * @param Page Merged frame with a single reference left (MergeLock held)
+ */
+static VOID MmRemoveMergedPage(PPHYSICAL_PAGE_FRAME Page)
+{
+    ULONG pfn = MM_PFN(Page);
+    ULONG home = Page->MergeHash & (MM_MERGE_TABLE_SIZE - 1);
+
+    for (ULONG probe = 0; probe < MM_MERGE_TABLE_PROBES; probe++) {
+        ULONG index = (home + probe) & (MM_MERGE_TABLE_SIZE - 1);
+        if (g_MemoryManager.MergeStableTable[index] == pfn) {
+            g_MemoryManager.MergeStableTable[index] = MM_MERGE_SLOT_EMPTY;
+            break;
+        }
+    }
+
+    MM_PAGE_FLAGS(pfn) &= ~PAGE_FLAG_MERGED;
+    g_MemoryManager.Statistics.MergedFrames--;
+}
+
+/**
+ * @brief Find a merged frame by content hash and reference it
+ * @param Hash Content hash
+ * @return Referenced merged frame, or NULL if none has the hash
+ * @note The reference is taken under MergeLock so the frame cannot be freed
+ *       between the lookup and its new mapping
+ */
+static PPHYSICAL_PAGE_FRAME MmReferenceMergedPage(ULONG Hash)
+{
+    PPHYSICAL_PAGE_FRAME found = NULL;
+    ULONG home = Hash & (MM_MERGE_TABLE_SIZE - 1);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.MergeLock, &old_irql);
+
+    for (ULONG probe = 0; probe < MM_MERGE_TABLE_PROBES; probe++) {
+        ULONG pfn = g_MemoryManager.MergeStableTable[(home + probe) & (MM_MERGE_TABLE_SIZE - 1)];
+        if (pfn != MM_MERGE_SLOT_EMPTY && g_MemoryManager.PageFrameArray[pfn].MergeHash == Hash) {
+            found = &g_MemoryManager.PageFrameArray[pfn];
+            InterlockedIncrement((PLONG)&MM_PAGE_REFERENCES(pfn));
+            g_MemoryManager.Statistics.MergedMappings++;
+            break;
+        }
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.MergeLock, old_irql);
+    return found;
+}
+
+/**
+ * @brief Drop a reference to a merged frame
+ * @param Page Merged frame
+ * @return TRUE if the reference was dropped; FALSE if it is the last one, in
+ *         which case the frame is no longer merged and the caller frees it
+ */
+static BOOLEAN MmReleaseMergedPage(PPHYSICAL_PAGE_FRAME Page)
+{
+    ULONG pfn = MM_PFN(Page);
+    BOOLEAN released = FALSE;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.MergeLock, &old_irql);
+
+    if (!(MM_PAGE_FLAGS(pfn) & PAGE_FLAG_MERGED)) {
+        // Unmerged by another sharer meanwhile
+    } else if (MM_PAGE_REFERENCES(pfn) > 1) {
+        InterlockedDecrement((PLONG)&MM_PAGE_REFERENCES(pfn));
+        g_MemoryManager.Statistics.MergedMappings--;
+        released = TRUE;
+    } else {
+        MmRemoveMergedPage(Page);
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.MergeLock, old_irql);
+    return released;
+}
+
+/**
+ * @brief Take over a merged frame whose other sharers are gone
+ * @param Page Merged frame mapped by the caller (page table lock held)
+ * @return TRUE if the caller holds the only reference and may write the frame
+ */
+static BOOLEAN MmUnmergePage(PPHYSICAL_PAGE_FRAME Page)
+{
+    ULONG pfn = MM_PFN(Page);
+    BOOLEAN owned = FALSE;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.MergeLock, &old_irql);
+
+    if (MM_PAGE_REFERENCES(pfn) == 1) {
+        if (MM_PAGE_FLAGS(pfn) & PAGE_FLAG_MERGED) {
+            MmRemoveMergedPage(Page);
+        }
+        owned = TRUE;
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.MergeLock, old_irql);
+    return owned;
+}
+
+/**
+ * @brief Free physical memory
+ * @param Address Address to free
+ * @param Size Size to free
+ */
+VOID MmFreePhysicalMemory(PVOID Address, SIZE_T Size)
+{
+    if (Address == NULL || Size == 0) {
+        return;
+    }
+
+    SIZE_T page_count = (Size + DSLOS_PAGE_SIZE - 1) / DSLOS_PAGE_SIZE;
+    ULONG base_pfn = (ULONG)((ULONG_PTR)Address / DSLOS_PAGE_SIZE);
+
+    if (page_count == 1) {
+        if (base_pfn < g_MemoryManager.PageFrameArraySize) {
+            PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[base_pfn];
+            if ((MM_PAGE_FLAGS(base_pfn) & PAGE_FLAG_MERGED) && MmReleaseMergedPage(page)) {
+                return;
+            }
+            MmFreePerCpuPage(page);
+        }
+        return;
+    }
+
+    // Release references and hand back each run of pages that became free.
+    // A run ends where the node changes so it goes back to a single zone
+    ULONG run_start = 0;
+    SIZE_T run_length = 0;
+
+    for (SIZE_T i = 0; i < page_count; i++) {
+        ULONG pfn = base_pfn + (ULONG)i;
+        BOOLEAN freed = FALSE;
+
+        if (pfn < g_MemoryManager.PageFrameArraySize) {
+            if (MM_PAGE_REFERENCES(pfn) > 0) {
+                // Shared pages are referenced without a zone lock
+                freed = (InterlockedDecrement((PLONG)&MM_PAGE_REFERENCES(pfn)) == 0);
+            }
+
+            if (run_length > 0 && MM_PAGE_NODE(pfn) != MM_PAGE_NODE(run_start)) {
+                MmFreeZonePages(run_start, run_length);
+                run_length = 0;
+            }
+        }
+
+        if (freed) {
+            if (run_length == 0) {
+                run_start = pfn;
+            }
+            run_length++;
+        } else if (run_length > 0) {
+            MmFreeZonePages(run_start, run_length);
+            run_length = 0;
+        }
+    }
+
+    if (run_length > 0) {
+        MmFreeZonePages(run_start, run_length);
+    }
+}
+
+/**
+ * @brief Take an extra reference on allocated physical pages
+ * @param Address Physical address of the first page
+ * @param PageCount Number of pages
+ * @note Each reference is dropped by a matching MmFreePhysicalMemory
+ */
+static VOID MmReferencePhysicalPages(ULONG_PTR Address, SIZE_T PageCount)
+{
+    ULONG base_pfn = (ULONG)(Address / DSLOS_PAGE_SIZE);
+
+    for (SIZE_T i = 0; i < PageCount; i++) {
+        ULONG pfn = base_pfn + (ULONG)i;
+
+        if (MM_PAGE_FLAGS(pfn) & PAGE_FLAG_MERGED) {
+            KIRQL old_irql;
+            KeAcquireSpinLock(&g_MemoryManager.MergeLock, &old_irql);
+            InterlockedIncrement((PLONG)&MM_PAGE_REFERENCES(pfn));
+            g_MemoryManager.Statistics.MergedMappings++;
+            KeReleaseSpinLock(&g_MemoryManager.MergeLock, old_irql);
+            continue;
+        }
+
+        InterlockedIncrement((PLONG)&MM_PAGE_REFERENCES(pfn));
+    }
+}
+
+/**
+ * @brief Find the lowest set bit
+ * @param Mask Non-zero bit mask
+ * @return Bit index
+ */
+static ULONG MmHeapFindFirstSet(ULONG Mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, Mask);
+    return (ULONG)index;
+#else
+    return (ULONG)__builtin_ctz(Mask);
+#endif
+}
+
+/**
+ * @brief Find the highest set bit
+ * @param Value Non-zero value
+ * @return Bit index
+ */
+static ULONG MmHeapFindLastSet(SIZE_T Value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, (ULONG64)Value);
+    return (ULONG)index;
+#else
+    return (ULONG)(63 - __builtin_clzll((unsigned long long)Value));
+#endif
+}
+
+/**
+ * @brief Map a block size to the size class that holds it
+ * @param Size Block size
+ * @param FirstLevel Receives the first-level index
+ * @param SecondLevel Receives the second-level index
+ */
+static VOID MmHeapMappingInsert(SIZE_T Size, PULONG FirstLevel, PULONG SecondLevel)
+{
+    ULONG fl = MmHeapFindLastSet(Size);
+
+    *SecondLevel = (ULONG)(Size >> (fl - MM_HEAP_SL_SHIFT)) & (MM_HEAP_SL_COUNT - 1);
+    *FirstLevel = fl - MM_HEAP_FL_SHIFT;
+}
+
+/**
+ * @brief Map a request to the first size class whose blocks all satisfy it
+ * @param Size Block size needed
+ * @param FirstLevel Receives the first-level index
+ * @param SecondLevel Receives the second-level index
+ */
+static VOID MmHeapMappingSearch(SIZE_T Size, PULONG FirstLevel, PULONG SecondLevel)
+{
+    Size += ((SIZE_T)1 << (MmHeapFindLastSet(Size) - MM_HEAP_SL_SHIFT)) - 1;
+    MmHeapMappingInsert(Size, FirstLevel, SecondLevel);
+}
+
+/**
+ * @brief Insert a free block into its size class
+ * @param Pool Pool (lock held)
+ * @param Block Free block
+ */
+static VOID MmHeapInsertFreeBlock(PMEMORY_POOL Pool, PMM_HEAP_BLOCK Block)
+{
+    SIZE_T size = MM_HEAP_BLOCK_SIZE(Block);
+    ULONG fl, sl;
+    MmHeapMappingInsert(size, &fl, &sl);
+
+    Block->Size |= MM_HEAP_BLOCK_FREE;
+    InsertHeadList(&Pool->FreeLists[fl][sl], &Block->FreeListEntry);
+    Pool->FirstLevelBitmap |= 1UL << fl;
+    Pool->SecondLevelBitmap[fl] |= 1UL << sl;
+
+    Pool->Statistics.FreeBytes += size;
+    Pool->Statistics.FreeBlockCount++;
+    Pool->Statistics.SizeClasses[fl * MM_HEAP_SL_COUNT + sl].FreeBlocks++;
+}
+
+/**
+ * @brief Remove a free block from its size class
+ * @param Pool Pool (lock held)
+ * @param Block Free block
+ */
+static VOID MmHeapRemoveFreeBlock(PMEMORY_POOL Pool, PMM_HEAP_BLOCK Block)
+{
+    SIZE_T size = MM_HEAP_BLOCK_SIZE(Block);
+    ULONG fl, sl;
+    MmHeapMappingInsert(size, &fl, &sl);
+
+    RemoveEntryList(&Block->FreeListEntry);
+    Block->Size &= ~(SIZE_T)MM_HEAP_BLOCK_FREE;
+
+    if (IsListEmpty(&Pool->FreeLists[fl][sl])) {
+        Pool->SecondLevelBitmap[fl] &= ~(1UL << sl);
+        if (Pool->SecondLevelBitmap[fl] == 0) {
+            Pool->FirstLevelBitmap &= ~(1UL << fl);
+        }
+    }
+
+    Pool->Statistics.FreeBytes -= size;
+    Pool->Statistics.FreeBlockCount--;
+    Pool->Statistics.SizeClasses[fl * MM_HEAP_SL_COUNT + sl].FreeBlocks--;
+}
+
+/**
+ * @brief Find a free block in the first non-empty class at or above a size class
+ * @param Pool Pool (lock held)
+ * @param FirstLevel First-level index to start from
+ * @param SecondLevel Second-level index to start from
+ * @return Free block, or NULL if none is large enough
+ */
+static PMM_HEAP_BLOCK MmHeapFindFreeBlock(PMEMORY_POOL Pool, ULONG FirstLevel, ULONG SecondLevel)
+{
+    if (FirstLevel >= MM_HEAP_FL_COUNT) {
+        return NULL;
+    }
+
+    ULONG sl_map = Pool->SecondLevelBitmap[FirstLevel] & (~0UL << SecondLevel);
+    if (sl_map == 0) {
+        ULONG fl_map = (FirstLevel + 1 < MM_HEAP_FL_COUNT) ?
+                       Pool->FirstLevelBitmap & (~0UL << (FirstLevel + 1)) : 0;
+        if (fl_map == 0) {
+            return NULL;
+        }
+
+        FirstLevel = MmHeapFindFirstSet(fl_map);
+        sl_map = Pool->SecondLevelBitmap[FirstLevel];
+    }
+
+    SecondLevel = MmHeapFindFirstSet(sl_map);
+    return CONTAINING_RECORD(Pool->FreeLists[FirstLevel][SecondLevel].Flink, MM_HEAP_BLOCK, FreeListEntry);
+}
+
+/**
+ * @brief Get the block that physically follows a block
+ * @param Block Heap block
+ * @return Next block, or NULL at the end of the segment
+ */
+static PMM_HEAP_BLOCK MmHeapNextBlock(PMM_HEAP_BLOCK Block)
+{
+    if (Block->Size & MM_HEAP_BLOCK_LAST) {
+        return NULL;
+    }
+    return (PMM_HEAP_BLOCK)((PUCHAR)Block + MM_HEAP_BLOCK_SIZE(Block));
+}
+
+/**
+ * @brief Get the block that physically precedes a block
+ * @param Block Heap block
+ * @return Previous block, or NULL at the start of the segment
+ */
+static PMM_HEAP_BLOCK MmHeapPrevBlock(PMM_HEAP_BLOCK Block)
+{
+    if (Block->PrevSize == 0) {
+        return NULL;
+    }
+    return (PMM_HEAP_BLOCK)((PUCHAR)Block - Block->PrevSize);
+}
+
+/**
+ * @brief Add a segment of buddy pages to a pool
+ * @param Pool Pool (lock not held)
+ * @param MinimumBlockSize Block size the new segment must be able to hold
+ * @return TRUE on success, FALSE if out of physical memory
+ * @note The pages are allocated before the pool lock is taken, so a failed
+ *       allocation may compact memory without the pool spinlock held
+ */
+static BOOLEAN MmHeapGrowPool(PMEMORY_POOL Pool, SIZE_T MinimumBlockSize)
+{
+    SIZE_T segment_size = MM_HEAP_SEGMENT_SIZE;
+    if (MinimumBlockSize + MM_HEAP_SEGMENT_HEADER > segment_size) {
+        segment_size = (MinimumBlockSize + MM_HEAP_SEGMENT_HEADER + DSLOS_PAGE_SIZE - 1) &
+                       ~(SIZE_T)(DSLOS_PAGE_SIZE - 1);
+    }
+
+    PVOID pages = MmAllocatePhysicalMemory(segment_size);
+    if (pages == NULL) {
+        return FALSE;
+    }
+
+    PMM_HEAP_SEGMENT segment = MmPhysicalToVirtual((ULONG_PTR)pages);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Pool->PoolLock, &old_irql);
+
+    segment->Size = segment_size;
+    InsertTailList(&Pool->SegmentListHead, &segment->SegmentListEntry);
+    Pool->PoolSize += segment_size;
+    Pool->Statistics.SegmentCount++;
+
+    // The whole segment starts out as one free block
+    PMM_HEAP_BLOCK block = (PMM_HEAP_BLOCK)((PUCHAR)segment + MM_HEAP_SEGMENT_HEADER);
+    block->PrevSize = 0;
+    block->Size = (segment_size - MM_HEAP_SEGMENT_HEADER) | MM_HEAP_BLOCK_LAST;
+    block->Tag = 0;
+    block->PoolType = Pool->PoolType;
+    MmHeapInsertFreeBlock(Pool, block);
+
+    KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+
+    return TRUE;
+}
+
+/**
+ * @brief Allocate a block from a pool's size classes
+ * @param Pool Pool to allocate from
+ * @param NumberOfBytes Requested size
+ * @param Tag Pool tag
+ * @return Pointer to the payload, or NULL on failure
+ */
+static PVOID MmHeapAllocate(PMEMORY_POOL Pool, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    SIZE_T block_size = MM_HEAP_ALIGN_UP(NumberOfBytes + MM_HEAP_HEADER_SIZE);
+    if (block_size < MM_HEAP_MIN_BLOCK_SIZE) {
+        block_size = MM_HEAP_MIN_BLOCK_SIZE;
+    }
+
+    ULONG fl, sl;
+    MmHeapMappingSearch(block_size, &fl, &sl);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Pool->PoolLock, &old_irql);
+
+    // Grow without the pool lock held, then look again; another allocation
+    // may have taken the new segment in between, which fails this one
+    PMM_HEAP_BLOCK block = MmHeapFindFreeBlock(Pool, fl, sl);
+    if (block == NULL) {
+        KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+        BOOLEAN grown = MmHeapGrowPool(Pool, block_size);
+        KeAcquireSpinLock(&Pool->PoolLock, &old_irql);
+
+        if (grown) {
+            block = MmHeapFindFreeBlock(Pool, fl, sl);
+        }
+    }
+
+    if (block == NULL) {
+        Pool->Statistics.FailedAllocationCount++;
+        KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+        return NULL;
+    }
+
+    MmHeapRemoveFreeBlock(Pool, block);
+
+    // Split off the tail when it can hold a block of its own
+    SIZE_T found_size = MM_HEAP_BLOCK_SIZE(block);
+    if (found_size - block_size >= MM_HEAP_MIN_BLOCK_SIZE) {
+        PMM_HEAP_BLOCK remainder = (PMM_HEAP_BLOCK)((PUCHAR)block + block_size);
+        remainder->PrevSize = block_size;
+        remainder->Size = (found_size - block_size) | (block->Size & MM_HEAP_BLOCK_LAST);
+        remainder->Tag = 0;
+        remainder->PoolType = Pool->PoolType;
+
+        PMM_HEAP_BLOCK next = MmHeapNextBlock(remainder);
+        if (next != NULL) {
+            next->PrevSize = found_size - block_size;
+        }
+
+        block->Size = block_size;
+        MmHeapInsertFreeBlock(Pool, remainder);
+    } else {
+        block_size = found_size;
+    }
+
+    block->Tag = Tag;
+
+    MmHeapMappingInsert(block_size, &fl, &sl);
+    Pool->Statistics.SizeClasses[fl * MM_HEAP_SL_COUNT + sl].AllocatedBlocks++;
+    Pool->Statistics.AllocatedBytes += block_size;
+    Pool->Statistics.AllocationCount++;
+    Pool->PoolUsed += block_size;
+
+    KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+
+    return (PUCHAR)block + MM_HEAP_HEADER_SIZE;
+}
+
+/**
+ * @brief Return a block to its pool, coalescing with free neighbours
+ * @param Pool Pool the block belongs to
+ * @param Block Allocated block
+ */
+static VOID MmHeapFree(PMEMORY_POOL Pool, PMM_HEAP_BLOCK Block)
+{
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Pool->PoolLock, &old_irql);
+
+    SIZE_T block_size = MM_HEAP_BLOCK_SIZE(Block);
+    ULONG fl, sl;
+    MmHeapMappingInsert(block_size, &fl, &sl);
+    Pool->Statistics.SizeClasses[fl * MM_HEAP_SL_COUNT + sl].AllocatedBlocks--;
+    Pool->Statistics.AllocatedBytes -= block_size;
+    Pool->Statistics.FreeCount++;
+    Pool->PoolUsed -= block_size;
+
+    // Merge with the following block
+    PMM_HEAP_BLOCK next = MmHeapNextBlock(Block);
+    if (next != NULL && (next->Size & MM_HEAP_BLOCK_FREE)) {
+        MmHeapRemoveFreeBlock(Pool, next);
+        Block->Size = (block_size + MM_HEAP_BLOCK_SIZE(next)) | (next->Size & MM_HEAP_BLOCK_LAST);
+    }
+
+    // Merge with the preceding block
+    PMM_HEAP_BLOCK prev = MmHeapPrevBlock(Block);
+    if (prev != NULL && (prev->Size & MM_HEAP_BLOCK_FREE)) {
+        MmHeapRemoveFreeBlock(Pool, prev);
+        prev->Size = (MM_HEAP_BLOCK_SIZE(prev) + MM_HEAP_BLOCK_SIZE(Block)) |
+                     (Block->Size & MM_HEAP_BLOCK_LAST);
+        Block = prev;
+    }
+
+    block_size = MM_HEAP_BLOCK_SIZE(Block);
+    next = MmHeapNextBlock(Block);
+    if (next != NULL) {
+        next->PrevSize = block_size;
+    }
+
+    // Give a completely free segment back to the page allocator, keeping the first one
+    PMM_HEAP_SEGMENT segment = (PMM_HEAP_SEGMENT)((PUCHAR)Block - MM_HEAP_SEGMENT_HEADER);
+    if (Block->PrevSize == 0 && (Block->Size & MM_HEAP_BLOCK_LAST) && segment != Pool->PoolBase) {
+        RemoveEntryList(&segment->SegmentListEntry);
+        Pool->PoolSize -= segment->Size;
+        Pool->Statistics.SegmentCount--;
+        KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+
+        MmFreePhysicalMemory((PVOID)MmVirtualToPhysical(segment), segment->Size);
+        return;
+    }
+
+    MmHeapInsertFreeBlock(Pool, Block);
+
+    KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+}
+
+/**
+ * @brief Allocate a large, page-backed block
+ * @param Pool Pool to charge
+ * @param NumberOfBytes Requested size
+ * @param Tag Pool tag
+ * @return Pointer to the payload, or NULL on failure
+ */
+static PVOID MmHeapAllocateLarge(PMEMORY_POOL Pool, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    SIZE_T size = (NumberOfBytes + MM_HEAP_HEADER_SIZE + DSLOS_PAGE_SIZE - 1) &
+                  ~(SIZE_T)(DSLOS_PAGE_SIZE - 1);
+
+    PVOID pages = MmAllocatePhysicalMemory(size);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Pool->PoolLock, &old_irql);
+
+    if (pages == NULL) {
+        Pool->Statistics.FailedAllocationCount++;
+        KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+        return NULL;
+    }
+
+    Pool->Statistics.LargeAllocationCount++;
+    Pool->Statistics.LargeAllocationBytes += size;
+    Pool->Statistics.AllocationCount++;
+    Pool->PoolUsed += size;
+
+    KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+
+    PMM_HEAP_BLOCK block = MmPhysicalToVirtual((ULONG_PTR)pages);
+    block->PrevSize = 0;
+    block->Size = size | MM_HEAP_BLOCK_LARGE | MM_HEAP_BLOCK_LAST;
+    block->Tag = Tag;
+    block->PoolType = Pool->PoolType;
+
+    return (PUCHAR)block + MM_HEAP_HEADER_SIZE;
+}
+
+/**
+ * @brief Free a large, page-backed block
+ * @param Pool Pool the block was charged to
+ * @param Block Large block
+ */
+static VOID MmHeapFreeLarge(PMEMORY_POOL Pool, PMM_HEAP_BLOCK Block)
+{
+    SIZE_T size = MM_HEAP_BLOCK_SIZE(Block);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Pool->PoolLock, &old_irql);
+
+    Pool->Statistics.LargeAllocationCount--;
+    Pool->Statistics.LargeAllocationBytes -= size;
+    Pool->Statistics.FreeCount++;
+    Pool->PoolUsed -= size;
+
+    KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+
+    MmFreePhysicalMemory((PVOID)MmVirtualToPhysical(Block), size);
+}
+
+/**
+ * @brief Snapshot a pool's statistics, computing fragmentation
+ * @param Pool Pool
+ * @param Statistics Statistics structure to fill
+ */
+static VOID MmHeapQueryStatistics(PMEMORY_POOL Pool, PMM_POOL_STATISTICS Statistics)
+{
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Pool->PoolLock, &old_irql);
+
+    RtlCopyMemory(Statistics, &Pool->Statistics, sizeof(MM_POOL_STATISTICS));
+    Statistics->CommittedBytes = Pool->PoolSize;
+
+    // The largest free block lives in the highest non-empty class
+    Statistics->LargestFreeBlock = 0;
+    if (Pool->FirstLevelBitmap != 0) {
+        ULONG fl = MmHeapFindLastSet(Pool->FirstLevelBitmap);
+        ULONG sl = MmHeapFindLastSet(Pool->SecondLevelBitmap[fl]);
+        PLIST_ENTRY head = &Pool->FreeLists[fl][sl];
+
+        for (PLIST_ENTRY entry = head->Flink; entry != head; entry = entry->Flink) {
+            SIZE_T size = MM_HEAP_BLOCK_SIZE(CONTAINING_RECORD(entry, MM_HEAP_BLOCK, FreeListEntry));
+            if (size > Statistics->LargestFreeBlock) {
+                Statistics->LargestFreeBlock = size;
+            }
+        }
+    }
+
+    Statistics->FragmentationPercent = (Statistics->FreeBytes == 0) ? 0 :
+        (ULONG)(100 - (Statistics->LargestFreeBlock * 100) / Statistics->FreeBytes);
+
+    KeReleaseSpinLock(&Pool->PoolLock, old_irql);
+}
+
+/**
+ * @brief Find the tracking slot of a pool tag, registering the tag on first use
+ * @param Tag Pool tag
+ * @param PoolType Pool the allocation comes from
+ * @return Slot index, or MM_POOL_TAG_COUNT when every slot is taken
+ * @note Slots are never released, so known tags are found without the lock
+ */
+static ULONG MmLookupPoolTag(ULONG Tag, POOL_TYPE PoolType)
+{
+    ULONG64 key = ((ULONG64)(PoolType + 1) << 32) | Tag;
+    ULONG home = (ULONG)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+
+    for (ULONG probe = 0; probe < MM_POOL_TAG_COUNT; probe++) {
+        ULONG64 slot_key = g_MemoryManager.PoolTags[(home + probe) & (MM_POOL_TAG_COUNT - 1)].Key;
+        if (slot_key == key) {
+            return (home + probe) & (MM_POOL_TAG_COUNT - 1);
+        }
+        if (slot_key == 0) {
+            break;
+        }
+    }
+
+    ULONG index = MM_POOL_TAG_COUNT;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.PoolTagLock, &old_irql);
+
+    for (ULONG probe = 0; probe < MM_POOL_TAG_COUNT; probe++) {
+        PMM_POOL_TAG_ENTRY entry = &g_MemoryManager.PoolTags[(home + probe) & (MM_POOL_TAG_COUNT - 1)];
+        if (entry->Key == 0) {
+            entry->Key = key;
+        }
+        if (entry->Key == key) {
+            index = (home + probe) & (MM_POOL_TAG_COUNT - 1);
+            break;
+        }
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.PoolTagLock, old_irql);
+
+    if (index == MM_POOL_TAG_COUNT) {
+        InterlockedIncrement((PLONG)&g_MemoryManager.PoolTagOverflows);
+    }
+    return index;
+}
+
+/**
+ * @brief Count an allocation or free against a pool tag
+ * @param Index Tag slot
+ * @param Bytes Block size, negative for a free
+ * @note Only the current processor's counters are written, at DISPATCH_LEVEL
+ */
+static VOID MmChargePoolTag(ULONG Index, LONG64 Bytes)
+{
+    KIRQL old_irql;
+    KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+    ULONG cpu = KeGetCurrentProcessorNumber();
+    if (cpu >= MM_MAX_PROCESSORS) {
+        cpu = 0;
+    }
+
+    PMM_POOL_TAG_COUNTERS counters = &g_MemoryManager.PoolTagCounters[cpu][Index];
+    if (Bytes > 0) {
+        counters->Allocations++;
+    } else {
+        counters->Frees++;
+    }
+    counters->Bytes += Bytes;
+
+    if (counters->Bytes >= MM_POOL_TAG_FOLD_BYTES || counters->Bytes <= -MM_POOL_TAG_FOLD_BYTES) {
+        PMM_POOL_TAG_ENTRY entry = &g_MemoryManager.PoolTags[Index];
+
+        KIRQL tag_irql;
+        KeAcquireSpinLock(&g_MemoryManager.PoolTagLock, &tag_irql);
+        entry->Bytes += counters->Bytes;
+        if (entry->Bytes > entry->PeakBytes) {
+            entry->PeakBytes = entry->Bytes;
+        }
+        KeReleaseSpinLock(&g_MemoryManager.PoolTagLock, tag_irql);
+
+        counters->Bytes = 0;
+    }
+
+    KeLowerIrql(old_irql);
+}
+
+/**
+ * @brief Record the call chain of a sampled pool allocation
+ * @param Block Allocated block
+ * @return TRUE if a trace record was free
+ * @note Follows the frame pointer chain, so it needs code built with frame
+ *       pointers; the walk stops at the first frame that does not lie just
+ *       above the previous one
+ */
+static BOOLEAN MmTracePoolAllocation(PMM_HEAP_BLOCK Block)
+{
+    PVOID frames[MM_POOL_TRACE_DEPTH];
+    ULONG frame_count = 0;
+    PVOID* frame = (PVOID*)__builtin_frame_address(0);
+
+    while (frame != NULL && frame_count < MM_POOL_TRACE_DEPTH) {
+        PVOID* next = (PVOID*)frame[0];
+        frames[frame_count++] = frame[1];
+
+        if (next <= frame || (ULONG_PTR)next - (ULONG_PTR)frame > MM_POOL_TRACE_FRAME_LIMIT) {
+            break;
+        }
+        frame = next;
+    }
+
+    BOOLEAN traced = FALSE;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.PoolTagLock, &old_irql);
+
+    for (ULONG i = 0; i < MM_POOL_TRACE_COUNT; i++) {
+        PMM_POOL_TRACE trace = &g_MemoryManager.PoolTraces[i];
+        if (trace->Address == NULL) {
+            trace->Address = (PUCHAR)Block + MM_HEAP_HEADER_SIZE;
+            trace->Tag = Block->Tag;
+            trace->Size = MM_HEAP_BLOCK_SIZE(Block);
+            trace->FrameCount = frame_count;
+            RtlCopyMemory(trace->Frames, frames, frame_count * sizeof(PVOID));
+            traced = TRUE;
+            break;
+        }
+    }
+
+    if (!traced) {
+        g_MemoryManager.PoolTracesDropped++;
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.PoolTagLock, old_irql);
+    return traced;
+}
+
+/**
+ * @brief Drop the trace record of a sampled allocation being freed
+ * @param Address Payload address of the allocation
+ */
+static VOID MmReleasePoolTrace(PVOID Address)
+{
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.PoolTagLock, &old_irql);
+
+    for (ULONG i = 0; i < MM_POOL_TRACE_COUNT; i++) {
+        if (g_MemoryManager.PoolTraces[i].Address == Address) {
+            g_MemoryManager.PoolTraces[i].Address = NULL;
+            break;
+        }
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.PoolTagLock, old_irql);
+}
+
+/**
+ * @brief Allocate pool memory with a tag
+ * @param PoolType Pool type
+ * @param NumberOfBytes Size to allocate
+ * @param Tag Pool tag
+ * @return Pointer to allocated memory, or NULL on failure
+ */
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    if (NumberOfBytes == 0) {
+        return NULL;
+    }
+
+    PMEMORY_POOL pool = (PoolType == PagedPool) ? &g_MemoryManager.PagedPool : &g_MemoryManager.NonPagedPool;
+    if (pool->PoolBase == NULL) {
+        return NULL; // Pools not initialized yet
+    }
+
+    PVOID allocation = (NumberOfBytes >= MM_HEAP_LARGE_THRESHOLD) ?
+        MmHeapAllocateLarge(pool, NumberOfBytes, Tag) : MmHeapAllocate(pool, NumberOfBytes, Tag);
+    if (allocation == NULL) {
+        return NULL;
+    }
+
+    PMM_HEAP_BLOCK block = (PMM_HEAP_BLOCK)((PUCHAR)allocation - MM_HEAP_HEADER_SIZE);
+    ULONG index = MmLookupPoolTag(Tag, pool->PoolType);
+    if (index < MM_POOL_TAG_COUNT) {
+        MmChargePoolTag(index, (LONG64)MM_HEAP_BLOCK_SIZE(block));
+    }
+
+    if (g_MemoryManager.PoolTraceRate != 0 && Tag == g_MemoryManager.PoolTraceTag &&
+        InterlockedIncrement((PLONG)&g_MemoryManager.PoolTraceCounter) % g_MemoryManager.PoolTraceRate == 0 &&
+        MmTracePoolAllocation(block)) {
+        block->Size |= MM_HEAP_BLOCK_TRACED;
+    }
+
+    return allocation;
+}
+
+/**
+ * @brief Allocate pool memory
+ * @param PoolType Pool type
+ * @param NumberOfBytes Size to allocate
+ * @return Pointer to allocated memory, or NULL on failure
+ */
+PVOID ExAllocatePool(POOL_TYPE PoolType, SIZE_T NumberOfBytes)
+{
+    return ExAllocatePoolWithTag(PoolType, NumberOfBytes, MM_POOL_DEFAULT_TAG);
+}
+
+/**
+ * @brief Free pool memory
+ * @param P Pointer returned by ExAllocatePoolWithTag
+ * @param Tag Pool tag used for the allocation, or 0 to skip the check
+ * @note A tag that does not match the block's header means the caller is
+ *       freeing someone else's memory, or memory that was corrupted, so the
+ *       system halts before the heap is damaged further
+ */
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+    if (P == NULL) {
+        return;
+    }
+
+    PMM_HEAP_BLOCK block = (PMM_HEAP_BLOCK)((PUCHAR)P - MM_HEAP_HEADER_SIZE);
+    if (Tag != 0 && block->Tag != Tag) {
+        KiKernelPanic("ExFreePoolWithTag: tag does not match the allocation");
+    }
+
+    PMEMORY_POOL pool = (block->PoolType == PagedPool) ? &g_MemoryManager.PagedPool :
+                                                         &g_MemoryManager.NonPagedPool;
+
+    ULONG index = MmLookupPoolTag(block->Tag, pool->PoolType);
+    if (index < MM_POOL_TAG_COUNT) {
+        MmChargePoolTag(index, -(LONG64)MM_HEAP_BLOCK_SIZE(block));
+    }
+
+    if (block->Size & MM_HEAP_BLOCK_TRACED) {
+        block->Size &= ~(SIZE_T)MM_HEAP_BLOCK_TRACED;
+        MmReleasePoolTrace(P);
+    }
+
+    if (block->Size & MM_HEAP_BLOCK_LARGE) {
+        MmHeapFreeLarge(pool, block);
+    } else {
+        MmHeapFree(pool, block);
+    }
+}
+
+/**
+ * @brief Free pool memory
+ * @param P Pointer returned by ExAllocatePool
+ */
+VOID ExFreePool(PVOID P)
+{
+    ExFreePoolWithTag(P, 0);
+}
+
+/**
+ * @brief Get the address space a process allocates from
+ * @param Process Process (may be NULL)
+ * @return Process address space, or the system address space
+ */
+static PADDRESS_SPACE_DESCRIPTOR MmGetAddressSpace(PPROCESS_CONTROL_BLOCK Process)
+{
+    if (Process != NULL && Process->AddressSpace != NULL) {
+        return (PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace;
+    }
+    return &g_MemoryManager.SystemAddressSpace;
+}
+
+/**
+ * @brief Get the height of a VMA subtree
+ * @param Node Subtree root
+ * @return Height, 0 for an empty subtree
+ */
+static LONG MmVmaHeight(PVIRTUAL_MEMORY_REGION Node)
+{
+    return (Node != NULL) ? Node->Height : 0;
+}
+
+/**
+ * @brief Recompute a VMA node's height and subtree augmentation from its children
+ * @param Node VMA node
+ */
+static VOID MmVmaUpdate(PVIRTUAL_MEMORY_REGION Node)
+{
+    ULONG_PTR start = (ULONG_PTR)Node->BaseAddress;
+    ULONG_PTR end = start + Node->RegionSize;
+    LONG left_height = MmVmaHeight(Node->Left);
+    LONG right_height = MmVmaHeight(Node->Right);
+
+    Node->Height = ((left_height > right_height) ? left_height : right_height) + 1;
+    Node->SubtreeStart = start;
+    Node->SubtreeEnd = end;
+    Node->SubtreeMaxGap = 0;
+
+    if (Node->Left != NULL) {
+        SIZE_T gap = start - Node->Left->SubtreeEnd;
+        Node->SubtreeStart = Node->Left->SubtreeStart;
+        Node->SubtreeMaxGap = (Node->Left->SubtreeMaxGap > gap) ? Node->Left->SubtreeMaxGap : gap;
+    }
+
+    if (Node->Right != NULL) {
+        SIZE_T gap = Node->Right->SubtreeStart - end;
+        Node->SubtreeEnd = Node->Right->SubtreeEnd;
+        if (gap > Node->SubtreeMaxGap) {
+            Node->SubtreeMaxGap = gap;
+        }
+        if (Node->Right->SubtreeMaxGap > Node->SubtreeMaxGap) {
+            Node->SubtreeMaxGap = Node->Right->SubtreeMaxGap;
+        }
+    }
+}
+
+/**
+ * @brief Rotate a VMA subtree left
+ * @param Node Subtree root
+ * @return New subtree root
+ */
+static PVIRTUAL_MEMORY_REGION MmVmaRotateLeft(PVIRTUAL_MEMORY_REGION Node)
+{
+    PVIRTUAL_MEMORY_REGION pivot = Node->Right;
+    Node->Right = pivot->Left;
+    pivot->Left = Node;
+    MmVmaUpdate(Node);
+    MmVmaUpdate(pivot);
+    return pivot;
+}
+
+/**
+ * @brief Rotate a VMA subtree right
+ * @param Node Subtree root
+ * @return New subtree root
+ */
+static PVIRTUAL_MEMORY_REGION MmVmaRotateRight(PVIRTUAL_MEMORY_REGION Node)
+{
+    PVIRTUAL_MEMORY_REGION pivot = Node->Left;
+    Node->Left = pivot->Right;
+    pivot->Right = Node;
+    MmVmaUpdate(Node);
+    MmVmaUpdate(pivot);
+    return pivot;
+}
+
+/**
+ * @brief Restore the AVL balance of a VMA subtree after an insert or remove below it
+ * @param Node Subtree root
+ * @return New subtree root
+ */
+static PVIRTUAL_MEMORY_REGION MmVmaBalance(PVIRTUAL_MEMORY_REGION Node)
+{
+    MmVmaUpdate(Node);
+
+    LONG balance = MmVmaHeight(Node->Left) - MmVmaHeight(Node->Right);
+    if (balance > 1) {
+        if (MmVmaHeight(Node->Left->Left) < MmVmaHeight(Node->Left->Right)) {
+            Node->Left = MmVmaRotateLeft(Node->Left);
+        }
+        return MmVmaRotateRight(Node);
+    }
+
+    if (balance < -1) {
+        if (MmVmaHeight(Node->Right->Right) < MmVmaHeight(Node->Right->Left)) {
+            Node->Right = MmVmaRotateRight(Node->Right);
+        }
+        return MmVmaRotateLeft(Node);
+    }
+
+    return Node;
+}
+
+/**
+ * @brief Insert a region into a VMA subtree
+ * @param Node Subtree root
+ * @param Region Region to insert (must not overlap existing regions)
+ * @return New subtree root
+ */
+static PVIRTUAL_MEMORY_REGION MmVmaInsert(PVIRTUAL_MEMORY_REGION Node, PVIRTUAL_MEMORY_REGION Region)
+{
+    if (Node == NULL) {
+        Region->Left = NULL;
+        Region->Right = NULL;
+        MmVmaUpdate(Region);
+        return Region;
+    }
+
+    if ((ULONG_PTR)Region->BaseAddress < (ULONG_PTR)Node->BaseAddress) {
+        Node->Left = MmVmaInsert(Node->Left, Region);
+    } else {
+        Node->Right = MmVmaInsert(Node->Right, Region);
+    }
+
+    return MmVmaBalance(Node);
+}
+
+/**
+ * @brief Detach the lowest region of a VMA subtree
+ * @param Node Subtree root
+ * @param Minimum Receives the detached region
+ * @return New subtree root
+ */
+static PVIRTUAL_MEMORY_REGION MmVmaRemoveMinimum(PVIRTUAL_MEMORY_REGION Node, PVIRTUAL_MEMORY_REGION* Minimum)
+{
+    if (Node->Left == NULL) {
+        *Minimum = Node;
+        return Node->Right;
+    }
+
+    Node->Left = MmVmaRemoveMinimum(Node->Left, Minimum);
+    return MmVmaBalance(Node);
+}
+
+/**
+ * @brief Remove a region from a VMA subtree
+ * @param Node Subtree root
+ * @param Region Region to remove
+ * @return New subtree root
+ */
+static PVIRTUAL_MEMORY_REGION MmVmaRemove(PVIRTUAL_MEMORY_REGION Node, PVIRTUAL_MEMORY_REGION Region)
+{
+    if (Node == NULL) {
+        return NULL;
+    }
+
+    if ((ULONG_PTR)Region->BaseAddress < (ULONG_PTR)Node->BaseAddress) {
+        Node->Left = MmVmaRemove(Node->Left, Region);
+    } else if ((ULONG_PTR)Region->BaseAddress > (ULONG_PTR)Node->BaseAddress) {
+        Node->Right = MmVmaRemove(Node->Right, Region);
+    } else {
+        PVIRTUAL_MEMORY_REGION left = Node->Left;
+        PVIRTUAL_MEMORY_REGION right = Node->Right;
+
+        if (right == NULL) {
+            return left;
+        }
+
+        // Replace the node with its in-order successor
+        PVIRTUAL_MEMORY_REGION successor;
+        right = MmVmaRemoveMinimum(right, &successor);
+        successor->Left = left;
+        successor->Right = right;
+        return MmVmaBalance(successor);
+    }
+
+    return MmVmaBalance(Node);
+}
+
+/**
+ * @brief Find any region overlapping an address range
+ * @param Node VMA tree root
+ * @param Start Range start
+ * @param End Range end (exclusive)
+ * @return Overlapping region, or NULL if the range is free
+ */
+static PVIRTUAL_MEMORY_REGION MmVmaFindOverlap(PVIRTUAL_MEMORY_REGION Node, ULONG_PTR Start, ULONG_PTR End)
+{
+    while (Node != NULL) {
+        ULONG_PTR node_start = (ULONG_PTR)Node->BaseAddress;
+
+        if (End <= node_start) {
+            Node = Node->Left;
+        } else if (Start >= node_start + Node->RegionSize) {
+            Node = Node->Right;
+        } else {
+            return Node;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Find the lowest free gap of a given size in a VMA subtree
+ * @param Node Subtree root
+ * @param Low Lowest usable address (end of the preceding region or range start)
+ * @param High Highest usable address (start of the following region or range end)
+ * @param Size Size needed
+ * @return Gap start address, or 0 if no gap is large enough
+ * @note Subtrees whose largest gap is too small are skipped, so the search is O(log n)
+ */
+static ULONG_PTR MmVmaFindGap(PVIRTUAL_MEMORY_REGION Node, ULONG_PTR Low, ULONG_PTR High, SIZE_T Size)
+{
+    if (High <= Low || High - Low < Size) {
+        return 0;
+    }
+
+    if (Node == NULL) {
+        return Low;
+    }
+
+    // Largest gap this subtree can offer within [Low, High)
+    SIZE_T best_gap = Node->SubtreeMaxGap;
+    if (Node->SubtreeStart > Low) {
+        SIZE_T gap = ((Node->SubtreeStart < High) ? Node->SubtreeStart : High) - Low;
+        best_gap = (gap > best_gap) ? gap : best_gap;
+    }
+    if (High > Node->SubtreeEnd) {
+        SIZE_T gap = High - ((Node->SubtreeEnd > Low) ? Node->SubtreeEnd : Low);
+        best_gap = (gap > best_gap) ? gap : best_gap;
+    }
+    if (best_gap < Size) {
+        return 0;
+    }
+
+    ULONG_PTR start = (ULONG_PTR)Node->BaseAddress;
+    ULONG_PTR end = start + Node->RegionSize;
+
+    ULONG_PTR address = MmVmaFindGap(Node->Left, Low, (start < High) ? start : High, Size);
+    if (address != 0) {
+        return address;
+    }
+
+    return MmVmaFindGap(Node->Right, (end > Low) ? end : Low, High, Size);
+}
+
+/**
+ * @brief Find the region containing an address
+ * @param AddressSpace Address space (region lock held)
+ * @param Address Address to look up
+ * @return Region, or NULL if the address is not mapped
+ */
+static PVIRTUAL_MEMORY_REGION MmFindVirtualMemoryRegion(PADDRESS_SPACE_DESCRIPTOR AddressSpace, PVOID Address)
+{
+    return MmVmaFindOverlap(AddressSpace->RegionRoot, (ULONG_PTR)Address, (ULONG_PTR)Address + 1);
+}
+
+/**
+ * @brief Find the lowest region overlapping an address range
+ * @param AddressSpace Address space (region lock held)
+ * @param Start Range start
+ * @param End Range end (exclusive)
+ * @return Lowest overlapping region, or NULL if the range is free
+ */
+static PVIRTUAL_MEMORY_REGION MmFindFirstVirtualMemoryRegion(PADDRESS_SPACE_DESCRIPTOR AddressSpace,
+                                                             ULONG_PTR Start, ULONG_PTR End)
+{
+    PVIRTUAL_MEMORY_REGION node = AddressSpace->RegionRoot;
+    PVIRTUAL_MEMORY_REGION first = NULL;
+
+    // Regions do not overlap, so the lowest region ending above Start is the candidate
+    while (node != NULL) {
+        if ((ULONG_PTR)node->BaseAddress + node->RegionSize > Start) {
+            first = node;
+            node = node->Left;
+        } else {
+            node = node->Right;
+        }
+    }
+
+    if (first != NULL && (ULONG_PTR)first->BaseAddress >= End) {
+        return NULL;
+    }
+
+    return first;
+}
+
+/**
+ * @brief Split a region in two at an address
+ * @param AddressSpace Address space (region lock held)
+ * @param Region Region to split
+ * @param SplitAddress Page-aligned address strictly inside the region
+ * @param Upper Region object receiving the part above SplitAddress
+ */
+static VOID MmSplitVirtualMemoryRegion(PADDRESS_SPACE_DESCRIPTOR AddressSpace, PVIRTUAL_MEMORY_REGION Region,
+                                       ULONG_PTR SplitAddress, PVIRTUAL_MEMORY_REGION Upper)
+{
+    ULONG_PTR start = (ULONG_PTR)Region->BaseAddress;
+
+    AddressSpace->RegionRoot = MmVmaRemove(AddressSpace->RegionRoot, Region);
+
+    RtlCopyMemory(Upper, Region, sizeof(VIRTUAL_MEMORY_REGION));
+    Upper->BaseAddress = (PVOID)SplitAddress;
+    Upper->RegionSize = start + Region->RegionSize - SplitAddress;
+    Region->RegionSize = SplitAddress - start;
+
+    AddressSpace->RegionRoot = MmVmaInsert(AddressSpace->RegionRoot, Region);
+    AddressSpace->RegionRoot = MmVmaInsert(AddressSpace->RegionRoot, Upper);
+    InsertHeadList(&Region->RegionListEntry, &Upper->RegionListEntry);
+    AddressSpace->RegionCount++;
+}
+
+/**
+ * @brief Split the regions straddling the ends of a range so the range is
+ *        covered by whole regions only
+ * @param AddressSpace Address space (region lock held)
+ * @param Start Range start
+ * @param End Range end (exclusive)
+ * @param Spares Two spare region objects; the ones consumed are set to NULL
+ */
+static VOID MmSplitVirtualMemoryRegionsAt(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Start, ULONG_PTR End,
+                                          PVIRTUAL_MEMORY_REGION* Spares)
+{
+    PVIRTUAL_MEMORY_REGION region = MmFindVirtualMemoryRegion(AddressSpace, (PVOID)Start);
+    if (region != NULL && (ULONG_PTR)region->BaseAddress < Start) {
+        MmSplitVirtualMemoryRegion(AddressSpace, region, Start, Spares[0]);
+        Spares[0] = NULL;
+    }
+
+    region = MmFindVirtualMemoryRegion(AddressSpace, (PVOID)(End - 1));
+    if (region != NULL && (ULONG_PTR)region->BaseAddress + region->RegionSize > End) {
+        MmSplitVirtualMemoryRegion(AddressSpace, region, End, Spares[1]);
+        Spares[1] = NULL;
+    }
+}
+
+/**
+ * @brief Check that a range lies inside an address space's usable range
+ * @param AddressSpace Address space
+ * @param Start Start of the range
+ * @param Size Size of the range
+ * @return STATUS_SUCCESS, or STATUS_INVALID_PARAMETER if the range wraps or
+ *         leaves [LowestAddress, HighestAddress)
+ * @note A user range must never reach the system range, whose page tables
+ *       every address space shares
+ */
+static NTSTATUS MmValidateAddressRange(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Start, SIZE_T Size)
+{
+    if (Size == 0 || Start + Size < Start) {
+        return STATUS_INVALID_PARAMETER; // Empty or wraps around
+    }
+
+    if (Start < AddressSpace->LowestAddress || Start + Size > AddressSpace->HighestAddress) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Reserve a new region, optionally committing and populating it
+ * @param Process Process to allocate for
+ * @param BaseAddress Base address (can be NULL)
+ * @param Size Size to allocate
+ * @param AllocationType MEM_RESERVE, optionally with MEM_COMMIT
+ * @param Protect Memory protection flags
+ * @param Populate TRUE to back the region with physical pages before returning
+ * @return Pointer to allocated virtual memory
+ * @note Allocations of 2MB or more are placed on a 2MB boundary so they can be
+ *       backed by huge pages
+ */
+static PVOID MmReserveVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size,
+                                    ULONG AllocationType, ULONG Protect, BOOLEAN Populate)
+{
+    if (Size == 0) {
+        return NULL;
+    }
+
+    // Align size to page boundary
+    SIZE_T aligned_size = (Size + DSLOS_PAGE_SIZE - 1) & ~(DSLOS_PAGE_SIZE - 1);
+    SIZE_T alignment = (aligned_size >= MM_HUGE_PAGE_SIZE) ? MM_HUGE_PAGE_SIZE : DSLOS_PAGE_SIZE;
+    PADDRESS_SPACE_DESCRIPTOR address_space = MmGetAddressSpace(Process);
+
+    if (aligned_size < Size) {
+        return NULL; // Size wraps when rounded up
+    }
+
+    // A caller-chosen range must lie inside this address space
+    ULONG_PTR requested = (ULONG_PTR)BaseAddress & ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+    if (BaseAddress != NULL && !NT_SUCCESS(MmValidateAddressRange(address_space, requested, aligned_size))) {
+        return NULL;
+    }
+
+    PVIRTUAL_MEMORY_REGION region = MmAllocateObject(g_MemoryManager.RegionCache);
+    if (region == NULL) {
+        return NULL;
+    }
+
+    // Find free virtual address space and claim it
+    KIRQL old_irql;
+    KeAcquireSpinLock(&address_space->RegionLock, &old_irql);
+
+    PVOID virtual_address = NULL;
+    if (BaseAddress != NULL) {
+        virtual_address = (PVOID)requested;
+        if (!MmIsAddressRangeFree(Process, virtual_address, aligned_size)) {
+            virtual_address = NULL;
+        }
+    } else {
+        virtual_address = MmFindFreeVirtualAddress(Process, aligned_size, alignment);
+    }
+
+    if (virtual_address == NULL) {
+        KeReleaseSpinLock(&address_space->RegionLock, old_irql);
+        MmFreeObject(g_MemoryManager.RegionCache, region);
+        return NULL; // Out of virtual address space
+    }
+
+    RtlZeroMemory(region, sizeof(VIRTUAL_MEMORY_REGION));
+    region->BaseAddress = virtual_address;
+    region->RegionSize = aligned_size;
+    region->Protect = Protect;
+    region->State = (AllocationType & MEM_COMMIT) ? MEM_COMMIT : MEM_RESERVE;
+    region->Type = MEM_PRIVATE;
+
+    address_space->RegionRoot = MmVmaInsert(address_space->RegionRoot, region);
+    InsertTailList(&address_space->RegionListHead, &region->RegionListEntry);
+    address_space->RegionCount++;
+
+    KeReleaseSpinLock(&address_space->RegionLock, old_irql);
+
+    if (!Populate) {
+        return virtual_address; // Committed pages are zero-filled on first touch
+    }
+
+    // Back the region with physical pages
+    NTSTATUS status = MmPopulateVirtualMemory(address_space, virtual_address, aligned_size, Protect);
+    if (!NT_SUCCESS(status)) {
+        KeAcquireSpinLock(&address_space->RegionLock, &old_irql);
+        address_space->RegionRoot = MmVmaRemove(address_space->RegionRoot, region);
+        RemoveEntryList(&region->RegionListEntry);
+        address_space->RegionCount--;
+        KeReleaseSpinLock(&address_space->RegionLock, old_irql);
+
+        MmFreeObject(g_MemoryManager.RegionCache, region);
+        return NULL; // Out of physical memory
+    }
+
+    return virtual_address;
+}
+
+/**
+ * @brief Allocate virtual memory
+ * @param Process Process to allocate for
+ * @param BaseAddress Base address (can be NULL)
+ * @param Size Size to allocate
+ * @param Protect Memory protection flags
+ * @return Pointer to allocated virtual memory
+ * @note The memory is committed and resident on return, so it never faults.
+ *       Use MmAllocateVirtualMemoryEx for memory that may be backed lazily
+ */
+PVOID MmAllocateVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size, ULONG Protect)
+{
+    return MmReserveVirtualMemory(Process, BaseAddress, Size, MEM_RESERVE | MEM_COMMIT, Protect, TRUE);
+}
+
+/**
+ * @brief Commit part of a reserved range
+ * @param Process Process owning the range
+ * @param BaseAddress Start of range
+ * @param Size Size of range
+ * @param Protect Memory protection flags
+ * @return Start of the committed range, or NULL if the range is not entirely reserved
+ */
+static PVOID MmCommitVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size, ULONG Protect)
+{
+    if (BaseAddress == NULL || Size == 0) {
+        return NULL;
+    }
+
+    PADDRESS_SPACE_DESCRIPTOR address_space = MmGetAddressSpace(Process);
+    ULONG_PTR start = (ULONG_PTR)BaseAddress & ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+    ULONG_PTR end = ((ULONG_PTR)BaseAddress + Size + DSLOS_PAGE_SIZE - 1) & ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+    if (end <= start) {
+        return NULL;
+    }
+
+    PVIRTUAL_MEMORY_REGION spares[2];
+    spares[0] = MmAllocateObject(g_MemoryManager.RegionCache);
+    spares[1] = MmAllocateObject(g_MemoryManager.RegionCache);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&address_space->RegionLock, &old_irql);
+
+    // The range must be covered by regions without gaps
+    BOOLEAN reserved = (spares[0] != NULL && spares[1] != NULL);
+    ULONG_PTR cursor = start;
+    while (reserved && cursor < end) {
+        PVIRTUAL_MEMORY_REGION region = MmFindFirstVirtualMemoryRegion(address_space, cursor, end);
+        if (region == NULL || (ULONG_PTR)region->BaseAddress > cursor) {
+            reserved = FALSE;
+        } else {
+            cursor = (ULONG_PTR)region->BaseAddress + region->RegionSize;
+        }
+    }
+
+    // Pages already present take on the new protection
+    if (reserved && NT_SUCCESS(MmProtectPageTableEntries(address_space, (PVOID)start, end - start, Protect))) {
+        MmSplitVirtualMemoryRegionsAt(address_space, start, end, spares);
+
+        PVIRTUAL_MEMORY_REGION region;
+        cursor = start;
+        while ((region = MmFindFirstVirtualMemoryRegion(address_space, cursor, end)) != NULL) {
+            region->State = MEM_COMMIT;
+            region->Protect = Protect;
+            cursor = (ULONG_PTR)region->BaseAddress + region->RegionSize;
+        }
+    } else {
+        start = 0;
+    }
+
+    KeReleaseSpinLock(&address_space->RegionLock, old_irql);
+
+    for (ULONG i = 0; i < 2; i++) {
+        if (spares[i] != NULL) {
+            MmFreeObject(g_MemoryManager.RegionCache, spares[i]);
+        }
+    }
+
+    return (PVOID)start;
+}
+
+/**
+ * @brief Reserve and/or commit virtual memory
+ * @param Process Process to allocate for
+ * @param BaseAddress Base address (can be NULL with MEM_RESERVE)
+ * @param Size Size to allocate
+ * @param AllocationType MEM_RESERVE, MEM_COMMIT or both
+ * @param Protect Memory protection flags
+ * @return Start of the range, or NULL on failure
+ * @note Committed pages take no physical memory until first touched; the page
+ *       fault handler then maps zero-filled pages. MEM_COMMIT without
+ *       MEM_RESERVE commits part of a range reserved earlier
+ */
+PVOID MmAllocateVirtualMemoryEx(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size,
+                                ULONG AllocationType, ULONG Protect)
+{
+    if ((AllocationType & ~(MEM_RESERVE | MEM_COMMIT)) != 0) {
+        return NULL;
+    }
+
+    if (AllocationType == MEM_COMMIT) {
+        return MmCommitVirtualMemory(Process, BaseAddress, Size, Protect);
+    }
+
+    if (!(AllocationType & MEM_RESERVE)) {
+        return NULL;
+    }
+
+    return MmReserveVirtualMemory(Process, BaseAddress, Size, AllocationType, Protect, FALSE);
+}
+
+/**
+ * @brief Decommit or release virtual memory
+ * @param Process Process to free for
+ * @param Address Start of range
+ * @param Size Size of range
+ * @param FreeType MEM_DECOMMIT to return the pages but keep the range
+ *        reserved, MEM_RELEASE to free the range entirely
+ * @return NTSTATUS Status code
+ * @note The range may cover part of a region; the rest of the region is left
+ *       as it was and huge pages straddling the range ends are split
+ */
+NTSTATUS MmFreeVirtualMemoryEx(PPROCESS_CONTROL_BLOCK Process, PVOID Address, SIZE_T Size, ULONG FreeType)
+{
+    if (Address == NULL || Size == 0 || (FreeType != MEM_DECOMMIT && FreeType != MEM_RELEASE)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PADDRESS_SPACE_DESCRIPTOR address_space = MmGetAddressSpace(Process);
+    ULONG_PTR start = (ULONG_PTR)Address & ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+    ULONG_PTR end = ((ULONG_PTR)Address + Size + DSLOS_PAGE_SIZE - 1) & ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+    if (end <= start) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // A partial free leaves at most one piece behind at each end of the range
+    PVIRTUAL_MEMORY_REGION spares[2];
+    spares[0] = MmAllocateObject(g_MemoryManager.RegionCache);
+    spares[1] = MmAllocateObject(g_MemoryManager.RegionCache);
+
+    LIST_ENTRY released_list;
+    InitializeListHead(&released_list);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&address_space->RegionLock, &old_irql);
+
+    NTSTATUS status;
+    if (MmFindFirstVirtualMemoryRegion(address_space, start, end) == NULL) {
+        status = STATUS_INVALID_PARAMETER;
+    } else if (spares[0] == NULL || spares[1] == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    } else {
+        status = MmUnmapVirtualMemory(address_space, (PVOID)start, end - start);
+    }
+
+    if (NT_SUCCESS(status)) {
+        MmSplitVirtualMemoryRegionsAt(address_space, start, end, spares);
+
+        PVIRTUAL_MEMORY_REGION region;
+        ULONG_PTR cursor = start;
+        while ((region = MmFindFirstVirtualMemoryRegion(address_space, cursor, end)) != NULL) {
+            cursor = (ULONG_PTR)region->BaseAddress + region->RegionSize;
+
+            if (FreeType == MEM_DECOMMIT) {
+                region->State = MEM_RESERVE;
+                continue;
+            }
+
+            address_space->RegionRoot = MmVmaRemove(address_space->RegionRoot, region);
+            RemoveEntryList(&region->RegionListEntry);
+            address_space->RegionCount--;
+            InsertTailList(&released_list, &region->RegionListEntry);
+        }
+    }
+
+    KeReleaseSpinLock(&address_space->RegionLock, old_irql);
+
+    while (!IsListEmpty(&released_list)) {
+        PVIRTUAL_MEMORY_REGION region = CONTAINING_RECORD(RemoveHeadList(&released_list),
+                                                          VIRTUAL_MEMORY_REGION, RegionListEntry);
+        MmFreeObject(g_MemoryManager.RegionCache, region);
+    }
+
+    for (ULONG i = 0; i < 2; i++) {
+        if (spares[i] != NULL) {
+            MmFreeObject(g_MemoryManager.RegionCache, spares[i]);
+        }
+    }
+
+    return status;
+}
+
+/**
+ * @brief Free virtual memory
+ * @param Process Process to free for
+ * @param Address Address to free
+ * @param Size Size to free
+ */
+VOID MmFreeVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID Address, SIZE_T Size)
+{
+    MmFreeVirtualMemoryEx(Process, Address, Size, MEM_RELEASE);
+}
+
+/**
+ * @brief Change the protection of virtual memory
+ * @param Process Process owning the memory
+ * @param Address Start of range
+ * @param Size Size of range
+ * @param NewProtect New memory protection flags
+ * @param OldProtect Receives the previous protection of the first page (optional)
+ * @return NTSTATUS Status code
+ * @note Regions straddling the range ends are split, as are huge pages
+ */
+NTSTATUS MmProtectVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID Address, SIZE_T Size,
+                                ULONG NewProtect, PULONG OldProtect)
+{
+    if (Address == NULL || Size == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PADDRESS_SPACE_DESCRIPTOR address_space = MmGetAddressSpace(Process);
+    ULONG_PTR start = (ULONG_PTR)Address & ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+    ULONG_PTR end = ((ULONG_PTR)Address + Size + DSLOS_PAGE_SIZE - 1) & ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+    if (end <= start) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PVIRTUAL_MEMORY_REGION spares[2];
+    spares[0] = MmAllocateObject(g_MemoryManager.RegionCache);
+    spares[1] = MmAllocateObject(g_MemoryManager.RegionCache);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&address_space->RegionLock, &old_irql);
+
+    NTSTATUS status;
+    PVIRTUAL_MEMORY_REGION region = MmFindVirtualMemoryRegion(address_space, (PVOID)start);
+    if (region == NULL) {
+        status = STATUS_INVALID_PARAMETER;
+    } else if (spares[0] == NULL || spares[1] == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    } else {
+        if (OldProtect != NULL) {
+            *OldProtect = region->Protect;
+        }
+
+        status = MmProtectPageTableEntries(address_space, (PVOID)start, end - start, NewProtect);
+    }
+
+    if (NT_SUCCESS(status)) {
+        MmSplitVirtualMemoryRegionsAt(address_space, start, end, spares);
+
+        ULONG_PTR cursor = start;
+        while ((region = MmFindFirstVirtualMemoryRegion(address_space, cursor, end)) != NULL) {
+            region->Protect = NewProtect;
+            cursor = (ULONG_PTR)region->BaseAddress + region->RegionSize;
+        }
+    }
+
+    KeReleaseSpinLock(&address_space->RegionLock, old_irql);
+
+    for (ULONG i = 0; i < 2; i++) {
+        if (spares[i] != NULL) {
+            MmFreeObject(g_MemoryManager.RegionCache, spares[i]);
+        }
+    }
+
+    return status;
+}
+
+/**
+ * @brief Find free virtual address space
+ * @param Process Process to find address for
+ * @param Size Size needed
+ * @param Alignment Required alignment of the address (power of two)
+ * @return Free virtual address
+ * @note Caller holds the address space's region lock
+ */
+static PVOID MmFindFreeVirtualAddress(PPROCESS_CONTROL_BLOCK Process, SIZE_T Size, SIZE_T Alignment)
+{
+    PADDRESS_SPACE_DESCRIPTOR address_space = MmGetAddressSpace(Process);
+
+    // Any gap with room for the alignment slack holds an aligned range
+    SIZE_T search_size = Size + Alignment - DSLOS_PAGE_SIZE;
+    if (search_size < Size) {
+        return NULL;
+    }
+
+    ULONG_PTR address = MmVmaFindGap(address_space->RegionRoot, address_space->LowestAddress,
+                                     address_space->HighestAddress, search_size);
+    if (address == 0) {
+        return NULL;
+    }
+
+    return (PVOID)((address + Alignment - 1) & ~(ULONG_PTR)(Alignment - 1));
+}
+
+/**
+ * @brief Check if address range is free
+ * @param Process Process to check
+ * @param BaseAddress Base address to check
+ * @param Size Size to check
+ * @return TRUE if free, FALSE otherwise
+ * @note Caller holds the address space's region lock. A range outside the
+ *       address space is never free
+ */
+static BOOLEAN MmIsAddressRangeFree(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size)
+{
+    PADDRESS_SPACE_DESCRIPTOR address_space = MmGetAddressSpace(Process);
+    ULONG_PTR start = (ULONG_PTR)BaseAddress;
+
+    if (!NT_SUCCESS(MmValidateAddressRange(address_space, start, Size))) {
+        return FALSE;
+    }
+
+    return MmVmaFindOverlap(address_space->RegionRoot, start, start + Size) == NULL;
+}
+
+/**
+ * @brief Convert memory protection flags to page table entry flags
+ * @param Protect Memory protection flags
+ * @param UserAccessible TRUE for user-mode mappings
+ * @return Page table entry flags
+ */
+static MM_PTE MmProtectToPte(ULONG Protect, BOOLEAN UserAccessible)
+{
+    if (Protect & PAGE_NOACCESS) {
+        return 0;
+    }
+
+    MM_PTE pte = MM_PTE_PRESENT;
+
+    if (Protect & (PAGE_READWRITE | PAGE_EXECUTE_READWRITE)) {
+        pte |= MM_PTE_WRITABLE;
+    }
+
+    if (!(Protect & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY))) {
+        pte |= MM_PTE_NO_EXECUTE;
+    }
+
+    pte |= UserAccessible ? MM_PTE_USER : MM_PTE_GLOBAL;
+    return pte;
+}
+
+/**
+ * @brief Allocate a zeroed page table page
+ * @return Page table, as a direct map address, or NULL if out of memory
+ */
+static PMM_PTE MmAllocatePageTable(VOID)
+{
+    PVOID page = MmAllocateZeroedPhysicalMemory(DSLOS_PAGE_SIZE);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.PageTablePages);
+    return (PMM_PTE)MmPhysicalToVirtual((ULONG_PTR)page);
+}
+
+/**
+ * @brief Free a page table page
+ * @param Table Page table, as a direct map address
+ */
+static VOID MmFreePageTable(PMM_PTE Table)
+{
+    MmFreePhysicalMemory((PVOID)MmVirtualToPhysical(Table), DSLOS_PAGE_SIZE);
+    InterlockedDecrement((PLONG)&g_MemoryManager.Statistics.PageTablePages);
+}
+
+/**
+ * @brief Walk the page tables of an address space in software
+ * @param Pml4 Top-level page table
+ * @param VirtualAddress Virtual address to resolve
+ * @param Level Level of the entry wanted (1 for a page table entry, 2 for a page directory entry)
+ * @param Allocate TRUE to create missing intermediate tables
+ * @return Pointer to the entry, or NULL if a table is missing. A walk to level 1
+ *         stops early at a page directory entry that maps a huge page
+ * @note Page tables are reached through the direct map, so the walk does not
+ *       depend on which address space is loaded in CR3
+ */
+static PMM_PTE MmWalkPageTables(PMM_PTE Pml4, PVOID VirtualAddress, ULONG Level, BOOLEAN Allocate)
+{
+    static const ULONG shifts[] = { MM_PT_SHIFT, MM_PD_SHIFT, MM_PDPT_SHIFT, MM_PML4_SHIFT };
+    PMM_PTE table = Pml4;
+
+    for (ULONG level = 4; ; level--) {
+        PMM_PTE entry = &table[MM_PAGE_TABLE_INDEX(VirtualAddress, shifts[level - 1])];
+
+        // Huge page entries stay recognizable while not present (PAGE_NOACCESS)
+        if (level == Level || (level == 2 && (*entry & MM_PTE_LARGE))) {
+            return entry;
+        }
+
+        if (!(*entry & MM_PTE_PRESENT)) {
+            if (!Allocate) {
+                return NULL;
+            }
+
+            PMM_PTE next = MmAllocatePageTable();
+            if (next == NULL) {
+                return NULL;
+            }
+
+            // Intermediate levels grant everything; the leaf entry enforces protection
+            *entry = MM_TABLE_FRAME(next) | MM_PTE_PRESENT | MM_PTE_WRITABLE | MM_PTE_USER;
+        }
+
+        table = MM_PTE_TABLE(*entry);
+    }
+}
+
+/**
+ * @brief Add a newly mapped base page to the active working set list
+ * @param AddressSpace Address space (page table lock held)
+ * @param Frame Physical address of the page
+ * @param VirtualAddress Address the page is mapped at
+ * @note System address space pages are never paged out
+ */
+static VOID MmInsertWorkingSetPage(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Frame, ULONG_PTR VirtualAddress)
+{
+    if (AddressSpace == &g_MemoryManager.SystemAddressSpace) {
+        return;
+    }
+
+    ULONG pfn = (ULONG)(Frame / DSLOS_PAGE_SIZE);
+    PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[pfn];
+    page->AddressSpace = AddressSpace;
+    page->VirtualMapping = (PVOID)VirtualAddress;
+    page->MergeHash = 0;
+    MM_PAGE_FLAGS(pfn) |= PAGE_FLAG_ACTIVE;
+    InsertHeadList(&AddressSpace->ActiveListHead, &page->PageListEntry);
+    AddressSpace->ActivePageCount++;
+}
+
+/**
+ * @brief Take a page off its working set list
+ * @param AddressSpace Address space (page table lock held)
+ * @param Frame Physical address of the page
+ * @note Pages outside the working set are left alone
+ */
+static VOID MmRemoveWorkingSetPage(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Frame)
+{
+    ULONG pfn = (ULONG)(Frame / DSLOS_PAGE_SIZE);
+    PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[pfn];
+
+    if (MM_PAGE_FLAGS(pfn) & PAGE_FLAG_ACTIVE) {
+        AddressSpace->ActivePageCount--;
+    } else if (MM_PAGE_FLAGS(pfn) & PAGE_FLAG_INACTIVE) {
+        AddressSpace->InactivePageCount--;
+    } else {
+        return;
+    }
+
+    RemoveEntryList(&page->PageListEntry);
+    InitializeListHead(&page->PageListEntry);
+    MM_PAGE_FLAGS(pfn) &= ~(PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE);
+    page->AddressSpace = NULL;
+    page->VirtualMapping = NULL;
+}
+
+/**
+ * @brief Allocate a paging file slot
+ * @param Slot Receives the slot number
+ * @return TRUE if a slot was free
+ */
+static BOOLEAN MmAllocatePagingFileSlot(PULONG Slot)
+{
+    PMM_PAGING_FILE paging_file = &g_MemoryManager.PagingFile;
+    BOOLEAN found = FALSE;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&paging_file->SlotLock, &old_irql);
+
+    if (paging_file->FreeSlotCount > 0) {
+        ULONG slot = paging_file->NextSlot;
+        while (paging_file->SlotReferences[slot] != 0) {
+            slot = (slot + 1) % paging_file->SlotCount;
+        }
+
+        paging_file->SlotReferences[slot] = 1;
+        paging_file->FreeSlotCount--;
+        paging_file->NextSlot = (slot + 1) % paging_file->SlotCount;
+        *Slot = slot;
+        found = TRUE;
+    }
+
+    KeReleaseSpinLock(&paging_file->SlotLock, old_irql);
+    return found;
+}
+
+/**
+ * @brief Add or drop a reference to a paging file slot
+ * @param Slot Slot number
+ * @param Delta 1 when an entry naming the slot is copied, -1 when one goes away
+ * @note The slot is free again when its last reference is dropped
+ */
+static VOID MmReferencePagingFileSlot(ULONG Slot, LONG Delta)
+{
+    PMM_PAGING_FILE paging_file = &g_MemoryManager.PagingFile;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&paging_file->SlotLock, &old_irql);
+
+    paging_file->SlotReferences[Slot] = (USHORT)(paging_file->SlotReferences[Slot] + Delta);
+    if (paging_file->SlotReferences[Slot] == 0) {
+        paging_file->FreeSlotCount++;
+    }
+
+    KeReleaseSpinLock(&paging_file->SlotLock, old_irql);
+}
+
+/**
+ * @brief Free the page tables below a table entry range, along with the pages they map
+ * @param Table Page table
+ * @param Level Table level (4 for the PML4, 1 for a page table)
+ * @param FirstIndex First entry to release
+ * @param LastIndex Last entry to release
+ * @note Every translation through the range must already be flushed. Working
+ *       set lists are abandoned with the address space, so pages only lose
+ *       their list flags here
+ */
+static VOID MmFreePageTables(PMM_PTE Table, ULONG Level, ULONG FirstIndex, ULONG LastIndex)
+{
+    for (ULONG i = FirstIndex; i <= LastIndex; i++) {
+        MM_PTE entry = Table[i];
+        if (entry == 0) {
+            continue;
+        }
+
+        if (Level == 1 && (entry & MM_PTE_PAGED_OUT)) {
+            MmReferencePagingFileSlot((ULONG)((entry & MM_PTE_FRAME_MASK) >> MM_PT_SHIFT), -1);
+        } else if (Level == 1) {
+            MM_PAGE_FLAGS((entry & MM_PTE_FRAME_MASK) / DSLOS_PAGE_SIZE) &= ~(PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE);
+            MmFreePhysicalMemory((PVOID)(ULONG_PTR)(entry & MM_PTE_FRAME_MASK), DSLOS_PAGE_SIZE);
+            InterlockedDecrement((PLONG)&g_MemoryManager.Statistics.BasePageMappings);
+        } else if (Level == 2 && (entry & MM_PTE_LARGE)) {
+            MmFreePhysicalMemory((PVOID)(ULONG_PTR)(entry & MM_PTE_LARGE_FRAME_MASK), MM_HUGE_PAGE_SIZE);
+            InterlockedDecrement((PLONG)&g_MemoryManager.Statistics.HugePageMappings);
+        } else {
+            PMM_PTE child = MM_PTE_TABLE(entry);
+            MmFreePageTables(child, Level - 1, 0, MM_PAGE_TABLE_ENTRIES - 1);
+            MmFreePageTable(child);
+        }
+
+        Table[i] = 0;
+    }
+}
+
+/**
+ * @brief Share the pages mapped below a table entry range with another address space
+ * @param SourceSpace Address space being cloned (page table lock held)
+ * @param Source Page table of the address space being cloned
+ * @param Target Empty page table at the same level in the new address space
+ * @param Level Table level (4 for the PML4, 1 for a page table)
+ * @param FirstIndex First entry to share
+ * @param LastIndex Last entry to share
+ * @return NTSTATUS Status code
+ * @note Shared entries lose write access on both sides and are marked copy-on-write,
+ *       so the caller must flush the source translations afterwards. Page tables
+ *       are copied; data pages and huge pages only gain a reference. Shared pages
+ *       leave the source working set, and paged-out entries share their slot
+ */
+static NTSTATUS MmClonePageTables(PADDRESS_SPACE_DESCRIPTOR SourceSpace, PMM_PTE Source, PMM_PTE Target,
+                                  ULONG Level, ULONG FirstIndex, ULONG LastIndex)
+{
+    for (ULONG i = FirstIndex; i <= LastIndex; i++) {
+        MM_PTE entry = Source[i];
+        if (entry == 0) {
+            continue;
+        }
+
+        if (Level == 1 && (entry & MM_PTE_PAGED_OUT)) {
+            MmReferencePagingFileSlot((ULONG)((entry & MM_PTE_FRAME_MASK) >> MM_PT_SHIFT), 1);
+            Target[i] = entry;
+            continue;
+        }
+
+        if (Level == 1 || (Level == 2 && (entry & MM_PTE_LARGE))) {
+            if (Level == 1) {
+                MmRemoveWorkingSetPage(SourceSpace, (ULONG_PTR)(entry & MM_PTE_FRAME_MASK));
+                MmReferencePhysicalPages((ULONG_PTR)(entry & MM_PTE_FRAME_MASK), 1);
+                InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.BasePageMappings);
+            } else {
+                MmReferencePhysicalPages((ULONG_PTR)(entry & MM_PTE_LARGE_FRAME_MASK), MM_PAGE_TABLE_ENTRIES);
+                InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.HugePageMappings);
+            }
+
+            entry = (entry & ~MM_PTE_WRITABLE) | MM_PTE_COPY_ON_WRITE;
+            Source[i] = entry;
+            Target[i] = entry;
+            continue;
+        }
+
+        PMM_PTE table = MmAllocatePageTable();
+        if (table == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Target[i] = MM_TABLE_FRAME(table) | (entry & ~MM_PTE_FRAME_MASK);
+
+        NTSTATUS status = MmClonePageTables(SourceSpace, MM_PTE_TABLE(entry), table,
+                                            Level - 1, 0, MM_PAGE_TABLE_ENTRIES - 1);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Start a TLB invalidation batch
+ * @param Batch Batch to initialize
+ * @param AddressSpace Address space whose translations are queued
+ */
+static VOID MmInitializeTlbBatch(PMM_TLB_BATCH Batch, PADDRESS_SPACE_DESCRIPTOR AddressSpace)
+{
+    Batch->AddressSpace = AddressSpace;
+    Batch->Count = 0;
+    Batch->FlushAll = FALSE;
+    Batch->Unload = FALSE;
+}
+
+/**
+ * @brief Queue a stale translation for invalidation
+ * @param Batch TLB batch
+ * @param VirtualAddress Address whose translation changed
+ */
+static VOID MmAddTlbBatchEntry(PMM_TLB_BATCH Batch, PVOID VirtualAddress)
+{
+    if (Batch->FlushAll) {
+        return;
+    }
+
+    if (Batch->Count == MM_TLB_BATCH_SIZE) {
+        Batch->FlushAll = TRUE; // Cheaper to flush everything than to track more entries
+        return;
+    }
+
+    Batch->Addresses[Batch->Count++] = VirtualAddress;
+}
+
+/**
+ * @brief Invalidate the translations queued in a batch on the current processor
+ * @param Batch TLB batch
+ */
+static VOID MmInvalidateTlbBatch(PMM_TLB_BATCH Batch)
+{
+    if (Batch->FlushAll) {
+        HalFlushTlb();
+        return;
+    }
+
+    for (ULONG i = 0; i < Batch->Count; i++) {
+        HalInvalidateTlbEntry(Batch->Addresses[i]);
+    }
+}
+
+/**
+ * @brief Apply the TLB shootdown aimed at the current processor, if any
+ * @note Called from the shootdown interrupt, and by a processor waiting to
+ *       start a shootdown of its own so that two initiators cannot deadlock.
+ *       An unloading shootdown also moves the processor to the system page tables
+ */
+VOID MmProcessTlbShootdown(VOID)
+{
+    ULONG processor = KeGetCurrentProcessorNumber();
+    LONG64 bit = (LONG64)(1ULL << processor);
+
+    if (g_MemoryManager.ShootdownPending & bit) {
+        PMM_TLB_BATCH batch = g_MemoryManager.ShootdownBatch;
+        MmInvalidateTlbBatch(batch);
+        if (batch->Unload && g_MemoryManager.LoadedAddressSpaces[processor] == batch->AddressSpace) {
+            MmSwitchAddressSpace(NULL);
+        }
+        InterlockedAnd64(&g_MemoryManager.ShootdownPending, ~bit);
+    }
+}
+
+/**
+ * @brief Invalidate a batch on other processors and wait until they have
+ * @param Batch TLB batch
+ * @param Targets Processors to interrupt, never including the current one
+ */
+static VOID MmSendTlbShootdown(PMM_TLB_BATCH Batch, ULONG64 Targets)
+{
+    while (InterlockedCompareExchange(&g_MemoryManager.ShootdownBusy, 1, 0) != 0) {
+        MmProcessTlbShootdown();
+        KeYieldProcessor();
+    }
+
+    g_MemoryManager.ShootdownBatch = Batch;
+    InterlockedExchange64(&g_MemoryManager.ShootdownPending, (LONG64)Targets);
+
+    for (ULONG64 remaining = Targets; remaining != 0; remaining &= remaining - 1) {
+        HalSendInterProcessorInterrupt(MmFindFirstSet64(remaining), HAL_TLB_SHOOTDOWN_VECTOR);
+    }
+
+    while (g_MemoryManager.ShootdownPending != 0) {
+        KeYieldProcessor();
+    }
+
+    g_MemoryManager.ShootdownBatch = NULL;
+    InterlockedExchange(&g_MemoryManager.ShootdownBusy, 0);
+}
+
+/**
+ * @brief Invalidate all translations queued in a batch
+ * @param Batch TLB batch
+ * @note Processors other than the current one are interrupted only when they
+ *       have the address space loaded. System range entries are global, so
+ *       they, and batches spanning address spaces, go to every processor that
+ *       has loaded page tables
+ */
+static VOID MmFlushTlbBatch(PMM_TLB_BATCH Batch)
+{
+    if (!Batch->FlushAll && Batch->Count == 0) {
+        return;
+    }
+
+    MmInvalidateTlbBatch(Batch);
+    if (Batch->FlushAll) {
+        InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.TlbFullFlushCount);
+    } else {
+        InterlockedExchangeAdd((PLONG)&g_MemoryManager.Statistics.TlbEntryFlushCount, (LONG)Batch->Count);
+    }
+
+    PADDRESS_SPACE_DESCRIPTOR address_space = Batch->AddressSpace;
+    ULONG64 targets = (address_space == NULL || address_space == &g_MemoryManager.SystemAddressSpace) ?
+                      (ULONG64)g_MemoryManager.LoadedProcessors : (ULONG64)address_space->ActiveProcessors;
+    targets &= ~(1ULL << KeGetCurrentProcessorNumber());
+
+    if (targets != 0) {
+        MmSendTlbShootdown(Batch, targets);
+        InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.TlbShootdownCount);
+    }
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.TlbBatchCount);
+    MmInitializeTlbBatch(Batch, address_space);
+}
+
+/**
+ * @brief Split the huge page mapping an address into base page mappings
+ * @param AddressSpace Address space (page table lock held)
+ * @param Address Boundary address; nothing is split when it is 2MB aligned
+ * @param Batch TLB batch receiving the replaced translation
+ * @return NTSTATUS Status code
+ * @note The order-9 block stays allocated. Each of its pages carries its own
+ *       reference, so the pages can be freed one by one afterwards
+ */
+static NTSTATUS MmSplitHugePage(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Address, PMM_TLB_BATCH Batch)
+{
+    if ((Address & MM_HUGE_PAGE_MASK) == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    PMM_PTE pde = MmWalkPageTables((PMM_PTE)AddressSpace->PageDirectory, (PVOID)Address, 2, FALSE);
+    if (pde == NULL || !(*pde & MM_PTE_LARGE)) {
+        return STATUS_SUCCESS;
+    }
+
+    PMM_PTE table = MmAllocatePageTable();
+    if (table == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    MM_PTE frame = *pde & MM_PTE_LARGE_FRAME_MASK;
+    MM_PTE flags = *pde & ~(MM_PTE_FRAME_MASK | MM_PTE_LARGE);
+    for (ULONG i = 0; i < MM_PAGE_TABLE_ENTRIES; i++) {
+        table[i] = (frame + (MM_PTE)i * DSLOS_PAGE_SIZE) | flags;
+    }
+
+    if (*pde & MM_PTE_PRESENT) {
+        MmAddTlbBatchEntry(Batch, (PVOID)(Address & ~(ULONG_PTR)MM_HUGE_PAGE_MASK));
+    }
+    *pde = MM_TABLE_FRAME(table) | MM_PTE_PRESENT | MM_PTE_WRITABLE | MM_PTE_USER;
+
+    InterlockedDecrement((PLONG)&g_MemoryManager.Statistics.HugePageMappings);
+    InterlockedExchangeAdd((PLONG)&g_MemoryManager.Statistics.BasePageMappings, MM_PAGE_TABLE_ENTRIES);
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.HugePageSplits);
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Revoke the translations of a range, queueing them for invalidation
+ * @param AddressSpace Address space (page table lock held)
+ * @param VirtualAddress Start of range
+ * @param Size Size of range
+ * @param Batch TLB batch receiving the revoked addresses
+ * @note Entries keep their frames so the pages can be released once the batch
+ *       is flushed. Huge pages straddling the range ends must already be split
+ */
+static VOID MmRevokePageTableEntries(PADDRESS_SPACE_DESCRIPTOR AddressSpace, PVOID VirtualAddress,
+                                     SIZE_T Size, PMM_TLB_BATCH Batch)
+{
+    ULONG_PTR address = (ULONG_PTR)VirtualAddress;
+    ULONG_PTR end = address + Size;
+
+    while (address < end) {
+        PMM_PTE entry = MmWalkPageTables((PMM_PTE)AddressSpace->PageDirectory, (PVOID)address, 1, FALSE);
+
+        if (entry == NULL || (*entry & MM_PTE_LARGE)) {
+            // A missing table or a huge page covers the rest of the 2MB window
+            if (entry != NULL && (*entry & MM_PTE_PRESENT)) {
+                *entry &= ~MM_PTE_PRESENT;
+                MmAddTlbBatchEntry(Batch, (PVOID)address);
+            }
+            address = (address | MM_HUGE_PAGE_MASK) + 1;
+            continue;
+        }
+
+        if (*entry & MM_PTE_PRESENT) {
+            *entry &= ~MM_PTE_PRESENT;
+            MmAddTlbBatchEntry(Batch, (PVOID)address);
+        }
+        address += DSLOS_PAGE_SIZE;
+    }
+}
+
+/**
+ * @brief Clear the entries of a revoked range and free the pages they map
+ * @param AddressSpace Address space (page table lock held)
+ * @param VirtualAddress Start of range
+ * @param Size Size of range
+ * @note Emptied page tables are kept until the address space is destroyed.
+ *       Paged-out entries give up their paging file slot
+ */
+static VOID MmReleasePageTableEntries(PADDRESS_SPACE_DESCRIPTOR AddressSpace, PVOID VirtualAddress, SIZE_T Size)
+{
+    ULONG_PTR address = (ULONG_PTR)VirtualAddress;
+    ULONG_PTR end = address + Size;
+
+    while (address < end) {
+        PMM_PTE entry = MmWalkPageTables((PMM_PTE)AddressSpace->PageDirectory, (PVOID)address, 1, FALSE);
+
+        if (entry == NULL || (*entry & MM_PTE_LARGE)) {
+            if (entry != NULL) {
+                MmFreePhysicalMemory((PVOID)(ULONG_PTR)(*entry & MM_PTE_LARGE_FRAME_MASK), MM_HUGE_PAGE_SIZE);
+                InterlockedDecrement((PLONG)&g_MemoryManager.Statistics.HugePageMappings);
+                *entry = 0;
+            }
+            address = (address | MM_HUGE_PAGE_MASK) + 1;
+            continue;
+        }
+
+        if (*entry & MM_PTE_PAGED_OUT) {
+            MmReferencePagingFileSlot((ULONG)((*entry & MM_PTE_FRAME_MASK) >> MM_PT_SHIFT), -1);
+            *entry = 0;
+        } else if (*entry != 0) {
+            MmRemoveWorkingSetPage(AddressSpace, (ULONG_PTR)(*entry & MM_PTE_FRAME_MASK));
+            MmFreePhysicalMemory((PVOID)(ULONG_PTR)(*entry & MM_PTE_FRAME_MASK), DSLOS_PAGE_SIZE);
+            InterlockedDecrement((PLONG)&g_MemoryManager.Statistics.BasePageMappings);
+            *entry = 0;
+        }
+        address += DSLOS_PAGE_SIZE;
+    }
+}
+
+/**
+ * @brief Back a range with physical pages and map them
+ * @param AddressSpace Address space
+ * @param VirtualAddress Start of range (page aligned)
+ * @param Size Size of range (page aligned)
+ * @param Protect Memory protection flags
+ * @return NTSTATUS Status code
+ * @note Every 2MB-aligned 2MB window of the range is mapped with a huge page
+ *       while order-9 blocks are available; the rest uses base pages
+ */
+static NTSTATUS MmPopulateVirtualMemory(PADDRESS_SPACE_DESCRIPTOR AddressSpace, PVOID VirtualAddress,
+                                        SIZE_T Size, ULONG Protect)
+{
+    BOOLEAN user_accessible = (AddressSpace != &g_MemoryManager.SystemAddressSpace);
+    MM_PTE flags = MmProtectToPte(Protect, user_accessible);
+    PMM_PTE pml4 = (PMM_PTE)AddressSpace->PageDirectory;
+    ULONG_PTR start = (ULONG_PTR)VirtualAddress;
+    ULONG_PTR end = start + Size;
+    ULONG_PTR address = start;
+    BOOLEAN huge_pages_available = TRUE;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    MM_TLB_BATCH batch;
+    MmInitializeTlbBatch(&batch, AddressSpace);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&AddressSpace->PageTableLock, &old_irql);
+
+    while (address < end) {
+        if ((address & MM_HUGE_PAGE_MASK) == 0 && end - address >= MM_HUGE_PAGE_SIZE) {
+            PVOID huge_page = huge_pages_available ?
+                MmAllocatePhysicalPages(MM_HUGE_PAGE_SIZE, MM_ALLOCATE_NO_COMPACT) : NULL;
+
+            if (huge_page != NULL) {
+                PMM_PTE pde = MmWalkPageTables(pml4, (PVOID)address, 2, TRUE);
+                if (pde == NULL) {
+                    MmFreePhysicalMemory(huge_page, MM_HUGE_PAGE_SIZE);
+                    status = STATUS_INSUFFICIENT_RESOURCES;
+                    break;
+                }
+
+                // Drop the empty page table an earlier unmap left behind
+                if (*pde & MM_PTE_PRESENT) {
+                    MmFreePageTable(MM_PTE_TABLE(*pde));
+                    MmAddTlbBatchEntry(&batch, (PVOID)address);
+                }
+
+                *pde = ((MM_PTE)(ULONG_PTR)huge_page & MM_PTE_LARGE_FRAME_MASK) | flags | MM_PTE_LARGE;
+                InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.HugePageMappings);
+                address += MM_HUGE_PAGE_SIZE;
+                continue;
+            }
+
+            // Stop asking the buddy allocator once it has no order-9 block left
+            huge_pages_available = FALSE;
+            InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.HugePageFallbacks);
+        }
+
+        PVOID page = MmAllocatePhysicalMemory(DSLOS_PAGE_SIZE);
+        PMM_PTE pte = (page != NULL) ? MmWalkPageTables(pml4, (PVOID)address, 1, TRUE) : NULL;
+        if (pte == NULL) {
+            if (page != NULL) {
+                MmFreePhysicalMemory(page, DSLOS_PAGE_SIZE);
+            }
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        *pte = ((MM_PTE)(ULONG_PTR)page & MM_PTE_FRAME_MASK) | flags;
+        InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.BasePageMappings);
+        address += DSLOS_PAGE_SIZE;
+    }
+
+    if (!NT_SUCCESS(status)) {
+        // Roll back the part that was mapped
+        MmRevokePageTableEntries(AddressSpace, VirtualAddress, address - start, &batch);
+        MmFlushTlbBatch(&batch);
+        MmReleasePageTableEntries(AddressSpace, VirtualAddress, address - start);
+    }
+
+    KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+
+    MmFlushTlbBatch(&batch);
+    return status;
+}
+
+/**
+ * @brief Unmap virtual memory and free the pages backing it
+ * @param AddressSpace Address space
+ * @param VirtualAddress Start of range (page aligned)
+ * @param Size Size of range (page aligned)
+ * @return NTSTATUS Status code
+ * @note Fails without unmapping anything if a huge page straddling the range
+ *       ends cannot be split
+ */
+static NTSTATUS MmUnmapVirtualMemory(PADDRESS_SPACE_DESCRIPTOR AddressSpace, PVOID VirtualAddress, SIZE_T Size)
+{
+    ULONG_PTR start = (ULONG_PTR)VirtualAddress;
+
+    MM_TLB_BATCH batch;
+    MmInitializeTlbBatch(&batch, AddressSpace);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&AddressSpace->PageTableLock, &old_irql);
+
+    NTSTATUS status = MmSplitHugePage(AddressSpace, start, &batch);
+    if (NT_SUCCESS(status)) {
+        status = MmSplitHugePage(AddressSpace, start + Size, &batch);
+    }
+
+    if (NT_SUCCESS(status)) {
+        // One flush for the whole range, then the pages can be reused
+        MmRevokePageTableEntries(AddressSpace, VirtualAddress, Size, &batch);
+        MmFlushTlbBatch(&batch);
+        MmReleasePageTableEntries(AddressSpace, VirtualAddress, Size);
+    }
+
+    KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+
+    MmFlushTlbBatch(&batch);
+    return status;
+}
+
+/**
+ * @brief Rewrite the protection of the entries mapping a range
+ * @param AddressSpace Address space
+ * @param VirtualAddress Start of range (page aligned)
+ * @param Size Size of range (page aligned)
+ * @param Protect Memory protection flags
+ * @return NTSTATUS Status code
+ * @note Huge pages entirely inside the range keep their huge mapping. Copy-on-write
+ *       entries gain write access only when a write fault breaks the sharing
+ */
+static NTSTATUS MmProtectPageTableEntries(PADDRESS_SPACE_DESCRIPTOR AddressSpace, PVOID VirtualAddress,
+                                          SIZE_T Size, ULONG Protect)
+{
+    BOOLEAN user_accessible = (AddressSpace != &g_MemoryManager.SystemAddressSpace);
+    MM_PTE flags = MmProtectToPte(Protect, user_accessible);
+    ULONG_PTR address = (ULONG_PTR)VirtualAddress;
+    ULONG_PTR end = address + Size;
+
+    MM_TLB_BATCH batch;
+    MmInitializeTlbBatch(&batch, AddressSpace);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&AddressSpace->PageTableLock, &old_irql);
+
+    NTSTATUS status = MmSplitHugePage(AddressSpace, address, &batch);
+    if (NT_SUCCESS(status)) {
+        status = MmSplitHugePage(AddressSpace, end, &batch);
+    }
+
+    while (NT_SUCCESS(status) && address < end) {
+        PMM_PTE entry = MmWalkPageTables((PMM_PTE)AddressSpace->PageDirectory, (PVOID)address, 1, FALSE);
+
+        if (entry == NULL) {
+            address = (address | MM_HUGE_PAGE_MASK) + 1;
+            continue;
+        }
+
+        // Paged-out entries take the region's protection when paged back in
+        BOOLEAN large = (*entry & MM_PTE_LARGE) != 0;
+        if (*entry != 0 && !(*entry & MM_PTE_PAGED_OUT)) {
+            if (*entry & MM_PTE_PRESENT) {
+                MmAddTlbBatchEntry(&batch, (PVOID)address);
+            }
+
+            // Shared frames stay read-only until a write fault breaks the sharing
+            MM_PTE entry_flags = flags;
+            if (*entry & MM_PTE_COPY_ON_WRITE) {
+                entry_flags = (flags & ~MM_PTE_WRITABLE) | MM_PTE_COPY_ON_WRITE;
+            }
+
+            *entry = large ? ((*entry & MM_PTE_LARGE_FRAME_MASK) | entry_flags | MM_PTE_LARGE)
+                           : ((*entry & MM_PTE_FRAME_MASK) | entry_flags);
+        }
+
+        address = large ? (address | MM_HUGE_PAGE_MASK) + 1 : address + DSLOS_PAGE_SIZE;
+    }
+
+    KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+
+    MmFlushTlbBatch(&batch);
+    return status;
+}
+
+/**
+ * @brief Give a faulting address space its own writable copy of a shared page
+ * @param AddressSpace Address space (page table lock held)
+ * @param Address Page-aligned faulting address
+ * @param Entry Copy-on-write entry mapping the address
+ * @return NTSTATUS Status code
+ * @note A shared huge page is split first so only the written 4KB page is copied.
+ *       The last sharer takes the frame over without copying
+ */
+static NTSTATUS MmResolveCopyOnWriteFault(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Address, PMM_PTE Entry)
+{
+    MM_TLB_BATCH batch;
+    MmInitializeTlbBatch(&batch, AddressSpace);
+
+    if (*Entry & MM_PTE_LARGE) {
+        // Any unaligned address inside the window splits it
+        NTSTATUS status = MmSplitHugePage(AddressSpace,
+            (Address & ~(ULONG_PTR)MM_HUGE_PAGE_MASK) + DSLOS_PAGE_SIZE, &batch);
+        if (!NT_SUCCESS(status)) {
+            MmFlushTlbBatch(&batch);
+            return status;
+        }
+        Entry = MmWalkPageTables((PMM_PTE)AddressSpace->PageDirectory, (PVOID)Address, 1, FALSE);
+    }
+
+    ULONG_PTR frame = (ULONG_PTR)(*Entry & MM_PTE_FRAME_MASK);
+    MM_PTE flags = (*Entry & ~(MM_PTE_FRAME_MASK | MM_PTE_COPY_ON_WRITE)) | MM_PTE_WRITABLE | MM_PTE_ACCESSED;
+    ULONG pfn = (ULONG)(frame / DSLOS_PAGE_SIZE);
+    PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[pfn];
+    PVOID copy = NULL;
+
+    // A merged frame is taken over only once no other page can be merged into it
+    BOOLEAN shared = (MM_PAGE_REFERENCES(pfn) > 1);
+    if (!shared && (MM_PAGE_FLAGS(pfn) & PAGE_FLAG_MERGED)) {
+        shared = !MmUnmergePage(page);
+    }
+
+    if (shared) {
+        copy = MmAllocatePhysicalMemory(DSLOS_PAGE_SIZE);
+        if (copy == NULL) {
+            MmFlushTlbBatch(&batch);
+            return STATUS_NO_MEMORY;
+        }
+
+        RtlCopyMemory(MmPhysicalToVirtual((ULONG_PTR)copy), MmPhysicalToVirtual(frame), DSLOS_PAGE_SIZE);
+        *Entry = ((MM_PTE)(ULONG_PTR)copy & MM_PTE_FRAME_MASK) | flags;
+        MmInsertWorkingSetPage(AddressSpace, (ULONG_PTR)copy, Address);
+        InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.CopyOnWriteCopies);
+    } else {
+        *Entry = (MM_PTE)frame | flags;
+        MmInsertWorkingSetPage(AddressSpace, frame, Address);
+    }
+
+    MmAddTlbBatchEntry(&batch, (PVOID)Address);
+    MmFlushTlbBatch(&batch);
+
+    // The read-only translation is gone, so the shared reference can be dropped
+    if (copy != NULL) {
+        MmFreePhysicalMemory((PVOID)frame, DSLOS_PAGE_SIZE);
+    }
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.CopyOnWriteFaults);
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Map a page read back from the paging file, or set up the read
+ * @param AddressSpace Address space (page table lock held)
+ * @param Address Page-aligned faulting address
+ * @param Entry Paged-out entry mapping the address
+ * @param Flags Entry flags for the region's protection
+ * @param PageIn Page read by an earlier attempt at the fault, if any
+ * @return STATUS_SUCCESS once the page is mapped, or
+ *         STATUS_MORE_PROCESSING_REQUIRED when the caller must read the slot
+ *         into PageIn with no lock held and retry the fault
+ * @note The page comes back private even if a clone still shares the slot.
+ *       The read's slot reference keeps the slot from being reused, so a page
+ *       read for the slot the entry still names holds its contents
+ */
+static NTSTATUS MmResolvePagedOutFault(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Address,
+                                       PMM_PTE Entry, MM_PTE Flags, PMM_PAGE_IN PageIn)
+{
+    ULONG slot = (ULONG)((*Entry & MM_PTE_FRAME_MASK) >> MM_PT_SHIFT);
+
+    if (PageIn->Page == NULL || PageIn->Slot != slot) {
+        if (PageIn->Page != NULL) {
+            MmFreePhysicalMemory(PageIn->Page, DSLOS_PAGE_SIZE);
+            MmReferencePagingFileSlot(PageIn->Slot, -1);
+        }
+
+        PageIn->Page = MmAllocatePhysicalMemory(DSLOS_PAGE_SIZE);
+        if (PageIn->Page == NULL) {
+            return STATUS_NO_MEMORY;
+        }
+
+        PageIn->Slot = slot;
+        MmReferencePagingFileSlot(slot, 1);
+        return STATUS_MORE_PROCESSING_REQUIRED;
+    }
+
+    PVOID page = PageIn->Page;
+    PageIn->Page = NULL;
+
+    *Entry = ((MM_PTE)(ULONG_PTR)page & MM_PTE_FRAME_MASK) | Flags | MM_PTE_ACCESSED;
+    MmReferencePagingFileSlot(slot, -1); // The entry's
+    MmReferencePagingFileSlot(slot, -1); // The read's
+    MmInsertWorkingSetPage(AddressSpace, (ULONG_PTR)page, Address);
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.BasePageMappings);
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.PageInCount);
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Map a zero-filled page at a faulting address, page one back in, or break copy-on-write sharing
+ * @param AddressSpace Address space
+ * @param Address Page-aligned faulting address
+ * @param FaultCode MM_FAULT_* bits of the fault
+ * @param Protect Protection of the region
+ * @param HugeAllowed TRUE if the 2MB window around the address lies inside one committed region
+ * @param PageIn Page read from the paging file by an earlier attempt at the fault
+ * @return NTSTATUS Status code; STATUS_MORE_PROCESSING_REQUIRED asks the
+ *         caller to read PageIn's slot and retry
+ * @note A fault on a page that is still being written out is retried until
+ *       the write is done. One left in transition after the write was
+ *       abandoned is mapped again as it is
+ */
+static NTSTATUS MmResolveDemandZeroFault(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Address,
+                                         ULONG FaultCode, ULONG Protect, BOOLEAN HugeAllowed,
+                                         PMM_PAGE_IN PageIn)
+{
+    BOOLEAN user_accessible = (AddressSpace != &g_MemoryManager.SystemAddressSpace);
+    MM_PTE flags = MmProtectToPte(Protect, user_accessible);
+    PMM_PTE pml4 = (PMM_PTE)AddressSpace->PageDirectory;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&AddressSpace->PageTableLock, &old_irql);
+
+    PMM_PTE entry = MmWalkPageTables(pml4, (PVOID)Address, 1, FALSE);
+    if (entry != NULL && *entry != 0) {
+        // Paged out, or already mapped. A write copies a shared page in a
+        // writable region. A fault on a page that was not present when it was
+        // taken lost a race with another processor and is retried
+        if (*entry & MM_PTE_PAGED_OUT) {
+            status = MmResolvePagedOutFault(AddressSpace, Address, entry, flags, PageIn);
+        } else if (*entry & MM_PTE_TRANSITION) {
+            ULONG_PTR frame = (ULONG_PTR)(*entry & MM_PTE_FRAME_MASK);
+            if (!(MM_PAGE_FLAGS(frame / DSLOS_PAGE_SIZE) & PAGE_FLAG_PAGE_OUT)) {
+                *entry = (*entry & ~MM_PTE_TRANSITION) | MM_PTE_PRESENT | MM_PTE_ACCESSED;
+                if (!(*entry & MM_PTE_COPY_ON_WRITE)) {
+                    MmInsertWorkingSetPage(AddressSpace, frame, Address);
+                }
+            }
+        } else if (!(*entry & MM_PTE_PRESENT)) {
+            status = STATUS_ACCESS_VIOLATION;
+        } else if (FaultCode & MM_FAULT_WRITE) {
+            if ((*entry & MM_PTE_COPY_ON_WRITE) && (flags & MM_PTE_WRITABLE)) {
+                status = MmResolveCopyOnWriteFault(AddressSpace, Address, entry);
+            } else if (!(*entry & MM_PTE_WRITABLE)) {
+                status = STATUS_ACCESS_VIOLATION;
+            }
+        } else if (FaultCode & MM_FAULT_PROTECTION) {
+            status = STATUS_ACCESS_VIOLATION;
+        }
+        KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+        return status;
+    }
+
+    // A whole untouched 2MB window is faulted in as one huge page
+    if (HugeAllowed && entry == NULL) {
+        PVOID huge_page = MmAllocatePhysicalPages(MM_HUGE_PAGE_SIZE,
+                                                  MM_ALLOCATE_ZEROED | MM_ALLOCATE_NO_COMPACT);
+        PMM_PTE pde = (huge_page != NULL) ? MmWalkPageTables(pml4, (PVOID)Address, 2, TRUE) : NULL;
+
+        if (pde != NULL) {
+            *pde = ((MM_PTE)(ULONG_PTR)huge_page & MM_PTE_LARGE_FRAME_MASK) | flags | MM_PTE_LARGE;
+            InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.HugePageMappings);
+            InterlockedExchangeAdd((PLONG)&g_MemoryManager.Statistics.PageInCount, MM_PAGE_TABLE_ENTRIES);
+            KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+            return STATUS_SUCCESS;
+        }
+
+        if (huge_page != NULL) {
+            MmFreePhysicalMemory(huge_page, MM_HUGE_PAGE_SIZE);
+        }
+        InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.HugePageFallbacks);
+    }
+
+    PVOID page = MmAllocateZeroedPhysicalMemory(DSLOS_PAGE_SIZE);
+    entry = (page != NULL) ? MmWalkPageTables(pml4, (PVOID)Address, 1, TRUE) : NULL;
+    if (entry == NULL) {
+        if (page != NULL) {
+            MmFreePhysicalMemory(page, DSLOS_PAGE_SIZE);
+        }
+        KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+        return STATUS_NO_MEMORY;
+    }
+
+    // Pre-set the accessed bit so the page is not aged out before the retried access
+    *entry = ((MM_PTE)(ULONG_PTR)page & MM_PTE_FRAME_MASK) | flags | MM_PTE_ACCESSED;
+    MmInsertWorkingSetPage(AddressSpace, (ULONG_PTR)page, Address);
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.BasePageMappings);
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.PageInCount);
+
+    KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+
+    // The entry was not present before, so no stale translation can exist
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Check whether a page holds only zeros
+ * @param Page Page to scan
+ * @return TRUE if every byte is zero
+ */
+static BOOLEAN MmIsZeroPage(PVOID Page)
+{
+    PULONG_PTR words = (PULONG_PTR)Page;
+
+    for (ULONG i = 0; i < DSLOS_PAGE_SIZE / sizeof(ULONG_PTR); i++) {
+        if (words[i] != 0) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Age the active working set list through the accessed bit
+ * @param AddressSpace Address space (page table lock held)
+ * @param ScanCount Pages to examine from the tail of the active list
+ * @note Referenced pages go back to the head with the bit cleared, the others
+ *       move to the inactive list. Cleared bits are not flushed, so a cached
+ *       translation can hide a reference until its next TLB flush
+ */
+static VOID MmAgeWorkingSet(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG ScanCount)
+{
+    PMM_PTE pml4 = (PMM_PTE)AddressSpace->PageDirectory;
+
+    while (ScanCount-- > 0 && AddressSpace->ActivePageCount > 0) {
+        PPHYSICAL_PAGE_FRAME page = CONTAINING_RECORD(RemoveTailList(&AddressSpace->ActiveListHead),
+                                                      PHYSICAL_PAGE_FRAME, PageListEntry);
+        PMM_PTE entry = MmWalkPageTables(pml4, page->VirtualMapping, 1, FALSE);
+
+        if (*entry & MM_PTE_ACCESSED) {
+            *entry &= ~MM_PTE_ACCESSED;
+            InsertHeadList(&AddressSpace->ActiveListHead, &page->PageListEntry);
+            continue;
+        }
+
+        MM_PAGE_FLAGS(MM_PFN(page)) = (MM_PAGE_FLAGS(MM_PFN(page)) & ~PAGE_FLAG_ACTIVE) | PAGE_FLAG_INACTIVE;
+        InsertHeadList(&AddressSpace->InactiveListHead, &page->PageListEntry);
+        AddressSpace->ActivePageCount--;
+        AddressSpace->InactivePageCount++;
+    }
+}
+
+/**
+ * @brief Evict pages from the working set of an address space
+ * @param AddressSpace Address space
+ * @param PageCount Pages wanted
+ * @return Pages evicted
+ * @note All-zero pages are dropped and come back as demand-zero faults; other
+ *       pages are written to the paging file, or stay resident without one.
+ *       Inactive pages referenced since they were aged get a second chance on
+ *       the active list. Victims are revoked in batches so a batch costs one
+ *       TLB flush, and are examined only once no processor can write them.
+ *       A victim's entry is left in transition and the frame referenced while
+ *       it is written out with the page table lock dropped; the entry is only
+ *       changed afterwards if nothing else changed it meanwhile
+ */
+static ULONG MmTrimAddressSpace(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG PageCount)
+{
+    PMM_PAGING_FILE paging_file = &g_MemoryManager.PagingFile;
+    PMM_PTE pml4 = (PMM_PTE)AddressSpace->PageDirectory;
+    PPHYSICAL_PAGE_FRAME victims[MM_RECLAIM_BATCH];
+    PVOID victim_addresses[MM_RECLAIM_BATCH];
+    MM_PTE victim_values[MM_RECLAIM_BATCH];
+    MM_PTE new_entries[MM_RECLAIM_BATCH];
+    ULONG evicted = 0;
+
+    MM_TLB_BATCH batch;
+    MmInitializeTlbBatch(&batch, AddressSpace);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&AddressSpace->PageTableLock, &old_irql);
+
+    MmAgeWorkingSet(AddressSpace, (PageCount > MM_RECLAIM_MIN_SCAN / 2) ? PageCount * 2 : MM_RECLAIM_MIN_SCAN);
+
+    // Each inactive page is looked at once per trim
+    ULONG scan = AddressSpace->InactivePageCount;
+
+    while (evicted < PageCount && scan > 0) {
+        ULONG victim_count = 0;
+
+        // Revoke a batch of unreferenced inactive pages
+        while (victim_count < MM_RECLAIM_BATCH && evicted + victim_count < PageCount && scan > 0) {
+            PPHYSICAL_PAGE_FRAME page = CONTAINING_RECORD(RemoveTailList(&AddressSpace->InactiveListHead),
+                                                          PHYSICAL_PAGE_FRAME, PageListEntry);
+            PMM_PTE entry = MmWalkPageTables(pml4, page->VirtualMapping, 1, FALSE);
+            scan--;
+
+            if (*entry & MM_PTE_ACCESSED) {
+                *entry &= ~MM_PTE_ACCESSED;
+                MM_PAGE_FLAGS(MM_PFN(page)) = (MM_PAGE_FLAGS(MM_PFN(page)) & ~PAGE_FLAG_INACTIVE) | PAGE_FLAG_ACTIVE;
+                InsertHeadList(&AddressSpace->ActiveListHead, &page->PageListEntry);
+                AddressSpace->InactivePageCount--;
+                AddressSpace->ActivePageCount++;
+                continue;
+            }
+
+            MM_PAGE_FLAGS(MM_PFN(page)) = (MM_PAGE_FLAGS(MM_PFN(page)) & ~PAGE_FLAG_INACTIVE) | PAGE_FLAG_PAGE_OUT;
+            InitializeListHead(&page->PageListEntry);
+            AddressSpace->InactivePageCount--;
+            MmReferencePhysicalPages(page->PhysicalAddress, 1);
+
+            victims[victim_count] = page;
+            victim_addresses[victim_count] = page->VirtualMapping;
+            victim_values[victim_count] = *entry;
+            victim_count++;
+
+            if (*entry & MM_PTE_PRESENT) {
+                MmAddTlbBatchEntry(&batch, page->VirtualMapping);
+            }
+            *entry = (*entry & ~MM_PTE_PRESENT) | MM_PTE_TRANSITION;
+        }
+
+        MmFlushTlbBatch(&batch);
+        KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+
+        // No processor can write the victims now; write them out unlocked
+        for (ULONG i = 0; i < victim_count; i++) {
+            PVOID page_address = MmPhysicalToVirtual(victims[i]->PhysicalAddress);
+            ULONG slot;
+
+            new_entries[i] = victim_values[i];
+            if (MmIsZeroPage(page_address)) {
+                new_entries[i] = 0;
+            } else if (paging_file->WritePage != NULL && MmAllocatePagingFileSlot(&slot)) {
+                if (NT_SUCCESS(paging_file->WritePage(paging_file->Context, slot, page_address))) {
+                    new_entries[i] = ((MM_PTE)slot << MM_PT_SHIFT) | MM_PTE_PAGED_OUT;
+                } else {
+                    MmReferencePagingFileSlot(slot, -1);
+                }
+            }
+        }
+
+        KeAcquireSpinLock(&AddressSpace->PageTableLock, &old_irql);
+
+        for (ULONG i = 0; i < victim_count; i++) {
+            PPHYSICAL_PAGE_FRAME page = victims[i];
+            PVOID frame = (PVOID)page->PhysicalAddress;
+            MM_PTE transition = (victim_values[i] & ~MM_PTE_PRESENT) | MM_PTE_TRANSITION;
+            PMM_PTE entry = MmWalkPageTables(pml4, victim_addresses[i], 1, FALSE);
+
+            MM_PAGE_FLAGS(MM_PFN(page)) &= ~PAGE_FLAG_PAGE_OUT;
+
+            if (entry == NULL || *entry != transition) {
+                // Unmapped, reprotected or cloned meanwhile: the write is
+                // dropped. A private mapping of the frame rejoins the working set
+                if (new_entries[i] & MM_PTE_PAGED_OUT) {
+                    MmReferencePagingFileSlot((ULONG)(new_entries[i] >> MM_PT_SHIFT), -1);
+                }
+                if (entry != NULL && (*entry & (MM_PTE_PRESENT | MM_PTE_COPY_ON_WRITE)) == MM_PTE_PRESENT &&
+                    (ULONG_PTR)(*entry & MM_PTE_FRAME_MASK) == (ULONG_PTR)frame) {
+                    MmInsertWorkingSetPage(AddressSpace, (ULONG_PTR)frame, (ULONG_PTR)victim_addresses[i]);
+                }
+                MmFreePhysicalMemory(frame, DSLOS_PAGE_SIZE);
+                continue;
+            }
+
+            *entry = new_entries[i];
+            MmFreePhysicalMemory(frame, DSLOS_PAGE_SIZE);
+            if (new_entries[i] == victim_values[i]) {
+                // Nowhere to put it: it stays mapped and starts over as active
+                MmInsertWorkingSetPage(AddressSpace, (ULONG_PTR)frame, (ULONG_PTR)victim_addresses[i]);
+                continue;
+            }
+
+            InterlockedIncrement((PLONG)((new_entries[i] == 0) ? &g_MemoryManager.Statistics.ReclaimedZeroPages :
+                                                                 &g_MemoryManager.Statistics.PageOutCount));
+            page->VirtualMapping = NULL;
+            MmFreePhysicalMemory(frame, DSLOS_PAGE_SIZE);
+            InterlockedDecrement((PLONG)&g_MemoryManager.Statistics.BasePageMappings);
+            InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.ReclaimedPages);
+            evicted++;
+        }
+    }
+
+    KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.WorkingSetTrims);
+    return evicted;
+}
+
+/**
+ * @brief Trim working sets until enough pages are reclaimed
+ * @param PageCount Pages wanted
+ * @return Pages reclaimed
+ * @note Each address space gives up pages in proportion to its working set.
+ *       MemoryLock is dropped while an address space is trimmed; a trim
+ *       reference keeps it listed until the pass moves past it
+ */
+static ULONG MmReclaimPages(ULONG PageCount)
+{
+    ULONG reclaimed = 0;
+    ULONG total_pages = 0;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+
+    for (PLIST_ENTRY entry = g_MemoryManager.AddressSpaceListHead.Flink;
+         entry != &g_MemoryManager.AddressSpaceListHead;
+         entry = entry->Flink) {
+        PADDRESS_SPACE_DESCRIPTOR address_space = CONTAINING_RECORD(entry, ADDRESS_SPACE_DESCRIPTOR,
+                                                                    AddressSpaceListEntry);
+        total_pages += address_space->ActivePageCount + address_space->InactivePageCount;
+    }
+
+    for (PLIST_ENTRY entry = g_MemoryManager.AddressSpaceListHead.Flink;
+         entry != &g_MemoryManager.AddressSpaceListHead && reclaimed < PageCount;
+         entry = entry->Flink) {
+        PADDRESS_SPACE_DESCRIPTOR address_space = CONTAINING_RECORD(entry, ADDRESS_SPACE_DESCRIPTOR,
+                                                                    AddressSpaceListEntry);
+        ULONG working_set = address_space->ActivePageCount + address_space->InactivePageCount;
+        if (working_set == 0 || total_pages == 0) {
+            continue; // Empty, or filled since the total was taken with the lock dropped
+        }
+
+        ULONG share = (ULONG)(((ULONG64)PageCount * working_set + total_pages - 1) / total_pages);
+        if (share > PageCount - reclaimed) {
+            share = PageCount - reclaimed;
+        }
+
+        InterlockedIncrement((PLONG)&address_space->TrimReferences);
+        KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+
+        reclaimed += MmTrimAddressSpace(address_space, share);
+
+        KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+        InterlockedDecrement((PLONG)&address_space->TrimReferences);
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+    return reclaimed;
+}
+
+/**
+ * @brief Compute the fragmentation index of a zone for an order
+ * @param Zone Zone to examine
+ * @param Order Block order
+ * @return Per mille index: near 0 when an allocation of the order would fail
+ *         for lack of free memory, near 1000 when it would fail because free
+ *         memory is fragmented, -1000 when it would succeed
+ * @note Reads the free area counters without the zone lock
+ */
+static LONG MmGetFragmentationIndex(PMM_ZONE Zone, ULONG Order)
+{
+    ULONG free_blocks = 0;
+    ULONG64 free_pages = 0;
+
+    for (ULONG order = 0; order <= MM_MAX_ORDER; order++) {
+        ULONG blocks = Zone->FreeAreas[order].FreeBlockCount;
+        if (order >= Order && blocks > 0) {
+            return -1000;
+        }
+
+        free_blocks += blocks;
+        free_pages += (ULONG64)blocks << order;
+    }
+
+    if (free_blocks == 0) {
+        return 0;
+    }
+
+    return 1000 - (LONG)((1000 + free_pages * 1000 / (1ULL << Order)) / free_blocks);
+}
+
+/**
+ * @brief Check that an address space is still on the address space list
+ * @param AddressSpace Address space
+ * @return TRUE if it is listed
+ * @note Caller holds MemoryLock, so a listed address space cannot be torn down
+ */
+static BOOLEAN MmIsAddressSpaceListed(PADDRESS_SPACE_DESCRIPTOR AddressSpace)
+{
+    for (PLIST_ENTRY entry = g_MemoryManager.AddressSpaceListHead.Flink;
+         entry != &g_MemoryManager.AddressSpaceListHead;
+         entry = entry->Flink) {
+        if (entry == &AddressSpace->AddressSpaceListEntry) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief Move a working set page to another frame and remap it
+ * @param Page Page to move
+ * @param Target Allocated frame receiving the contents
+ * @return TRUE if the page moved; the old frame then stays allocated to the caller
+ * @note Caller holds MemoryLock. The new frame takes the old one's place on the
+ *       working set list, so the page keeps its age
+ */
+static BOOLEAN MmMigratePage(PPHYSICAL_PAGE_FRAME Page, PPHYSICAL_PAGE_FRAME Target)
+{
+    PADDRESS_SPACE_DESCRIPTOR address_space = Page->AddressSpace;
+    if (address_space == NULL || !MmIsAddressSpaceListed(address_space)) {
+        return FALSE;
+    }
+
+    MM_TLB_BATCH batch;
+    MmInitializeTlbBatch(&batch, address_space);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&address_space->PageTableLock, &old_irql);
+
+    // The page may have been unmapped or paged out since it was picked
+    PMM_PTE entry = NULL;
+    if ((MM_PAGE_FLAGS(MM_PFN(Page)) & (PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE)) && Page->AddressSpace == address_space) {
+        entry = MmWalkPageTables((PMM_PTE)address_space->PageDirectory, Page->VirtualMapping, 1, FALSE);
+    }
+
+    if (entry == NULL || (*entry & MM_PTE_PAGED_OUT) ||
+        (ULONG_PTR)(*entry & MM_PTE_FRAME_MASK) != Page->PhysicalAddress) {
+        KeReleaseSpinLock(&address_space->PageTableLock, old_irql);
+        return FALSE;
+    }
+
+    // Copy only once no processor can write the old frame
+    MM_PTE old_entry = *entry;
+    if (old_entry & MM_PTE_PRESENT) {
+        *entry &= ~MM_PTE_PRESENT;
+        MmAddTlbBatchEntry(&batch, Page->VirtualMapping);
+    }
+    MmFlushTlbBatch(&batch);
+
+    RtlCopyMemory(MmPhysicalToVirtual(Target->PhysicalAddress), MmPhysicalToVirtual(Page->PhysicalAddress),
+                  DSLOS_PAGE_SIZE);
+    *entry = ((MM_PTE)Target->PhysicalAddress & MM_PTE_FRAME_MASK) | (old_entry & ~MM_PTE_FRAME_MASK);
+
+    MM_PAGE_FLAGS(MM_PFN(Target)) |= MM_PAGE_FLAGS(MM_PFN(Page)) & (PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE);
+    Target->AddressSpace = address_space;
+    Target->VirtualMapping = Page->VirtualMapping;
+    Target->MergeHash = Page->MergeHash;
+    InsertHeadList(&Page->PageListEntry, &Target->PageListEntry);
+    RemoveEntryList(&Page->PageListEntry);
+    InitializeListHead(&Page->PageListEntry);
+
+    MM_PAGE_FLAGS(MM_PFN(Page)) &= ~(PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE);
+    Page->AddressSpace = NULL;
+    Page->VirtualMapping = NULL;
+
+    KeReleaseSpinLock(&address_space->PageTableLock, old_irql);
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.CompactionMigratedPages);
+    return TRUE;
+}
+
+/**
+ * @brief Empty an aligned block by migrating its working set pages elsewhere
+ * @param Zone Zone owning the block
+ * @param Pfn First page frame number, aligned to the order
+ * @param Order Block order
+ * @return TRUE if the whole block is free afterwards
+ * @note Caller holds MemoryLock. The block's free pages are taken out of the
+ *       free areas first, so migration never picks a target inside the block
+ */
+static BOOLEAN MmCompactBlock(PMM_ZONE Zone, ULONG Pfn, ULONG Order)
+{
+    ULONG page_count = 1UL << Order;
+    ULONG held[(1UL << MM_MAX_ORDER) / 32] = {0};   // Pages of the block owned by compaction
+    BOOLEAN success = TRUE;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Zone->ZoneLock, &old_irql);
+
+    if ((MM_PAGE_FLAGS(Pfn) & PAGE_FLAG_BUDDY_HEAD) && MM_PAGE_ORDER(Pfn) >= Order) {
+        KeReleaseSpinLock(&Zone->ZoneLock, old_irql);
+        return TRUE; // Freed in the meantime
+    }
+
+    // Free blocks inside an aligned range are wholly inside it
+    for (ULONG i = 0; i < page_count; ) {
+        if (!(MM_PAGE_FLAGS(Pfn + i) & PAGE_FLAG_BUDDY_HEAD)) {
+            i++;
+            continue;
+        }
+
+        ULONG block_pages = 1UL << MM_PAGE_ORDER(Pfn + i);
+        MmBuddyRemoveBlock(Zone, Pfn + i);
+        MmSetPagesAvailable(Pfn + i, block_pages, FALSE);
+        Zone->FreePageCount -= block_pages;
+
+        for (ULONG end = i + block_pages; i < end; i++) {
+            MM_PAGE_REFERENCES(Pfn + i) = 1;
+            held[i / 32] |= 1UL << (i % 32);
+        }
+    }
+
+    KeReleaseSpinLock(&Zone->ZoneLock, old_irql);
+
+    for (ULONG i = 0; i < page_count && success; i++) {
+        if (held[i / 32] & (1UL << (i % 32))) {
+            continue;
+        }
+
+        // Pages freed into the block since it was isolated are kept as well
+        PPHYSICAL_PAGE_FRAME target = NULL;
+        ULONG target_pfn;
+        while (MmAllocateZonePages(Zone->Node, 1, &target_pfn)) {
+            if (target_pfn - Pfn >= page_count) {
+                target = &g_MemoryManager.PageFrameArray[target_pfn];
+                break;
+            }
+            held[(target_pfn - Pfn) / 32] |= 1UL << ((target_pfn - Pfn) % 32);
+        }
+
+        if (held[i / 32] & (1UL << (i % 32))) {
+            if (target != NULL) {
+                MmFreeZonePages(target_pfn, 1);
+            }
+            continue;
+        }
+
+        if (target == NULL || !MmMigratePage(&g_MemoryManager.PageFrameArray[Pfn + i], target)) {
+            if (target != NULL) {
+                MmFreeZonePages(target_pfn, 1);
+            }
+            success = FALSE;
+            break;
+        }
+
+        held[i / 32] |= 1UL << (i % 32);
+    }
+
+    KeAcquireSpinLock(&Zone->ZoneLock, &old_irql);
+
+    if (success) {
+        MmBuddyFreeRange(Zone, Pfn, page_count);
+    } else {
+        for (ULONG i = 0; i < page_count; i++) {
+            if (held[i / 32] & (1UL << (i % 32))) {
+                MmBuddyFreeBlock(Zone, Pfn + i, 0);
+            }
+        }
+    }
+
+    KeReleaseSpinLock(&Zone->ZoneLock, old_irql);
+    return success;
+}
+
+/**
+ * @brief Compact a zone until it has a free block of an order
+ * @param Zone Zone to compact
+ * @param Order Block order wanted
+ * @return TRUE if the zone has a free block of the order afterwards
+ * @note Aligned blocks holding only free and working set pages are candidates;
+ *       the one with the fewest pages to move is emptied. The free page bitmap
+ *       lets the scan skip free pages a word at a time and reject blocks with
+ *       too many allocated pages without looking at them. Takes MemoryLock and
+ *       page table locks, so the caller must hold neither
+ */
+static BOOLEAN MmCompactZone(PMM_ZONE Zone, ULONG Order)
+{
+    ULONG page_count = 1UL << Order;
+
+    // Pages parked in per-CPU caches or zeroed lists would look allocated
+    MmDrainAllPerCpuPages();
+    MmReleaseZeroedPages();
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.CompactionRuns);
+
+    BOOLEAN success = (MmGetFragmentationIndex(Zone, Order) == -1000);
+    if (!success) {
+        ULONG best_pfn = 0;
+        ULONG best_moves = page_count;
+
+        for (ULONG pfn = 0; pfn + page_count <= g_MemoryManager.PageFrameArraySize; pfn += page_count) {
+            ULONG end = pfn + page_count;
+
+            // Nodes are contiguous, so the block is on the zone's node if both ends are
+            if (MM_PAGE_NODE(pfn) != Zone->Node || MM_PAGE_NODE(end - 1) != Zone->Node ||
+                page_count - MmCountFreePages(pfn, page_count) >= best_moves) {
+                continue;
+            }
+
+            ULONG moves = 0;
+            for (ULONG i = MmFindNextPage(pfn, end, FALSE); i < end && moves < best_moves;
+                 i = MmFindNextPage(i + 1, end, FALSE)) {
+                if ((MM_PAGE_FLAGS(i) & (PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE)) && MM_PAGE_REFERENCES(i) == 1) {
+                    moves++;
+                } else {
+                    moves = page_count; // Unmovable
+                }
+            }
+
+            if (moves < best_moves) {
+                best_moves = moves;
+                best_pfn = pfn;
+            }
+        }
+
+        if (best_moves < page_count) {
+            success = MmCompactBlock(Zone, best_pfn, Order);
+        }
+    }
+
+    if (success) {
+        InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.CompactionSuccesses);
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+    return success;
+}
+
+/**
+ * @brief Hash the contents of a page
+ * @param Page Page to hash
+ * @return Non-zero 32-bit hash
+ * @note Each lane folds in every MM_MERGE_HASH_LANES-th word with a
+ *       multiply-rotate round, so the lanes are independent and the inner
+ *       loop maps onto vector registers
+ */
+static ULONG MmHashPage(PVOID Page)
+{
+    static const ULONG64 prime1 = 0x9E3779B185EBCA87ULL;
+    static const ULONG64 prime2 = 0xC2B2AE3D27D4EB4FULL;
+    PULONG64 words = (PULONG64)Page;
+    ULONG64 lanes[MM_MERGE_HASH_LANES];
+
+    for (ULONG lane = 0; lane < MM_MERGE_HASH_LANES; lane++) {
+        lanes[lane] = prime1 * (lane + 1);
+    }
+
+    for (ULONG i = 0; i < DSLOS_PAGE_SIZE / sizeof(ULONG64); i += MM_MERGE_HASH_LANES) {
+        for (ULONG lane = 0; lane < MM_MERGE_HASH_LANES; lane++) {
+            ULONG64 value = lanes[lane] + words[i + lane] * prime2;
+            lanes[lane] = ((value << 31) | (value >> 33)) * prime1;
+        }
+    }
+
+    ULONG64 hash = 0;
+    for (ULONG lane = 0; lane < MM_MERGE_HASH_LANES; lane++) {
+        hash = (hash ^ lanes[lane]) * prime2;
+    }
+    hash ^= hash >> 32;
+
+    return (ULONG)hash | 1; // 0 marks a page not hashed yet
+}
+
+/**
+ * @brief Merge a working set page with an identical page
+ * @param AddressSpace Address space (page table lock held)
+ * @param Entry Entry mapping the page
+ * @param Page Working set page whose hash held since the previous pass
+ * @return TRUE if the page was merged and its frame freed
+ * @note Caller holds MemoryLock, which makes the scanner the only path that
+ *       holds two page table locks. An identical merged frame is preferred;
+ *       otherwise the page is matched against the candidate seen last with the
+ *       same hash, and the two become a new merged frame. Pages are compared
+ *       only once no processor can write them, and both entries end up
+ *       read-only and copy-on-write
+ */
+static BOOLEAN MmMergePage(PADDRESS_SPACE_DESCRIPTOR AddressSpace, PMM_PTE Entry, PPHYSICAL_PAGE_FRAME Page)
+{
+    PVOID page_address = Page->VirtualMapping;
+    MM_PTE old_entry = *Entry;
+    BOOLEAN merged = FALSE;
+
+    MM_TLB_BATCH batch;
+    MmInitializeTlbBatch(&batch, AddressSpace);
+
+    PPHYSICAL_PAGE_FRAME target = MmReferenceMergedPage(Page->MergeHash);
+    if (target != NULL) {
+        *Entry &= ~MM_PTE_PRESENT;
+        MmAddTlbBatchEntry(&batch, page_address);
+        MmFlushTlbBatch(&batch);
+
+        if (memcmp(MmPhysicalToVirtual(Page->PhysicalAddress), MmPhysicalToVirtual(target->PhysicalAddress),
+                   DSLOS_PAGE_SIZE) != 0) {
+            *Entry = old_entry;
+            MmFreePhysicalMemory((PVOID)target->PhysicalAddress, DSLOS_PAGE_SIZE);
+            return FALSE;
+        }
+
+        *Entry = ((MM_PTE)target->PhysicalAddress & MM_PTE_FRAME_MASK) |
+                 (old_entry & ~(MM_PTE_FRAME_MASK | MM_PTE_WRITABLE)) | MM_PTE_COPY_ON_WRITE;
+        MmRemoveWorkingSetPage(AddressSpace, Page->PhysicalAddress);
+        MmFreePhysicalMemory((PVOID)Page->PhysicalAddress, DSLOS_PAGE_SIZE);
+        return TRUE;
+    }
+
+    // The page takes the candidate's slot whatever the outcome
+    PULONG slot = &g_MemoryManager.MergeUnstableTable[Page->MergeHash & (MM_MERGE_TABLE_SIZE - 1)];
+    ULONG candidate_pfn = *slot;
+    *slot = MM_PFN(Page);
+
+    if (candidate_pfn == MM_MERGE_SLOT_EMPTY || candidate_pfn == *slot) {
+        return FALSE;
+    }
+
+    PPHYSICAL_PAGE_FRAME candidate = &g_MemoryManager.PageFrameArray[candidate_pfn];
+    PADDRESS_SPACE_DESCRIPTOR candidate_space = candidate->AddressSpace;
+    if (!(MM_PAGE_FLAGS(candidate_pfn) & (PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE)) ||
+        candidate->MergeHash != Page->MergeHash ||
+        candidate_space == NULL || !candidate_space->PageMerging || !MmIsAddressSpaceListed(candidate_space)) {
+        return FALSE;
+    }
+
+    KIRQL old_irql;
+    if (candidate_space != AddressSpace) {
+        KeAcquireSpinLock(&candidate_space->PageTableLock, &old_irql);
+    }
+
+    // The candidate may have been unmapped, shared or paged out since it was seen
+    PMM_PTE candidate_entry = NULL;
+    if ((MM_PAGE_FLAGS(candidate_pfn) & (PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE)) &&
+        candidate->AddressSpace == candidate_space) {
+        candidate_entry = MmWalkPageTables((PMM_PTE)candidate_space->PageDirectory,
+                                           candidate->VirtualMapping, 1, FALSE);
+    }
+
+    if (candidate_entry != NULL &&
+        (*candidate_entry & (MM_PTE_PRESENT | MM_PTE_COPY_ON_WRITE | MM_PTE_PAGED_OUT)) == MM_PTE_PRESENT &&
+        (ULONG_PTR)(*candidate_entry & MM_PTE_FRAME_MASK) == candidate->PhysicalAddress) {
+        MM_PTE old_candidate_entry = *candidate_entry;
+
+        *candidate_entry &= ~MM_PTE_PRESENT;
+        *Entry &= ~MM_PTE_PRESENT;
+        if (candidate_space != AddressSpace) {
+            batch.AddressSpace = NULL;
+        }
+        MmAddTlbBatchEntry(&batch, candidate->VirtualMapping);
+        MmAddTlbBatchEntry(&batch, page_address);
+        MmFlushTlbBatch(&batch);
+
+        if (memcmp(MmPhysicalToVirtual(Page->PhysicalAddress), MmPhysicalToVirtual(candidate->PhysicalAddress),
+                   DSLOS_PAGE_SIZE) == 0) {
+            MM_PTE frame = (MM_PTE)candidate->PhysicalAddress & MM_PTE_FRAME_MASK;
+            *candidate_entry = frame | (old_candidate_entry & ~(MM_PTE_FRAME_MASK | MM_PTE_WRITABLE)) |
+                               MM_PTE_COPY_ON_WRITE;
+            *Entry = frame | (old_entry & ~(MM_PTE_FRAME_MASK | MM_PTE_WRITABLE)) | MM_PTE_COPY_ON_WRITE;
+
+            MmRemoveWorkingSetPage(candidate_space, candidate->PhysicalAddress);
+            MmRemoveWorkingSetPage(AddressSpace, Page->PhysicalAddress);
+
+            KIRQL merge_irql;
+            KeAcquireSpinLock(&g_MemoryManager.MergeLock, &merge_irql);
+            MmInsertMergedPage(candidate);
+            InterlockedIncrement((PLONG)&MM_PAGE_REFERENCES(candidate_pfn));
+            g_MemoryManager.Statistics.MergedMappings++;
+            KeReleaseSpinLock(&g_MemoryManager.MergeLock, merge_irql);
+
+            *slot = MM_MERGE_SLOT_EMPTY;
+            MmFreePhysicalMemory((PVOID)Page->PhysicalAddress, DSLOS_PAGE_SIZE);
+            merged = TRUE;
+        } else {
+            *candidate_entry = old_candidate_entry;
+            *Entry = old_entry;
+        }
+    }
+
+    if (candidate_space != AddressSpace) {
+        KeReleaseSpinLock(&candidate_space->PageTableLock, old_irql);
+    }
+
+    return merged;
+}
+
+/**
+ * @brief Scan the working set pages of an address space for merging
+ * @param AddressSpace Address space that opted in
+ * @param PageCount Pages to hash
+ * @return Pages merged
+ * @note Caller holds MemoryLock. Walks the user range from the address space's
+ *       cursor, skipping whole page tables that are missing, and stops after
+ *       one full lap. Pages hashed for the first time or changed since the
+ *       previous pass are only remembered
+ */
+static ULONG MmScanAddressSpaceForMerging(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG PageCount)
+{
+    PMM_PTE pml4 = (PMM_PTE)AddressSpace->PageDirectory;
+    ULONG_PTR start = AddressSpace->MergeCursor;
+    ULONG_PTR address = start;
+    BOOLEAN wrapped = FALSE;
+    ULONG scanned = 0;
+    ULONG merged = 0;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&AddressSpace->PageTableLock, &old_irql);
+
+    while (scanned < PageCount) {
+        if (address >= AddressSpace->HighestAddress) {
+            address = AddressSpace->LowestAddress;
+            wrapped = TRUE;
+        }
+        if (wrapped && address >= start) {
+            break;
+        }
+
+        PMM_PTE directory_entry = MmWalkPageTables(pml4, (PVOID)address, 2, FALSE);
+        if (directory_entry == NULL || !(*directory_entry & MM_PTE_PRESENT) || (*directory_entry & MM_PTE_LARGE)) {
+            address = (address + MM_HUGE_PAGE_SIZE) & ~(ULONG_PTR)MM_HUGE_PAGE_MASK;
+            continue;
+        }
+
+        PMM_PTE entry = &MM_PTE_TABLE(*directory_entry)[MM_PAGE_TABLE_INDEX(address, MM_PT_SHIFT)];
+        address += DSLOS_PAGE_SIZE;
+
+        if ((*entry & (MM_PTE_PRESENT | MM_PTE_COPY_ON_WRITE | MM_PTE_PAGED_OUT)) != MM_PTE_PRESENT) {
+            continue;
+        }
+
+        ULONG pfn = (ULONG)((*entry & MM_PTE_FRAME_MASK) / DSLOS_PAGE_SIZE);
+        PPHYSICAL_PAGE_FRAME page = &g_MemoryManager.PageFrameArray[pfn];
+        if (!(MM_PAGE_FLAGS(pfn) & (PAGE_FLAG_ACTIVE | PAGE_FLAG_INACTIVE))) {
+            continue;
+        }
+
+        scanned++;
+        ULONG hash = MmHashPage(MmPhysicalToVirtual(page->PhysicalAddress));
+        if (hash != page->MergeHash) {
+            page->MergeHash = hash;
+            continue;
+        }
+
+        if (MmMergePage(AddressSpace, entry, page)) {
+            merged++;
+        }
+    }
+
+    AddressSpace->MergeCursor = address;
+    KeReleaseSpinLock(&AddressSpace->PageTableLock, old_irql);
+
+    InterlockedExchangeAdd((PLONG)&g_MemoryManager.Statistics.MergeScannedPages, (LONG)scanned);
+    return merged;
+}
+
+/**
+ * @brief Extend a user stack's committed part down to a faulting address
+ * @param AddressSpace Address space (region lock held)
+ * @param Region Reserved part of the stack, containing the address
+ * @param Address Page-aligned faulting address
+ * @return Committed part of the stack, now covering the address, or NULL if
+ *         the address is in the guard page or the stack layout was changed
+ * @note The boundary between the two regions moves down a growth step at a
+ *       time, so growing needs no new region objects
+ */
+static PVIRTUAL_MEMORY_REGION MmGrowStackRegion(PADDRESS_SPACE_DESCRIPTOR AddressSpace,
+                                                PVIRTUAL_MEMORY_REGION Region, ULONG_PTR Address)
+{
+    ULONG_PTR base = (ULONG_PTR)Region->BaseAddress;
+    ULONG_PTR end = base + Region->RegionSize;
+    if (Address < base + MM_STACK_GUARD_SIZE) {
+        return NULL; // Stack overflow
+    }
+
+    PVIRTUAL_MEMORY_REGION stack = MmFindVirtualMemoryRegion(AddressSpace, (PVOID)end);
+    if (stack == NULL || (ULONG_PTR)stack->BaseAddress != end || stack->State != MEM_COMMIT) {
+        return NULL;
+    }
+
+    // Commit in whole growth steps measured from the top of the stack
+    ULONG_PTR top = (ULONG_PTR)stack->BaseAddress + stack->RegionSize;
+    SIZE_T depth = (top - Address + MM_USER_STACK_GROWTH - 1) & ~(SIZE_T)(MM_USER_STACK_GROWTH - 1);
+    ULONG_PTR boundary = (depth < top - base) ? top - depth : base;
+    if (boundary < base + MM_STACK_GUARD_SIZE) {
+        boundary = base + MM_STACK_GUARD_SIZE;
+    }
+
+    AddressSpace->RegionRoot = MmVmaRemove(AddressSpace->RegionRoot, Region);
+    AddressSpace->RegionRoot = MmVmaRemove(AddressSpace->RegionRoot, stack);
+
+    Region->RegionSize = boundary - base;
+    stack->RegionSize += end - boundary;
+    stack->BaseAddress = (PVOID)boundary;
+
+    AddressSpace->RegionRoot = MmVmaInsert(AddressSpace->RegionRoot, Region);
+    AddressSpace->RegionRoot = MmVmaInsert(AddressSpace->RegionRoot, stack);
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.StackGrowthFaults);
+    return stack;
+}
+
+/**
+ * @brief Resolve a fault against the region containing the address
+ * @param AddressSpace Address space
+ * @param Address Page-aligned faulting address
+ * @param FaultCode MM_FAULT_* bits of the fault
+ * @param PageIn Page read from the paging file by an earlier attempt at the fault
+ * @return NTSTATUS Status code; STATUS_MORE_PROCESSING_REQUIRED asks the
+ *         caller to read PageIn's slot and retry
+ * @note Runs under the region lock. An address space taken over its working
+ *       set limit is trimmed after the lock is dropped, since trimming writes
+ *       to the paging file
+ */
+static NTSTATUS MmResolveRegionFault(PADDRESS_SPACE_DESCRIPTOR AddressSpace, ULONG_PTR Address,
+                                     ULONG FaultCode, PMM_PAGE_IN PageIn)
+{
+    KIRQL old_irql;
+    KeAcquireSpinLock(&AddressSpace->RegionLock, &old_irql);
+
+    PVIRTUAL_MEMORY_REGION region = MmFindVirtualMemoryRegion(AddressSpace, (PVOID)Address);
+    if (region != NULL && region->State == MEM_RESERVE && region->GrowsDown) {
+        region = MmGrowStackRegion(AddressSpace, region, Address);
+    }
+
+    if (region == NULL || region->State != MEM_COMMIT || (region->Protect & PAGE_NOACCESS)) {
+        KeReleaseSpinLock(&AddressSpace->RegionLock, old_irql);
+        return STATUS_ACCESS_VIOLATION;
+    }
+
+    // Writes to read-only regions and fetches from non-executable ones are never resolved
+    MM_PTE region_flags = MmProtectToPte(region->Protect, FALSE);
+    if (((FaultCode & MM_FAULT_WRITE) && !(region_flags & MM_PTE_WRITABLE)) ||
+        ((FaultCode & MM_FAULT_INSTRUCTION) && (region_flags & MM_PTE_NO_EXECUTE))) {
+        KeReleaseSpinLock(&AddressSpace->RegionLock, old_irql);
+        return STATUS_ACCESS_VIOLATION;
+    }
+
+    ULONG_PTR window = Address & ~(ULONG_PTR)MM_HUGE_PAGE_MASK;
+    ULONG_PTR region_start = (ULONG_PTR)region->BaseAddress;
+    BOOLEAN huge_allowed = (window >= region_start &&
+                            window + MM_HUGE_PAGE_SIZE <= region_start + region->RegionSize);
+
+    NTSTATUS status = MmResolveDemandZeroFault(AddressSpace, Address, FaultCode, region->Protect,
+                                               huge_allowed, PageIn);
+
+    KeReleaseSpinLock(&AddressSpace->RegionLock, old_irql);
+
+    // Keep the address space within its working set limit
+    ULONG working_set = AddressSpace->ActivePageCount + AddressSpace->InactivePageCount;
+    if (NT_SUCCESS(status) && AddressSpace->WorkingSetMaximum != 0 &&
+        working_set > AddressSpace->WorkingSetMaximum) {
+        MmTrimAddressSpace(AddressSpace, working_set - AddressSpace->WorkingSetMaximum);
+    }
+
+    return status;
+}
+
+/**
+ * @brief Resolve a page fault
+ * @param Process Process running when the fault occurred (NULL for the system)
+ * @param FaultAddress Faulting virtual address
+ * @param FaultCode MM_FAULT_* bits from the processor's page fault error code
+ * @return STATUS_SUCCESS if the faulting access can be retried,
+ *         STATUS_ACCESS_VIOLATION if the access is not allowed
+ * @note Called by the page fault handler with the address from HalGetPageFaultAddress.
+ *       A fault in the reserved part of a user stack commits the stack down to it.
+ *       A fault that finds no free page reclaims some directly and asks for a retry.
+ *       A paged-out page is read with no lock held, then the fault is resolved again
+ */
+NTSTATUS MmAccessFault(PPROCESS_CONTROL_BLOCK Process, PVOID FaultAddress, ULONG FaultCode)
+{
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.PageFaultCount);
+
+    ULONG_PTR address = (ULONG_PTR)FaultAddress & ~(ULONG_PTR)(DSLOS_PAGE_SIZE - 1);
+    if (address >= MM_SYSTEM_RANGE_START && (FaultCode & MM_FAULT_USER)) {
+        return STATUS_ACCESS_VIOLATION;
+    }
+
+    PADDRESS_SPACE_DESCRIPTOR address_space = (address >= MM_SYSTEM_RANGE_START) ?
+        &g_MemoryManager.SystemAddressSpace : MmGetAddressSpace(Process);
+    PMM_PAGING_FILE paging_file = &g_MemoryManager.PagingFile;
+    MM_PAGE_IN page_in = { NULL, 0 };
+
+    NTSTATUS status = MmResolveRegionFault(address_space, address, FaultCode, &page_in);
+    while (status == STATUS_MORE_PROCESSING_REQUIRED) {
+        status = paging_file->ReadPage(paging_file->Context, page_in.Slot,
+                                       MmPhysicalToVirtual((ULONG_PTR)page_in.Page));
+        if (NT_SUCCESS(status)) {
+            status = MmResolveRegionFault(address_space, address, FaultCode, &page_in);
+        }
+    }
+
+    // The read failed, or the entry changed while it was in progress
+    if (page_in.Page != NULL) {
+        MmFreePhysicalMemory(page_in.Page, DSLOS_PAGE_SIZE);
+        MmReferencePagingFileSlot(page_in.Slot, -1);
+    }
+
+    if (status == STATUS_NO_MEMORY && MmReclaimPages(MM_RECLAIM_BATCH) > 0) {
+        status = STATUS_SUCCESS;
+    }
+
+    return status;
+}
+
+/**
+ * @brief Get memory statistics
+ * @param Statistics Memory statistics structure
+ */
+VOID MmGetMemoryStatistics(PMEMORY_STATISTICS Statistics)
+{
+    if (Statistics == NULL) {
+        return;
+    }
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+
+    RtlCopyMemory(Statistics, &g_MemoryManager.Statistics, sizeof(MEMORY_STATISTICS));
+
+    Statistics->TotalPhysicalPages = g_MemoryManager.TotalPhysicalPages;
+    Statistics->FreePhysicalPages = MmGetFreePageCount();
+    Statistics->MergeSavedBytes = (SIZE_T)Statistics->MergedMappings * DSLOS_PAGE_SIZE;
+
+    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+
+    // Kernel heap occupancy and fragmentation
+    MmHeapQueryStatistics(&g_MemoryManager.NonPagedPool, &Statistics->NonPagedPoolStatistics);
+    MmHeapQueryStatistics(&g_MemoryManager.PagedPool, &Statistics->PagedPoolStatistics);
+
+    Statistics->NonPagedPoolPages = (ULONG)((Statistics->NonPagedPoolStatistics.CommittedBytes +
+        Statistics->NonPagedPoolStatistics.LargeAllocationBytes) / DSLOS_PAGE_SIZE);
+    Statistics->PagedPoolPages = (ULONG)((Statistics->PagedPoolStatistics.CommittedBytes +
+        Statistics->PagedPoolStatistics.LargeAllocationBytes) / DSLOS_PAGE_SIZE);
+}
+
+/**
+ * @brief Time scans of the page frame database
+ * @param Timing Receives the frame count, the free pages found and the time
+ *        each way of scanning took
+ * @return NTSTATUS Status code
+ * @note The record walk reads one field of every PHYSICAL_PAGE_FRAME, which
+ *       is what any flag test cost when the flags lived in the records. The
+ *       flag and bitmap scans run with every zone lock held in node order, so
+ *       both see the same free pages
+ */
+NTSTATUS MmMeasureFrameScan(PMM_FRAME_SCAN_TIMING Timing)
+{
+    if (Timing == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ULONG size = g_MemoryManager.PageFrameArraySize;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    RtlZeroMemory(Timing, sizeof(MM_FRAME_SCAN_TIMING));
+    Timing->PageCount = size;
+
+    KeQueryPerformanceCounter(&start);
+    for (ULONG pfn = 0; pfn < size; pfn++) {
+        if (g_MemoryManager.PageFrameArray[pfn].AddressSpace == NULL) {
+            Timing->RecordPages++;
+        }
+    }
+    KeQueryPerformanceCounter(&end);
+    Timing->RecordTicks = (ULONG64)(end.QuadPart - start.QuadPart);
+
+    KIRQL old_irql[MM_MAX_NODES];
+    for (ULONG node = 0; node < g_MemoryManager.NodeCount; node++) {
+        KeAcquireSpinLock(&g_MemoryManager.Zones[node].ZoneLock, &old_irql[node]);
+    }
+
+    KeQueryPerformanceCounter(&start);
+    for (ULONG pfn = 0; pfn < size; pfn++) {
+        if (MM_PAGE_FLAGS(pfn) & PAGE_FLAG_AVAILABLE) {
+            Timing->FlagFreePages++;
+        }
+    }
+    KeQueryPerformanceCounter(&end);
+    Timing->FlagTicks = (ULONG64)(end.QuadPart - start.QuadPart);
+
+    KeQueryPerformanceCounter(&start);
+    Timing->BitmapFreePages = MmCountFreePages(0, size);
+    KeQueryPerformanceCounter(&end);
+    Timing->BitmapTicks = (ULONG64)(end.QuadPart - start.QuadPart);
+
+    for (ULONG node = g_MemoryManager.NodeCount; node-- > 0; ) {
+        KeReleaseSpinLock(&g_MemoryManager.Zones[node].ZoneLock, old_irql[node]);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Report pool usage per tag
+ * @param Buffer Receives one record per tag and pool in use so far
+ * @param Count Records the buffer holds
+ * @param ReturnedCount Receives the number of records available
+ * @return STATUS_BUFFER_TOO_SMALL if only the first Count records were returned
+ * @note Sums the per-CPU counters without stopping allocations, so the
+ *       figures are a snapshot
+ */
+NTSTATUS MmQueryPoolTags(PMM_POOL_TAG_INFORMATION Buffer, ULONG Count, PULONG ReturnedCount)
+{
+    if (ReturnedCount == NULL || (Buffer == NULL && Count != 0)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ULONG found = 0;
+
+    for (ULONG index = 0; index < MM_POOL_TAG_COUNT; index++) {
+        PMM_POOL_TAG_ENTRY entry = &g_MemoryManager.PoolTags[index];
+        if (entry->Key == 0) {
+            continue;
+        }
+
+        if (found < Count) {
+            PMM_POOL_TAG_INFORMATION information = &Buffer[found];
+            LONG64 bytes = entry->Bytes;
+
+            information->Tag = (ULONG)entry->Key;
+            information->PoolType = (POOL_TYPE)((entry->Key >> 32) - 1);
+            information->Allocations = 0;
+            information->Frees = 0;
+
+            for (ULONG cpu = 0; cpu < MM_MAX_PROCESSORS; cpu++) {
+                PMM_POOL_TAG_COUNTERS counters = &g_MemoryManager.PoolTagCounters[cpu][index];
+                information->Allocations += counters->Allocations;
+                information->Frees += counters->Frees;
+                bytes += counters->Bytes;
+            }
+
+            information->Bytes = (bytes > 0) ? (SIZE_T)bytes : 0;
+            information->PeakBytes = (entry->PeakBytes > bytes) ? (SIZE_T)entry->PeakBytes : information->Bytes;
+        }
+        found++;
+    }
+
+    *ReturnedCount = found;
+    return (found > Count) ? STATUS_BUFFER_TOO_SMALL : STATUS_SUCCESS;
+}
+
+/**
+ * @brief Sample the allocations of a pool tag for leak hunting
+ * @param Tag Pool tag to trace
+ * @param SampleRate Trace every SampleRate-th allocation of the tag, 0 to stop
+ * @return NTSTATUS Status code
+ * @note Traces of allocations made earlier stay until the allocations are freed
+ */
+NTSTATUS MmSetPoolTraceTag(ULONG Tag, ULONG SampleRate)
+{
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.PoolTagLock, &old_irql);
+
+    g_MemoryManager.PoolTraceRate = 0;
+    g_MemoryManager.PoolTraceTag = Tag;
+    g_MemoryManager.PoolTraceCounter = 0;
+    g_MemoryManager.PoolTraceRate = SampleRate;
+
+    KeReleaseSpinLock(&g_MemoryManager.PoolTagLock, old_irql);
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Report the sampled pool allocations that are still outstanding
+ * @param Buffer Receives the traces
+ * @param Count Traces the buffer holds
+ * @param ReturnedCount Receives the number of outstanding traces
+ * @return STATUS_BUFFER_TOO_SMALL if only the first Count traces were returned
+ */
+NTSTATUS MmQueryPoolTraces(PMM_POOL_TRACE Buffer, ULONG Count, PULONG ReturnedCount)
+{
+    if (ReturnedCount == NULL || (Buffer == NULL && Count != 0)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ULONG found = 0;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.PoolTagLock, &old_irql);
+
+    for (ULONG i = 0; i < MM_POOL_TRACE_COUNT; i++) {
+        if (g_MemoryManager.PoolTraces[i].Address == NULL) {
+            continue;
+        }
+
+        if (found < Count) {
+            RtlCopyMemory(&Buffer[found], &g_MemoryManager.PoolTraces[i], sizeof(MM_POOL_TRACE));
+        }
+        found++;
+    }
+
+    KeReleaseSpinLock(&g_MemoryManager.PoolTagLock, old_irql);
+
+    *ReturnedCount = found;
+    return (found > Count) ? STATUS_BUFFER_TOO_SMALL : STATUS_SUCCESS;
+}
+
+/**
+ * @brief Get the per-order free block report of a NUMA node
+ * @param Node Node number
+ * @param Report Report structure to fill
+ * @return NTSTATUS Status code
+ */
+NTSTATUS MmGetFragmentationReport(ULONG Node, PMM_FRAGMENTATION_REPORT Report)
+{
+    if (Node >= g_MemoryManager.NodeCount || Report == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PMM_ZONE zone = &g_MemoryManager.Zones[Node];
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&zone->ZoneLock, &old_irql);
+
+    Report->FreePages = zone->FreePageCount;
+    for (ULONG order = 0; order <= MM_MAX_ORDER; order++) {
+        Report->FreeBlocks[order] = zone->FreeAreas[order].FreeBlockCount;
+        Report->FragmentationIndex[order] = MmGetFragmentationIndex(zone, order);
+    }
+
+    KeReleaseSpinLock(&zone->ZoneLock, old_irql);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Compact a NUMA node's memory to free a contiguous block
+ * @param Node Node number
+ * @param Order Block order wanted (2^Order pages)
+ * @return STATUS_SUCCESS if the node has a free block of the order afterwards
+ */
+NTSTATUS MmCompactMemory(ULONG Node, ULONG Order)
+{
+    if (Node >= g_MemoryManager.NodeCount || Order > MM_MAX_ORDER) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return MmCompactZone(&g_MemoryManager.Zones[Node], Order) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+/**
+ * @brief Get per-CPU page cache statistics
+ * @param Processor Processor number
+ * @param Statistics Statistics structure to fill
+ * @return NTSTATUS Status code
+ */
+NTSTATUS MmGetPerCpuPageStatistics(ULONG Processor, PMM_PER_CPU_PAGE_STATISTICS Statistics)
+{
+    if (Processor >= MM_MAX_PROCESSORS || Statistics == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PMM_PER_CPU_PAGES pcp = &g_MemoryManager.PerCpuPages[Processor];
+
+    RtlCopyMemory(Statistics, &pcp->Statistics, sizeof(MM_PER_CPU_PAGE_STATISTICS));
+    Statistics->HotPages = pcp->HotCount;
+    Statistics->ColdPages = pcp->ColdCount;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Get the allocation statistics of a NUMA node
+ * @param Node Node number
+ * @param Statistics Statistics structure to fill
+ * @return NTSTATUS Status code
+ */
+NTSTATUS MmGetNodeStatistics(ULONG Node, PMM_NODE_STATISTICS Statistics)
+{
+    if (Node >= g_MemoryManager.NodeCount || Statistics == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PMM_ZONE zone = &g_MemoryManager.Zones[Node];
+
+    RtlCopyMemory(Statistics, &zone->Statistics, sizeof(MM_NODE_STATISTICS));
+    Statistics->TotalPages = zone->TotalPages;
+    Statistics->FreePages = zone->FreePageCount;
+    Statistics->ZeroedPages = zone->ZeroedPageCount;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Assign a processor to a NUMA node
+ * @param Processor Processor number
+ * @param Node Node whose memory is local to the processor
+ * @return NTSTATUS Status code
+ * @note For use by topology detection before the processor allocates; the
+ *       processor's page cache is drained so it only holds local pages
+ */
+NTSTATUS MmSetProcessorNode(ULONG Processor, ULONG Node)
+{
+    if (Processor >= MM_MAX_PROCESSORS || Node >= g_MemoryManager.NodeCount) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PMM_PER_CPU_PAGES pcp = &g_MemoryManager.PerCpuPages[Processor];
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&pcp->Lock, &old_irql);
+
+    MmDrainPerCpuPages(pcp, pcp->HotCount + pcp->ColdCount);
+    g_MemoryManager.ProcessorNode[Processor] = Node;
+    pcp->Node = Node;
+
+    KeReleaseSpinLock(&pcp->Lock, old_irql);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Set the NUMA placement policy for a thread's page allocations
+ * @param Thread Thread to configure
+ * @param Policy MM_POLICY_LOCAL, MM_POLICY_PREFERRED or MM_POLICY_INTERLEAVE
+ * @param Node Preferred node for MM_POLICY_PREFERRED, first node for MM_POLICY_INTERLEAVE
+ * @return NTSTATUS Status code
+ */
+NTSTATUS MmSetThreadMemoryPolicy(PTHREAD_CONTROL_BLOCK Thread, ULONG Policy, ULONG Node)
+{
+    if (Thread == NULL || Policy > MM_POLICY_INTERLEAVE) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Policy != MM_POLICY_LOCAL && Node >= g_MemoryManager.NodeCount) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Thread->MemoryPolicy = Policy;
+    Thread->MemoryPolicyNode = Node;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Set per-CPU page cache watermarks
+ * @param HighWatermark Cached page count above which a CPU drains to its node's free areas
+ * @param LowWatermark Cached page count at or below which a CPU refills
+ * @param Batch Pages moved per refill or drain
+ * @return NTSTATUS Status code
+ */
+NTSTATUS MmSetPerCpuPageWatermarks(ULONG HighWatermark, ULONG LowWatermark, ULONG Batch)
+{
+    if (Batch == 0 || LowWatermark >= HighWatermark || Batch > HighWatermark) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
 
-    // Allocate physical pages
-    PVOID physical_memory = MmAllocatePhysicalMemory(aligned_size);
-    if (physical_memory == NULL) {
-        return NULL; // Out of physical memory
-    }
+    g_MemoryManager.PerCpuHighWatermark = HighWatermark;
+    g_MemoryManager.PerCpuLowWatermark = LowWatermark;
+    g_MemoryManager.PerCpuBatch = Batch;
 
-    // Map physical pages to virtual address
-    NTSTATUS status = MmMapPhysicalMemory(Process, virtual_address, physical_memory, aligned_size, Protect);
-    if (!NT_SUCCESS(status)) {
-        MmFreePhysicalMemory(physical_memory, aligned_size);
-        return NULL;
-    }
+    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
 
-    return virtual_address;
+    return STATUS_SUCCESS;
 }
 
 /**
- * @brief Free virtual memory
- * @param Process Process to free for
- * @param Address Address to free
- * @param Size Size to free
+ * @brief Set the free page watermarks that drive the reclaim thread
+ * @param LowWatermark Free page count below which working sets are trimmed
+ * @param HighWatermark Free page count at which trimming stops
+ * @return NTSTATUS Status code
  */
-VOID MmFreeVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID Address, SIZE_T Size)
+NTSTATUS MmSetReclaimWatermarks(ULONG LowWatermark, ULONG HighWatermark)
 {
-    if (Address == NULL || Size == 0) {
-        return;
+    if (LowWatermark >= HighWatermark || HighWatermark > g_MemoryManager.TotalPhysicalPages) {
+        return STATUS_INVALID_PARAMETER;
     }
 
-    // Unmap virtual memory
-    SIZE_T aligned_size = (Size + DSLOS_PAGE_SIZE - 1) & ~(DSLOS_PAGE_SIZE - 1);
-    PVOID physical_memory = MmUnmapVirtualMemory(Process, Address, aligned_size);
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
 
-    if (physical_memory != NULL) {
-        MmFreePhysicalMemory(physical_memory, aligned_size);
-    }
+    g_MemoryManager.ReclaimLowWatermark = LowWatermark;
+    g_MemoryManager.ReclaimHighWatermark = HighWatermark;
+
+    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+
+    return STATUS_SUCCESS;
 }
 
 /**
- * @brief Find free virtual address space
- * @param Process Process to find address for
- * @param Size Size needed
- * @return Free virtual address
+ * @brief Register the paging file that receives evicted pages
+ * @param SlotCount Number of page-sized slots in the file
+ * @param WritePage Routine storing a page in a slot
+ * @param ReadPage Routine loading a page from a slot
+ * @param Context Passed to both routines
+ * @return NTSTATUS Status code
+ * @note Only one paging file is supported. The routines are called at
+ *       DISPATCH_LEVEL with an address space's page table lock held, so they
+ *       must complete without blocking
  */
-static PVOID MmFindFreeVirtualAddress(PPROCESS_CONTROL_BLOCK Process, SIZE_T Size)
+NTSTATUS MmRegisterPagingFile(ULONG SlotCount, PMM_PAGING_FILE_ROUTINE WritePage,
+                              PMM_PAGING_FILE_ROUTINE ReadPage, PVOID Context)
 {
-    // This is a simplified implementation
-    // In a real implementation, this would scan the process's address space
+    PMM_PAGING_FILE paging_file = &g_MemoryManager.PagingFile;
+
+    if (SlotCount == 0 || WritePage == NULL || ReadPage == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PUSHORT slot_references = ExAllocatePoolWithTag(NonPagedPool, SlotCount * sizeof(USHORT), 'gaPM');
+    if (slot_references == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(slot_references, SlotCount * sizeof(USHORT));
 
-    PVOID base_address = (PVOID)0x10000000; // Start at 256MB for user mode
-    PVOID end_address = (PVOID)0x7FFFFFFF;   // End at 2GB-1 for user mode
+    KIRQL old_irql;
+    KeAcquireSpinLock(&paging_file->SlotLock, &old_irql);
 
-    while ((UINT_PTR)base_address + Size <= (UINT_PTR)end_address) {
-        // Check if address range is free (simplified check)
-        if (MmIsAddressRangeFree(Process, base_address, Size)) {
-            return base_address;
-        }
-        base_address = (PVOID)((UINT_PTR)base_address + DSLOS_PAGE_SIZE);
+    if (paging_file->WritePage != NULL) {
+        KeReleaseSpinLock(&paging_file->SlotLock, old_irql);
+        ExFreePoolWithTag(slot_references, 'gaPM');
+        return STATUS_UNSUCCESSFUL;
     }
 
-    return NULL;
+    paging_file->ReadPage = ReadPage;
+    paging_file->Context = Context;
+    paging_file->SlotCount = SlotCount;
+    paging_file->FreeSlotCount = SlotCount;
+    paging_file->NextSlot = 0;
+    paging_file->SlotReferences = slot_references;
+    paging_file->WritePage = WritePage;   // Enables eviction to the file
+
+    KeReleaseSpinLock(&paging_file->SlotLock, old_irql);
+
+    return STATUS_SUCCESS;
 }
 
 /**
- * @brief Check if address range is free
- * @param Process Process to check
- * @param BaseAddress Base address to check
- * @param Size Size to check
- * @return TRUE if free, FALSE otherwise
+ * @brief Evict pages from the working set of a process
+ * @param Process Process to trim
+ * @param PageCount Pages to evict
+ * @return Pages evicted
  */
-static BOOLEAN MmIsAddressRangeFree(PPROCESS_CONTROL_BLOCK Process, PVOID BaseAddress, SIZE_T Size)
+ULONG MmTrimWorkingSet(PPROCESS_CONTROL_BLOCK Process, ULONG PageCount)
 {
-    // This is a simplified implementation
-    // In a real implementation, this would check the process's virtual memory regions
+    if (Process == NULL || Process->AddressSpace == NULL) {
+        return 0;
+    }
 
-    // For now, just return TRUE
-    return TRUE;
+    return MmTrimAddressSpace((PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace, PageCount);
 }
 
 /**
- * @brief Map physical memory to virtual address
- * @param Process Process to map for
- * @param VirtualAddress Virtual address
- * @param PhysicalAddress Physical address
- * @param Size Size to map
- * @param Protect Memory protection flags
+ * @brief Limit the working set of a process
+ * @param Process Process to limit
+ * @param MaximumPages Resident pageable pages allowed, 0 for no limit
  * @return NTSTATUS Status code
+ * @note A working set above the new limit is trimmed right away; afterwards
+ *       the fault handler trims it whenever a fault takes it over the limit
  */
-static NTSTATUS MmMapPhysicalMemory(PPROCESS_CONTROL_BLOCK Process, PVOID VirtualAddress,
-                                    PVOID PhysicalAddress, SIZE_T Size, ULONG Protect)
+NTSTATUS MmSetWorkingSetLimit(PPROCESS_CONTROL_BLOCK Process, ULONG MaximumPages)
 {
-    // This is a simplified implementation
-    // In a real implementation, this would:
-    // - Update page tables
-    // - Set proper permissions
-    // - Flush TLB if necessary
+    if (Process == NULL || Process->AddressSpace == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
 
-    UNREFERENCED_PARAMETER(Process);
-    UNREFERENCED_PARAMETER(VirtualAddress);
-    UNREFERENCED_PARAMETER(PhysicalAddress);
-    UNREFERENCED_PARAMETER(Size);
-    UNREFERENCED_PARAMETER(Protect);
+    PADDRESS_SPACE_DESCRIPTOR address_space = (PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace;
+    address_space->WorkingSetMaximum = MaximumPages;
+
+    ULONG working_set = address_space->ActivePageCount + address_space->InactivePageCount;
+    if (MaximumPages != 0 && working_set > MaximumPages) {
+        MmTrimAddressSpace(address_space, working_set - MaximumPages);
+    }
 
     return STATUS_SUCCESS;
 }
 
 /**
- * @brief Unmap virtual memory
- * @param Process Process to unmap for
- * @param VirtualAddress Virtual address
- * @param Size Size to unmap
- * @return Physical address that was mapped
+ * @brief Opt a process in or out of page merging
+ * @param Process Process whose address space is scanned
+ * @param Enable TRUE to merge its identical pages with those of other opted-in processes
+ * @return NTSTATUS Status code
+ * @note The merge tables are allocated when the first process opts in. Opting
+ *       out stops the scanning; pages merged already stay shared until written
  */
-static PVOID MmUnmapVirtualMemory(PPROCESS_CONTROL_BLOCK Process, PVOID VirtualAddress, SIZE_T Size)
+NTSTATUS MmSetPageMerging(PPROCESS_CONTROL_BLOCK Process, BOOLEAN Enable)
 {
-    // This is a simplified implementation
-    // In a real implementation, this would:
-    // - Update page tables
-    // - Flush TLB if necessary
-    // - Return the physical address
+    if (Process == NULL || Process->AddressSpace == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
 
-    UNREFERENCED_PARAMETER(Process);
-    UNREFERENCED_PARAMETER(VirtualAddress);
-    UNREFERENCED_PARAMETER(Size);
+    if (Enable && g_MemoryManager.MergeStableTable == NULL) {
+        PULONG tables = ExAllocatePoolWithTag(NonPagedPool, 2 * MM_MERGE_TABLE_SIZE * sizeof(ULONG), 'gmPM');
+        if (tables == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
 
-    return NULL;
+        for (ULONG i = 0; i < 2 * MM_MERGE_TABLE_SIZE; i++) {
+            tables[i] = MM_MERGE_SLOT_EMPTY;
+        }
+
+        // The scanner reads the tables under MemoryLock
+        KIRQL old_irql;
+        KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+        if (g_MemoryManager.MergeStableTable == NULL) {
+            g_MemoryManager.MergeStableTable = tables;
+            g_MemoryManager.MergeUnstableTable = tables + MM_MERGE_TABLE_SIZE;
+            tables = NULL;
+        }
+        KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+
+        if (tables != NULL) {
+            ExFreePoolWithTag(tables, 'gmPM');
+        }
+    }
+
+    ((PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace)->PageMerging = Enable;
+    return STATUS_SUCCESS;
 }
 
 /**
- * @brief Get memory statistics
- * @param Statistics Memory statistics structure
+ * @brief Set how many pages the reclaim thread hashes for merging per interval
+ * @param PagesPerInterval Pages hashed every MM_RECLAIM_INTERVAL, 0 to stop scanning
+ * @return NTSTATUS Status code
+ * @note Bounds the CPU time spent on merging: each page costs one pass over
+ *       its 4KB, plus a compare when it matches. Starting the scan wakes the
+ *       reclaim thread, which sleeps without a timeout while it is stopped
  */
-VOID MmGetMemoryStatistics(PMEMORY_STATISTICS Statistics)
+NTSTATUS MmSetPageMergingRate(ULONG PagesPerInterval)
 {
-    if (Statistics == NULL) {
-        return;
+    ULONG previous = g_MemoryManager.MergeScanRate;
+
+    g_MemoryManager.MergeScanRate = PagesPerInterval;
+    if (previous == 0 && PagesPerInterval != 0) {
+        MmWakeReclaimThread();
+    }
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Scan the address spaces that opted in and merge identical pages
+ * @param PageCount Pages to hash, shared evenly between the address spaces
+ * @return Pages merged
+ * @note A page is merged on the first pass that finds it unchanged since the
+ *       previous one, so a newly written page takes two passes
+ */
+ULONG MmScanMergeablePages(ULONG PageCount)
+{
+    ULONG merged = 0;
+    ULONG address_space_count = 0;
+
+    if (g_MemoryManager.MergeStableTable == NULL || PageCount == 0) {
+        return 0;
     }
 
     KIRQL old_irql;
     KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
 
-    RtlCopyMemory(Statistics, &g_MemoryManager.Statistics, sizeof(MEMORY_STATISTICS));
+    for (PLIST_ENTRY entry = g_MemoryManager.AddressSpaceListHead.Flink;
+         entry != &g_MemoryManager.AddressSpaceListHead;
+         entry = entry->Flink) {
+        if (CONTAINING_RECORD(entry, ADDRESS_SPACE_DESCRIPTOR, AddressSpaceListEntry)->PageMerging) {
+            address_space_count++;
+        }
+    }
 
-    Statistics->TotalPhysicalPages = g_MemoryManager.TotalPhysicalPages;
-    Statistics->FreePhysicalPages = g_MemoryManager.FreePhysicalPages;
+    if (address_space_count > 0) {
+        ULONG share = (PageCount + address_space_count - 1) / address_space_count;
+
+        for (PLIST_ENTRY entry = g_MemoryManager.AddressSpaceListHead.Flink;
+             entry != &g_MemoryManager.AddressSpaceListHead;
+             entry = entry->Flink) {
+            PADDRESS_SPACE_DESCRIPTOR address_space = CONTAINING_RECORD(entry, ADDRESS_SPACE_DESCRIPTOR,
+                                                                        AddressSpaceListEntry);
+            if (address_space->PageMerging) {
+                merged += MmScanAddressSpaceForMerging(address_space, share);
+            }
+        }
+    }
 
     KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+    return merged;
+}
+
+/**
+ * @brief Page reclaim and compaction thread
+ * @param Context Unused
+ * @note Runs in the system process. Sleeps until the allocator signals that
+ *       free pages fell below the low watermark or an allocation failed, then
+ *       trims working sets up to the high watermark. Then compacts the nodes
+ *       too fragmented for huge pages, or for the last allocation that failed
+ *       without compacting, and scans for pages to merge. While merging is on
+ *       it also wakes every MM_RECLAIM_INTERVAL for the scan
+ */
+VOID MmWorkingSetManager(PVOID Context)
+{
+    UNREFERENCED_PARAMETER(Context);
+
+    for (;;) {
+        LARGE_INTEGER interval;
+        interval.QuadPart = -(LONGLONG)MM_RECLAIM_INTERVAL * 10; // Relative, in 100ns units
+
+        KeWaitForSingleObject(&g_MemoryManager.ReclaimEvent, Executive, KernelMode, FALSE,
+                              (g_MemoryManager.MergeScanRate != 0) ? &interval : NULL);
+
+        // Allocations from here on may wake the thread for another pass
+        InterlockedExchange(&g_MemoryManager.ReclaimPending, 0);
+
+        ULONG free_pages = MmGetFreePageCount();
+        if (free_pages < g_MemoryManager.ReclaimLowWatermark) {
+            MmReclaimPages(g_MemoryManager.ReclaimHighWatermark - free_pages);
+        }
+
+        ULONG order = g_MemoryManager.CompactionOrder;
+        g_MemoryManager.CompactionOrder = 0;
+        if (order == 0) {
+            order = MM_COMPACTION_ORDER;
+        }
+
+        for (ULONG node = 0; node < g_MemoryManager.NodeCount; node++) {
+            if (MmGetFragmentationIndex(&g_MemoryManager.Zones[node], order) > MM_COMPACTION_THRESHOLD) {
+                MmCompactZone(&g_MemoryManager.Zones[node], order);
+            }
+        }
+
+        MmScanMergeablePages(g_MemoryManager.MergeScanRate);
+    }
 }
 
 /**
@@ -634,26 +5943,25 @@ NTSTATUS MmCreateAddressSpace(PPROCESS_CONTROL_BLOCK Process)
         return STATUS_INVALID_PARAMETER;
     }
 
-    // Allocate page directory
-    PVOID page_directory = MmAllocatePhysicalMemory(DSLOS_PAGE_SIZE);
+    // Allocate PML4 and share the system range with every other address space
+    PMM_PTE page_directory = MmAllocatePageTable();
     if (page_directory == NULL) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    // Initialize page directory (simplified)
-    RtlZeroMemory(page_directory, DSLOS_PAGE_SIZE);
+    PMM_PTE system_directory = (PMM_PTE)g_MemoryManager.SystemAddressSpace.PageDirectory;
+    page_directory[MM_KERNEL_PML4_INDEX] = system_directory[MM_KERNEL_PML4_INDEX];
+    page_directory[MM_DIRECT_MAP_PML4_INDEX] = system_directory[MM_DIRECT_MAP_PML4_INDEX];
 
     // Create address space descriptor
     PADDRESS_SPACE_DESCRIPTOR descriptor = ExAllocatePool(NonPagedPool, sizeof(ADDRESS_SPACE_DESCRIPTOR));
     if (descriptor == NULL) {
-        MmFreePhysicalMemory(page_directory, DSLOS_PAGE_SIZE);
+        MmFreePageTable(page_directory);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    descriptor->Process = Process;
+    MmInitializeAddressSpaceDescriptor(descriptor, Process, MM_USER_RANGE_START, MM_USER_RANGE_END);
     descriptor->PageDirectory = page_directory;
-    descriptor->RegionCount = 0;
-    InitializeListHead(&descriptor->AddressSpaceListEntry);
 
     // Add to global address space list
     KIRQL old_irql;
@@ -663,9 +5971,75 @@ NTSTATUS MmCreateAddressSpace(PPROCESS_CONTROL_BLOCK Process)
     KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
 
     Process->PageDirectory = page_directory;
+    Process->AddressSpace = descriptor;
     return STATUS_SUCCESS;
 }
 
+/**
+ * @brief Clone the user address space of a process into a new process
+ * @param Parent Process whose address space is cloned
+ * @param Process Process with a newly created, empty address space
+ * @return NTSTATUS Status code
+ * @note Both processes share the parent's pages read-only until either writes
+ *       to one, so the cost depends on the page tables, not on resident memory.
+ *       On failure the caller destroys the new address space
+ */
+NTSTATUS MmCloneAddressSpace(PPROCESS_CONTROL_BLOCK Parent, PPROCESS_CONTROL_BLOCK Process)
+{
+    if (Parent == NULL || Process == NULL || Parent->AddressSpace == NULL || Process->AddressSpace == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PADDRESS_SPACE_DESCRIPTOR source = (PADDRESS_SPACE_DESCRIPTOR)Parent->AddressSpace;
+    PADDRESS_SPACE_DESCRIPTOR target = (PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace;
+    if (target->RegionCount != 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    NTSTATUS status = STATUS_SUCCESS;
+
+    // The new address space is not in use yet, so only the parent is locked
+    KIRQL old_irql;
+    KeAcquireSpinLock(&source->RegionLock, &old_irql);
+
+    // Copy the region descriptors
+    for (PLIST_ENTRY entry = source->RegionListHead.Flink;
+         entry != &source->RegionListHead;
+         entry = entry->Flink) {
+        PVIRTUAL_MEMORY_REGION region = CONTAINING_RECORD(entry, VIRTUAL_MEMORY_REGION, RegionListEntry);
+
+        PVIRTUAL_MEMORY_REGION copy = MmAllocateObject(g_MemoryManager.RegionCache);
+        if (copy == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        RtlCopyMemory(copy, region, sizeof(VIRTUAL_MEMORY_REGION));
+        target->RegionRoot = MmVmaInsert(target->RegionRoot, copy);
+        InsertTailList(&target->RegionListHead, &copy->RegionListEntry);
+        target->RegionCount++;
+    }
+
+    // Share the mapped pages, then drop the parent's writable translations
+    if (NT_SUCCESS(status)) {
+        KIRQL page_table_irql;
+        KeAcquireSpinLock(&source->PageTableLock, &page_table_irql);
+
+        status = MmClonePageTables(source, (PMM_PTE)source->PageDirectory, (PMM_PTE)target->PageDirectory,
+                                   4, 0, MM_KERNEL_PML4_INDEX - 1);
+
+        MM_TLB_BATCH batch;
+        MmInitializeTlbBatch(&batch, source);
+        batch.FlushAll = TRUE;
+        MmFlushTlbBatch(&batch);
+
+        KeReleaseSpinLock(&source->PageTableLock, page_table_irql);
+    }
+
+    KeReleaseSpinLock(&source->RegionLock, old_irql);
+    return status;
+}
+
 /**
  * @brief Destroy address space for process
  * @param Process Process to destroy address space for
@@ -676,30 +6050,270 @@ NTSTATUS MmDestroyAddressSpace(PPROCESS_CONTROL_BLOCK Process)
         return STATUS_INVALID_PARAMETER;
     }
 
-    // Find and remove address space descriptor
-    PADDRESS_SPACE_DESCRIPTOR descriptor = NULL;
+    // Remove address space descriptor
+    PADDRESS_SPACE_DESCRIPTOR descriptor = (PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace;
+    if (descriptor == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // A reclaim pass trimming the address space moves on before it is unlisted
     KIRQL old_irql;
     KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+    while (descriptor->TrimReferences != 0) {
+        KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+        KeYieldProcessor();
+        KeAcquireSpinLock(&g_MemoryManager.MemoryLock, &old_irql);
+    }
+    RemoveEntryList(&descriptor->AddressSpaceListEntry);
+    g_MemoryManager.AddressSpaceCount--;
+    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+
+    // A process tearing down its own address space moves to the system page tables first
+    if (g_MemoryManager.LoadedAddressSpaces[KeGetCurrentProcessorNumber()] == descriptor) {
+        MmSwitchAddressSpace(NULL);
+    }
+
+    // Flush the user half with a single TLB flush. Every other processor that
+    // still has the page tables loaded switches away from them in the same
+    // shootdown, and one caught mid-switch is waited out, so no processor can
+    // walk the tables once they are freed
+    MM_TLB_BATCH batch;
+    MmInitializeTlbBatch(&batch, descriptor);
+    batch.FlushAll = TRUE;
+    batch.Unload = TRUE;
+    MmFlushTlbBatch(&batch);
+
+    while (descriptor->ActiveProcessors != 0) {
+        MmProcessTlbShootdown();
+        KeYieldProcessor();
+    }
+
+    // Tear down the page tables along with the pages they map
+    KIRQL page_table_irql;
+    KeAcquireSpinLock(&descriptor->PageTableLock, &page_table_irql);
+    MmFreePageTables((PMM_PTE)descriptor->PageDirectory, 4, 0, MM_KERNEL_PML4_INDEX - 1);
+    KeReleaseSpinLock(&descriptor->PageTableLock, page_table_irql);
+
+    // Release the region descriptors
+    while (!IsListEmpty(&descriptor->RegionListHead)) {
+        PVIRTUAL_MEMORY_REGION region = CONTAINING_RECORD(RemoveHeadList(&descriptor->RegionListHead),
+                                                          VIRTUAL_MEMORY_REGION, RegionListEntry);
+        MmFreeObject(g_MemoryManager.RegionCache, region);
+    }
+    descriptor->RegionRoot = NULL;
+    descriptor->RegionCount = 0;
+
+    // Free PML4
+    MmFreePageTable((PMM_PTE)descriptor->PageDirectory);
+    ExFreePool(descriptor);
+    Process->PageDirectory = NULL;
+    Process->AddressSpace = NULL;
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Load the page tables of a process on the current processor
+ * @param Process Process about to run, or NULL for the system address space
+ * @note Called on every context switch. The processor joins the new address
+ *       space's active set before loading it, so no shootdown can miss it, and
+ *       leaves the old one after the CR3 write has dropped its translations
+ */
+VOID MmSwitchAddressSpace(PPROCESS_CONTROL_BLOCK Process)
+{
+    ULONG processor = KeGetCurrentProcessorNumber();
+    LONG64 bit = (LONG64)(1ULL << processor);
+    PADDRESS_SPACE_DESCRIPTOR previous = g_MemoryManager.LoadedAddressSpaces[processor];
+    PADDRESS_SPACE_DESCRIPTOR next = (Process != NULL && Process->AddressSpace != NULL) ?
+                                     (PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace :
+                                     &g_MemoryManager.SystemAddressSpace;
+
+    if (next == previous) {
+        return;
+    }
+
+    InterlockedOr64(&g_MemoryManager.LoadedProcessors, bit);
+    InterlockedOr64(&next->ActiveProcessors, bit);
+    g_MemoryManager.LoadedAddressSpaces[processor] = next;
+
+    HalSetCr3(MmVirtualToPhysical(next->PageDirectory));
+
+    if (previous != NULL) {
+        InterlockedAnd64(&previous->ActiveProcessors, ~bit);
+    }
+}
+
+/**
+ * @brief Allocate a kernel stack
+ * @param Stack Receives the lowest address of the stack
+ * @param Size Stack size, at most MM_KERNEL_STACK_SIZE
+ * @return NTSTATUS Status code
+ * @note Every kernel stack is MM_KERNEL_STACK_SIZE, resident, and has an
+ *       uncommitted guard page below it. Stacks freed on this processor are
+ *       reused first, so thread churn rarely maps memory
+ */
+NTSTATUS MmAllocateKernelStack(PVOID* Stack, SIZE_T Size)
+{
+    if (Stack == NULL || Size == 0 || Size > MM_KERNEL_STACK_SIZE) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    KIRQL old_irql;
+    KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
 
-    PLIST_ENTRY entry = g_MemoryManager.AddressSpaceListHead.Flink;
-    while (entry != &g_MemoryManager.AddressSpaceListHead) {
-        descriptor = CONTAINING_RECORD(entry, ADDRESS_SPACE_DESCRIPTOR, AddressSpaceListEntry);
-        if (descriptor->Process == Process) {
-            RemoveEntryList(&descriptor->AddressSpaceListEntry);
-            g_MemoryManager.AddressSpaceCount--;
+    ULONG cpu = KeGetCurrentProcessorNumber();
+    PMM_KERNEL_STACK_CACHE cache = &g_MemoryManager.KernelStackCaches[(cpu < MM_MAX_PROCESSORS) ? cpu : 0];
+    PVOID stack = (cache->Count > 0) ? cache->Stacks[--cache->Count] : NULL;
+
+    KeLowerIrql(old_irql);
+
+    if (stack != NULL) {
+        InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.KernelStackCacheHits);
+        *Stack = stack;
+        return STATUS_SUCCESS;
+    }
+
+    // Map the stack with its guard page, then take the guard page away again
+    PUCHAR base = MmAllocateVirtualMemory(NULL, NULL, MM_STACK_GUARD_SIZE + MM_KERNEL_STACK_SIZE, PAGE_READWRITE);
+    if (base == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    NTSTATUS status = MmFreeVirtualMemoryEx(NULL, base, MM_STACK_GUARD_SIZE, MEM_DECOMMIT);
+    if (!NT_SUCCESS(status)) {
+        MmFreeVirtualMemory(NULL, base, MM_STACK_GUARD_SIZE + MM_KERNEL_STACK_SIZE);
+        return status;
+    }
+
+    InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.KernelStackCacheMisses);
+    *Stack = base + MM_STACK_GUARD_SIZE;
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Free a kernel stack
+ * @param Stack Stack returned by MmAllocateKernelStack
+ * @note The stack goes to this processor's cache while it has room
+ */
+VOID MmFreeKernelStack(PVOID Stack)
+{
+    if (Stack == NULL) {
+        return;
+    }
+
+    KIRQL old_irql;
+    KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+    ULONG cpu = KeGetCurrentProcessorNumber();
+    PMM_KERNEL_STACK_CACHE cache = &g_MemoryManager.KernelStackCaches[(cpu < MM_MAX_PROCESSORS) ? cpu : 0];
+    BOOLEAN cached = (cache->Count < MM_KERNEL_STACK_CACHE_DEPTH);
+    if (cached) {
+        cache->Stacks[cache->Count++] = Stack;
+    }
+
+    KeLowerIrql(old_irql);
+
+    if (!cached) {
+        MmFreeVirtualMemory(NULL, (PUCHAR)Stack - MM_STACK_GUARD_SIZE, MM_STACK_GUARD_SIZE + MM_KERNEL_STACK_SIZE);
+    }
+}
+
+/**
+ * @brief Allocate a user stack in a process
+ * @param Process Process owning the stack
+ * @param Size Stack size
+ * @param Stack Receives the lowest address of the stack
+ * @return NTSTATUS Status code
+ * @note Only the top MM_USER_STACK_INITIAL_COMMIT is committed; faults below
+ *       it commit the stack downward, and the guard page below the stack
+ *       catches overflows. A stack of the same size left by an exited thread
+ *       of the process is reused as it is
+ */
+NTSTATUS MmAllocateUserStack(PPROCESS_CONTROL_BLOCK Process, SIZE_T Size, PVOID* Stack)
+{
+    if (Process == NULL || Process->AddressSpace == NULL || Stack == NULL || Size == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PADDRESS_SPACE_DESCRIPTOR address_space = (PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace;
+    SIZE_T aligned_size = (Size + DSLOS_PAGE_SIZE - 1) & ~(SIZE_T)(DSLOS_PAGE_SIZE - 1);
+    PVOID stack = NULL;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&address_space->RegionLock, &old_irql);
+
+    for (ULONG i = 0; i < address_space->StackCacheCount; i++) {
+        if (address_space->StackCache[i].Size == aligned_size) {
+            stack = address_space->StackCache[i].Stack;
+            address_space->StackCache[i] = address_space->StackCache[--address_space->StackCacheCount];
             break;
         }
-        entry = entry->Flink;
     }
 
-    KeReleaseSpinLock(&g_MemoryManager.MemoryLock, old_irql);
+    KeReleaseSpinLock(&address_space->RegionLock, old_irql);
+
+    if (stack != NULL) {
+        InterlockedIncrement((PLONG)&g_MemoryManager.Statistics.UserStackCacheHits);
+        *Stack = stack;
+        return STATUS_SUCCESS;
+    }
+
+    PUCHAR base = MmAllocateVirtualMemoryEx(Process, NULL, MM_STACK_GUARD_SIZE + aligned_size,
+                                            MEM_RESERVE, PAGE_READWRITE);
+    if (base == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    SIZE_T commit = (aligned_size < MM_USER_STACK_INITIAL_COMMIT) ? aligned_size : MM_USER_STACK_INITIAL_COMMIT;
+    PUCHAR top = base + MM_STACK_GUARD_SIZE + aligned_size;
+    if (MmAllocateVirtualMemoryEx(Process, top - commit, commit, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+        MmFreeVirtualMemory(Process, base, MM_STACK_GUARD_SIZE + aligned_size);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
-    if (descriptor != NULL) {
-        // Free page directory
-        MmFreePhysicalMemory(descriptor->PageDirectory, DSLOS_PAGE_SIZE);
-        ExFreePool(descriptor);
-        Process->PageDirectory = NULL;
+    // The reserved part below the committed top grows on fault
+    KeAcquireSpinLock(&address_space->RegionLock, &old_irql);
+    PVIRTUAL_MEMORY_REGION region = MmFindVirtualMemoryRegion(address_space, base);
+    if (region != NULL && region->State == MEM_RESERVE) {
+        region->GrowsDown = TRUE;
     }
+    KeReleaseSpinLock(&address_space->RegionLock, old_irql);
 
+    *Stack = base + MM_STACK_GUARD_SIZE;
     return STATUS_SUCCESS;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Free a user stack
+ * @param Process Process owning the stack
+ * @param Stack Stack returned by MmAllocateUserStack
+ * @param Size Size it was allocated with
+ * @note The stack is kept for the next thread of the process while the
+ *       address space's cache has room, with its pages still committed
+ */
+VOID MmFreeUserStack(PPROCESS_CONTROL_BLOCK Process, PVOID Stack, SIZE_T Size)
+{
+    if (Process == NULL || Process->AddressSpace == NULL || Stack == NULL) {
+        return; // The address space took its stacks with it
+    }
+
+    PADDRESS_SPACE_DESCRIPTOR address_space = (PADDRESS_SPACE_DESCRIPTOR)Process->AddressSpace;
+    SIZE_T aligned_size = (Size + DSLOS_PAGE_SIZE - 1) & ~(SIZE_T)(DSLOS_PAGE_SIZE - 1);
+    BOOLEAN cached = FALSE;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&address_space->RegionLock, &old_irql);
+
+    if (address_space->StackCacheCount < MM_USER_STACK_CACHE_DEPTH) {
+        address_space->StackCache[address_space->StackCacheCount].Stack = Stack;
+        address_space->StackCache[address_space->StackCacheCount].Size = aligned_size;
+        address_space->StackCacheCount++;
+        cached = TRUE;
+    }
+
+    KeReleaseSpinLock(&address_space->RegionLock, old_irql);
+
+    if (!cached) {
+        MmFreeVirtualMemory(Process, (PUCHAR)Stack - MM_STACK_GUARD_SIZE, MM_STACK_GUARD_SIZE + aligned_size);
+    }
+}
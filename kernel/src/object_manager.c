@@ -28,6 +28,7 @@ typedef struct _OBJECT_MANAGER_STATE {
         PVOID DefaultObject;
         PVOID ParseProcedure;
         PVOID DeleteProcedure;
+        PMM_OBJECT_CACHE ObjectCache;  // Cache objects of this type are allocated from (optional)
         LIST_ENTRY TypeListEntry;
     } OBJECT_TYPE, *POBJECT_TYPE;
 
@@ -194,7 +195,28 @@ VOID ObDeleteObject(PKERNEL_OBJECT Object)
     }
 
     // Free object memory
-    ExFreePool(Object);
+    if (Object->ObjectType < KERNEL_OBJECT_TYPE_MAX &&
+        g_ObjectManager.ObjectTypes[Object->ObjectType].ObjectCache != NULL) {
+        MmFreeObject(g_ObjectManager.ObjectTypes[Object->ObjectType].ObjectCache, Object);
+    } else {
+        ExFreePool(Object);
+    }
+}
+
+/**
+ * @brief Set the object cache used to free objects of a type
+ * @param Type Object type
+ * @param Cache Object cache, or NULL to free through the pool
+ * @return NTSTATUS Status code
+ */
+NTSTATUS ObSetObjectTypeCache(KERNEL_OBJECT_TYPE Type, PMM_OBJECT_CACHE Cache)
+{
+    if (Type >= KERNEL_OBJECT_TYPE_MAX) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    g_ObjectManager.ObjectTypes[Type].ObjectCache = Cache;
+    return STATUS_SUCCESS;
 }
 
 /**
@@ -40,6 +40,9 @@ typedef struct _PROCESS_MANAGER_STATE {
 
 static PROCESS_MANAGER_STATE g_ProcessManager = {0};
 
+// Thread control block cache, shared with the scheduler and thread manager
+PMM_OBJECT_CACHE PsThreadObjectCache = NULL;
+
 // Handle entry structure
 typedef struct _HANDLE_ENTRY {
     HANDLE Handle;
@@ -64,6 +67,7 @@ typedef struct _PROCESS_STATISTICS {
 #define CREATE_PROCESS_SUSPENDED    0x00000001
 #define CREATE_PROCESS_DEBUG         0x00000002
 #define CREATE_PROCESS_INHERIT_HANDLES 0x00000004
+#define CREATE_PROCESS_CLONE_ADDRESS_SPACE 0x00000008   // Start with the parent's memory, shared copy-on-write
 
 // Thread creation flags
 #define CREATE_THREAD_SUSPENDED     0x00000001
@@ -100,8 +104,16 @@ NTSTATUS PsInitializeProcessManager(VOID)
     // Initialize statistics
     RtlZeroMemory(&g_ProcessManager.Statistics, sizeof(PROCESS_STATISTICS));
 
+    // Create thread control block cache; threads are released through ObDeleteObject
+    NTSTATUS status = MmCreateObjectCache("ThreadControlBlock", sizeof(THREAD_CONTROL_BLOCK), 0,
+                                          NULL, NULL, &PsThreadObjectCache);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    ObSetObjectTypeCache(KERNEL_OBJECT_TYPE_THREAD, PsThreadObjectCache);
+
     // Create system processes
-    NTSTATUS status = PsCreateSystemProcesses();
+    status = PsCreateSystemProcesses();
     if (!NT_SUCCESS(status)) {
         return status;
     }
@@ -120,7 +132,8 @@ static NTSTATUS PsCreateSystemProcesses(VOID)
     NTSTATUS status = PsCreateProcessInternal(&g_ProcessManager.IdleProcess,
                                             L"\\System\\Idle.exe",
                                             NULL,
-                                            PROCESS_PRIORITY_IDLE);
+                                            PROCESS_PRIORITY_IDLE,
+                                            0);
     if (!NT_SUCCESS(status)) {
         return status;
     }
@@ -131,7 +144,8 @@ static NTSTATUS PsCreateSystemProcesses(VOID)
     status = PsCreateProcessInternal(&g_ProcessManager.SystemProcess,
                                    L"\\System\\System.exe",
                                    NULL,
-                                   PROCESS_PRIORITY_HIGH);
+                                   PROCESS_PRIORITY_HIGH,
+                                   0);
     if (!NT_SUCCESS(status)) {
         return status;
     }
@@ -162,22 +176,41 @@ NTSTATUS PsCreateProcess(PPROCESS_CONTROL_BLOCK* Process, PCSTR ImagePath, PPROC
     }
 
     // Create process
-    status = PsCreateProcessInternal(Process, unicode_path.Buffer, Parent, PROCESS_PRIORITY_NORMAL);
+    status = PsCreateProcessInternal(Process, unicode_path.Buffer, Parent, PROCESS_PRIORITY_NORMAL, 0);
 
     RtlFreeUnicodeString(&unicode_path);
     return status;
 }
 
+/**
+ * @brief Create a child process that starts with a copy of its parent's memory
+ * @param Process Pointer to receive process pointer
+ * @param Parent Process to fork
+ * @return NTSTATUS Status code
+ * @note The parent's pages are shared copy-on-write, so the cost follows the
+ *       size of its page tables rather than its resident memory
+ */
+NTSTATUS PsForkProcess(PPROCESS_CONTROL_BLOCK* Process, PPROCESS_CONTROL_BLOCK Parent)
+{
+    if (Process == NULL || Parent == NULL || Parent->AddressSpace == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return PsCreateProcessInternal(Process, NULL, Parent, PROCESS_PRIORITY_NORMAL,
+                                   CREATE_PROCESS_CLONE_ADDRESS_SPACE);
+}
+
 /**
  * @brief Internal process creation function
  * @param Process Pointer to receive process pointer
  * @param ImagePath Process image path
  * @param Parent Parent process
  * @param Priority Process priority
+ * @param Flags CREATE_PROCESS_* flags
  * @return NTSTATUS Status code
  */
 static NTSTATUS PsCreateProcessInternal(PPROCESS_CONTROL_BLOCK* Process, PCWSTR ImagePath,
-                                       PPROCESS_CONTROL_BLOCK Parent, LONG Priority)
+                                       PPROCESS_CONTROL_BLOCK Parent, LONG Priority, ULONG Flags)
 {
     // Allocate process control block
     PPROCESS_CONTROL_BLOCK new_process = ExAllocatePool(NonPagedPool, sizeof(PROCESS_CONTROL_BLOCK));
@@ -217,6 +250,16 @@ static NTSTATUS PsCreateProcessInternal(PPROCESS_CONTROL_BLOCK* Process, PCWSTR
         return status;
     }
 
+    // A forked child starts with the parent's memory, shared copy-on-write
+    if ((Flags & CREATE_PROCESS_CLONE_ADDRESS_SPACE) && Parent != NULL && Parent->AddressSpace != NULL) {
+        status = MmCloneAddressSpace(Parent, new_process);
+        if (!NT_SUCCESS(status)) {
+            MmDestroyAddressSpace(new_process);
+            ExFreePool(new_process);
+            return status;
+        }
+    }
+
     // Set resource limits
     new_process->CpuTimeLimit = 0; // No limit
     new_process->MemoryLimit = 0;   // No limit
@@ -282,7 +325,7 @@ static NTSTATUS PsCreateProcessInternal(PPROCESS_CONTROL_BLOCK* Process, PCWSTR
 static NTSTATUS PsCreateMainThread(PPROCESS_CONTROL_BLOCK Process, PTHREAD_CONTROL_BLOCK* Thread)
 {
     // Allocate thread control block
-    PTHREAD_CONTROL_BLOCK new_thread = ExAllocatePool(NonPagedPool, sizeof(THREAD_CONTROL_BLOCK));
+    PTHREAD_CONTROL_BLOCK new_thread = MmAllocateObject(PsThreadObjectCache);
     if (new_thread == NULL) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -307,10 +350,13 @@ static NTSTATUS PsCreateMainThread(PPROCESS_CONTROL_BLOCK Process, PTHREAD_CONTR
     new_thread->Priority = 8; // Default priority
     new_thread->BasePriority = 8;
 
+    // Not yet run anywhere, so the first ready picks the least loaded processor
+    new_thread->LastProcessor = MAXULONG;
+
     // Allocate thread stack
     NTSTATUS status = PsAllocateThreadStack(new_thread);
     if (!NT_SUCCESS(status)) {
-        ExFreePool(new_thread);
+        MmFreeObject(PsThreadObjectCache, new_thread);
         return status;
     }
 
@@ -318,7 +364,7 @@ static NTSTATUS PsCreateMainThread(PPROCESS_CONTROL_BLOCK Process, PTHREAD_CONTR
     status = PsInitializeThreadContext(new_thread);
     if (!NT_SUCCESS(status)) {
         PsFreeThreadStack(new_thread);
-        ExFreePool(new_thread);
+        MmFreeObject(PsThreadObjectCache, new_thread);
         return status;
     }
 
@@ -362,22 +408,26 @@ static NTSTATUS PsCreateMainThread(PPROCESS_CONTROL_BLOCK Process, PTHREAD_CONTR
  * @brief Allocate thread stack
  * @param Thread Thread to allocate stack for
  * @return NTSTATUS Status code
+ * @note Both stacks have a guard page below them. The user stack commits
+ *       its pages downward as the thread faults on them
  */
 static NTSTATUS PsAllocateThreadStack(PTHREAD_CONTROL_BLOCK Thread)
 {
     // Allocate kernel stack
-    SIZE_T kernel_stack_size = 16 * 1024; // 16KB kernel stack
-    Thread->KernelStack = MmAllocateVirtualMemory(Thread->Process, NULL, kernel_stack_size, PAGE_READWRITE);
-    if (Thread->KernelStack == NULL) {
-        return STATUS_INSUFFICIENT_RESOURCES;
+    NTSTATUS status = MmAllocateKernelStack(&Thread->KernelStack, MM_KERNEL_STACK_SIZE);
+    if (!NT_SUCCESS(status)) {
+        Thread->KernelStack = NULL;
+        return status;
     }
 
     // Allocate user stack
     SIZE_T user_stack_size = 1024 * 1024; // 1MB user stack
-    Thread->UserStack = MmAllocateVirtualMemory(Thread->Process, NULL, user_stack_size, PAGE_READWRITE);
-    if (Thread->UserStack == NULL) {
-        MmFreeVirtualMemory(Thread->Process, Thread->KernelStack, kernel_stack_size);
-        return STATUS_INSUFFICIENT_RESOURCES;
+    status = MmAllocateUserStack(Thread->Process, user_stack_size, &Thread->UserStack);
+    if (!NT_SUCCESS(status)) {
+        MmFreeKernelStack(Thread->KernelStack);
+        Thread->KernelStack = NULL;
+        Thread->UserStack = NULL;
+        return status;
     }
 
     // Set stack boundaries
@@ -394,12 +444,12 @@ static NTSTATUS PsAllocateThreadStack(PTHREAD_CONTROL_BLOCK Thread)
 static VOID PsFreeThreadStack(PTHREAD_CONTROL_BLOCK Thread)
 {
     if (Thread->KernelStack != NULL) {
-        MmFreeVirtualMemory(Thread->Process, Thread->KernelStack, 16 * 1024);
+        MmFreeKernelStack(Thread->KernelStack);
         Thread->KernelStack = NULL;
     }
 
     if (Thread->UserStack != NULL) {
-        MmFreeVirtualMemory(Thread->Process, Thread->UserStack, 1024 * 1024);
+        MmFreeUserStack(Thread->Process, Thread->UserStack, 1024 * 1024);
         Thread->UserStack = NULL;
     }
 }
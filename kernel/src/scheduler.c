@@ -9,54 +9,78 @@
 #include "../include/kernel.h"
 #include "../include/dslos.h"
 
+// Scheduler statistics structure
+typedef struct _SCHEDULER_STATISTICS {
+    ULONG ContextSwitches;
+    ULONG ThreadSwitches;
+    ULONG IdleSwitches;
+    ULONG Preemptions;
+    ULONG LoadBalanceOperations;
+    ULONG RemoteWakeups;           // Threads readied onto another processor's queue
+    ULONG RescheduleIpis;          // Reschedule interrupts sent to other processors
+    LARGE_INTEGER TotalCpuTime;
+    LARGE_INTEGER IdleTime;
+} SCHEDULER_STATISTICS, *PSCHEDULER_STATISTICS;
+
+#define KI_MAX_PROCESSORS          DSLOS_MAX_PROCESSORS
+#define KI_PRIORITY_LEVELS         32
+
+// Per-processor run queue. A processor dispatches only from its own queue;
+// other processors take the queue lock just long enough to place a thread
+// they readied and, when it should preempt, send a reschedule interrupt
+typedef struct _KI_RUN_QUEUE {
+    KSPIN_LOCK Lock;
+    ULONG Processor;
+
+    // Ready queues
+    LIST_ENTRY ReadyQueues[KI_PRIORITY_LEVELS]; // Priority levels 0-31
+    ULONG ReadyThreadCounts[KI_PRIORITY_LEVELS];
+    ULONG ReadySummary;            // Bit n set while ReadyQueues[n] is non-empty
+    volatile ULONG ReadyCount;     // Read without the lock as a placement hint
+    volatile ULONG MigratableCount; // Ready threads allowed on other processors; steal hint
+
+    PTHREAD_CONTROL_BLOCK CurrentThread;
+    PTHREAD_CONTROL_BLOCK IdleThread;
+    ULONG QuantumRemaining;
+    volatile BOOLEAN ReschedulePending;
+    ULONG64 LastLoadBalanceTime;
+    ULONG64 StealDomainMask;       // Processors this one may pull work from
+    ULONG64 DomainMasks[KE_DOMAIN_COUNT]; // Processors sharing each topology level, itself included
+    KE_TICK_MODE TickMode;         // How this processor's tick fires
+
+    // Updated under the queue lock or by the owning processor only
+    SCHEDULER_STATISTICS Statistics;
+    KE_MIGRATION_STATISTICS Migration;
+} KI_RUN_QUEUE, *PKI_RUN_QUEUE;
+
 // Scheduler state
 typedef struct _SCHEDULER_STATE {
     BOOLEAN Initialized;
     BOOLEAN Running;
-    KSPIN_LOCK SchedulerLock;
-
-    // Ready queues
-    LIST_ENTRY ReadyQueues[32];    // Priority levels 0-31
-    ULONG ReadyThreadCounts[32];
-    PTHREAD_CONTROL_BLOCK CurrentThread[64]; // Per CPU current thread
-    ULONG CurrentProcessor;
+    KSPIN_LOCK SchedulerLock;      // Guards the parameters below, not dispatch
 
-    // Idle threads
-    PTHREAD_CONTROL_BLOCK IdleThreads[64];
-
-    // Scheduler statistics
-    SCHEDULER_STATISTICS Statistics;
+    // Per processor run queues
+    KI_RUN_QUEUE RunQueues[KI_MAX_PROCESSORS];
+    ULONG ProcessorCount;
+    ULONG64 ActiveProcessorMask;
 
     // Time quantum
     ULONG TimeQuantum;
-    ULONG QuantumRemaining;
 
     // Load balancing
     BOOLEAN LoadBalancingEnabled;
     ULONG LoadBalanceInterval;
-    ULONG LastLoadBalanceTime;
 
     // Preemption
     BOOLEAN PreemptionEnabled;
     ULONG PreemptionThreshold;
 
     // Affinity
-    ULONG DefaultAffinity;
+    ULONG64 DefaultAffinity;
 } SCHEDULER_STATE;
 
 static SCHEDULER_STATE g_Scheduler = {0};
 
-// Scheduler statistics structure
-typedef struct _SCHEDULER_STATISTICS {
-    ULONG ContextSwitches;
-    ULONG ThreadSwitches;
-    ULONG IdleSwitches;
-    ULONG Preemptions;
-    ULONG LoadBalanceOperations;
-    LARGE_INTEGER TotalCpuTime;
-    LARGE_INTEGER IdleTime;
-} SCHEDULER_STATISTICS, *PSCHEDULER_STATISTICS;
-
 // Priority levels
 #define PRIORITY_IDLE              0
 #define PRIORITY_LOWEST            1
@@ -70,6 +94,66 @@ typedef struct _SCHEDULER_STATISTICS {
 // Time quantum (milliseconds)
 #define DEFAULT_TIME_QUANTUM       10
 
+// Work stealing
+#define KI_CACHE_HOT_TIME          50000   // 5ms in 100ns units; threads that ran more recently stay put
+#define KI_STEAL_SCAN_LIMIT        16      // Ready threads examined per steal attempt
+
+#define KI_BENCHMARK_TAG           'QRiK'
+
+static PTHREAD_CONTROL_BLOCK KeFindNextThread(PKI_RUN_QUEUE Queue);
+
+static ULONG64 KiActiveProcessors(VOID);
+static ULONG64 KiDomainMask(ULONG Processor, ULONG Level);
+static ULONG KiReadyCount(ULONG Processor);
+static ULONG KiMigratableCount(ULONG Processor);
+static PKSPIN_LOCK KiQueueLock(ULONG Processor);
+static KE_TICK_MODE* KiTickMode(ULONG Processor);
+static PKE_MIGRATION_STATISTICS KiMigration(ULONG Processor);
+static PVOID KiTakeReadyThread(ULONG Victim, ULONG Thief, BOOLEAN Enqueue);
+static BOOLEAN KiClaimIdleProcessor(ULONG Processor);
+static ULONG KiThreadQueue(PVOID Thread);
+
+// Run queue operations for the helpers shared with the advanced scheduler
+static KI_RUN_QUEUE_OPERATIONS g_KiRunQueueOperations = {
+    KiActiveProcessors,
+    KiDomainMask,
+    KiReadyCount,
+    KiMigratableCount,
+    KiQueueLock,
+    KiTickMode,
+    KiMigration,
+    KiTakeReadyThread,
+    KiClaimIdleProcessor,
+    KiThreadQueue
+};
+
+/**
+ * @brief Check whether a thread's affinity allows more than one processor
+ * @param Thread Thread
+ * @return TRUE if another processor could run it
+ */
+static BOOLEAN KiIsThreadMigratable(PTHREAD_CONTROL_BLOCK Thread)
+{
+    return Thread->CpuAffinity == 0 || (Thread->CpuAffinity & (Thread->CpuAffinity - 1)) != 0;
+}
+
+/**
+ * @brief Prepare an empty run queue
+ * @param Queue Queue to initialize
+ * @param Processor Processor that dispatches from it
+ */
+static VOID KiInitializeRunQueue(PKI_RUN_QUEUE Queue, ULONG Processor)
+{
+    RtlZeroMemory(Queue, sizeof(KI_RUN_QUEUE));
+    KeInitializeSpinLock(&Queue->Lock);
+    Queue->Processor = Processor;
+    Queue->QuantumRemaining = g_Scheduler.TimeQuantum;
+
+    for (ULONG i = 0; i < KI_PRIORITY_LEVELS; i++) {
+        InitializeListHead(&Queue->ReadyQueues[i]);
+    }
+}
+
 /**
  * @brief Initialize scheduler
  * @return NTSTATUS Status code
@@ -82,39 +166,101 @@ NTSTATUS KeInitializeScheduler(VOID)
 
     KeInitializeSpinLock(&g_Scheduler.SchedulerLock);
     g_Scheduler.Running = FALSE;
-    g_Scheduler.CurrentProcessor = 0;
     g_Scheduler.TimeQuantum = DEFAULT_TIME_QUANTUM;
-    g_Scheduler.QuantumRemaining = DEFAULT_TIME_QUANTUM;
     g_Scheduler.LoadBalancingEnabled = TRUE;
     g_Scheduler.LoadBalanceInterval = 1000; // 1 second
-    g_Scheduler.LastLoadBalanceTime = 0;
     g_Scheduler.PreemptionEnabled = TRUE;
     g_Scheduler.PreemptionThreshold = 5;
-    g_Scheduler.DefaultAffinity = 0xFFFFFFFF; // All CPUs
-
-    // Initialize ready queues
-    for (ULONG i = 0; i < 32; i++) {
-        InitializeListHead(&g_Scheduler.ReadyQueues[i]);
-        g_Scheduler.ReadyThreadCounts[i] = 0;
+    g_Scheduler.DefaultAffinity = ~0ULL; // All CPUs
+
+    SYSTEM_INFO sys_info;
+    KeGetSystemInfo(&sys_info);
+    g_Scheduler.ProcessorCount = sys_info.dwNumberOfProcessors;
+    if (g_Scheduler.ProcessorCount == 0) {
+        g_Scheduler.ProcessorCount = 1;
+    } else if (g_Scheduler.ProcessorCount > KI_MAX_PROCESSORS) {
+        g_Scheduler.ProcessorCount = KI_MAX_PROCESSORS;
+    }
+    g_Scheduler.ActiveProcessorMask = (g_Scheduler.ProcessorCount == 64) ?
+        ~0ULL : (1ULL << g_Scheduler.ProcessorCount) - 1;
+
+    // Initialize one run queue per processor. Every processor may steal from
+    // every other; the topology domains decide which it looks at first
+    for (ULONG i = 0; i < KI_MAX_PROCESSORS; i++) {
+        KiInitializeRunQueue(&g_Scheduler.RunQueues[i], i);
+        g_Scheduler.RunQueues[i].StealDomainMask = g_Scheduler.ActiveProcessorMask;
     }
 
-    // Initialize current thread array
-    for (ULONG i = 0; i < 64; i++) {
-        g_Scheduler.CurrentThread[i] = NULL;
+    g_Scheduler.Initialized = TRUE;
+    return KeBuildSchedulerDomains();
+}
+
+/**
+ * @brief Group processors into SMT, last-level cache and package domains
+ * @return NTSTATUS Status code
+ * @note Reads each processor's ids from the HAL. Called at initialization
+ *       and again whenever the topology the HAL reports changes. Placement
+ *       and stealing read the masks without locks, as hints
+ */
+NTSTATUS KeBuildSchedulerDomains(VOID)
+{
+    if (!g_Scheduler.Initialized) {
+        return STATUS_UNSUCCESSFUL;
     }
 
-    // Initialize idle threads
-    for (ULONG i = 0; i < 64; i++) {
-        g_Scheduler.IdleThreads[i] = NULL;
+    KE_PROCESSOR_TOPOLOGY topology[KI_MAX_PROCESSORS];
+    for (ULONG i = 0; i < g_Scheduler.ProcessorCount; i++) {
+        HalQueryProcessorTopology(i, &topology[i]);
     }
 
-    // Initialize statistics
-    RtlZeroMemory(&g_Scheduler.Statistics, sizeof(SCHEDULER_STATISTICS));
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_Scheduler.SchedulerLock, &old_irql);
+
+    for (ULONG i = 0; i < g_Scheduler.ProcessorCount; i++) {
+        ULONG64 masks[KE_DOMAIN_COUNT] = {0};
 
-    g_Scheduler.Initialized = TRUE;
+        for (ULONG j = 0; j < g_Scheduler.ProcessorCount; j++) {
+            if (topology[j].PackageId != topology[i].PackageId) {
+                continue;
+            }
+            masks[KE_DOMAIN_PACKAGE] |= 1ULL << j;
+            if (topology[j].LlcId == topology[i].LlcId) {
+                masks[KE_DOMAIN_LLC] |= 1ULL << j;
+            }
+            if (topology[j].CoreId == topology[i].CoreId) {
+                masks[KE_DOMAIN_SMT] |= 1ULL << j;
+            }
+        }
+
+        // Each level contains the one below it
+        masks[KE_DOMAIN_LLC] |= masks[KE_DOMAIN_SMT];
+        masks[KE_DOMAIN_PACKAGE] |= masks[KE_DOMAIN_LLC];
+
+        for (ULONG level = 0; level < KE_DOMAIN_COUNT; level++) {
+            g_Scheduler.RunQueues[i].DomainMasks[level] = masks[level];
+        }
+    }
+
+    KeReleaseSpinLock(&g_Scheduler.SchedulerLock, old_irql);
     return STATUS_SUCCESS;
 }
 
+/**
+ * @brief Get the processors sharing a topology level with one processor
+ * @param Processor Processor number
+ * @param Domain Topology level
+ * @return Processor mask including Processor, or 0 if either is invalid
+ */
+ULONG64 KeQuerySchedulerDomain(ULONG Processor, KE_SCHED_DOMAIN Domain)
+{
+    if (!g_Scheduler.Initialized || Processor >= g_Scheduler.ProcessorCount ||
+        (ULONG)Domain >= KE_DOMAIN_COUNT) {
+        return 0;
+    }
+
+    return g_Scheduler.RunQueues[Processor].DomainMasks[Domain];
+}
+
 /**
  * @brief Start scheduler
  */
@@ -127,7 +273,7 @@ VOID KeStartScheduler(VOID)
     g_Scheduler.Running = TRUE;
 
     // Create idle threads for each processor
-    for (ULONG i = 0; i < g_Scheduler.SystemInfo.dwNumberOfProcessors; i++) {
+    for (ULONG i = 0; i < g_Scheduler.ProcessorCount; i++) {
         KeCreateIdleThread(i);
     }
 
@@ -135,8 +281,270 @@ VOID KeStartScheduler(VOID)
     KeSchedule();
 }
 
+/**
+ * @brief Queue a ready thread at the tail of its priority level
+ * @param Queue Run queue, locked by the caller
+ * @param Thread Thread to queue
+ */
+static VOID KiInsertReadyThread(PKI_RUN_QUEUE Queue, PTHREAD_CONTROL_BLOCK Thread)
+{
+    InsertTailList(&Queue->ReadyQueues[Thread->Priority], &Thread->ReadyListEntry);
+    Queue->ReadyThreadCounts[Thread->Priority]++;
+    Queue->ReadySummary |= 1UL << Thread->Priority;
+    Queue->ReadyCount++;
+    if (KiIsThreadMigratable(Thread)) {
+        Queue->MigratableCount++;
+    }
+
+    Thread->LastProcessor = Queue->Processor;
+    Thread->State = THREAD_STATE_READY;
+
+    // A waiting thread needs the periodic tick for its quantum to expire
+    KiRestorePeriodicTick(&Queue->TickMode, Queue->Processor);
+}
+
+/**
+ * @brief Take a ready thread off its run queue
+ * @param Queue Run queue holding the thread, locked by the caller
+ * @param Thread Thread to remove
+ */
+static VOID KiRemoveReadyThread(PKI_RUN_QUEUE Queue, PTHREAD_CONTROL_BLOCK Thread)
+{
+    RemoveEntryList(&Thread->ReadyListEntry);
+    InitializeListHead(&Thread->ReadyListEntry);
+    if (--Queue->ReadyThreadCounts[Thread->Priority] == 0) {
+        Queue->ReadySummary &= ~(1UL << Thread->Priority);
+    }
+    Queue->ReadyCount--;
+    if (KiIsThreadMigratable(Thread)) {
+        Queue->MigratableCount--;
+    }
+}
+
+/**
+ * @brief Get the processors dispatching from a run queue
+ * @return Processor mask
+ */
+static ULONG64 KiActiveProcessors(VOID)
+{
+    return g_Scheduler.ActiveProcessorMask;
+}
+
+/**
+ * @brief Get the processors sharing a topology level with a processor
+ * @param Processor Processor number
+ * @param Level Topology level, or KE_DOMAIN_COUNT for its steal domain
+ * @return Processor mask
+ */
+static ULONG64 KiDomainMask(ULONG Processor, ULONG Level)
+{
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[Processor];
+    return (Level < KE_DOMAIN_COUNT) ? queue->DomainMasks[Level] : queue->StealDomainMask;
+}
+
+/**
+ * @brief Get the number of ready threads on a processor's queue
+ * @param Processor Processor number
+ * @return Ready thread count
+ */
+static ULONG KiReadyCount(ULONG Processor)
+{
+    return g_Scheduler.RunQueues[Processor].ReadyCount;
+}
+
+/**
+ * @brief Get the number of ready threads another processor could take
+ * @param Processor Processor number
+ * @return Migratable thread count
+ */
+static ULONG KiMigratableCount(ULONG Processor)
+{
+    return g_Scheduler.RunQueues[Processor].MigratableCount;
+}
+
+/**
+ * @brief Get a processor's run queue lock
+ * @param Processor Processor number
+ * @return Queue lock
+ */
+static PKSPIN_LOCK KiQueueLock(ULONG Processor)
+{
+    return &g_Scheduler.RunQueues[Processor].Lock;
+}
+
+/**
+ * @brief Get a processor's tick mode
+ * @param Processor Processor number
+ * @return Tick mode, guarded by the queue lock
+ */
+static KE_TICK_MODE* KiTickMode(ULONG Processor)
+{
+    return &g_Scheduler.RunQueues[Processor].TickMode;
+}
+
+/**
+ * @brief Get a processor's work stealing counters
+ * @param Processor Processor number
+ * @return Migration statistics
+ */
+static PKE_MIGRATION_STATISTICS KiMigration(ULONG Processor)
+{
+    return &g_Scheduler.RunQueues[Processor].Migration;
+}
+
+/**
+ * @brief Get the processor whose queue holds a ready thread
+ * @param Thread Thread
+ * @return Processor number, or MAXULONG if the thread is not queued
+ */
+static ULONG KiThreadQueue(PVOID Thread)
+{
+    PTHREAD_CONTROL_BLOCK thread = (PTHREAD_CONTROL_BLOCK)Thread;
+    return IsListEmpty(&thread->ReadyListEntry) ? MAXULONG : thread->LastProcessor;
+}
+
+/**
+ * @brief Lock the run queue a ready thread sits on
+ * @param Thread Thread to look up
+ * @param OldIrql Receives the IRQL to restore
+ * @return Locked queue, or NULL if the thread is not queued
+ */
+static PKI_RUN_QUEUE KiLockThreadRunQueue(PTHREAD_CONTROL_BLOCK Thread, PKIRQL OldIrql)
+{
+    ULONG processor = KiLockThreadQueue(&g_KiRunQueueOperations, Thread, OldIrql);
+    return (processor != MAXULONG) ? &g_Scheduler.RunQueues[processor] : NULL;
+}
+
+/**
+ * @brief Choose the processor whose queue a readied thread joins
+ * @param Thread Thread being readied
+ * @return Processor number
+ * @note Prefers the processor the thread last ran on while its affinity
+ *       allows, since its cache state is there. If that processor is busy,
+ *       an idle core sharing its last-level cache runs the thread sooner
+ *       with the cache still warm. Otherwise takes the allowed processor
+ *       with the fewest ready threads. Queue state is read without locks,
+ *       which is good enough for a hint
+ */
+static ULONG KiSelectReadyProcessor(PTHREAD_CONTROL_BLOCK Thread)
+{
+    ULONG64 allowed = g_Scheduler.ActiveProcessorMask;
+    if (Thread->CpuAffinity != 0 && (Thread->CpuAffinity & allowed) != 0) {
+        allowed &= Thread->CpuAffinity;
+    }
+
+    if (Thread->LastProcessor < g_Scheduler.ProcessorCount &&
+        (allowed & (1ULL << Thread->LastProcessor))) {
+        ULONG last = Thread->LastProcessor;
+
+        if (!KiIsProcessorIdle(&g_KiRunQueueOperations, last)) {
+            ULONG idle = KiFindIdleProcessor(&g_KiRunQueueOperations,
+                                             allowed & g_Scheduler.RunQueues[last].DomainMasks[KE_DOMAIN_LLC]);
+            if (idle != MAXULONG) {
+                return idle;
+            }
+        }
+        return last;
+    }
+
+    ULONG best_processor = 0;
+    ULONG best_count = MAXULONG;
+
+    for (ULONG i = 0; i < g_Scheduler.ProcessorCount; i++) {
+        if ((allowed & (1ULL << i)) && g_Scheduler.RunQueues[i].ReadyCount < best_count) {
+            best_count = g_Scheduler.RunQueues[i].ReadyCount;
+            best_processor = i;
+        }
+    }
+
+    return best_processor;
+}
+
+/**
+ * @brief Take the best ready thread off a sibling's queue for a thief
+ * @param Victim Processor to take from
+ * @param Thief Processor taking it
+ * @param Enqueue TRUE to queue the thread on the thief, FALSE to hand it back to run now
+ * @return Thread taken, or NULL
+ * @note Called by KiStealThread with both queues locked. Highest priority
+ *       first, oldest waiter first within a level; threads not allowed on
+ *       the thief, or that left a processor less than KI_CACHE_HOT_TIME
+ *       ago, are skipped
+ */
+static PVOID KiTakeReadyThread(ULONG Victim, ULONG Thief, BOOLEAN Enqueue)
+{
+    PKI_RUN_QUEUE victim = &g_Scheduler.RunQueues[Victim];
+    PKI_RUN_QUEUE thief = &g_Scheduler.RunQueues[Thief];
+    PKE_MIGRATION_STATISTICS counters = &thief->Migration;
+    ULONG64 thief_bit = 1ULL << Thief;
+
+    LARGE_INTEGER now;
+    KeQuerySystemTime(&now);
+
+    PTHREAD_CONTROL_BLOCK stolen = NULL;
+    ULONG summary = victim->ReadySummary;
+    ULONG scanned = 0;
+
+    while (summary != 0 && stolen == NULL && scanned < KI_STEAL_SCAN_LIMIT) {
+        ULONG priority = KiFindHighestSetBit(summary);
+        PLIST_ENTRY head = &victim->ReadyQueues[priority];
+
+        summary &= ~(1UL << priority);
+
+        for (PLIST_ENTRY entry = head->Flink; entry != head && scanned < KI_STEAL_SCAN_LIMIT;
+             entry = entry->Flink) {
+            PTHREAD_CONTROL_BLOCK thread = CONTAINING_RECORD(entry, THREAD_CONTROL_BLOCK, ReadyListEntry);
+            scanned++;
+
+            if (thread->CpuAffinity != 0 && !(thread->CpuAffinity & thief_bit)) {
+                counters->AffinitySkips++;
+                continue;
+            }
+            if (now.QuadPart - (LONGLONG)thread->LastRunTime < KI_CACHE_HOT_TIME) {
+                counters->CacheHotSkips++;
+                continue;
+            }
+
+            stolen = thread;
+            break;
+        }
+    }
+
+    if (stolen != NULL) {
+        KiRemoveReadyThread(victim, stolen);
+        if (Enqueue) {
+            KiInsertReadyThread(thief, stolen);
+        } else {
+            stolen->LastProcessor = Thief;
+            stolen->State = THREAD_STATE_RUNNING;
+        }
+    }
+
+    return stolen;
+}
+
+/**
+ * @brief Choose the tick for what a processor is about to run
+ * @param Queue Current processor's run queue, not locked by the caller
+ * @param NextThread Thread it is switching to
+ * @return Tick mode
+ * @note Idle stops the tick and a thread with nothing waiting behind it
+ *       slows it. Queueing a thread here restores it, see KiInsertReadyThread
+ */
+static KE_TICK_MODE KiSelectTickMode(PKI_RUN_QUEUE Queue, PTHREAD_CONTROL_BLOCK NextThread)
+{
+    if (Queue->ReadyCount != 0) {
+        return KE_TICK_PERIODIC;
+    }
+
+    return (NextThread == Queue->IdleThread) ? KE_TICK_STOPPED : KE_TICK_REDUCED;
+}
+
 /**
  * @brief Main scheduler function
+ * @note Takes only the current processor's run queue lock, and a sibling's
+ *       only when this processor would otherwise go idle and work stealing
+ *       finds a candidate
  */
 VOID KeSchedule(VOID)
 {
@@ -144,56 +552,73 @@ VOID KeSchedule(VOID)
         return;
     }
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_Scheduler.SchedulerLock, &old_irql);
-
     // Get current processor
     ULONG current_cpu = KeGetCurrentProcessorNumber();
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[current_cpu];
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&queue->Lock, &old_irql);
+
+    queue->ReschedulePending = FALSE;
 
     // Get current thread
-    PTHREAD_CONTROL_BLOCK current_thread = g_Scheduler.CurrentThread[current_cpu];
+    PTHREAD_CONTROL_BLOCK current_thread = queue->CurrentThread;
     PTHREAD_CONTROL_BLOCK next_thread = NULL;
 
     // Find next thread to run
-    next_thread = KeFindNextThread(current_cpu);
+    next_thread = KeFindNextThread(queue);
+
+    // Keep running the current thread when nothing else is ready
+    if (next_thread == queue->IdleThread && current_thread != NULL &&
+        current_thread->State == THREAD_STATE_RUNNING) {
+        next_thread = current_thread;
+    }
+
+    KeReleaseSpinLock(&queue->Lock, old_irql);
+
+    // About to idle: take work from the busiest sibling instead
+    if (next_thread == queue->IdleThread && g_Scheduler.LoadBalancingEnabled) {
+        PTHREAD_CONTROL_BLOCK stolen = KiStealThread(&g_KiRunQueueOperations, current_cpu, 1, FALSE);
+        if (stolen != NULL) {
+            next_thread = stolen;
+        }
+    }
+
+    KiUpdateTickMode(&g_KiRunQueueOperations, current_cpu, KiSelectTickMode(queue, next_thread));
 
     if (next_thread != current_thread) {
         // Switch to new thread
         KeSwitchContext(next_thread);
     }
-
-    KeReleaseSpinLock(&g_Scheduler.SchedulerLock, old_irql);
 }
 
 /**
  * @brief Find next thread to run
- * @param CurrentProcessor Current processor number
+ * @param Queue Current processor's run queue, locked by the caller
  * @return Next thread to run
+ * @note The summary bitmap gives the highest non-empty level in one bit
+ *       scan, however many levels are empty
  */
-static PTHREAD_CONTROL_BLOCK KeFindNextThread(ULONG CurrentProcessor)
+static PTHREAD_CONTROL_BLOCK KeFindNextThread(PKI_RUN_QUEUE Queue)
 {
-    // Find highest priority ready thread
-    for (LONG priority = 31; priority >= 0; priority--) {
-        if (!IsListEmpty(&g_Scheduler.ReadyQueues[priority])) {
-            PLIST_ENTRY entry = g_Scheduler.ReadyQueues[priority].Flink;
-            PTHREAD_CONTROL_BLOCK thread = CONTAINING_RECORD(entry, THREAD_CONTROL_BLOCK, ReadyListEntry);
+    // No ready threads, run idle thread
+    if (Queue->ReadySummary == 0) {
+        return Queue->IdleThread;
+    }
 
-            // Check thread affinity
-            if (thread->CpuAffinity == 0 || (thread->CpuAffinity & (1ULL << CurrentProcessor))) {
-                // Remove from ready queue
-                RemoveEntryList(&thread->ReadyListEntry);
-                g_Scheduler.ReadyThreadCounts[priority]--;
+    // Find highest priority ready thread. Threads are only placed on queues
+    // of processors their affinity allows, so the head is always eligible
+    ULONG priority = KiFindHighestSetBit(Queue->ReadySummary);
+    PLIST_ENTRY entry = Queue->ReadyQueues[priority].Flink;
+    PTHREAD_CONTROL_BLOCK thread = CONTAINING_RECORD(entry, THREAD_CONTROL_BLOCK, ReadyListEntry);
 
-                // Set thread state to running
-                thread->State = THREAD_STATE_RUNNING;
+    // Remove from ready queue
+    KiRemoveReadyThread(Queue, thread);
 
-                return thread;
-            }
-        }
-    }
+    // Set thread state to running
+    thread->State = THREAD_STATE_RUNNING;
 
-    // No ready threads, run idle thread
-    return g_Scheduler.IdleThreads[CurrentProcessor];
+    return thread;
 }
 
 /**
@@ -203,47 +628,64 @@ static PTHREAD_CONTROL_BLOCK KeFindNextThread(ULONG CurrentProcessor)
 VOID KeSwitchContext(PTHREAD_CONTROL_BLOCK NewThread)
 {
     ULONG current_cpu = KeGetCurrentProcessorNumber();
-    PTHREAD_CONTROL_BLOCK current_thread = g_Scheduler.CurrentThread[current_cpu];
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[current_cpu];
+    PTHREAD_CONTROL_BLOCK current_thread = queue->CurrentThread;
 
     if (current_thread == NewThread) {
         return; // No switch needed
     }
 
     // Update statistics
-    InterlockedIncrement(&g_Scheduler.Statistics.ContextSwitches);
+    queue->Statistics.ContextSwitches++;
 
     if (current_thread != NULL) {
         // Save current thread context
         KeSaveThreadContext(current_thread);
 
-        // Update thread state
-        if (current_thread->State == THREAD_STATE_RUNNING) {
+        // Remember when it left, for the cache-hot check of work stealing
+        LARGE_INTEGER now;
+        KeQuerySystemTime(&now);
+        current_thread->LastRunTime = (ULONG64)now.QuadPart;
+
+        // Update thread state; the idle thread never joins a ready queue
+        if (current_thread->State == THREAD_STATE_RUNNING && current_thread != queue->IdleThread) {
             current_thread->State = THREAD_STATE_READY;
             KeAddThreadToReadyQueue(current_thread);
         }
 
-        InterlockedIncrement(&g_Scheduler.Statistics.ThreadSwitches);
+        queue->Statistics.ThreadSwitches++;
     } else {
-        InterlockedIncrement(&g_Scheduler.Statistics.IdleSwitches);
+        queue->Statistics.IdleSwitches++;
     }
 
     // Set new current thread
-    g_Scheduler.CurrentThread[current_cpu] = NewThread;
+    queue->CurrentThread = NewThread;
+    NewThread->LastProcessor = current_cpu;
+    NewThread->State = THREAD_STATE_RUNNING;
 
     // Restore new thread context
     KeRestoreThreadContext(NewThread);
 
     // Reset time quantum
-    g_Scheduler.QuantumRemaining = g_Scheduler.TimeQuantum;
+    queue->QuantumRemaining = g_Scheduler.TimeQuantum;
+}
 
-    // Update thread CPU affinity tracking
-    NewThread->CpuAffinity = 1ULL << current_cpu;
+/**
+ * @brief Get the thread running on the current processor
+ * @return Current thread, or NULL before the scheduler has started
+ */
+PTHREAD_CONTROL_BLOCK KeGetCurrentThread(VOID)
+{
+    return g_Scheduler.RunQueues[KeGetCurrentProcessorNumber()].CurrentThread;
 }
 
 /**
  * @brief Add thread to ready queue
  * @param Thread Thread to add
  * @return NTSTATUS Status code
+ * @note Queues the thread on the processor chosen for it. If that is another
+ *       processor and the thread should preempt what runs there, the target
+ *       gets a reschedule interrupt instead of waiting for its next tick
  */
 NTSTATUS KeAddThreadToReadyQueue(PTHREAD_CONTROL_BLOCK Thread)
 {
@@ -251,22 +693,42 @@ NTSTATUS KeAddThreadToReadyQueue(PTHREAD_CONTROL_BLOCK Thread)
         return STATUS_INVALID_PARAMETER;
     }
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_Scheduler.SchedulerLock, &old_irql);
-
     // Validate thread priority
-    if (Thread->Priority < 0 || Thread->Priority >= 32) {
+    if (Thread->Priority < 0 || Thread->Priority >= KI_PRIORITY_LEVELS) {
         Thread->Priority = PRIORITY_NORMAL;
     }
 
+    ULONG current_cpu = KeGetCurrentProcessorNumber();
+    ULONG target_cpu = KiSelectReadyProcessor(Thread);
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[target_cpu];
+    BOOLEAN send_ipi = FALSE;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&queue->Lock, &old_irql);
+
     // Add to appropriate ready queue
-    InsertTailList(&g_Scheduler.ReadyQueues[Thread->Priority], &Thread->ReadyListEntry);
-    g_Scheduler.ReadyThreadCounts[Thread->Priority]++;
+    KiInsertReadyThread(queue, Thread);
+
+    // Ask the target to reschedule if the thread beats what it is running
+    PTHREAD_CONTROL_BLOCK running = queue->CurrentThread;
+    if (g_Scheduler.PreemptionEnabled &&
+        (running == NULL || running == queue->IdleThread || Thread->Priority > running->Priority)) {
+        if (!queue->ReschedulePending && target_cpu != current_cpu) {
+            send_ipi = TRUE;
+            queue->Statistics.RescheduleIpis++;
+        }
+        queue->ReschedulePending = TRUE;
+    }
 
-    // Set thread state to ready
-    Thread->State = THREAD_STATE_READY;
+    if (target_cpu != current_cpu) {
+        queue->Statistics.RemoteWakeups++;
+    }
 
-    KeReleaseSpinLock(&g_Scheduler.SchedulerLock, old_irql);
+    KeReleaseSpinLock(&queue->Lock, old_irql);
+
+    if (send_ipi) {
+        HalSendInterProcessorInterrupt(target_cpu, HAL_RESCHEDULE_VECTOR);
+    }
 
     return STATUS_SUCCESS;
 }
@@ -281,18 +743,16 @@ VOID KeRemoveThreadFromReadyQueue(PTHREAD_CONTROL_BLOCK Thread)
         return;
     }
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_Scheduler.Scheduler.Lock, &old_irql);
-
     // Remove from ready queue if present
-    if (!IsListEmpty(&Thread->ReadyListEntry)) {
-        RemoveEntryList(&Thread->ReadyListEntry);
-        if (Thread->Priority < 32) {
-            g_Scheduler.ReadyThreadCounts[Thread->Priority]--;
-        }
+    KIRQL old_irql;
+    PKI_RUN_QUEUE queue = KiLockThreadRunQueue(Thread, &old_irql);
+    if (queue == NULL) {
+        return;
     }
 
-    KeReleaseSpinLock(&g_Scheduler.SchedulerLock, old_irql);
+    KiRemoveReadyThread(queue, Thread);
+
+    KeReleaseSpinLock(&queue->Lock, old_irql);
 }
 
 /**
@@ -302,7 +762,7 @@ VOID KeRemoveThreadFromReadyQueue(PTHREAD_CONTROL_BLOCK Thread)
 VOID KeCreateIdleThread(ULONG Processor)
 {
     // Create idle thread for specified processor
-    PTHREAD_CONTROL_BLOCK idle_thread = ExAllocatePool(NonPagedPool, sizeof(THREAD_CONTROL_BLOCK));
+    PTHREAD_CONTROL_BLOCK idle_thread = MmAllocateObject(PsThreadObjectCache);
     if (idle_thread == NULL) {
         return;
     }
@@ -318,6 +778,7 @@ VOID KeCreateIdleThread(ULONG Processor)
     idle_thread->BasePriority = PRIORITY_IDLE;
     idle_thread->State = THREAD_STATE_READY;
     idle_thread->CpuAffinity = 1ULL << Processor;
+    idle_thread->LastProcessor = Processor;
 
     InitializeListHead(&idle_thread->Header.ObjectListEntry);
     InitializeListHead(&idle_thread->ThreadListEntry);
@@ -328,8 +789,8 @@ VOID KeCreateIdleThread(ULONG Processor)
     KeQuerySystemTime(&idle_thread->CreateTime);
 
     // Set as current thread for this processor
-    g_Scheduler.CurrentThread[Processor] = idle_thread;
-    g_Scheduler.IdleThreads[Processor] = idle_thread;
+    g_Scheduler.RunQueues[Processor].CurrentThread = idle_thread;
+    g_Scheduler.RunQueues[Processor].IdleThread = idle_thread;
 
     // Add to process thread list
     KIRQL old_irql;
@@ -366,9 +827,9 @@ VOID KeRestoreThreadContext(PTHREAD_CONTROL_BLOCK Thread)
     // - Restore CPU registers
     // - Restore FPU state
     // - Restore segment registers
-    // - Load page directory if process changed
 
-    UNREFERENCED_PARAMETER(Thread);
+    // Load the page tables of the thread's process
+    MmSwitchAddressSpace(Thread->Process);
 }
 
 /**
@@ -376,10 +837,10 @@ VOID KeRestoreThreadContext(PTHREAD_CONTROL_BLOCK Thread)
  */
 VOID KeUpdateThreadTimes(VOID)
 {
-    ULONG current_cpu = KeGetCurrentProcessorNumber();
-    PTHREAD_CONTROL_BLOCK current_thread = g_Scheduler.CurrentThread[current_cpu];
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[KeGetCurrentProcessorNumber()];
+    PTHREAD_CONTROL_BLOCK current_thread = queue->CurrentThread;
 
-    if (current_thread == NULL || current_thread == g_Scheduler.IdleThreads[current_cpu]) {
+    if (current_thread == NULL || current_thread == queue->IdleThread) {
         return;
     }
 
@@ -405,15 +866,17 @@ VOID KePreemptCurrentThread(VOID)
         return;
     }
 
-    ULONG current_cpu = KeGetCurrentProcessorNumber();
-    PTHREAD_CONTROL_BLOCK current_thread = g_Scheduler.CurrentThread[current_cpu];
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[KeGetCurrentProcessorNumber()];
+    PTHREAD_CONTROL_BLOCK current_thread = queue->CurrentThread;
 
-    if (current_thread == NULL || current_thread == g_Scheduler.IdleThreads[current_cpu]) {
+    if (current_thread == NULL || current_thread == queue->IdleThread) {
         return;
     }
 
     // Check if preemption threshold is met
-    if (g_Scheduler.QuantumRemaining <= g_Scheduler.PreemptionThreshold) {
+    if (queue->QuantumRemaining <= g_Scheduler.PreemptionThreshold) {
+        queue->Statistics.Preemptions++;
+
         // Trigger context switch
         KeSchedule();
     }
@@ -436,21 +899,21 @@ NTSTATUS KeSetThreadPriority(PTHREAD_CONTROL_BLOCK Thread, LONG Priority)
         return STATUS_INVALID_PARAMETER;
     }
 
+    // If thread is in a ready queue, move it to the new level under that queue's lock
     KIRQL old_irql;
-    KeAcquireSpinLock(&g_Scheduler.SchedulerLock, &old_irql);
-
-    LONG old_priority = Thread->Priority;
-    Thread->Priority = Priority;
+    PKI_RUN_QUEUE queue = KiLockThreadRunQueue(Thread, &old_irql);
+    if (queue == NULL) {
+        Thread->Priority = Priority;
+        return STATUS_SUCCESS;
+    }
 
-    // If thread is in ready queue and priority changed, move it
-    if (Thread->State == THREAD_STATE_READY && old_priority != Priority) {
-        RemoveEntryList(&Thread->ReadyListEntry);
-        g_Scheduler.ReadyThreadCounts[old_priority]--;
-        InsertTailList(&g_Scheduler.ReadyQueues[Priority], &Thread->ReadyListEntry);
-        g_Scheduler.ReadyThreadCounts[Priority]++;
+    if (Thread->Priority != Priority) {
+        KiRemoveReadyThread(queue, Thread);
+        Thread->Priority = Priority;
+        KiInsertReadyThread(queue, Thread);
     }
 
-    KeReleaseSpinLock(&g_Scheduler.SchedulerLock, old_irql);
+    KeReleaseSpinLock(&queue->Lock, old_irql);
 
     return STATUS_SUCCESS;
 }
@@ -483,14 +946,21 @@ VOID KeHandleTimerInterrupt(VOID)
         return;
     }
 
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[KeGetCurrentProcessorNumber()];
+
+    // Expire timers and rearm a one-shot tick
+    KeHandleProcessorTick();
+
     // Decrement quantum
-    if (g_Scheduler.QuantumRemaining > 0) {
-        g_Scheduler.QuantumRemaining--;
+    if (queue->QuantumRemaining > 0) {
+        queue->QuantumRemaining--;
     }
 
-    // Check if quantum expired
-    if (g_Scheduler.QuantumRemaining == 0) {
+    // Check if quantum expired or a readied thread asked for this processor
+    if (queue->QuantumRemaining == 0) {
         KePreemptCurrentThread();
+    } else if (queue->ReschedulePending) {
+        KeSchedule();
     }
 
     // Update thread times
@@ -500,31 +970,75 @@ VOID KeHandleTimerInterrupt(VOID)
     if (g_Scheduler.LoadBalancingEnabled) {
         LARGE_INTEGER current_time;
         KeQuerySystemTime(&current_time);
-        if (current_time.QuadPart - g_Scheduler.LastLoadBalanceTime > g_Scheduler.LoadBalanceInterval * 10000LL) {
+        if (current_time.QuadPart - queue->LastLoadBalanceTime > g_Scheduler.LoadBalanceInterval * 10000LL) {
             KePerformLoadBalancing();
-            g_Scheduler.LastLoadBalanceTime = current_time.QuadPart;
+            queue->LastLoadBalanceTime = current_time.QuadPart;
         }
     }
 }
 
+/**
+ * @brief Handle a reschedule interrupt sent by another processor
+ * @note The sender already queued the thread here; this only dispatches it
+ */
+VOID KeHandleRescheduleInterrupt(VOID)
+{
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[KeGetCurrentProcessorNumber()];
+
+    if (queue->ReschedulePending) {
+        KeSchedule();
+    }
+}
+
+/**
+ * @brief Mark a reschedule pending on an idle processor
+ * @param Processor Processor to wake
+ * @return TRUE if it was idle and the caller should send the interrupt
+ */
+static BOOLEAN KiClaimIdleProcessor(ULONG Processor)
+{
+    PKI_RUN_QUEUE idle = &g_Scheduler.RunQueues[Processor];
+    BOOLEAN claimed = FALSE;
+
+    if (idle->TickMode != KE_TICK_STOPPED || idle->ReschedulePending) {
+        return FALSE;
+    }
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&idle->Lock, &old_irql);
+    if (idle->TickMode == KE_TICK_STOPPED && !idle->ReschedulePending) {
+        idle->ReschedulePending = TRUE;
+        idle->Statistics.RescheduleIpis++;
+        claimed = TRUE;
+    }
+    KeReleaseSpinLock(&idle->Lock, old_irql);
+
+    return claimed;
+}
+
 /**
  * @brief Perform load balancing
+ * @note Pulls one thread onto this processor when the busiest sibling in
+ *       its domain has at least two more ready threads. Idle processors
+ *       steal from KeSchedule, and are woken to do so when threads wait here
  */
 VOID KePerformLoadBalancing(VOID)
 {
-    // This is a simplified implementation
-    // In a real implementation, this would:
-    // - Analyze CPU load distribution
-    // - Migrate threads between processors
-    // - Balance ready queue lengths
-    // - Consider thread affinity
+    PKI_RUN_QUEUE queue = &g_Scheduler.RunQueues[KeGetCurrentProcessorNumber()];
 
-    InterlockedIncrement(&g_Scheduler.Statistics.LoadBalanceOperations);
+    queue->Statistics.LoadBalanceOperations++;
+    KiStealThread(&g_KiRunQueueOperations, queue->Processor, queue->ReadyCount + 2, TRUE);
+
+    if (queue->ReadyCount >= 2 && queue->MigratableCount != 0) {
+        KiKickIdleProcessor(&g_KiRunQueueOperations, queue->Processor);
+    }
 }
 
 /**
  * @brief Get scheduler statistics
  * @param Statistics Statistics structure to fill
+ * @note Sums the per-processor counters without stopping dispatch, so the
+ *       figures are a snapshot
  */
 VOID KeGetSchedulerStatistics(PSCHEDULER_STATISTICS Statistics)
 {
@@ -532,10 +1046,55 @@ VOID KeGetSchedulerStatistics(PSCHEDULER_STATISTICS Statistics)
         return;
     }
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_Scheduler.SchedulerLock, &old_irql);
-    RtlCopyMemory(Statistics, &g_Scheduler.Statistics, sizeof(SCHEDULER_STATISTICS));
-    KeReleaseSpinLock(&g_Scheduler.SchedulerLock, old_irql);
+    RtlZeroMemory(Statistics, sizeof(SCHEDULER_STATISTICS));
+
+    for (ULONG i = 0; i < g_Scheduler.ProcessorCount; i++) {
+        PSCHEDULER_STATISTICS counters = &g_Scheduler.RunQueues[i].Statistics;
+
+        Statistics->ContextSwitches += counters->ContextSwitches;
+        Statistics->ThreadSwitches += counters->ThreadSwitches;
+        Statistics->IdleSwitches += counters->IdleSwitches;
+        Statistics->Preemptions += counters->Preemptions;
+        Statistics->LoadBalanceOperations += counters->LoadBalanceOperations;
+        Statistics->RemoteWakeups += counters->RemoteWakeups;
+        Statistics->RescheduleIpis += counters->RescheduleIpis;
+        Statistics->TotalCpuTime.QuadPart += counters->TotalCpuTime.QuadPart;
+        Statistics->IdleTime.QuadPart += counters->IdleTime.QuadPart;
+    }
+}
+
+/**
+ * @brief Get work stealing counters
+ * @param Processor Processor to report, or KE_ALL_PROCESSORS for the sum
+ * @param Statistics Receives the counters
+ * @return NTSTATUS Status code
+ * @note Read without stopping dispatch, so the figures are a snapshot
+ */
+NTSTATUS KeQueryMigrationStatistics(ULONG Processor, PKE_MIGRATION_STATISTICS Statistics)
+{
+    if (Statistics == NULL || (Processor != KE_ALL_PROCESSORS && Processor >= g_Scheduler.ProcessorCount)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlZeroMemory(Statistics, sizeof(KE_MIGRATION_STATISTICS));
+
+    for (ULONG i = 0; i < g_Scheduler.ProcessorCount; i++) {
+        if (Processor != KE_ALL_PROCESSORS && Processor != i) {
+            continue;
+        }
+
+        PKE_MIGRATION_STATISTICS counters = &g_Scheduler.RunQueues[i].Migration;
+
+        Statistics->StealAttempts += counters->StealAttempts;
+        Statistics->StealsWithoutCandidate += counters->StealsWithoutCandidate;
+        Statistics->StealFailures += counters->StealFailures;
+        Statistics->Migrations += counters->Migrations;
+        Statistics->AffinitySkips += counters->AffinitySkips;
+        Statistics->CacheHotSkips += counters->CacheHotSkips;
+        Statistics->MigrationTicks += counters->MigrationTicks;
+    }
+
+    return STATUS_SUCCESS;
 }
 
 /**
@@ -543,6 +1102,7 @@ VOID KeGetSchedulerStatistics(PSCHEDULER_STATISTICS Statistics)
  * @param TimeQuantum Time quantum in milliseconds
  * @param PreemptionEnabled Whether preemption is enabled
  * @param LoadBalancingEnabled Whether load balancing is enabled
+ * @note Each processor picks up the new quantum at its next switch
  */
 VOID KeSetSchedulerParameters(ULONG TimeQuantum, BOOLEAN PreemptionEnabled, BOOLEAN LoadBalancingEnabled)
 {
@@ -550,9 +1110,145 @@ VOID KeSetSchedulerParameters(ULONG TimeQuantum, BOOLEAN PreemptionEnabled, BOOL
     KeAcquireSpinLock(&g_Scheduler.SchedulerLock, &old_irql);
 
     g_Scheduler.TimeQuantum = TimeQuantum;
-    g_Scheduler.QuantumRemaining = TimeQuantum;
     g_Scheduler.PreemptionEnabled = PreemptionEnabled;
     g_Scheduler.LoadBalancingEnabled = LoadBalancingEnabled;
 
     KeReleaseSpinLock(&g_Scheduler.SchedulerLock, old_irql);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Measure the per-operation cost of a number of per-processor run queues
+ * @param ProcessorCount Processors to model, at most DSLOS_MAX_PROCESSORS
+ * @param ThreadsPerProcessor Ready threads each processor cycles through
+ * @param Rounds Enqueue/dispatch passes per processor
+ * @param Timing Receives operation count and elapsed ticks
+ * @return NTSTATUS Status code
+ * @note Runs every modelled processor's loop against its own scratch run
+ *       queue with the same insert and dispatch code the live queues use,
+ *       one after another on the calling processor. It shows whether the
+ *       cost of an operation depends on how many queues exist, not how the
+ *       queues behave under concurrent use. The live queues are not touched
+ */
+NTSTATUS KeMeasureRunQueueCost(ULONG ProcessorCount, ULONG ThreadsPerProcessor, ULONG Rounds,
+                               PKE_RUN_QUEUE_TIMING Timing)
+{
+    if (Timing == NULL || ProcessorCount == 0 || ProcessorCount > KI_MAX_PROCESSORS ||
+        ThreadsPerProcessor == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    SIZE_T thread_count = (SIZE_T)ProcessorCount * ThreadsPerProcessor;
+    PKI_RUN_QUEUE queues = ExAllocatePoolWithTag(NonPagedPool,
+        ProcessorCount * sizeof(KI_RUN_QUEUE), KI_BENCHMARK_TAG);
+    PTHREAD_CONTROL_BLOCK threads = ExAllocatePoolWithTag(NonPagedPool,
+        thread_count * sizeof(THREAD_CONTROL_BLOCK), KI_BENCHMARK_TAG);
+
+    if (queues == NULL || threads == NULL) {
+        if (queues != NULL) {
+            ExFreePoolWithTag(queues, KI_BENCHMARK_TAG);
+        }
+        if (threads != NULL) {
+            ExFreePoolWithTag(threads, KI_BENCHMARK_TAG);
+        }
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(threads, thread_count * sizeof(THREAD_CONTROL_BLOCK));
+    for (ULONG cpu = 0; cpu < ProcessorCount; cpu++) {
+        KiInitializeRunQueue(&queues[cpu], cpu);
+    }
+    for (SIZE_T i = 0; i < thread_count; i++) {
+        threads[i].Priority = (LONG)(i % KI_PRIORITY_LEVELS);
+        threads[i].CpuAffinity = 1ULL << (i / ThreadsPerProcessor);
+        InitializeListHead(&threads[i].ReadyListEntry);
+    }
+
+    RtlZeroMemory(Timing, sizeof(KE_RUN_QUEUE_TIMING));
+    Timing->ProcessorCount = ProcessorCount;
+
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    KeQueryPerformanceCounter(&start);
+
+    for (ULONG round = 0; round < Rounds; round++) {
+        for (ULONG cpu = 0; cpu < ProcessorCount; cpu++) {
+            PKI_RUN_QUEUE queue = &queues[cpu];
+            PTHREAD_CONTROL_BLOCK first = &threads[(SIZE_T)cpu * ThreadsPerProcessor];
+            KIRQL old_irql;
+
+            for (ULONG i = 0; i < ThreadsPerProcessor; i++) {
+                KeAcquireSpinLock(&queue->Lock, &old_irql);
+                KiInsertReadyThread(queue, &first[i]);
+                KeReleaseSpinLock(&queue->Lock, old_irql);
+            }
+
+            for (ULONG i = 0; i < ThreadsPerProcessor; i++) {
+                KeAcquireSpinLock(&queue->Lock, &old_irql);
+                if (KeFindNextThread(queue) != NULL) {
+                    Timing->Dispatches++;
+                }
+                KeReleaseSpinLock(&queue->Lock, old_irql);
+            }
+
+            Timing->Operations += 2 * ThreadsPerProcessor;
+        }
+    }
+
+    KeQueryPerformanceCounter(&end);
+    Timing->Ticks = (ULONG64)(end.QuadPart - start.QuadPart);
+
+    ExFreePoolWithTag(threads, KI_BENCHMARK_TAG);
+    ExFreePoolWithTag(queues, KI_BENCHMARK_TAG);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Measure the cost of picking the next thread
+ * @param Priority Priority of the only ready thread
+ * @param Iterations Enqueue/pick pairs to time
+ * @param Timing Receives operation count and elapsed ticks
+ * @return NTSTATUS Status code
+ * @note Uses a scratch run queue. With the ready summary bitmap the result
+ *       should not depend on Priority, i.e. on how many empty levels lie
+ *       above the thread
+ */
+NTSTATUS KeMeasureThreadPick(LONG Priority, ULONG Iterations, PKE_RUN_QUEUE_TIMING Timing)
+{
+    if (Timing == NULL || Priority < 0 || Priority >= KI_PRIORITY_LEVELS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PKI_RUN_QUEUE queue = ExAllocatePoolWithTag(NonPagedPool, sizeof(KI_RUN_QUEUE), KI_BENCHMARK_TAG);
+    if (queue == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    THREAD_CONTROL_BLOCK thread;
+    RtlZeroMemory(&thread, sizeof(THREAD_CONTROL_BLOCK));
+    thread.Priority = Priority;
+    InitializeListHead(&thread.ReadyListEntry);
+
+    KiInitializeRunQueue(queue, 0);
+    RtlZeroMemory(Timing, sizeof(KE_RUN_QUEUE_TIMING));
+    Timing->ProcessorCount = 1;
+
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    KeQueryPerformanceCounter(&start);
+
+    for (ULONG i = 0; i < Iterations; i++) {
+        KiInsertReadyThread(queue, &thread);
+        if (KeFindNextThread(queue) == &thread) {
+            Timing->Dispatches++;
+        }
+        Timing->Operations += 2;
+    }
+
+    KeQueryPerformanceCounter(&end);
+    Timing->Ticks = (ULONG64)(end.QuadPart - start.QuadPart);
+
+    ExFreePoolWithTag(queue, KI_BENCHMARK_TAG);
+
+    return STATUS_SUCCESS;
+}
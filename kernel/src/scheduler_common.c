@@ -0,0 +1,299 @@
+/**
+ * @file scheduler_common.c
+ * @brief Run queue placement, work stealing and tick helpers shared by the schedulers
+ * @author DslsOS Team
+ * @version 1.0
+ * @date 2024
+ */
+
+#include "../include/kernel.h"
+#include "../include/dslos.h"
+
+/**
+ * @brief Find the lowest set bit of a 32-bit value
+ * @param Value Value, must not be zero
+ * @return Index of the lowest set bit
+ */
+ULONG KiFindLowestSetBit(ULONG Value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, Value);
+    return (ULONG)index;
+#else
+    return (ULONG)__builtin_ctz(Value);
+#endif
+}
+
+/**
+ * @brief Find the highest set bit of a 32-bit value
+ * @param Value Value, must not be zero
+ * @return Index of the highest set bit
+ */
+ULONG KiFindHighestSetBit(ULONG Value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, Value);
+    return (ULONG)index;
+#else
+    return 31 - (ULONG)__builtin_clz(Value);
+#endif
+}
+
+/**
+ * @brief Find the lowest set bit of a 64-bit value
+ * @param Value Value, must not be zero
+ * @return Index of the lowest set bit
+ */
+ULONG KiFindFirstSet64(ULONG64 Value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, Value);
+    return (ULONG)index;
+#else
+    return (ULONG)__builtin_ctzll((unsigned long long)Value);
+#endif
+}
+
+/**
+ * @brief Check whether a processor is idle with nothing queued
+ * @param Queues Scheduler's run queue operations
+ * @param Processor Processor number
+ * @return TRUE if idle
+ * @note An idle processor is the one whose tick is stopped
+ */
+BOOLEAN KiIsProcessorIdle(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG Processor)
+{
+    return Queues->ReadyCount(Processor) == 0 && *Queues->TickMode(Processor) == KE_TICK_STOPPED;
+}
+
+/**
+ * @brief Find an idle processor, preferring one whose whole core is idle
+ * @param Queues Scheduler's run queue operations
+ * @param Candidates Processors to consider
+ * @return Processor number, or MAXULONG if none is idle
+ * @note An idle SMT thread next to a busy one shares that core's execution
+ *       units, so it is only taken when no core is idle
+ */
+ULONG KiFindIdleProcessor(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG64 Candidates)
+{
+    ULONG64 active = Queues->ActiveProcessors();
+    ULONG idle_thread = MAXULONG;
+
+    Candidates &= active;
+    while (Candidates != 0) {
+        ULONG processor = KiFindFirstSet64(Candidates);
+        Candidates &= Candidates - 1;
+
+        if (!KiIsProcessorIdle(Queues, processor)) {
+            continue;
+        }
+
+        ULONG64 siblings = Queues->DomainMask(processor, KE_DOMAIN_SMT) & active & ~(1ULL << processor);
+        while (siblings != 0 && KiIsProcessorIdle(Queues, KiFindFirstSet64(siblings))) {
+            siblings &= siblings - 1;
+        }
+        if (siblings == 0) {
+            return processor;
+        }
+        if (idle_thread == MAXULONG) {
+            idle_thread = processor;
+        }
+    }
+
+    return idle_thread;
+}
+
+/**
+ * @brief Lock the run queue a ready thread sits on
+ * @param Queues Scheduler's run queue operations
+ * @param Thread Thread to look up
+ * @param OldIrql Receives the IRQL to restore
+ * @return Processor whose queue is locked, or MAXULONG if the thread is not queued
+ * @note The thread may move between looking up its queue and taking the
+ *       lock, so the queue is checked again once it is held
+ */
+ULONG KiLockThreadQueue(PKI_RUN_QUEUE_OPERATIONS Queues, PVOID Thread, PKIRQL OldIrql)
+{
+    for (;;) {
+        ULONG processor = Queues->ThreadQueue(Thread);
+        if (processor == MAXULONG) {
+            return MAXULONG;
+        }
+
+        PKSPIN_LOCK lock = Queues->Lock(processor);
+        KeAcquireSpinLock(lock, OldIrql);
+
+        if (Queues->ThreadQueue(Thread) == processor) {
+            return processor;
+        }
+
+        KeReleaseSpinLock(lock, *OldIrql);
+    }
+}
+
+/**
+ * @brief Pull a ready thread from the busiest queue in a processor's domain
+ * @param Queues Scheduler's run queue operations
+ * @param Thief Current processor, whose queue is not locked by the caller
+ * @param MinimumReady Ready threads a victim must hold to be considered
+ * @param Enqueue TRUE to queue the thread on the thief, FALSE to hand it back to run now
+ * @return Stolen thread, or NULL
+ * @note Victims are chosen from unlocked ready and migratable counts, so no
+ *       victim lock is taken unless a queue advertises a thread that may
+ *       move. The search widens one topology level at a time: SMT sibling,
+ *       last-level cache, package, then the whole steal domain. Queue locks
+ *       are taken in processor order, and the scheduler's TakeThread picks
+ *       the thread under them
+ */
+PVOID KiStealThread(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG Thief, ULONG MinimumReady, BOOLEAN Enqueue)
+{
+    PKE_MIGRATION_STATISTICS counters = Queues->Migration(Thief);
+    ULONG64 active = Queues->ActiveProcessors();
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    KeQueryPerformanceCounter(&start);
+    counters->StealAttempts++;
+
+    // Find the busiest sibling with something that may migrate, without
+    // locks, in the nearest domain that has one
+    ULONG victim = MAXULONG;
+    ULONG victim_ready = 0;
+    ULONG64 searched = 1ULL << Thief;
+
+    for (ULONG level = 0; level <= KE_DOMAIN_COUNT && victim == MAXULONG; level++) {
+        ULONG64 domain = Queues->DomainMask(Thief, KE_DOMAIN_COUNT) & active & ~searched;
+        if (level < KE_DOMAIN_COUNT) {
+            domain &= Queues->DomainMask(Thief, level);
+        }
+        searched |= domain;
+
+        while (domain != 0) {
+            ULONG processor = KiFindFirstSet64(domain);
+            ULONG ready = Queues->ReadyCount(processor);
+
+            domain &= domain - 1;
+            if (Queues->MigratableCount(processor) != 0 && ready >= MinimumReady && ready > victim_ready) {
+                victim = processor;
+                victim_ready = ready;
+            }
+        }
+    }
+
+    if (victim == MAXULONG) {
+        counters->StealsWithoutCandidate++;
+        KeQueryPerformanceCounter(&end);
+        counters->MigrationTicks += (ULONG64)(end.QuadPart - start.QuadPart);
+        return NULL;
+    }
+
+    PKSPIN_LOCK thief_lock = Queues->Lock(Thief);
+    PKSPIN_LOCK victim_lock = Queues->Lock(victim);
+    KIRQL victim_irql;
+    KIRQL thief_irql;
+
+    if (Enqueue && Thief < victim) {
+        KeAcquireSpinLock(thief_lock, &thief_irql);
+    }
+    KeAcquireSpinLock(victim_lock, &victim_irql);
+    if (Enqueue && Thief > victim) {
+        KeAcquireSpinLock(thief_lock, &thief_irql);
+    }
+
+    PVOID stolen = Queues->TakeThread(victim, Thief, Enqueue);
+    if (stolen != NULL) {
+        counters->Migrations++;
+    } else {
+        counters->StealFailures++;
+    }
+
+    if (Enqueue) {
+        KeReleaseSpinLock(thief_lock, thief_irql);
+    }
+    KeReleaseSpinLock(victim_lock, victim_irql);
+
+    KeQueryPerformanceCounter(&end);
+    counters->MigrationTicks += (ULONG64)(end.QuadPart - start.QuadPart);
+
+    return stolen;
+}
+
+/**
+ * @brief Wake an idle processor in this one's domain to steal from it
+ * @param Queues Scheduler's run queue operations
+ * @param Processor Current processor, with threads waiting
+ * @note An idle processor has no tick, so it would not balance by itself.
+ *       The nearest one by topology is woken, as it steals from here first
+ */
+VOID KiKickIdleProcessor(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG Processor)
+{
+    ULONG64 active = Queues->ActiveProcessors();
+    ULONG64 searched = 1ULL << Processor;
+
+    for (ULONG level = 0; level <= KE_DOMAIN_COUNT; level++) {
+        ULONG64 candidates = Queues->DomainMask(Processor, KE_DOMAIN_COUNT) & active & ~searched;
+        if (level < KE_DOMAIN_COUNT) {
+            candidates &= Queues->DomainMask(Processor, level);
+        }
+        searched |= candidates;
+
+        while (candidates != 0) {
+            ULONG idle = KiFindFirstSet64(candidates);
+            candidates &= candidates - 1;
+
+            if (Queues->ClaimIdleProcessor(idle)) {
+                HalSendInterProcessorInterrupt(idle, HAL_RESCHEDULE_VECTOR);
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Restore the periodic tick on a processor that has queued work
+ * @param TickMode Tick mode of the processor's run queue, locked by the caller
+ * @param Processor Processor number
+ * @note A stopped or reduced tick would leave the new thread waiting
+ *       until the running one blocks
+ */
+VOID KiRestorePeriodicTick(KE_TICK_MODE* TickMode, ULONG Processor)
+{
+    if (*TickMode != KE_TICK_PERIODIC) {
+        *TickMode = KE_TICK_PERIODIC;
+        KeSetProcessorTickMode(Processor, KE_TICK_PERIODIC);
+    }
+}
+
+/**
+ * @brief Switch a processor's tick to the mode its scheduler chose
+ * @param Queues Scheduler's run queue operations
+ * @param Processor Current processor, whose queue is not locked by the caller
+ * @param Mode Mode for what it is about to run
+ * @note A thread queued meanwhile needs the periodic tick, so the choice is
+ *       checked again under the queue lock before the tick changes
+ */
+VOID KiUpdateTickMode(PKI_RUN_QUEUE_OPERATIONS Queues, ULONG Processor, KE_TICK_MODE Mode)
+{
+    KE_TICK_MODE* tick_mode = Queues->TickMode(Processor);
+
+    if (Mode == *tick_mode) {
+        return;
+    }
+
+    PKSPIN_LOCK lock = Queues->Lock(Processor);
+    KIRQL old_irql;
+    KeAcquireSpinLock(lock, &old_irql);
+
+    if (Queues->ReadyCount(Processor) != 0) {
+        Mode = KE_TICK_PERIODIC;
+    }
+    if (Mode != *tick_mode) {
+        *tick_mode = Mode;
+        KeSetProcessorTickMode(Processor, Mode);
+    }
+
+    KeReleaseSpinLock(lock, old_irql);
+}
@@ -216,6 +216,7 @@ static LIST_ENTRY g_RoleList;
 static LIST_ENTRY g_AuditLog;
 static KSPIN_LOCK g_RoleListLock;
 static KSPIN_LOCK g_AuditLogLock;
+static PMM_OBJECT_CACHE g_AuditLogEntryCache;
 static ULONG g_NextRoleId = 1;
 
 // Security capabilities
@@ -382,7 +383,9 @@ KiInitializeSecurityMonitoring(VOID)
     InitializeListHead(&g_SecurityMonitor.AlertList);
     InitializeListHead(&g_SecurityMonitor.ViolationList);
 
-    return STATUS_SUCCESS;
+    // Audit log entries are allocated on every security event
+    return MmCreateObjectCache("AuditLogEntry", sizeof(AUDIT_LOG_ENTRY), 0, NULL, NULL,
+                               &g_AuditLogEntryCache);
 }
 
 /**
@@ -874,8 +877,7 @@ KiLogSecurityEvent(
     _In_ ULONG DataSize
 )
 {
-    PAUDIT_LOG_ENTRY entry = ExAllocatePoolWithTag(NonPagedPool,
-        sizeof(AUDIT_LOG_ENTRY), 'AldS');
+    PAUDIT_LOG_ENTRY entry = MmAllocateObject(g_AuditLogEntryCache);
 
     if (!entry) {
         return;
@@ -0,0 +1,830 @@
+/**
+ * @file slab_allocator.c
+ * @brief Slab allocator with per-CPU magazines for fixed-size kernel objects
+ * @author DslsOS Team
+ * @version 1.0
+ * @date 2024
+ */
+
+#include "../include/kernel.h"
+#include "../include/dslos.h"
+#include <string.h>
+
+// Slab sizing
+#define MM_SLAB_MIN_OBJECTS        8     // Grow the slab until this many objects fit
+#define MM_SLAB_MAX_PAGES          8     // Largest slab (order 3)
+#define MM_SLAB_MAX_EMPTY          1     // Empty slabs kept per cache before returning pages
+
+// Magazine sizing
+#define MM_MAGAZINE_SIZE           16    // Objects per magazine
+
+// Object magazine (Bonwick-style per-CPU object stack)
+typedef struct _MM_MAGAZINE {
+    LIST_ENTRY DepotListEntry;
+    ULONG Rounds;
+    PVOID Objects[MM_MAGAZINE_SIZE];
+} MM_MAGAZINE, *PMM_MAGAZINE;
+
+// Per-CPU cache state
+typedef struct _MM_CACHE_CPU {
+    PMM_MAGAZINE Loaded;           // May be partially filled
+    PMM_MAGAZINE Previous;         // Always completely full or completely empty
+    ULONG64 AllocationCount;
+    ULONG64 FreeCount;
+    ULONG64 MagazineHits;
+    ULONG64 MagazineMisses;
+} MM_CACHE_CPU, *PMM_CACHE_CPU;
+
+// Slab header, stored at the start of the slab pages
+typedef struct _MM_SLAB {
+    LIST_ENTRY SlabListEntry;
+    PMM_OBJECT_CACHE Cache;
+    PVOID FreeList;
+    ULONG InUse;
+} MM_SLAB, *PMM_SLAB;
+
+// Object cache
+struct _MM_OBJECT_CACHE {
+    CHAR Name[32];
+    SIZE_T ObjectSize;
+    SIZE_T BufferSize;
+    SIZE_T FreeLinkOffset;
+    SIZE_T FirstObjectOffset;
+    SIZE_T SlabSize;
+    ULONG ObjectsPerSlab;
+    MM_OBJECT_CONSTRUCTOR Constructor;
+    MM_OBJECT_DESTRUCTOR Destructor;
+
+    // Slab layer
+    KSPIN_LOCK CacheLock;
+    LIST_ENTRY FullSlabListHead;
+    LIST_ENTRY PartialSlabListHead;
+    LIST_ENTRY EmptySlabListHead;
+    ULONG SlabCount;
+    ULONG EmptySlabCount;
+    ULONG SlabAllocatedObjects;    // Objects taken out of slabs (callers + magazines)
+    ULONG64 SlabsCreated;
+    ULONG64 SlabsDestroyed;
+    volatile LONG ReapingSlabs;    // Slabs taken off the cache by a reaper and not yet destroyed
+
+    // Magazine depot
+    LIST_ENTRY FullMagazineListHead;
+    LIST_ENTRY EmptyMagazineListHead;
+    ULONG FullMagazineCount;
+    ULONG EmptyMagazineCount;
+
+    // Per-CPU layer
+    MM_CACHE_CPU CpuCaches[DSLOS_MAX_PROCESSORS];
+
+    LIST_ENTRY CacheListEntry;
+};
+
+// Object cache manager state
+typedef struct _OBJECT_CACHE_MANAGER_STATE {
+    BOOLEAN Initialized;
+    KSPIN_LOCK CacheListLock;
+    LIST_ENTRY CacheListHead;
+    ULONG CacheCount;
+} OBJECT_CACHE_MANAGER_STATE;
+
+static OBJECT_CACHE_MANAGER_STATE g_ObjectCacheManager = {0};
+
+/**
+ * @brief Initialize object cache manager
+ * @return NTSTATUS Status code
+ */
+NTSTATUS MmInitializeObjectCaches(VOID)
+{
+    if (g_ObjectCacheManager.Initialized) {
+        return STATUS_SUCCESS;
+    }
+
+    KeInitializeSpinLock(&g_ObjectCacheManager.CacheListLock);
+    InitializeListHead(&g_ObjectCacheManager.CacheListHead);
+    g_ObjectCacheManager.CacheCount = 0;
+
+    g_ObjectCacheManager.Initialized = TRUE;
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Create an object cache
+ * @param Name Cache name
+ * @param ObjectSize Size of each object
+ * @param Alignment Object alignment (0 for pointer alignment)
+ * @param Constructor Called once when an object is carved from a new slab (optional)
+ * @param Destructor Called once when a slab is returned to the page allocator (optional)
+ * @param Cache Pointer to receive the cache
+ * @return NTSTATUS Status code
+ * @note Freed objects are cached in their constructed state
+ */
+NTSTATUS MmCreateObjectCache(PCSTR Name, SIZE_T ObjectSize, SIZE_T Alignment,
+                             MM_OBJECT_CONSTRUCTOR Constructor, MM_OBJECT_DESTRUCTOR Destructor,
+                             PMM_OBJECT_CACHE* Cache)
+{
+    if (Name == NULL || ObjectSize == 0 || Cache == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Alignment == 0) {
+        Alignment = sizeof(PVOID);
+    }
+
+    if ((Alignment & (Alignment - 1)) != 0 || Alignment > DSLOS_PAGE_SIZE) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PMM_OBJECT_CACHE cache = ExAllocatePoolWithTag(NonPagedPool, sizeof(MM_OBJECT_CACHE), 'CldM');
+    if (cache == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(cache, sizeof(MM_OBJECT_CACHE));
+
+    strncpy(cache->Name, Name, sizeof(cache->Name) - 1);
+    cache->ObjectSize = ObjectSize;
+    cache->Constructor = Constructor;
+    cache->Destructor = Destructor;
+
+    // The free link lives after the object so constructed state is preserved
+    cache->FreeLinkOffset = DSLOS_ALIGN(ObjectSize, sizeof(PVOID));
+    cache->BufferSize = DSLOS_ALIGN(cache->FreeLinkOffset + sizeof(PVOID), Alignment);
+    cache->FirstObjectOffset = DSLOS_ALIGN(sizeof(MM_SLAB), Alignment);
+
+    // Grow the slab until enough objects fit
+    cache->SlabSize = DSLOS_PAGE_SIZE;
+    while (cache->SlabSize < MM_SLAB_MAX_PAGES * DSLOS_PAGE_SIZE &&
+           (cache->SlabSize - cache->FirstObjectOffset) / cache->BufferSize < MM_SLAB_MIN_OBJECTS) {
+        cache->SlabSize *= 2;
+    }
+
+    cache->ObjectsPerSlab = (ULONG)((cache->SlabSize - cache->FirstObjectOffset) / cache->BufferSize);
+    if (cache->ObjectsPerSlab == 0) {
+        ExFreePoolWithTag(cache, 'CldM');
+        return STATUS_INVALID_PARAMETER; // Object too large for a slab
+    }
+
+    KeInitializeSpinLock(&cache->CacheLock);
+    InitializeListHead(&cache->FullSlabListHead);
+    InitializeListHead(&cache->PartialSlabListHead);
+    InitializeListHead(&cache->EmptySlabListHead);
+    InitializeListHead(&cache->FullMagazineListHead);
+    InitializeListHead(&cache->EmptyMagazineListHead);
+
+    // Add to global cache list
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_ObjectCacheManager.CacheListLock, &old_irql);
+    InsertTailList(&g_ObjectCacheManager.CacheListHead, &cache->CacheListEntry);
+    g_ObjectCacheManager.CacheCount++;
+    KeReleaseSpinLock(&g_ObjectCacheManager.CacheListLock, old_irql);
+
+    *Cache = cache;
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Get the free link slot of an object
+ * @param Cache Object cache
+ * @param Object Object
+ * @return Pointer to the free link
+ */
+static PVOID* MmObjectFreeLink(PMM_OBJECT_CACHE Cache, PVOID Object)
+{
+    return (PVOID*)((PUCHAR)Object + Cache->FreeLinkOffset);
+}
+
+/**
+ * @brief Find the slab that owns an object
+ * @param Cache Object cache
+ * @param Object Object
+ * @return Owning slab
+ * @note Slabs are naturally aligned buddy blocks, so masking finds the header
+ */
+static PMM_SLAB MmSlabFromObject(PMM_OBJECT_CACHE Cache, PVOID Object)
+{
+    return (PMM_SLAB)((ULONG_PTR)Object & ~(ULONG_PTR)(Cache->SlabSize - 1));
+}
+
+/**
+ * @brief Grow a cache by one slab
+ * @param Cache Object cache
+ * @return New slab or NULL
+ * @note Called without CacheLock held; constructors run here
+ */
+static PMM_SLAB MmCreateSlab(PMM_OBJECT_CACHE Cache)
+{
+    PVOID pages = MmAllocatePhysicalMemory(Cache->SlabSize);
+    if (pages == NULL) {
+        return NULL;
+    }
+
+    PMM_SLAB slab = MmPhysicalToVirtual((ULONG_PTR)pages);
+
+    slab->Cache = Cache;
+    slab->FreeList = NULL;
+    slab->InUse = 0;
+    InitializeListHead(&slab->SlabListEntry);
+
+    // Construct objects and thread them onto the free list in address order
+    PUCHAR base = (PUCHAR)slab + Cache->FirstObjectOffset;
+    for (LONG i = (LONG)Cache->ObjectsPerSlab - 1; i >= 0; i--) {
+        PVOID object = base + (SIZE_T)i * Cache->BufferSize;
+        if (Cache->Constructor != NULL) {
+            Cache->Constructor(object, Cache->ObjectSize);
+        }
+        *MmObjectFreeLink(Cache, object) = slab->FreeList;
+        slab->FreeList = object;
+    }
+
+    return slab;
+}
+
+/**
+ * @brief Return a slab to the page allocator
+ * @param Cache Object cache
+ * @param Slab Slab to destroy
+ * @note Called without CacheLock held; destructors run here
+ */
+static VOID MmDestroySlab(PMM_OBJECT_CACHE Cache, PMM_SLAB Slab)
+{
+    if (Cache->Destructor != NULL) {
+        PUCHAR base = (PUCHAR)Slab + Cache->FirstObjectOffset;
+        for (ULONG i = 0; i < Cache->ObjectsPerSlab; i++) {
+            Cache->Destructor(base + (SIZE_T)i * Cache->BufferSize, Cache->ObjectSize);
+        }
+    }
+
+    MmFreePhysicalMemory((PVOID)MmVirtualToPhysical(Slab), Cache->SlabSize);
+}
+
+/**
+ * @brief Take an object from the slab layer
+ * @param Cache Object cache
+ * @return Object or NULL if no slab has a free object
+ * @note Caller must hold CacheLock
+ */
+static PVOID MmSlabAllocateLocked(PMM_OBJECT_CACHE Cache)
+{
+    PMM_SLAB slab;
+
+    if (!IsListEmpty(&Cache->PartialSlabListHead)) {
+        slab = CONTAINING_RECORD(Cache->PartialSlabListHead.Flink, MM_SLAB, SlabListEntry);
+    } else if (!IsListEmpty(&Cache->EmptySlabListHead)) {
+        slab = CONTAINING_RECORD(Cache->EmptySlabListHead.Flink, MM_SLAB, SlabListEntry);
+        RemoveEntryList(&slab->SlabListEntry);
+        InsertHeadList(&Cache->PartialSlabListHead, &slab->SlabListEntry);
+        Cache->EmptySlabCount--;
+    } else {
+        return NULL;
+    }
+
+    PVOID object = slab->FreeList;
+    slab->FreeList = *MmObjectFreeLink(Cache, object);
+    slab->InUse++;
+    Cache->SlabAllocatedObjects++;
+
+    if (slab->InUse == Cache->ObjectsPerSlab) {
+        RemoveEntryList(&slab->SlabListEntry);
+        InsertTailList(&Cache->FullSlabListHead, &slab->SlabListEntry);
+    }
+
+    return object;
+}
+
+/**
+ * @brief Return an object to its slab
+ * @param Cache Object cache
+ * @param Object Object to return
+ * @return Slab that became surplus and must be destroyed by the caller, or NULL
+ * @note Caller must hold CacheLock
+ */
+static PMM_SLAB MmSlabFreeLocked(PMM_OBJECT_CACHE Cache, PVOID Object)
+{
+    PMM_SLAB slab = MmSlabFromObject(Cache, Object);
+
+    if (slab->InUse == Cache->ObjectsPerSlab) {
+        RemoveEntryList(&slab->SlabListEntry);
+        InsertHeadList(&Cache->PartialSlabListHead, &slab->SlabListEntry);
+    }
+
+    *MmObjectFreeLink(Cache, Object) = slab->FreeList;
+    slab->FreeList = Object;
+    slab->InUse--;
+    Cache->SlabAllocatedObjects--;
+
+    if (slab->InUse > 0) {
+        return NULL;
+    }
+
+    RemoveEntryList(&slab->SlabListEntry);
+
+    if (Cache->EmptySlabCount >= MM_SLAB_MAX_EMPTY) {
+        Cache->SlabCount--;
+        Cache->SlabsDestroyed++;
+        return slab;
+    }
+
+    InsertHeadList(&Cache->EmptySlabListHead, &slab->SlabListEntry);
+    Cache->EmptySlabCount++;
+    return NULL;
+}
+
+/**
+ * @brief Allocate an object from the slab layer, growing the cache if needed
+ * @param Cache Object cache
+ * @return Object or NULL
+ */
+static PVOID MmSlabAllocate(PMM_OBJECT_CACHE Cache)
+{
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+    PVOID object = MmSlabAllocateLocked(Cache);
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+
+    if (object != NULL) {
+        return object;
+    }
+
+    PMM_SLAB slab = MmCreateSlab(Cache);
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+    InsertHeadList(&Cache->EmptySlabListHead, &slab->SlabListEntry);
+    Cache->EmptySlabCount++;
+    Cache->SlabCount++;
+    Cache->SlabsCreated++;
+    object = MmSlabAllocateLocked(Cache);
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+
+    return object;
+}
+
+/**
+ * @brief Return an object to the slab layer
+ * @param Cache Object cache
+ * @param Object Object to return
+ */
+static VOID MmSlabFree(PMM_OBJECT_CACHE Cache, PVOID Object)
+{
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+    PMM_SLAB surplus = MmSlabFreeLocked(Cache, Object);
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+
+    if (surplus != NULL) {
+        MmDestroySlab(Cache, surplus);
+    }
+}
+
+/**
+ * @brief Get the current processor's cache state
+ * @param Cache Object cache
+ * @return Per-CPU cache state
+ * @note Caller must be at DISPATCH_LEVEL so the processor cannot change
+ */
+static PMM_CACHE_CPU MmGetCurrentCpuCache(PMM_OBJECT_CACHE Cache)
+{
+    ULONG cpu = KeGetCurrentProcessorNumber();
+    if (cpu >= DSLOS_MAX_PROCESSORS) {
+        cpu = 0;
+    }
+    return &Cache->CpuCaches[cpu];
+}
+
+/**
+ * @brief Allocate from the per-CPU magazines, refilling from the depot
+ * @param Cache Object cache
+ * @param CpuCache Per-CPU cache state
+ * @return Object or NULL if the magazine layer is empty
+ */
+static PVOID MmMagazineAllocate(PMM_OBJECT_CACHE Cache, PMM_CACHE_CPU CpuCache)
+{
+    if (CpuCache->Loaded != NULL && CpuCache->Loaded->Rounds > 0) {
+        return CpuCache->Loaded->Objects[--CpuCache->Loaded->Rounds];
+    }
+
+    if (CpuCache->Previous != NULL && CpuCache->Previous->Rounds > 0) {
+        PMM_MAGAZINE magazine = CpuCache->Loaded;
+        CpuCache->Loaded = CpuCache->Previous;
+        CpuCache->Previous = magazine;
+        return CpuCache->Loaded->Objects[--CpuCache->Loaded->Rounds];
+    }
+
+    // Exchange the empty previous magazine for a full one from the depot
+    PVOID object = NULL;
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+
+    if (Cache->FullMagazineCount > 0) {
+        PMM_MAGAZINE full = CONTAINING_RECORD(RemoveHeadList(&Cache->FullMagazineListHead),
+                                              MM_MAGAZINE, DepotListEntry);
+        Cache->FullMagazineCount--;
+
+        if (CpuCache->Previous != NULL) {
+            InsertHeadList(&Cache->EmptyMagazineListHead, &CpuCache->Previous->DepotListEntry);
+            Cache->EmptyMagazineCount++;
+        }
+
+        CpuCache->Previous = CpuCache->Loaded;
+        CpuCache->Loaded = full;
+        object = full->Objects[--full->Rounds];
+    }
+
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+    return object;
+}
+
+/**
+ * @brief Free into the per-CPU magazines, exchanging with the depot
+ * @param Cache Object cache
+ * @param CpuCache Per-CPU cache state
+ * @param Object Object to free
+ * @return TRUE if the magazine layer took the object
+ */
+static BOOLEAN MmMagazineFree(PMM_OBJECT_CACHE Cache, PMM_CACHE_CPU CpuCache, PVOID Object)
+{
+    if (CpuCache->Loaded != NULL && CpuCache->Loaded->Rounds < MM_MAGAZINE_SIZE) {
+        CpuCache->Loaded->Objects[CpuCache->Loaded->Rounds++] = Object;
+        return TRUE;
+    }
+
+    if (CpuCache->Previous != NULL && CpuCache->Previous->Rounds == 0) {
+        PMM_MAGAZINE magazine = CpuCache->Loaded;
+        CpuCache->Loaded = CpuCache->Previous;
+        CpuCache->Previous = magazine;
+        CpuCache->Loaded->Objects[CpuCache->Loaded->Rounds++] = Object;
+        return TRUE;
+    }
+
+    // Get an empty magazine from the depot or the pool
+    PMM_MAGAZINE empty = NULL;
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+    if (Cache->EmptyMagazineCount > 0) {
+        empty = CONTAINING_RECORD(RemoveHeadList(&Cache->EmptyMagazineListHead),
+                                  MM_MAGAZINE, DepotListEntry);
+        Cache->EmptyMagazineCount--;
+    }
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+
+    if (empty == NULL) {
+        empty = ExAllocatePoolWithTag(NonPagedPool, sizeof(MM_MAGAZINE), 'GldM');
+        if (empty == NULL) {
+            return FALSE;
+        }
+        empty->Rounds = 0;
+        InitializeListHead(&empty->DepotListEntry);
+    }
+
+    // Retire the full previous magazine to the depot
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+    if (CpuCache->Previous != NULL) {
+        InsertHeadList(&Cache->FullMagazineListHead, &CpuCache->Previous->DepotListEntry);
+        Cache->FullMagazineCount++;
+    }
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+
+    CpuCache->Previous = CpuCache->Loaded;
+    CpuCache->Loaded = empty;
+    empty->Objects[empty->Rounds++] = Object;
+    return TRUE;
+}
+
+/**
+ * @brief Allocate an object from a cache
+ * @param Cache Object cache
+ * @return Constructed object or NULL
+ */
+PVOID MmAllocateObject(PMM_OBJECT_CACHE Cache)
+{
+    if (Cache == NULL) {
+        return NULL;
+    }
+
+    KIRQL old_irql;
+    KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+    PMM_CACHE_CPU cpu_cache = MmGetCurrentCpuCache(Cache);
+    PVOID object = MmMagazineAllocate(Cache, cpu_cache);
+
+    if (object != NULL) {
+        cpu_cache->MagazineHits++;
+        cpu_cache->AllocationCount++;
+        KeLowerIrql(old_irql);
+        return object;
+    }
+
+    cpu_cache->MagazineMisses++;
+    KeLowerIrql(old_irql);
+
+    object = MmSlabAllocate(Cache);
+    if (object != NULL) {
+        KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+        MmGetCurrentCpuCache(Cache)->AllocationCount++;
+        KeLowerIrql(old_irql);
+    }
+
+    return object;
+}
+
+/**
+ * @brief Free an object back to its cache
+ * @param Cache Object cache
+ * @param Object Object to free; must be returned in its constructed state
+ */
+VOID MmFreeObject(PMM_OBJECT_CACHE Cache, PVOID Object)
+{
+    if (Cache == NULL || Object == NULL) {
+        return;
+    }
+
+    KIRQL old_irql;
+    KeRaiseIrql(DISPATCH_LEVEL, &old_irql);
+
+    PMM_CACHE_CPU cpu_cache = MmGetCurrentCpuCache(Cache);
+    cpu_cache->FreeCount++;
+    BOOLEAN cached = MmMagazineFree(Cache, cpu_cache, Object);
+
+    KeLowerIrql(old_irql);
+
+    if (!cached) {
+        MmSlabFree(Cache, Object);
+    }
+}
+
+/**
+ * @brief Flush a magazine's objects back to the slab layer
+ * @param Cache Object cache
+ * @param Magazine Magazine to flush
+ * @param SurplusListHead List receiving slabs that must be destroyed
+ * @return Number of slabs added to the list
+ * @note Caller must hold CacheLock
+ */
+static ULONG MmFlushMagazineLocked(PMM_OBJECT_CACHE Cache, PMM_MAGAZINE Magazine,
+                                   PLIST_ENTRY SurplusListHead)
+{
+    ULONG surplus_count = 0;
+
+    while (Magazine->Rounds > 0) {
+        PMM_SLAB surplus = MmSlabFreeLocked(Cache, Magazine->Objects[--Magazine->Rounds]);
+        if (surplus != NULL) {
+            InsertTailList(SurplusListHead, &surplus->SlabListEntry);
+            surplus_count++;
+        }
+    }
+
+    return surplus_count;
+}
+
+/**
+ * @brief Take depot magazines and empty slabs off a cache
+ * @param Cache Object cache
+ * @param SurplusListHead List receiving slabs that must be destroyed
+ * @param MagazineListHead List receiving magazines that must be freed
+ * @note The slabs are counted in ReapingSlabs until MmReleaseCacheSurplus
+ *       destroys them, so the cache outlives them
+ */
+static VOID MmCollectCacheSurplus(PMM_OBJECT_CACHE Cache, PLIST_ENTRY SurplusListHead,
+                                  PLIST_ENTRY MagazineListHead)
+{
+    ULONG surplus_count = 0;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+
+    while (!IsListEmpty(&Cache->FullMagazineListHead)) {
+        PMM_MAGAZINE magazine = CONTAINING_RECORD(RemoveHeadList(&Cache->FullMagazineListHead),
+                                                  MM_MAGAZINE, DepotListEntry);
+        surplus_count += MmFlushMagazineLocked(Cache, magazine, SurplusListHead);
+        InsertTailList(MagazineListHead, &magazine->DepotListEntry);
+    }
+    Cache->FullMagazineCount = 0;
+
+    while (!IsListEmpty(&Cache->EmptyMagazineListHead)) {
+        InsertTailList(MagazineListHead, RemoveHeadList(&Cache->EmptyMagazineListHead));
+    }
+    Cache->EmptyMagazineCount = 0;
+
+    while (!IsListEmpty(&Cache->EmptySlabListHead)) {
+        InsertTailList(SurplusListHead, RemoveHeadList(&Cache->EmptySlabListHead));
+        Cache->SlabCount--;
+        Cache->SlabsDestroyed++;
+        surplus_count++;
+    }
+    Cache->EmptySlabCount = 0;
+
+    InterlockedExchangeAdd(&Cache->ReapingSlabs, (LONG)surplus_count);
+
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+}
+
+/**
+ * @brief Free magazines and destroy slabs taken by MmCollectCacheSurplus
+ * @param SurplusListHead Slabs to destroy, of any cache
+ * @param MagazineListHead Magazines to free
+ * @note Called without any cache lock held; destructors run here
+ */
+static VOID MmReleaseCacheSurplus(PLIST_ENTRY SurplusListHead, PLIST_ENTRY MagazineListHead)
+{
+    while (!IsListEmpty(MagazineListHead)) {
+        ExFreePoolWithTag(CONTAINING_RECORD(RemoveHeadList(MagazineListHead), MM_MAGAZINE, DepotListEntry),
+                          'GldM');
+    }
+
+    while (!IsListEmpty(SurplusListHead)) {
+        PMM_SLAB slab = CONTAINING_RECORD(RemoveHeadList(SurplusListHead), MM_SLAB, SlabListEntry);
+        PMM_OBJECT_CACHE cache = slab->Cache;
+
+        MmDestroySlab(cache, slab);
+        InterlockedDecrement(&cache->ReapingSlabs);
+    }
+}
+
+/**
+ * @brief Return depot magazines and empty slabs of one cache to the system
+ * @param Cache Object cache
+ */
+static VOID MmReapObjectCache(PMM_OBJECT_CACHE Cache)
+{
+    LIST_ENTRY surplus_list;
+    LIST_ENTRY magazine_list;
+    InitializeListHead(&surplus_list);
+    InitializeListHead(&magazine_list);
+
+    MmCollectCacheSurplus(Cache, &surplus_list, &magazine_list);
+    MmReleaseCacheSurplus(&surplus_list, &magazine_list);
+}
+
+/**
+ * @brief Return cached but unused memory of every object cache to the system
+ * @note Victims are collected under CacheListLock and freed after it is
+ *       released, so destructors and the page allocator run without it
+ */
+VOID MmReapObjectCaches(VOID)
+{
+    LIST_ENTRY surplus_list;
+    LIST_ENTRY magazine_list;
+    InitializeListHead(&surplus_list);
+    InitializeListHead(&magazine_list);
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_ObjectCacheManager.CacheListLock, &old_irql);
+
+    for (PLIST_ENTRY entry = g_ObjectCacheManager.CacheListHead.Flink;
+         entry != &g_ObjectCacheManager.CacheListHead;
+         entry = entry->Flink) {
+        MmCollectCacheSurplus(CONTAINING_RECORD(entry, MM_OBJECT_CACHE, CacheListEntry),
+                              &surplus_list, &magazine_list);
+    }
+
+    KeReleaseSpinLock(&g_ObjectCacheManager.CacheListLock, old_irql);
+
+    MmReleaseCacheSurplus(&surplus_list, &magazine_list);
+}
+
+/**
+ * @brief Destroy an object cache
+ * @param Cache Object cache
+ * @note All objects must have been freed and no CPU may still use the cache
+ */
+VOID MmDestroyObjectCache(PMM_OBJECT_CACHE Cache)
+{
+    if (Cache == NULL) {
+        return;
+    }
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_ObjectCacheManager.CacheListLock, &old_irql);
+    RemoveEntryList(&Cache->CacheListEntry);
+    g_ObjectCacheManager.CacheCount--;
+    KeReleaseSpinLock(&g_ObjectCacheManager.CacheListLock, old_irql);
+
+    // Move every per-CPU magazine to the depot so the reaper flushes it
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+    for (ULONG cpu = 0; cpu < DSLOS_MAX_PROCESSORS; cpu++) {
+        PMM_CACHE_CPU cpu_cache = &Cache->CpuCaches[cpu];
+        PMM_MAGAZINE magazines[2] = { cpu_cache->Loaded, cpu_cache->Previous };
+
+        for (ULONG i = 0; i < 2; i++) {
+            if (magazines[i] == NULL) {
+                continue;
+            }
+            if (magazines[i]->Rounds > 0) {
+                InsertTailList(&Cache->FullMagazineListHead, &magazines[i]->DepotListEntry);
+                Cache->FullMagazineCount++;
+            } else {
+                InsertTailList(&Cache->EmptyMagazineListHead, &magazines[i]->DepotListEntry);
+                Cache->EmptyMagazineCount++;
+            }
+        }
+
+        cpu_cache->Loaded = NULL;
+        cpu_cache->Previous = NULL;
+    }
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+
+    MmReapObjectCache(Cache);
+
+    // Anything left is a leaked object; give the pages back regardless
+    while (!IsListEmpty(&Cache->PartialSlabListHead)) {
+        MmDestroySlab(Cache, CONTAINING_RECORD(RemoveHeadList(&Cache->PartialSlabListHead),
+                                               MM_SLAB, SlabListEntry));
+    }
+    while (!IsListEmpty(&Cache->FullSlabListHead)) {
+        MmDestroySlab(Cache, CONTAINING_RECORD(RemoveHeadList(&Cache->FullSlabListHead),
+                                               MM_SLAB, SlabListEntry));
+    }
+
+    // A concurrent MmReapObjectCaches may still be destroying slabs it took
+    while (Cache->ReapingSlabs != 0) {
+        KeYieldProcessor();
+    }
+
+    ExFreePoolWithTag(Cache, 'CldM');
+}
+
+/**
+ * @brief Get object cache statistics
+ * @param Cache Object cache
+ * @param Statistics Statistics structure to fill
+ * @return NTSTATUS Status code
+ */
+NTSTATUS MmGetObjectCacheStatistics(PMM_OBJECT_CACHE Cache, PMM_OBJECT_CACHE_STATISTICS Statistics)
+{
+    if (Cache == NULL || Statistics == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlZeroMemory(Statistics, sizeof(MM_OBJECT_CACHE_STATISTICS));
+
+    RtlCopyMemory(Statistics->Name, Cache->Name, sizeof(Statistics->Name));
+    Statistics->ObjectSize = Cache->ObjectSize;
+    Statistics->BufferSize = Cache->BufferSize;
+    Statistics->ObjectsPerSlab = Cache->ObjectsPerSlab;
+
+    ULONG cached_objects = 0;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&Cache->CacheLock, &old_irql);
+
+    Statistics->SlabCount = Cache->SlabCount;
+    Statistics->SlabsCreated = Cache->SlabsCreated;
+    Statistics->SlabsDestroyed = Cache->SlabsDestroyed;
+    cached_objects = Cache->FullMagazineCount * MM_MAGAZINE_SIZE;
+
+    for (ULONG cpu = 0; cpu < DSLOS_MAX_PROCESSORS; cpu++) {
+        PMM_CACHE_CPU cpu_cache = &Cache->CpuCaches[cpu];
+
+        Statistics->AllocationCount += cpu_cache->AllocationCount;
+        Statistics->FreeCount += cpu_cache->FreeCount;
+        Statistics->MagazineHits += cpu_cache->MagazineHits;
+        Statistics->MagazineMisses += cpu_cache->MagazineMisses;
+
+        if (cpu_cache->Loaded != NULL) {
+            cached_objects += cpu_cache->Loaded->Rounds;
+        }
+        if (cpu_cache->Previous != NULL) {
+            cached_objects += cpu_cache->Previous->Rounds;
+        }
+    }
+
+    Statistics->CachedObjects = cached_objects;
+    Statistics->ActiveObjects = Cache->SlabAllocatedObjects - cached_objects;
+
+    KeReleaseSpinLock(&Cache->CacheLock, old_irql);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Find an object cache by name
+ * @param Name Cache name
+ * @return Object cache or NULL
+ */
+PMM_OBJECT_CACHE MmLookupObjectCache(PCSTR Name)
+{
+    if (Name == NULL) {
+        return NULL;
+    }
+
+    PMM_OBJECT_CACHE result = NULL;
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_ObjectCacheManager.CacheListLock, &old_irql);
+
+    PLIST_ENTRY entry = g_ObjectCacheManager.CacheListHead.Flink;
+    while (entry != &g_ObjectCacheManager.CacheListHead) {
+        PMM_OBJECT_CACHE cache = CONTAINING_RECORD(entry, MM_OBJECT_CACHE, CacheListEntry);
+        if (strncmp(cache->Name, Name, sizeof(cache->Name)) == 0) {
+            result = cache;
+            break;
+        }
+        entry = entry->Flink;
+    }
+
+    KeReleaseSpinLock(&g_ObjectCacheManager.CacheListLock, old_irql);
+
+    return result;
+}
@@ -8,6 +8,7 @@
 
 #include "../include/kernel.h"
 #include "../include/dslos.h"
+#include "../include/advanced_scheduler.h"
 
 // Test result structure
 typedef struct _TEST_RESULT {
@@ -59,11 +60,16 @@ static NTSTATUS TestProcessManagement(VOID);
 static NTSTATUS TestDeviceManagement(VOID);
 static NTSTATUS TestFileSystem(VOID);
 static NTSTATUS TestScheduler(VOID);
+static NTSTATUS TestFairShareScheduling(VOID);
 static NTSTATUS TestInterruptHandling(VOID);
 static NTSTATUS TestSystemCalls(VOID);
 static NTSTATUS TestObjectManager(VOID);
 static NTSTATUS TestIpcCommunication(VOID);
 static NTSTATUS TestTimerSystem(VOID);
+static NTSTATUS BenchmarkFrameDatabaseScan(VOID);
+static NTSTATUS BenchmarkRunQueueCost(VOID);
+static NTSTATUS BenchmarkThreadPick(VOID);
+static NTSTATUS BenchmarkFairPick(VOID);
 
 /**
  * @brief Initialize test manager
@@ -183,6 +189,18 @@ static NTSTATUS TmCreateTestSuites(VOID)
     TmAddTest(ui_suite, L"Input Handling", TestInputHandling);
     TmAddTest(ui_suite, L"Rendering", TestRendering);
 
+    // Create performance benchmark suite
+    PTEST_SUITE benchmark_suite = TmCreateTestSuite(L"Performance Benchmarks");
+    if (benchmark_suite == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // Add performance benchmarks
+    TmAddTest(benchmark_suite, L"Frame Database Scan", BenchmarkFrameDatabaseScan);
+    TmAddTest(benchmark_suite, L"Run Queue Cost", BenchmarkRunQueueCost);
+    TmAddTest(benchmark_suite, L"Thread Pick", BenchmarkThreadPick);
+    TmAddTest(benchmark_suite, L"Fair Pick", BenchmarkFairPick);
+
     return STATUS_SUCCESS;
 }
 
@@ -547,6 +565,89 @@ static NTSTATUS TestMemoryManagement(VOID)
         ExFreePool(blocks[i]);
     }
 
+    // Test page-backed large allocation
+    PVOID large_block = ExAllocatePoolWithTag(NonPagedPool, 256 * 1024, 'TldT');
+    if (large_block == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlFillMemory(large_block, 256 * 1024, 0x55);
+    ExFreePoolWithTag(large_block, 'TldT');
+
+    // Test huge-page backed virtual memory split by a partial protect and free
+    SIZE_T huge_size = 4 * 1024 * 1024;
+    PUCHAR huge_block = MmAllocateVirtualMemory(NULL, NULL, huge_size, PAGE_READWRITE);
+    if (huge_block == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ULONG old_protect = 0;
+    NTSTATUS status = MmProtectVirtualMemory(NULL, huge_block + DSLOS_PAGE_SIZE, DSLOS_PAGE_SIZE,
+                                             PAGE_READONLY, &old_protect);
+    if (!NT_SUCCESS(status) || old_protect != PAGE_READWRITE) {
+        MmFreeVirtualMemory(NULL, huge_block, huge_size);
+        return STATUS_DATA_ERROR;
+    }
+
+    MmFreeVirtualMemory(NULL, huge_block + huge_size / 2, DSLOS_PAGE_SIZE);
+    MmFreeVirtualMemory(NULL, huge_block, huge_size);
+
+    // The whole range is released, protected piece included
+    if (MmProtectVirtualMemory(NULL, huge_block, DSLOS_PAGE_SIZE, PAGE_READWRITE, NULL) !=
+        STATUS_INVALID_PARAMETER) {
+        return STATUS_DATA_ERROR;
+    }
+
+    // Test demand-zero commit of part of a reservation
+    PUCHAR reserved_block = MmAllocateVirtualMemoryEx(NULL, NULL, 1024 * 1024, MEM_RESERVE, PAGE_READWRITE);
+    if (reserved_block == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (MmAllocateVirtualMemoryEx(NULL, reserved_block, 64 * 1024, MEM_COMMIT, PAGE_READWRITE) == NULL ||
+        !NT_SUCCESS(MmAccessFault(NULL, reserved_block + DSLOS_PAGE_SIZE, MM_FAULT_WRITE)) ||
+        MmAccessFault(NULL, reserved_block + 128 * 1024, MM_FAULT_WRITE) != STATUS_ACCESS_VIOLATION) {
+        MmFreeVirtualMemory(NULL, reserved_block, 1024 * 1024);
+        return STATUS_DATA_ERROR;
+    }
+
+    MmFreeVirtualMemory(NULL, reserved_block, 1024 * 1024);
+
+    // A caller-chosen range outside the address space, or one that wraps, is refused
+    if (MmAllocateVirtualMemoryEx(NULL, (PVOID)0x10000000, DSLOS_PAGE_SIZE, MEM_RESERVE, PAGE_READWRITE) != NULL ||
+        MmAllocateVirtualMemoryEx(NULL, reserved_block, ~(SIZE_T)0 - DSLOS_PAGE_SIZE, MEM_RESERVE,
+                                  PAGE_READWRITE) != NULL) {
+        return STATUS_DATA_ERROR;
+    }
+
+#if defined(DSLOS_HOSTED)
+    // Test the page table walker on a process address space, whose tables live
+    // in the hosted physical memory arena: map, protect, fault in and tear down
+    PROCESS_CONTROL_BLOCK process;
+    RtlZeroMemory(&process, sizeof(PROCESS_CONTROL_BLOCK));
+    status = MmCreateAddressSpace(&process);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    PUCHAR process_block = MmAllocateVirtualMemory(&process, NULL, 256 * 1024, PAGE_READWRITE);
+    PUCHAR process_reserved = MmAllocateVirtualMemoryEx(&process, NULL, 64 * 1024, MEM_RESERVE | MEM_COMMIT,
+                                                        PAGE_READWRITE);
+    if (process_block == NULL || process_reserved == NULL ||
+        !NT_SUCCESS(MmProtectVirtualMemory(&process, process_block + DSLOS_PAGE_SIZE, DSLOS_PAGE_SIZE,
+                                           PAGE_READONLY, &old_protect)) ||
+        !NT_SUCCESS(MmAccessFault(&process, process_reserved, MM_FAULT_WRITE | MM_FAULT_USER))) {
+        MmDestroyAddressSpace(&process);
+        return STATUS_DATA_ERROR;
+    }
+
+    MmSwitchAddressSpace(&process);
+    status = MmDestroyAddressSpace(&process);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+#endif
+
     return STATUS_SUCCESS;
 }
 
@@ -628,6 +729,148 @@ static NTSTATUS TestScheduler(VOID)
     // Test priority handling
     // In a real implementation, this would test thread priorities
 
+    // Test migration counters: every steal attempt has exactly one outcome
+    KE_MIGRATION_STATISTICS migration;
+    status = KeQueryMigrationStatistics(KE_ALL_PROCESSORS, &migration);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    if (migration.Migrations + migration.StealFailures + migration.StealsWithoutCandidate !=
+        migration.StealAttempts) {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    // Test scheduling domains: every processor is in its own domains
+    if (!(KeQuerySchedulerDomain(0, KE_DOMAIN_SMT) & 1) ||
+        (KeQuerySchedulerDomain(0, KE_DOMAIN_SMT) & ~KeQuerySchedulerDomain(0, KE_DOMAIN_LLC)) != 0 ||
+        (KeQuerySchedulerDomain(0, KE_DOMAIN_LLC) & ~KeQuerySchedulerDomain(0, KE_DOMAIN_PACKAGE)) != 0) {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+#if defined(DSLOS_HOSTED)
+    // Test a configured topology: processors 0 and 1 as SMT threads of one core
+    KE_PROCESSOR_TOPOLOGY topology[2] = { { 0, 0, 0 }, { 0, 0, 0 } };
+    status = HalSetProcessorTopology(topology, 2);
+    if (NT_SUCCESS(status)) {
+        status = KeBuildSchedulerDomains();
+    }
+    ULONG64 siblings = KeQuerySchedulerDomain(1, KE_DOMAIN_SMT);
+
+    HalSetProcessorTopology(NULL, 0);
+    KeBuildSchedulerDomains();
+
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    if (siblings != 0 && siblings != 0x3) {
+        return STATUS_UNSUCCESSFUL;
+    }
+#endif
+
+    // Test deadline admission on processor 0: 5% threads until one is refused
+    status = KeInitializeAdvancedScheduler();
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    const ULONG deadline_threads = 32;
+    PTHREAD threads = ExAllocatePool(NonPagedPool, deadline_threads * sizeof(THREAD));
+    if (threads == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(threads, deadline_threads * sizeof(THREAD));
+    for (ULONG i = 0; i < deadline_threads; i++) {
+        KeInitializeSchedulerThread(&threads[i]);
+        threads[i].Affinity = 1;
+    }
+
+    ULONG admitted = 0;
+    while (admitted < deadline_threads &&
+           NT_SUCCESS(KeSetThreadDeadline(&threads[admitted], 5, 100, 100))) {
+        admitted++;
+    }
+
+    // The limit must be reached, and a zero runtime must give the room back
+    status = STATUS_SUCCESS;
+    if (admitted == 0 || admitted == deadline_threads ||
+        KeSetThreadDeadline(&threads[admitted], 5, 100, 100) != STATUS_INSUFFICIENT_RESOURCES) {
+        status = STATUS_UNSUCCESSFUL;
+    } else if (!NT_SUCCESS(KeSetThreadDeadline(&threads[0], 0, 0, 0)) ||
+               !NT_SUCCESS(KeSetThreadDeadline(&threads[admitted], 5, 100, 100))) {
+        status = STATUS_UNSUCCESSFUL;
+    }
+
+    // Removing the threads releases the rest
+    for (ULONG i = 0; i < deadline_threads; i++) {
+        KeRemoveThreadFromScheduler(&threads[i]);
+    }
+    ExFreePool(threads);
+
+    return status;
+}
+
+/**
+ * @brief Test fair share group nesting and bandwidth limits
+ * @return NTSTATUS Status code
+ */
+static NTSTATUS TestFairShareScheduling(VOID)
+{
+    NTSTATUS status = KeInitializeAdvancedScheduler();
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Test a service group nested in a container group
+    GROUP_ID container;
+    GROUP_ID service;
+    status = KeCreateFairShareGroup(L"TestContainer", 1024, &container);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = KeCreateNestedFairShareGroup(container, L"TestService", 2048, &service);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Test that unknown parents are rejected
+    GROUP_ID orphan;
+    if (NT_SUCCESS(KeCreateNestedFairShareGroup(service + 1, L"TestOrphan", 1024, &orphan))) {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    // Test setting and lifting a quota
+    status = KeSetFairShareBandwidth(container, 20, 100);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = KeSetFairShareBandwidth(container, 0, 0);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Test that a 20/100 group is held once its quota is used up, even
+    // under an algorithm that picks from the priority lists
+    status = KeSetSchedulerAlgorithm(SCHED_ALGORITHM_PRIORITY);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    KE_GROUP_BANDWIDTH_STATISTICS bandwidth;
+    status = KeMeasureGroupBandwidth(20, 100, 1000, &bandwidth);
+    KeSetSchedulerAlgorithm(SCHED_ALGORITHM_ADAPTIVE);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    if (bandwidth.Picks != 1000 || bandwidth.ThrottledPicks != 0 || bandwidth.ThrottleCount < 9 ||
+        bandwidth.GroupPicks == 0 || bandwidth.GroupPicks > 20 * (1000 / 100)) {
+        return STATUS_UNSUCCESSFUL;
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -789,6 +1032,183 @@ static NTSTATUS TestTimerSystem(VOID)
         return STATUS_UNSUCCESSFUL;
     }
 
+    // Test tick statistics
+    KE_TICK_STATISTICS tick_stats;
+    status = KeQueryTickStatistics(KE_ALL_PROCESSORS, &tick_stats);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    if (NT_SUCCESS(KeQueryTickStatistics(MAXULONG - 1, &tick_stats))) {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Benchmark page frame database scans
+ * @return NTSTATUS Status code
+ * @note Compares walking the frame records, as every scan did before the hot
+ *       fields moved to dense arrays, with walking the flag array and counting
+ *       the free page bitmap
+ */
+static NTSTATUS BenchmarkFrameDatabaseScan(VOID)
+{
+    MM_FRAME_SCAN_TIMING timing;
+    NTSTATUS status = MmMeasureFrameScan(&timing);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // Both free page scans must agree
+    if (timing.PageCount == 0 || timing.FlagFreePages != timing.BitmapFreePages) {
+        return STATUS_DATA_ERROR;
+    }
+
+    HalDisplayString(L"  Frames scanned: ");
+    TmDisplayNumber(timing.PageCount);
+    HalDisplayString(L", free: ");
+    TmDisplayNumber(timing.BitmapFreePages);
+    HalDisplayString(L"\r\n");
+
+    HalDisplayString(L"  Frame records: ");
+    TmDisplayNumber((ULONG)timing.RecordTicks);
+    HalDisplayString(L" ticks\r\n");
+
+    HalDisplayString(L"  Flag array: ");
+    TmDisplayNumber((ULONG)timing.FlagTicks);
+    HalDisplayString(L" ticks\r\n");
+
+    HalDisplayString(L"  Free page bitmap: ");
+    TmDisplayNumber((ULONG)timing.BitmapTicks);
+    HalDisplayString(L" ticks\r\n");
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Benchmark per-processor run queue operations from 1 to 64 modelled processors
+ * @return NTSTATUS Status code
+ * @note The modelled processors run one after another, so this reports what
+ *       an operation costs as queues are added, not throughput under
+ *       contention. Only the dispatch count is checked
+ */
+static NTSTATUS BenchmarkRunQueueCost(VOID)
+{
+    const ULONG threads_per_processor = 64;
+    const ULONG rounds = 16;
+    ULONG64 base_ticks = 0;
+
+    for (ULONG processors = 1; processors <= DSLOS_MAX_PROCESSORS; processors *= 2) {
+        KE_RUN_QUEUE_TIMING timing;
+        NTSTATUS status = KeMeasureRunQueueCost(processors, threads_per_processor, rounds, &timing);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
+
+        // Every queued thread must come back out of its own queue
+        if (timing.Dispatches != (ULONG64)processors * threads_per_processor * rounds ||
+            timing.Dispatches * 2 != timing.Operations) {
+            return STATUS_DATA_ERROR;
+        }
+
+        // Timings are reported, not asserted; they depend on the machine
+        ULONG64 ticks_per_processor = timing.Ticks / processors;
+        if (processors == 1) {
+            base_ticks = ticks_per_processor;
+        }
+
+        HalDisplayString(L"  Processors: ");
+        TmDisplayNumber(processors);
+        HalDisplayString(L", operations: ");
+        TmDisplayNumber((ULONG)timing.Operations);
+        HalDisplayString(L", ticks per processor: ");
+        TmDisplayNumber((ULONG)ticks_per_processor);
+        HalDisplayString(L", single processor: ");
+        TmDisplayNumber((ULONG)base_ticks);
+        HalDisplayString(L"\r\n");
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Benchmark next-thread selection at the lowest and highest priority
+ * @return NTSTATUS Status code
+ * @note A thread at priority 0 sits under 31 empty levels. With the ready
+ *       summary bitmap it should cost about the same to pick as one at
+ *       priority 31. Timings vary with the machine, so they are only
+ *       reported; every iteration must enqueue and dispatch the thread
+ */
+static NTSTATUS BenchmarkThreadPick(VOID)
+{
+    const ULONG iterations = 100000;
+    KE_RUN_QUEUE_TIMING lowest;
+    KE_RUN_QUEUE_TIMING highest;
+
+    NTSTATUS status = KeMeasureThreadPick(0, iterations, &lowest);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = KeMeasureThreadPick(31, iterations, &highest);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    if (lowest.Dispatches != iterations || highest.Dispatches != iterations ||
+        lowest.Operations != 2ULL * iterations || highest.Operations != 2ULL * iterations) {
+        return STATUS_DATA_ERROR;
+    }
+
+    HalDisplayString(L"  Priority 0: ");
+    TmDisplayNumber((ULONG)lowest.Ticks);
+    HalDisplayString(L" ticks, priority 31: ");
+    TmDisplayNumber((ULONG)highest.Ticks);
+    HalDisplayString(L" ticks\r\n");
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Benchmark fair-class picks with 100 and 10000 runnable threads
+ * @return NTSTATUS Status code
+ * @note The fair tree makes a pick logarithmic in the runnable count. The
+ *       timings are only reported; the tree left behind must keep within
+ *       the red-black height bound
+ */
+static NTSTATUS BenchmarkFairPick(VOID)
+{
+    const ULONG picks = 100000;
+    KE_RUN_QUEUE_TIMING small;
+    KE_RUN_QUEUE_TIMING large;
+
+    NTSTATUS status = KeMeasureFairPick(100, picks, &small);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = KeMeasureFairPick(10000, picks, &large);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    if (small.Dispatches != picks || large.Dispatches != picks) {
+        return STATUS_DATA_ERROR;
+    }
+
+    HalDisplayString(L"  100 threads: ");
+    TmDisplayNumber((ULONG)small.Ticks);
+    HalDisplayString(L" ticks, 10000 threads: ");
+    TmDisplayNumber((ULONG)large.Ticks);
+    HalDisplayString(L" ticks\r\n");
+
+    // Height h <= 2 * log2(n + 1), i.e. 2^h <= (n + 1)^2
+    if (small.TreeHeight == 0 || (1ULL << small.TreeHeight) > 101ULL * 101ULL ||
+        large.TreeHeight == 0 || (1ULL << large.TreeHeight) > 10001ULL * 10001ULL) {
+        return STATUS_UNSUCCESSFUL;
+    }
+
     return STATUS_SUCCESS;
 }
 
@@ -135,10 +135,7 @@ NTSTATUS TmCreateThreadInternal(
     TM_PERF_START();
 
     // ߳̿ƿ飨ڴ
-    newThread = (PTHREAD_CONTROL_BLOCK)ExAllocatePool(
-        NonPagedPool,
-        sizeof(THREAD_CONTROL_BLOCK)
-    );
+    newThread = (PTHREAD_CONTROL_BLOCK)MmAllocateObject(PsThreadObjectCache);
 
     if (!newThread) {
         TRACE_ERROR("[TM] Failed to allocate TCB\n");
@@ -162,6 +159,7 @@ NTSTATUS TmCreateThreadInternal(
     // ȼ̳нȼʹĬֵ
     newThread->BasePriority = Process->BasePriority;
     newThread->Priority = Process->BasePriority;
+    newThread->LastProcessor = MAXULONG;
 
     // óʼ״̬
     newThread->State = CreateSuspended ? THREAD_STATE_SUSPENDED : THREAD_STATE_READY;
@@ -180,7 +178,7 @@ NTSTATUS TmCreateThreadInternal(
     status = MmAllocateKernelStack(&newThread->KernelStack, KERNEL_STACK_SIZE);
     if (!NT_SUCCESS(status)) {
         TRACE_ERROR("[TM] Failed to allocate kernel stack: 0x%X\n", status);
-        ExFreePool(newThread);
+        MmFreeObject(PsThreadObjectCache, newThread);
         return status;
     }
 
@@ -190,7 +188,7 @@ NTSTATUS TmCreateThreadInternal(
         if (!NT_SUCCESS(status)) {
             TRACE_ERROR("[TM] Failed to allocate user stack: 0x%X\n", status);
             MmFreeKernelStack(newThread->KernelStack);
-            ExFreePool(newThread);
+            MmFreeObject(PsThreadObjectCache, newThread);
             return status;
         }
     }
@@ -200,7 +198,7 @@ NTSTATUS TmCreateThreadInternal(
     if (!NT_SUCCESS(status)) {
         TRACE_ERROR("[TM] Failed to initialize thread context: 0x%X\n", status);
         TmCleanupThreadResources(newThread);
-        ExFreePool(newThread);
+        MmFreeObject(PsThreadObjectCache, newThread);
         return status;
     }
 
@@ -961,7 +959,7 @@ NTSTATUS TmDumpThread(
     TRACE_INFO("  User Stack: %p\n", Thread->UserStack);
     TRACE_INFO("  Instruction Pointer: %p\n", Thread->InstructionPointer);
     TRACE_INFO("  Wait Object: %p (Reason: %d)\n", Thread->WaitObject, Thread->WaitReason);
-    TRACE_INFO("  CPU Affinity: 0x%X\n", Thread->CpuAffinity);
+    TRACE_INFO("  CPU Affinity: 0x%I64X\n", Thread->CpuAffinity);
     TRACE_INFO("  Context Switches: %u\n", Thread->ContextSwitchCount);
     TRACE_INFO("  Kernel Time: %I64d\n", Thread->KernelTime.QuadPart);
     TRACE_INFO("  User Time: %I64d\n", Thread->UserTime.QuadPart);
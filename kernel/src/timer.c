@@ -9,6 +9,14 @@
 #include "../include/kernel.h"
 #include "../include/dslos.h"
 
+// Tick device of one processor. Mode changes and one-shot programming are
+// made under TimerLock, so any processor may restore another's tick
+typedef struct _TICK_STATE {
+    KE_TICK_MODE Mode;
+    LONGLONG ProgrammedExpiry;     // System time the one-shot tick fires, 0 if none
+    KE_TICK_STATISTICS Statistics;
+} TICK_STATE;
+
 // Timer state
 typedef struct _TIMER_STATE {
     BOOLEAN Initialized;
@@ -36,6 +44,11 @@ typedef struct _TIMER_STATE {
     ULONG TimerResolution;
     ULONG MinimumTimerResolution;
     ULONG MaximumTimerResolution;
+
+    // Tick devices. The timekeeping processor expires the timer queue
+    TICK_STATE Ticks[DSLOS_MAX_PROCESSORS];
+    ULONG ProcessorCount;
+    ULONG TimekeepingProcessor;
 } TIMER_STATE;
 
 static TIMER_STATE g_Timer = {0};
@@ -87,6 +100,8 @@ typedef struct _TIMER_STATISTICS {
 #define TIMER_FLAG_MANUAL_RESET      0x00000002
 #define TIMER_FLAG_HIGH_RESOLUTION   0x00000004
 
+static VOID KiProgramProcessorTick(ULONG Processor);
+
 /**
  * @brief Initialize timer subsystem
  * @return NTSTATUS Status code
@@ -124,6 +139,15 @@ NTSTATUS KeInitializeTimer(VOID)
     g_Timer.MinimumTimerResolution = 1;   // 1ns
     g_Timer.MaximumTimerResolution = 1000000; // 1ms
 
+    // Every processor starts with a periodic tick; the boot processor keeps time
+    SYSTEM_INFO sys_info;
+    KeGetSystemInfo(&sys_info);
+    g_Timer.ProcessorCount = sys_info.dwNumberOfProcessors;
+    if (g_Timer.ProcessorCount == 0 || g_Timer.ProcessorCount > DSLOS_MAX_PROCESSORS) {
+        g_Timer.ProcessorCount = (g_Timer.ProcessorCount == 0) ? 1 : DSLOS_MAX_PROCESSORS;
+    }
+    g_Timer.TimekeepingProcessor = KeGetCurrentProcessorNumber();
+
     // Initialize hardware timer
     HalInitializeHardwareTimer();
 
@@ -227,6 +251,13 @@ NTSTATUS KeSetTimer(PKTIMER Timer, LARGE_INTEGER DueTime, LARGE_INTEGER Period,
     Timer->TimerInserted = TRUE;
     Timer->TimerState = TimerStatePending;
 
+    // A timekeeper without a periodic tick must wake for a new earliest timer
+    TICK_STATE* keeper = &g_Timer.Ticks[g_Timer.TimekeepingProcessor];
+    if (keeper->Mode != KE_TICK_PERIODIC && g_Timer.TimerQueueHead.Flink == &Timer->TimerListEntry &&
+        (keeper->ProgrammedExpiry == 0 || Timer->DueTime.QuadPart < keeper->ProgrammedExpiry)) {
+        KiProgramProcessorTick(g_Timer.TimekeepingProcessor);
+    }
+
     // Update statistics
     InterlockedIncrement(&g_Timer.Statistics.TotalTimersCreated);
 
@@ -310,12 +341,13 @@ VOID KeProcessExpiredTimers(VOID)
         return;
     }
 
-    KIRQL old_irql;
-    KeAcquireSpinLock(&g_Timer.TimerLock, &old_irql);
-
+    // Read the clock first; KeQuerySystemTime takes the timer lock
     LARGE_INTEGER current_time;
     KeQuerySystemTime(&current_time);
 
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_Timer.TimerLock, &old_irql);
+
     // Process timer queue
     while (!IsListEmpty(&g_Timer.TimerQueueHead)) {
         PLIST_ENTRY entry = g_Timer.TimerQueueHead.Flink;
@@ -354,6 +386,185 @@ VOID KeProcessExpiredTimers(VOID)
     KeReleaseSpinLock(&g_Timer.TimerLock, old_irql);
 }
 
+/**
+ * @brief Get the due time of the earliest queued timer
+ * @param DueTime Receives the absolute due time
+ * @return TRUE if a timer is queued
+ */
+BOOLEAN KeQueryNextTimerExpiry(PLARGE_INTEGER DueTime)
+{
+    if (DueTime == NULL || !g_Timer.Initialized) {
+        return FALSE;
+    }
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_Timer.TimerLock, &old_irql);
+
+    BOOLEAN queued = !IsListEmpty(&g_Timer.TimerQueueHead);
+    if (queued) {
+        *DueTime = CONTAINING_RECORD(g_Timer.TimerQueueHead.Flink, KTIMER, TimerListEntry)->DueTime;
+    }
+
+    KeReleaseSpinLock(&g_Timer.TimerLock, old_irql);
+    return queued;
+}
+
+/**
+ * @brief Arm a processor's one-shot tick for its mode
+ * @param Processor Processor whose tick is not periodic
+ * @note Called with TimerLock held. A reduced tick fires after
+ *       KE_TICK_REDUCED_INTERVAL, and the timekeeper also fires for the
+ *       earliest queued timer. A stopped processor that does not keep time
+ *       has nothing to wake for until new work restores its tick
+ */
+static VOID KiProgramProcessorTick(ULONG Processor)
+{
+    TICK_STATE* tick = &g_Timer.Ticks[Processor];
+    LONGLONG now = g_Timer.SystemTime.QuadPart;
+    LONGLONG expiry = 0;
+
+    if (tick->Mode == KE_TICK_REDUCED) {
+        expiry = now + KE_TICK_REDUCED_INTERVAL * 10000LL;
+    }
+
+    if (Processor == g_Timer.TimekeepingProcessor && !IsListEmpty(&g_Timer.TimerQueueHead)) {
+        PKTIMER timer = CONTAINING_RECORD(g_Timer.TimerQueueHead.Flink, KTIMER, TimerListEntry);
+        if (expiry == 0 || timer->DueTime.QuadPart < expiry) {
+            expiry = timer->DueTime.QuadPart;
+            tick->Statistics.TimerWakeups++;
+        }
+    }
+
+    tick->ProgrammedExpiry = expiry;
+    if (expiry == 0) {
+        HalStopTick(Processor);
+        return;
+    }
+
+    // 100ns units to whole milliseconds, at least one
+    LONGLONG delay = (expiry - now + 9999) / 10000;
+    if (delay < 1) {
+        delay = 1;
+    } else if (delay > MAXULONG) {
+        delay = MAXULONG;
+    }
+    HalSetOneShotTick(Processor, (ULONG)delay);
+}
+
+/**
+ * @brief Change how a processor's tick fires
+ * @param Processor Processor whose tick to change
+ * @param Mode KE_TICK_PERIODIC while it has threads to share out,
+ *        KE_TICK_REDUCED while it runs a single thread, KE_TICK_STOPPED
+ *        while it is idle
+ * @note Callers hold that processor's run queue lock, so changes for one
+ *       processor do not race. A timekeeper leaving the periodic tick hands
+ *       the timer queue to a processor still ticking if there is one;
+ *       otherwise it keeps the queue and wakes for its earliest timer
+ */
+VOID KeSetProcessorTickMode(ULONG Processor, KE_TICK_MODE Mode)
+{
+    if (!g_Timer.Initialized || Processor >= g_Timer.ProcessorCount) {
+        return;
+    }
+
+    TICK_STATE* tick = &g_Timer.Ticks[Processor];
+    if (tick->Mode == Mode) {
+        return;
+    }
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_Timer.TimerLock, &old_irql);
+
+    tick->Mode = Mode;
+
+    if (Mode == KE_TICK_PERIODIC) {
+        tick->ProgrammedExpiry = 0;
+        HalSetPeriodicTick(Processor, KE_TICK_INTERVAL);
+    } else {
+        if (Mode == KE_TICK_STOPPED) {
+            tick->Statistics.StoppedEntries++;
+        } else {
+            tick->Statistics.ReducedEntries++;
+        }
+
+        if (Processor == g_Timer.TimekeepingProcessor) {
+            for (ULONG i = 0; i < g_Timer.ProcessorCount; i++) {
+                if (i != Processor && g_Timer.Ticks[i].Mode == KE_TICK_PERIODIC) {
+                    g_Timer.TimekeepingProcessor = i;
+                    break;
+                }
+            }
+        }
+
+        KiProgramProcessorTick(Processor);
+    }
+
+    KeReleaseSpinLock(&g_Timer.TimerLock, old_irql);
+}
+
+/**
+ * @brief Account a tick interrupt on the current processor
+ * @note The timekeeper expires the timer queue. A tick that is not
+ *       periodic was a one-shot, so the next one is armed here
+ */
+VOID KeHandleProcessorTick(VOID)
+{
+    if (!g_Timer.Initialized) {
+        return;
+    }
+
+    ULONG processor = KeGetCurrentProcessorNumber();
+    TICK_STATE* tick = &g_Timer.Ticks[processor];
+
+    tick->Statistics.Ticks++;
+
+    if (processor == g_Timer.TimekeepingProcessor) {
+        KeProcessExpiredTimers();
+    }
+
+    if (tick->Mode != KE_TICK_PERIODIC) {
+        KIRQL old_irql;
+        KeAcquireSpinLock(&g_Timer.TimerLock, &old_irql);
+        KiProgramProcessorTick(processor);
+        KeReleaseSpinLock(&g_Timer.TimerLock, old_irql);
+    }
+}
+
+/**
+ * @brief Get tick counters for one processor or all of them
+ * @param Processor Processor number, or KE_ALL_PROCESSORS for the sum
+ * @param Statistics Structure to fill
+ * @return NTSTATUS Status code
+ */
+NTSTATUS KeQueryTickStatistics(ULONG Processor, PKE_TICK_STATISTICS Statistics)
+{
+    if (Statistics == NULL || !g_Timer.Initialized ||
+        (Processor != KE_ALL_PROCESSORS && Processor >= g_Timer.ProcessorCount)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    RtlZeroMemory(Statistics, sizeof(KE_TICK_STATISTICS));
+
+    KIRQL old_irql;
+    KeAcquireSpinLock(&g_Timer.TimerLock, &old_irql);
+
+    for (ULONG i = 0; i < g_Timer.ProcessorCount; i++) {
+        if (Processor != KE_ALL_PROCESSORS && i != Processor) {
+            continue;
+        }
+
+        PKE_TICK_STATISTICS counters = &g_Timer.Ticks[i].Statistics;
+        Statistics->Ticks += counters->Ticks;
+        Statistics->StoppedEntries += counters->StoppedEntries;
+        Statistics->ReducedEntries += counters->ReducedEntries;
+        Statistics->TimerWakeups += counters->TimerWakeups;
+    }
+
+    KeReleaseSpinLock(&g_Timer.TimerLock, old_irql);
+    return STATUS_SUCCESS;
+}
+
 /**
  * @brief Query system time
  * @param CurrentTime Pointer to receive current time
@@ -13,6 +13,12 @@
 static BOOLEAN g_HalInitialized = FALSE;
 static KSPIN_LOCK g_HalLock;
 
+#if defined(DSLOS_HOSTED)
+// Topology a test described, reported in place of the default
+static KE_PROCESSOR_TOPOLOGY g_HalTestTopology[DSLOS_MAX_PROCESSORS];
+static ULONG g_HalTestTopologyCount = 0;
+#endif
+
 /**
  * @brief Initialize HAL
  * @return NTSTATUS Status code
@@ -467,11 +473,11 @@ HalCpuid(
 
 #ifdef _MSC_VER
     int info[4];
-    __cpuid(info, Function);
+    __cpuidex(info, Function, SubFunction);
     if (Eax) *Eax = info[0];
-    if (Ebx) *Eax = info[1];
-    if (Ecx) *Eax = info[2];
-    if (Edx) *Eax = info[3];
+    if (Ebx) *Ebx = info[1];
+    if (Ecx) *Ecx = info[2];
+    if (Edx) *Edx = info[3];
 #else
     __asm__ __volatile__("cpuid"
         : "=a"(*Eax), "=b"(*Ebx), "=c"(*Ecx), "=d"(*Edx)
@@ -479,6 +485,150 @@ HalCpuid(
 #endif
 }
 
+/**
+ * @brief Get the width of an APIC id field that holds Count values
+ * @param Count Number of values
+ * @return Bits needed
+ */
+static ULONG
+NTAPI
+HalTopologyShift(
+    _In_ ULONG Count
+)
+{
+    ULONG shift = 0;
+    while (shift < 32 && (1UL << shift) < Count) {
+        shift++;
+    }
+    return shift;
+}
+
+/**
+ * @brief Get a processor's core, last-level cache and package ids
+ * @param Processor Processor number
+ * @param Topology Receives the ids
+ * @note Field widths come from CPUID leaf 0xB, or leaves 1 and 4 on older
+ *       processors, and the deepest cache that leaf 4 reports. Processors
+ *       are brought up in APIC id order, so the processor number stands in
+ *       for the APIC id. Without these leaves every processor is a core of
+ *       its own in one shared cache and package
+ */
+VOID
+NTAPI
+HalQueryProcessorTopology(
+    _In_ ULONG Processor,
+    _Out_ PKE_PROCESSOR_TOPOLOGY Topology
+)
+{
+    // A flat topology unless the leaves say otherwise
+    Topology->CoreId = Processor;
+    Topology->LlcId = 0;
+    Topology->PackageId = 0;
+
+#if defined(DSLOS_HOSTED)
+    // The host's CPUID describes the host, not the processors simulated here
+    if (Processor < g_HalTestTopologyCount) {
+        *Topology = g_HalTestTopology[Processor];
+    }
+#else
+    ULONG eax, ebx, ecx, edx;
+    ULONG smt_shift = 0;
+    ULONG package_shift = 0;
+    ULONG llc_shift = 0;
+    BOOLEAN have_levels = FALSE;
+
+    HalCpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    ULONG max_leaf = eax;
+
+    if (max_leaf >= 0xB) {
+        // One subleaf per level, SMT first, until a level of type zero
+        for (ULONG level = 0; level < 8; level++) {
+            HalCpuid(0xB, level, &eax, &ebx, &ecx, &edx);
+            ULONG type = (ecx >> 8) & 0xFF;
+            if (type == 0) {
+                break;
+            }
+            if (type == 1) {
+                smt_shift = eax & 0x1F;
+            }
+            package_shift = eax & 0x1F;
+            have_levels = TRUE;
+        }
+    }
+
+    if (!have_levels && max_leaf >= 4) {
+        HalCpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        ULONG logical = (edx & (1UL << 28)) ? ((ebx >> 16) & 0xFF) : 1;
+        HalCpuid(4, 0, &eax, &ebx, &ecx, &edx);
+        ULONG core_shift = HalTopologyShift(((eax >> 26) & 0x3F) + 1);
+
+        package_shift = HalTopologyShift(logical);
+        smt_shift = (package_shift > core_shift) ? package_shift - core_shift : 0;
+        have_levels = TRUE;
+    }
+
+    if (!have_levels) {
+        return;
+    }
+
+    // Processors sharing the deepest cache share the last-level cache
+    llc_shift = package_shift;
+    ULONG deepest = 0;
+    for (ULONG index = 0; index < 16 && max_leaf >= 4; index++) {
+        HalCpuid(4, index, &eax, &ebx, &ecx, &edx);
+        if ((eax & 0x1F) == 0) {
+            break;
+        }
+        ULONG cache_level = (eax >> 5) & 0x7;
+        if (cache_level >= deepest) {
+            deepest = cache_level;
+            llc_shift = HalTopologyShift(((eax >> 14) & 0xFFF) + 1);
+        }
+    }
+    if (llc_shift < smt_shift) {
+        llc_shift = smt_shift;
+    } else if (llc_shift > package_shift) {
+        llc_shift = package_shift;
+    }
+
+    Topology->CoreId = Processor >> smt_shift;
+    Topology->LlcId = Processor >> llc_shift;
+    Topology->PackageId = Processor >> package_shift;
+#endif
+}
+
+/**
+ * @brief Describe the simulated processors of a hosted build
+ * @param Topology Ids for processors 0 to ProcessorCount - 1
+ * @param ProcessorCount Processors described, 0 to restore the flat default
+ * @return NTSTATUS Status code
+ * @note Lets tests model SMT, shared caches and packages. Only the hosted
+ *       build has no real topology to report
+ */
+NTSTATUS
+NTAPI
+HalSetProcessorTopology(
+    _In_opt_ PKE_PROCESSOR_TOPOLOGY Topology,
+    _In_ ULONG ProcessorCount
+)
+{
+#if defined(DSLOS_HOSTED)
+    if (ProcessorCount > DSLOS_MAX_PROCESSORS || (Topology == NULL && ProcessorCount != 0)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (ProcessorCount != 0) {
+        RtlCopyMemory(g_HalTestTopology, Topology, ProcessorCount * sizeof(KE_PROCESSOR_TOPOLOGY));
+    }
+    g_HalTestTopologyCount = ProcessorCount;
+    return STATUS_SUCCESS;
+#else
+    UNREFERENCED_PARAMETER(Topology);
+    UNREFERENCED_PARAMETER(ProcessorCount);
+    return STATUS_NOT_SUPPORTED;
+#endif
+}
+
 /**
  * @brief Invalidate TLB entry
  * @param Address Address to invalidate
@@ -491,7 +641,9 @@ HalInvalidateTlbEntry(
 {
     // This is a simplified implementation
     // In a real implementation, this would invalidate TLB entry
-#ifdef _MSC_VER
+#if defined(DSLOS_HOSTED)
+    UNREFERENCED_PARAMETER(Address); // No hardware TLB to maintain
+#elif defined(_MSC_VER)
     __invlpg(Address);
 #else
     __asm__ __volatile__("invlpg %0" : : "m"(*(char*)Address));
@@ -507,7 +659,9 @@ HalFlushTlb(VOID)
 {
     // This is a simplified implementation
     // In a real implementation, this would flush entire TLB
-#ifdef _MSC_VER
+#if defined(DSLOS_HOSTED)
+    // No hardware TLB to maintain
+#elif defined(_MSC_VER)
     __writecr3(__readcr3());
 #else
     ULONG cr3;
@@ -524,9 +678,16 @@ PVOID
 NTAPI
 HalGetPageFaultAddress(VOID)
 {
-    // This is a simplified implementation
-    // In a real implementation, this would read CR2 register
+#if defined(DSLOS_HOSTED)
+    // No hardware page faults are delivered to the kernel
     return NULL;
+#elif defined(_MSC_VER)
+    return (PVOID)__readcr2();
+#else
+    PVOID fault_address;
+    __asm__ __volatile__("mov %%cr2, %0" : "=r"(fault_address));
+    return fault_address;
+#endif
 }
 
 /**